@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <thread>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "image.h"
+#include "codec.h"
+#include "prefetch.h"
+
+using namespace std;
+
+// One image on its way through the batch
+struct BatchItem
+{
+    string input;
+    string output;
+    Image image;
+    GrayImage gray; // The image instead, once a gray operation has run
+    bool ok;
+    string key;     // The result cache key, or "" without a cache
+    bool cached;    // True if the output was written from the result cache
+};
+
+/**
+ * A first-in, first-out queue that holds at most capacity items. push
+ * waits while the queue is full and pop while it is empty, so a fast stage
+ * cannot run ahead of a slow one by more than the capacity.
+ */
+template <class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+    // Adds an item, waiting for room
+    void push(T item)
+    {
+        unique_lock<mutex> lock(lock_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+        items_.push_back(move(item));
+        not_empty_.notify_one();
+    }
+
+    // Takes the oldest item, waiting for one; false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        unique_lock<mutex> lock(lock_);
+        not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+        if (items_.empty())
+        {
+            return false;
+        }
+        item = move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // Marks the end of the items; pop returns false once the rest are taken
+    void close()
+    {
+        lock_guard<mutex> lock(lock_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_;
+    deque<T> items_;
+    mutex lock_;
+    condition_variable not_full_;
+    condition_variable not_empty_;
+};
+
+static double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static bool is_directory(const string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static size_t file_size(const string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_size : 0;
+}
+
+// The last component of a path
+static string base_name(const string& path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+/**
+ * The file name each input is written under: its own name, except that an
+ * input whose name an earlier one already has gets _2, _3 and so on before
+ * its extension, skipping names any input has, so no two results are
+ * written to the same file.
+ */
+static vector<string> output_names(const vector<string>& inputs)
+{
+    set<string> names;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        names.insert(base_name(inputs[i]));
+    }
+    vector<string> outputs;
+    set<string> used;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        string name = base_name(inputs[i]);
+        size_t dot = name.find_last_of('.');
+        string stem = dot == string::npos || dot == 0 ? name : name.substr(0, dot);
+        string extension = dot == string::npos || dot == 0 ? "" : name.substr(dot);
+        for (int n = 2; used.count(name) > 0; n++)
+        {
+            string candidate = stem + "_" + to_string(n) + extension;
+            if (names.count(candidate) == 0 && used.count(candidate) == 0)
+            {
+                cerr << inputs[i] << " has the name of an earlier input; its result is written as " << candidate << endl;
+                name = candidate;
+            }
+        }
+        used.insert(name);
+        outputs.push_back(name);
+    }
+    return outputs;
+}
+
+vector<string> expand_inputs(const vector<string>& arguments)
+{
+    vector<string> files;
+    for (size_t i = 0; i < arguments.size(); i++)
+    {
+        const string& argument = arguments[i];
+        if (is_directory(argument))
+        {
+            vector<string> found;
+            DIR* directory = opendir(argument.c_str());
+            for (struct dirent* entry = directory ? readdir(directory) : nullptr; entry != nullptr; entry = readdir(directory))
+            {
+                string path = argument + "/" + entry->d_name;
+                if (has_image_extension(entry->d_name) && !is_directory(path))
+                {
+                    found.push_back(path);
+                }
+            }
+            if (directory != nullptr)
+            {
+                closedir(directory);
+            }
+            sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        else if (argument.find_first_of("*?[") != string::npos)
+        {
+            glob_t matches;
+            if (glob(argument.c_str(), 0, nullptr, &matches) == 0)
+            {
+                for (size_t m = 0; m < matches.gl_pathc; m++) // glob sorts its matches
+                {
+                    files.push_back(matches.gl_pathv[m]);
+                }
+            }
+            globfree(&matches);
+        }
+        else
+        {
+            files.push_back(argument);
+        }
+    }
+    return files;
+}
+
+BatchSummary run_batch(const vector<string>& inputs, const string& output_dir,
+                       const vector<Operation>& operations, int queue_depth,
+                       int prefetch_depth, bool allow_io_uring, ResultCache* cache)
+{
+    BatchSummary summary = {0, 0, 0, 0, 0, 0, 0, 0, 0, false};
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mkdir(output_dir.c_str(), 0777); // Fails harmlessly if it already exists
+    vector<string> outputs = output_names(inputs);
+
+    size_t depth = max(1, queue_depth);
+    BoundedQueue<unique_ptr<BatchItem> > read_queue(depth);
+    BoundedQueue<unique_ptr<BatchItem> > write_queue(depth);
+    unique_ptr<FilePrefetcher> prefetcher;
+    if (prefetch_depth > 0 && inputs.size() > 1)
+    {
+        prefetcher.reset(new FilePrefetcher(inputs, prefetch_depth, allow_io_uring));
+        summary.io_uring = prefetcher->uses_io_uring();
+    }
+
+    // Reads the inputs in order while earlier images are being filtered
+    thread reader([&]
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            chrono::steady_clock::time_point read_start = chrono::steady_clock::now();
+            if (prefetcher)
+            {
+                prefetcher->advance(i);
+            }
+            unique_ptr<BatchItem> item(new BatchItem());
+            item->input = inputs[i];
+            item->output = output_dir + "/" + outputs[i];
+            item->cached = false;
+            try
+            {
+                item->ok = starts_gray(operations) ? read_image(item->input, item->gray, operation_weights(operations.front()))
+                                                   : read_image(item->input, item->image);
+            }
+            catch (const bad_alloc&) // Only this image fails, the rest of the batch still runs
+            {
+                item->ok = false;
+                item->image = Image();
+                item->gray = GrayImage();
+            }
+            if (item->ok && cache != nullptr)
+            {
+                item->key = starts_gray(operations) ? result_key(item->gray, operations, item->output)
+                                                    : result_key(item->image, operations, item->output);
+                item->cached = cache->fetch(item->key, item->output);
+                if (item->cached) // Only the name goes on to the writer
+                {
+                    item->image = Image();
+                    item->gray = GrayImage();
+                }
+            }
+            summary.read_seconds += seconds_since(read_start);
+            read_queue.push(move(item));
+        }
+        read_queue.close();
+    });
+
+    // Writes the results in order while later images are being filtered
+    thread writer([&]
+    {
+        unique_ptr<BatchItem> item;
+        while (write_queue.pop(item))
+        {
+            chrono::steady_clock::time_point write_start = chrono::steady_clock::now();
+            if (item->ok && cache != nullptr && !item->cached)
+            {
+                release_output(item->output);
+            }
+            if (item->ok && (item->cached || (converts_to_gray(operations) ? write_image(item->output, item->gray)
+                                                                           : write_image(item->output, item->image))))
+            {
+                if (cache != nullptr && !item->cached)
+                {
+                    cache->store(item->key, item->output);
+                }
+                summary.images++;
+                summary.cached += item->cached;
+                summary.bytes_read += file_size(item->input);
+                summary.bytes_written += file_size(item->output);
+            }
+            else
+            {
+                cerr << "Error! Could not process " << item->input << endl;
+                summary.failed++;
+            }
+            item.reset(); // Free the image before waiting for the next one
+            summary.write_seconds += seconds_since(write_start);
+        }
+    });
+
+    // Filters on this thread, which hands each image to the filter pool
+    unique_ptr<BatchItem> item;
+    while (read_queue.pop(item))
+    {
+        chrono::steady_clock::time_point filter_start = chrono::steady_clock::now();
+        if (item->ok && !item->cached)
+        {
+            item->ok = starts_gray(operations) ? chain_fits(item->gray.width(), item->gray.height(), operations)
+                                               : chain_fits(item->image.width(), item->image.height(), operations);
+        }
+        if (item->ok && !item->cached)
+        {
+            try
+            {
+                if (starts_gray(operations))
+                {
+                    item->gray = run_pipeline(move(item->gray), operations);
+                }
+                else if (converts_to_gray(operations))
+                {
+                    item->gray = run_gray_pipeline(move(item->image), operations);
+                }
+                else
+                {
+                    item->image = run_pipeline(move(item->image), operations);
+                }
+            }
+            catch (const bad_alloc&) // An enlargement can outgrow memory even when chain_fits allows it
+            {
+                item->ok = false;
+                item->image = Image();
+                item->gray = GrayImage();
+            }
+        }
+        summary.filter_seconds += seconds_since(filter_start);
+        write_queue.push(move(item));
+    }
+    write_queue.close();
+
+    reader.join();
+    writer.join();
+    prefetcher.reset();
+    summary.seconds = seconds_since(start);
+    return summary;
+}
@@ -0,0 +1,71 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "pipeline.h"
+#include "result_cache.h"
+
+using namespace std;
+
+// Images held in each queue between the read, filter and write stages by default
+const int BATCH_QUEUE_DEPTH = 4;
+
+// Input files read ahead of the reader thread by default (see FilePrefetcher)
+const int BATCH_PREFETCH_DEPTH = 4;
+
+// Totals for a batch run
+struct BatchSummary
+{
+    int images;         // Images written successfully
+    int failed;         // Images that could not be read or written
+    int cached;         // Images written from the result cache, also counted in images
+    size_t bytes_read;  // Size of the input files that were read
+    size_t bytes_written; // Size of the output files that were written
+    double seconds;     // Wall-clock time of the whole run
+    double read_seconds;   // Time the reader thread spent reading and decoding
+    double filter_seconds; // Time spent filtering
+    double write_seconds;  // Time the writer thread spent encoding and writing
+    bool io_uring;      // True if the inputs were read ahead through io_uring
+};
+
+/**
+ * Expands the inputs given on the command line into a sorted list of files:
+ * a directory stands for the image files in it (by extension: .bmp, .ppm, .pgm, .pnm), and a pattern containing *,
+ * ? or [ is matched against file names (for patterns the shell did not
+ * expand). Anything else is taken as a file name.
+ */
+vector<string> expand_inputs(const vector<string>& arguments);
+
+/**
+ * Applies the operations to every input file and writes each result into
+ * the output directory under the input's file name (inputs from different
+ * directories with the same name get _2, _3 and so on before the
+ * extension, with a message on standard error). Reading, filtering and
+ * writing run at the same time on different images: a reader thread and a
+ * writer thread are connected to the filtering thread by queues of at most
+ * queue_depth images, so at most 2 * queue_depth + 4 images are in memory.
+ * Each image is filtered by the filter thread pool. Ahead of the reader, a
+ * FilePrefetcher reads the next prefetch_depth input files into the page
+ * cache, so the reader decodes from memory instead of waiting on the disk.
+ * With a result cache, the reader looks each image up once it is decoded:
+ * a hit is written from the cache and skips the filters, and a miss is
+ * stored once it is written.
+ * The stage times in the summary add up to more than the wall-clock time
+ * by however much the stages overlapped.
+ * @param inputs         The image files to process
+ * @param output_dir     The directory to write into (created if missing)
+ * @param operations     The operations to apply to each image, in order
+ * @param queue_depth    Most images waiting in each queue
+ * @param prefetch_depth Most input files read ahead, or 0 not to read ahead
+ * @param allow_io_uring False to read ahead with pread even where io_uring works
+ * @param cache          The result cache to use, or null for none
+ * @return The totals for the run
+ */
+BatchSummary run_batch(const vector<string>& inputs, const string& output_dir,
+                       const vector<Operation>& operations, int queue_depth,
+                       int prefetch_depth = BATCH_PREFETCH_DEPTH, bool allow_io_uring = true,
+                       ResultCache* cache = nullptr);
+
+#endif
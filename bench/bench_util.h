@@ -0,0 +1,124 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+// Test images, comparisons and timers shared by the programs in bench/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "image_buffer.h"
+
+// Reproducible noise from a xorshift generator, so no filter sees unusually uniform data
+template <class ImageType = Image>
+ImageType noise_image(int width, int height, unsigned int seed = 2463534242u)
+{
+    ImageType image(width, height);
+    unsigned int state = seed;
+    for (int i = 0; i < height; i++)
+    {
+        unsigned char* row = image.row(i);
+        for (size_t j = 0; j < image.row_bytes(); j++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            row[j] = static_cast<unsigned char>(state);
+        }
+    }
+    return image;
+}
+
+// Smooth gradients with noise on top, like a photograph; the gradients run from low to high
+template <class ImageType = Image>
+ImageType test_image(int width, int height, unsigned int seed = 2463534242u, int low = 0, int high = 255)
+{
+    ImageType image(width, height);
+    unsigned int state = seed;
+    for (int i = 0; i < height; i++)
+    {
+        unsigned char* row = image.row(i);
+        for (size_t j = 0; j < image.row_bytes(); j++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int value = low + static_cast<int>((i * (high - low) / std::max(height, 1) + j * (high - low) / image.row_bytes()) / 2)
+                        + static_cast<int>(state % 64) - 32;
+            row[j] = static_cast<unsigned char>(std::min(255, std::max(0, value)));
+        }
+    }
+    return image;
+}
+
+template <class ImageType>
+bool same_pixels(const ImageType& a, const ImageType& b)
+{
+    if (a.width() != b.width() || a.height() != b.height())
+    {
+        return false;
+    }
+    for (int i = 0; i < a.height(); i++)
+    {
+        if (memcmp(a.row(i), b.row(i), a.row_bytes()) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Median time in milliseconds of several runs
+template <class Function>
+double time_ms(Function run, int reps)
+{
+    std::vector<double> times;
+    for (int rep = 0; rep < reps; rep++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// Peak resident memory since the last reset, in bytes, from /proc/self/status
+inline size_t peak_resident()
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    char line[256];
+    size_t kib = 0;
+    while (file != nullptr && fgets(line, sizeof(line), file) != nullptr)
+    {
+        if (strncmp(line, "VmHWM:", 6) == 0)
+        {
+            kib = strtoul(line + 6, nullptr, 10);
+        }
+    }
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+    return kib << 10;
+}
+
+// Resets the peak to the current resident memory (Linux 4.0 and later)
+inline void reset_peak()
+{
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file != nullptr)
+    {
+        fputs("5", file);
+        fclose(file);
+    }
+}
+
+#endif
@@ -0,0 +1,394 @@
+// Checks the codecs: PPM and PGM files written by write_image read back
+// exactly, 32-bit BMP files (bottom-up, top-down and with color masks),
+// RLE8 files and 16-bit PPM files read as the image they were made from,
+// the row readers give the same rows as the whole-image readers, and the
+// PPM row writer gives the same bytes as write_image, and the BMP writer,
+// through its mapping and through writev to standard output, gives the
+// same bytes as the files in sample_images, written by the original
+// per-pixel writer. Then measures read and write throughput of each format
+// on a large image.
+//
+// Usage: codec_bench [width height]    (default 6000 4000; run from the directory holding sample_images)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "image.h"
+#include "bmp.h"
+#include "pnm.h"
+#include "codec.h"
+#include "bench_util.h"
+
+using namespace std;
+
+static void put(vector<unsigned char>& bytes, int offset, int size, long value)
+{
+    for (int i = 0; i < size; i++)
+    {
+        bytes[offset + i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+static bool save(const string& filename, const vector<unsigned char>& bytes)
+{
+    ofstream file(filename.c_str(), ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return file.good();
+}
+
+static vector<unsigned char> load(const string& filename)
+{
+    ifstream file(filename.c_str(), ios::binary);
+    return vector<unsigned char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+// Headers of a BMP file with the given depth, compression, extra bytes before the pixels and pixel array size
+static vector<unsigned char> bmp_headers(int width, int height, int bits, int compression, int extra, long array_bytes)
+{
+    vector<unsigned char> bytes(BMP_HEADERS_SIZE + extra);
+    bytes[0] = 'B';
+    bytes[1] = 'M';
+    put(bytes, 2, 4, bytes.size() + array_bytes);
+    put(bytes, 10, 4, bytes.size());
+    put(bytes, 14, 4, 40);
+    put(bytes, 18, 4, width);
+    put(bytes, 22, 4, height);
+    put(bytes, 26, 2, 1);
+    put(bytes, 28, 2, bits);
+    put(bytes, 30, 4, compression);
+    put(bytes, 34, 4, array_bytes);
+    return bytes;
+}
+
+// A 32-bit file of the image, with a junk fourth byte; masked files give the usual masks after the header
+static bool write_bmp32(const string& filename, const Image& image, bool top_down, bool masked)
+{
+    int extra = masked ? 12 : 0;
+    vector<unsigned char> bytes = bmp_headers(image.width(), top_down ? -image.height() : image.height(), 32,
+                                              masked ? BMP_BITFIELDS : BMP_RGB, extra, 4L * image.width() * image.height());
+    if (masked)
+    {
+        put(bytes, BMP_HEADERS_SIZE, 4, 0xFF0000);
+        put(bytes, BMP_HEADERS_SIZE + 4, 4, 0xFF00);
+        put(bytes, BMP_HEADERS_SIZE + 8, 4, 0xFF);
+    }
+    for (int s = 0; s < image.height(); s++)
+    {
+        const unsigned char* row = image.row(top_down ? image.height() - 1 - s : s);
+        for (int x = 0; x < image.width(); x++)
+        {
+            bytes.insert(bytes.end(), row + 3 * x, row + 3 * x + 3);
+            bytes.push_back(static_cast<unsigned char>(x * 31 + s));
+        }
+    }
+    return save(filename, bytes);
+}
+
+// Posterizes the image to 16 colors in runs and writes it as RLE8, with runs, absolute runs and a delta
+static bool write_rle8(const string& filename, const Image& image, Image& expected)
+{
+    unsigned char palette[BMP_PALETTE_SIZE] = {};
+    for (int c = 0; c < 16; c++)
+    {
+        palette[4 * c] = static_cast<unsigned char>(c * 17);
+        palette[4 * c + 1] = static_cast<unsigned char>(255 - c * 13);
+        palette[4 * c + 2] = static_cast<unsigned char>(c * 7);
+    }
+
+    int width = image.width();
+    vector<unsigned char> data;
+    expected = Image(width, image.height());
+    for (int y = 0; y < image.height(); y++)
+    {
+        for (int x = 0; x < width; x++) // Pixels the delta skips get color index 0
+        {
+            memcpy(expected.row(y) + 3 * x, palette, 3);
+        }
+    }
+    for (int y = 0; y < image.height(); y++)
+    {
+        vector<unsigned char> indices(width);
+        for (int x = 0; x < width; x++)
+        {
+            indices[x] = image.row(y)[3 * (x / 5 * 5)] >> 4; // Runs of five
+        }
+        if (y == 2 && image.height() > 4) // Skip two rows and start row 4 at column 1
+        {
+            data.insert(data.end(), {0, 2, 1, 2});
+            y = 4;
+            for (int x = 1; x < width; x++)
+            {
+                indices[x] = image.row(y)[3 * (x / 5 * 5)] >> 4;
+            }
+        }
+        int x = y == 4 && image.height() > 4 ? 1 : 0;
+        while (x < width)
+        {
+            int run = 1;
+            while (x + run < width && run < 255 && indices[x + run] == indices[x])
+            {
+                run++;
+            }
+            if (run == 1 && x + 3 <= width) // Three indices as they are, padded to an even count
+            {
+                data.insert(data.end(), {0, 3, indices[x], indices[x + 1], indices[x + 2], 0});
+                run = 3;
+            }
+            else
+            {
+                data.insert(data.end(), {static_cast<unsigned char>(run), indices[x]});
+            }
+            for (int i = x; i < x + run; i++)
+            {
+                memcpy(expected.row(y) + 3 * i, palette + 4 * indices[i], 3);
+            }
+            x += run;
+        }
+        data.insert(data.end(), {0, 0});
+    }
+    data.insert(data.end(), {0, 1});
+
+    vector<unsigned char> bytes = bmp_headers(width, image.height(), 8, BMP_RLE8, BMP_PALETTE_SIZE, data.size());
+    put(bytes, 46, 4, 256);
+    memcpy(bytes.data() + BMP_HEADERS_SIZE, palette, BMP_PALETTE_SIZE);
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    return save(filename, bytes);
+}
+
+// A PPM file with two-byte samples (maximum 65535, so each 8-bit value v is stored as v * 257)
+static bool write_ppm16(const string& filename, const Image& image)
+{
+    string header = "P6\n# sixteen bits\n" + to_string(image.width()) + " " + to_string(image.height()) + "\n65535\n";
+    vector<unsigned char> bytes(header.begin(), header.end());
+    for (int i = image.height() - 1; i >= 0; i--)
+    {
+        const unsigned char* row = image.row(i);
+        for (int x = 0; x < image.width(); x++)
+        {
+            for (int c = 2; c >= 0; c--)
+            {
+                bytes.push_back(row[3 * x + c]);
+                bytes.push_back(row[3 * x + c]);
+            }
+        }
+    }
+    return save(filename, bytes);
+}
+
+// Reads the file through its row reader in bands of band rows
+static bool read_streamed(const string& filename, Image& image, int band)
+{
+    unique_ptr<RowReader> reader = open_row_reader(filename);
+    if (!reader)
+    {
+        return false;
+    }
+    image = Image(reader->width(), reader->height());
+    Image window(reader->width(), band);
+    for (int first = 0; first < reader->height(); first += band)
+    {
+        int count = min(band, reader->height() - first);
+        if (!reader->read_rows(window, count))
+        {
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            memcpy(image.row(first + i), window.row(i), image.row_bytes());
+        }
+    }
+    return true;
+}
+
+// Writes the image through the row writer of the file's format in bands of band rows
+static bool write_streamed(const string& filename, const Image& image, int band)
+{
+    unique_ptr<RowWriter> writer = open_row_writer(filename, image.width(), image.height());
+    if (!writer)
+    {
+        return false;
+    }
+    Image window(image.width(), band);
+    for (int first = 0; first < image.height(); first += band)
+    {
+        int count = min(band, image.height() - first);
+        for (int i = 0; i < count; i++)
+        {
+            memcpy(window.row(i), image.row(first + i), image.row_bytes());
+        }
+        if (!writer->write_rows(window, count))
+        {
+            return false;
+        }
+    }
+    return writer->close_file();
+}
+
+// Reads the file whole and through the row reader, expecting the given image both ways
+static bool check_read(const string& label, const string& filename, const Image& expected)
+{
+    Image whole, streamed;
+    bool correct = read_image(filename, whole) && same_pixels(whole, expected)
+        && read_streamed(filename, streamed, 7) && same_pixels(streamed, expected);
+    if (!correct)
+    {
+        cout << label << " reads WRONG at " << expected.width() << "x" << expected.height() << endl;
+    }
+    return correct;
+}
+
+// Reads each process*.bmp in sample_images and writes it again, to a file and to standard output; both must give
+// its bytes (sample.bmp, the input, was written by another program, with other header fields)
+static bool check_sample_bmps(const string& dir)
+{
+    const char* const names[] = {"process1", "process2", "process3", "process4", "process5", "process6",
+                                 "process7", "process8", "process9", "process10"};
+    bool correct = true;
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++)
+    {
+        string original = string("sample_images/") + names[n] + ".bmp";
+        Image image;
+        if (!read_image(original, image))
+        {
+            cout << "could not read " << original << endl;
+            correct = false;
+            continue;
+        }
+        vector<unsigned char> expected = load(original);
+        bool mapped = write_bmp(dir + "s.bmp", image) && load(dir + "s.bmp") == expected;
+
+        // Standard output is written with writev, even when it is a regular file
+        cout.flush();
+        int saved = dup(STDOUT_FILENO);
+        int fd = open((dir + "t.bmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        bool vectored = fd >= 0 && dup2(fd, STDOUT_FILENO) >= 0 && write_bmp("-", image);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        vectored = vectored && load(dir + "t.bmp") == expected;
+        if (!mapped || !vectored)
+        {
+            cout << "BMP writer " << (mapped ? "(writev)" : "(mapped)") << " differs from " << original << endl;
+            correct = false;
+        }
+    }
+    remove((dir + "s.bmp").c_str());
+    remove((dir + "t.bmp").c_str());
+    return correct;
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 6000;
+    int height = argc > 2 ? atoi(argv[2]) : 4000;
+    const string dir = "/tmp/codec_bench_";
+    bool correct = true;
+
+    const int sizes[][2] = { {333, 217}, {64, 64}, {1, 1}, {97, 30} };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        Image image = noise_image(sizes[s][0], sizes[s][1]);
+        GrayImage gray = to_gray(image);
+
+        correct = write_image(dir + "a.ppm", image) && check_read("PPM", dir + "a.ppm", image) && correct;
+        correct = write_streamed(dir + "b.ppm", image, 5) && load(dir + "a.ppm") == load(dir + "b.ppm") && correct;
+        GrayImage gray_back;
+        correct = write_image(dir + "a.pgm", gray) && read_image(dir + "a.pgm", gray_back) && same_pixels(gray_back, gray)
+            && check_read("PGM", dir + "a.pgm", to_color(gray)) && correct;
+        correct = write_bmp32(dir + "a.bmp", image, false, false) && check_read("32-bit BMP", dir + "a.bmp", image) && correct;
+        correct = write_bmp32(dir + "a.bmp", image, true, false) && check_read("32-bit top-down BMP", dir + "a.bmp", image)
+            && correct;
+        correct = write_bmp32(dir + "a.bmp", image, false, true) && check_read("32-bit masked BMP", dir + "a.bmp", image)
+            && correct;
+        Image expected;
+        correct = write_rle8(dir + "a.bmp", image, expected) && check_read("RLE8 BMP", dir + "a.bmp", expected) && correct;
+        correct = write_ppm16(dir + "a.ppm", image) && check_read("16-bit PPM", dir + "a.ppm", image) && correct;
+
+        // Color files read straight into gray images match to_gray with each set of weights
+        for (int w = GRAY_AVERAGE; w <= GRAY_BT709; w++)
+        {
+            GrayWeights weights = static_cast<GrayWeights>(w);
+            correct = write_image(dir + "a.ppm", image) && read_image(dir + "a.ppm", gray_back, weights)
+                && same_pixels(gray_back, to_gray(image, weights)) && correct;
+            correct = write_bmp32(dir + "a.bmp", image, false, false) && read_image(dir + "a.bmp", gray_back, weights)
+                && same_pixels(gray_back, to_gray(image, weights)) && correct;
+        }
+    }
+    cout << "round trips and decoders " << (correct ? "match" : "DO NOT MATCH") << endl;
+    bool samples = check_sample_bmps(dir);
+    cout << "BMP writer and sample_images " << (samples ? "match" : "DO NOT MATCH") << endl;
+    correct = correct && samples;
+
+    // Throughput of each format's whole-image reader and writer, in MB/s of image (3 bytes per pixel)
+    Image image = noise_image(width, height);
+    Image posterized;
+    double megabytes = 3.0 * width * height / 1e6;
+    struct Format
+    {
+        const char* label;
+        string filename;
+        bool gray;
+    };
+    write_image(dir + "big.bmp", image);
+    write_bmp32(dir + "big32.bmp", image, false, false);
+    write_rle8(dir + "bigrle.bmp", image, posterized);
+    write_image(dir + "big.ppm", image);
+    write_image(dir + "big.pgm", to_gray(image));
+    const Format formats[] = {
+        {"24-bit BMP", dir + "big.bmp", false},
+        {"32-bit BMP", dir + "big32.bmp", false},
+        {"RLE8 BMP", dir + "bigrle.bmp", false},
+        {"PPM", dir + "big.ppm", false},
+        {"PGM (into gray)", dir + "big.pgm", true}
+    };
+    cout << fixed << setprecision(1) << width << "x" << height << " image:" << endl;
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        double best = 1e9;
+        for (int run = 0; run < 3; run++)
+        {
+            Image color;
+            GrayImage gray;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            bool read = formats[f].gray ? read_image(formats[f].filename, gray) : read_image(formats[f].filename, color);
+            best = min(best, seconds_since(start));
+            correct = correct && read;
+        }
+        cout << "  read  " << setw(16) << left << formats[f].label << right << setw(9) << megabytes / best << " MB/s" << endl;
+    }
+    const char* const outputs[] = {"out.bmp", "out.ppm"};
+    for (size_t o = 0; o < 2; o++)
+    {
+        double best = 1e9;
+        for (int run = 0; run < 3; run++)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            correct = write_image(dir + outputs[o], image) && correct;
+            best = min(best, seconds_since(start));
+        }
+        cout << "  write " << setw(16) << left << (o == 0 ? "24-bit BMP" : "PPM") << right << setw(9) << megabytes / best
+             << " MB/s" << endl;
+    }
+
+    const char* const files[] = {"a.ppm", "b.ppm", "a.pgm", "a.bmp", "big.bmp", "big32.bmp", "bigrle.bmp", "big.ppm",
+                                 "big.pgm", "out.bmp", "out.ppm"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        remove((dir + files[i]).c_str());
+    }
+    cout << (correct ? "all checks passed" : "CHECKS FAILED") << endl;
+    return correct ? 0 : 1;
+}
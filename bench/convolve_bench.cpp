@@ -0,0 +1,352 @@
+// Checks the neighbourhood filters: the SIMD box, unsharp and Sobel
+// kernels against the scalar ones on random rows of every length up to a
+// few registers (the bytes must match), every filter through every set of
+// kernels, separate_kernel on kernels of rank 1 and more, flat images
+// staying flat, and the fixed-point filters against the same filters in
+// double precision. Then times the box blur and the Gaussian over a range
+// of radii, to show the cost per pixel staying flat, and the unsharp mask
+// and Sobel edges.
+//
+// Usage: convolve_bench [width height]    (default 6000 4000)
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "image.h"
+#include "convolve.h"
+#include "kernels.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Largest difference between two images' values
+static int max_difference(const Image& a, const Image& b)
+{
+    int largest = 0;
+    for (int i = 0; i < a.height(); i++)
+    {
+        for (size_t j = 0; j < a.row_bytes(); j++)
+        {
+            largest = max(largest, abs(a.row(i)[j] - b.row(i)[j]));
+        }
+    }
+    return largest;
+}
+
+// The kernel in double precision, with the edge pixels repeated and the results rounded to bytes
+static Image reference_convolve(const Image& image, const ConvolutionKernel& kernel)
+{
+    Image result(image.width(), image.height());
+    for (int i = 0; i < image.height(); i++)
+    {
+        for (int j = 0; j < image.width(); j++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                double sum = 0;
+                for (int k = 0; k < kernel.height; k++)
+                {
+                    int y = min(max(i + kernel.height / 2 - k, 0), image.height() - 1);
+                    for (int l = 0; l < kernel.width; l++)
+                    {
+                        int x = min(max(j + l - kernel.width / 2, 0), image.width() - 1);
+                        sum += kernel.values[k * kernel.width + l] * image.pixel(y, x)[c];
+                    }
+                }
+                result.pixel(i, j)[c] = static_cast<unsigned char>(min(255.0, max(0.0, floor(sum + 0.5))));
+            }
+        }
+    }
+    return result;
+}
+
+// A width x height kernel whose values are column[k] * row[j]
+static ConvolutionKernel outer_product(const vector<double>& column, const vector<double>& row)
+{
+    ConvolutionKernel kernel = { static_cast<int>(row.size()), static_cast<int>(column.size()), vector<double>() };
+    for (size_t k = 0; k < column.size(); k++)
+    {
+        for (size_t j = 0; j < row.size(); j++)
+        {
+            kernel.values.push_back(column[k] * row[j]);
+        }
+    }
+    return kernel;
+}
+
+static ConvolutionKernel gaussian_kernel(double sigma)
+{
+    int radius = max(1, static_cast<int>(ceil(3 * sigma)));
+    vector<double> weights;
+    double total = 0;
+    for (int k = -radius; k <= radius; k++)
+    {
+        weights.push_back(exp(-0.5 * k * k / (sigma * sigma)));
+        total += weights.back();
+    }
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        weights[k] /= total;
+    }
+    return outer_product(weights, weights);
+}
+
+// Sobel |gx| + |gy| in plain integers
+static Image reference_sobel(const Image& image)
+{
+    Image result(image.width(), image.height());
+    for (int i = 0; i < image.height(); i++)
+    {
+        for (int j = 0; j < image.width(); j++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int v[3][3]; // v[dy + 1][dx + 1], dy counted up the image
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int y = min(max(i + dy, 0), image.height() - 1), x = min(max(j + dx, 0), image.width() - 1);
+                        v[dy + 1][dx + 1] = image.pixel(y, x)[c];
+                    }
+                }
+                int gx = (v[0][2] + 2 * v[1][2] + v[2][2]) - (v[0][0] + 2 * v[1][0] + v[2][0]);
+                int gy = (v[0][0] + 2 * v[0][1] + v[0][2]) - (v[2][0] + 2 * v[2][1] + v[2][2]);
+                result.pixel(i, j)[c] = static_cast<unsigned char>(min(255, abs(gx) + abs(gy)));
+            }
+        }
+    }
+    return result;
+}
+
+// Checks one set of SIMD kernels against the scalar ones on random rows of every length up to 200 bytes
+static bool check_kernels(const FilterKernels& kernels)
+{
+    const FilterKernels& scalar = scalar_kernels();
+    unsigned int state = 88172645u;
+    const int MARGIN = 4;
+    vector<unsigned char> a(200 + 2 * MARGIN), b(a.size()), c(a.size()), expected(200), actual(200);
+    for (int bytes = 0; bytes <= 200; bytes++)
+    {
+        for (size_t x = 0; x < a.size(); x++)
+        {
+            state = state * 1664525u + 1013904223u;
+            a[x] = static_cast<unsigned char>(state >> 24);
+            b[x] = static_cast<unsigned char>(state >> 16);
+            c[x] = static_cast<unsigned char>(state >> 8);
+        }
+
+        int window = 1 + bytes % 9 * 2;
+        vector<int> sums(bytes), expected_sums(bytes);
+        for (int x = 0; x < bytes; x++)
+        {
+            sums[x] = expected_sums[x] = (a[x] + b[x]) * window / 2;
+        }
+        scalar.box_columns(expected_sums.data(), a.data(), b.data(), expected.data(), 1.0f / window, bytes);
+        kernels.box_columns(sums.data(), a.data(), b.data(), actual.data(), 1.0f / window, bytes);
+        if (memcmp(expected.data(), actual.data(), bytes) != 0 || sums != expected_sums)
+        {
+            cout << kernels.name << " box_columns differs from scalar at " << bytes << " bytes" << endl;
+            return false;
+        }
+
+        int amount = static_cast<int>(state % 25600);
+        scalar.unsharp(a.data(), b.data(), expected.data(), amount, bytes);
+        kernels.unsharp(a.data(), b.data(), actual.data(), amount, bytes);
+        if (memcmp(expected.data(), actual.data(), bytes) != 0)
+        {
+            cout << kernels.name << " unsharp differs from scalar at " << bytes << " bytes" << endl;
+            return false;
+        }
+
+        for (int channels = 1; channels <= 4; channels++)
+        {
+            scalar.sobel(&a[MARGIN], &b[MARGIN], &c[MARGIN], expected.data(), bytes, channels);
+            kernels.sobel(&a[MARGIN], &b[MARGIN], &c[MARGIN], actual.data(), bytes, channels);
+            if (memcmp(expected.data(), actual.data(), bytes) != 0)
+            {
+                cout << kernels.name << " sobel differs from scalar at " << bytes << " bytes of " << channels << " channels" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Runs filter f of the checks on an image
+static Image run_filter(int f, const Image& image)
+{
+    Image result;
+    switch (f)
+    {
+        case 0 : box_blur(image, result, 3); break;
+        case 1 : box_blur(image, result, 40); break;
+        case 2 : gaussian_blur(image, result, 1.5); break;
+        case 3 : gaussian_blur(image, result, 7); break;
+        case 4 : unsharp_mask(image, result, 1.5, 2); break;
+        case 5 : sobel_edges(image, result); break;
+        case 6 : convolve(image, result, outer_product(vector<double>{1, 2, 1}, vector<double>{-1, 0, 1})); break;
+        default :
+        {
+            ConvolutionKernel laplacian = { 3, 3, { 0, -1, 0, -1, 5, -1, 0, -1, 0 } };
+            convolve(image, result, laplacian);
+        }
+    }
+    return result;
+}
+
+static const char* const FILTER_NAMES[] = {
+    "box 3", "box 40", "gaussian 1.5", "gaussian 7", "sharpen 1.5,2", "edges", "sobel x", "laplacian sharpen"
+};
+static const int FILTER_COUNT = 8;
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 6000;
+    int height = argc > 2 ? atoi(argv[2]) : 4000;
+    bool correct = true;
+
+    const FilterKernels* sets[] = { sse2_kernels(), avx2_kernels() };
+    for (int k = 0; k < 2; k++)
+    {
+        correct = (sets[k] == nullptr || check_kernels(*sets[k])) && correct;
+    }
+
+    // Every filter gives the same bytes through every set of kernels, at sizes that leave row tails
+    const int sizes[][2] = { {333, 217}, {1, 1}, {7, 130}, {130, 2}, {64, 48} };
+    const char* const kernel_sets[] = { "sse2", "avx2" };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        Image image = test_image(sizes[s][0], sizes[s][1]);
+        for (int f = 0; f < FILTER_COUNT; f++)
+        {
+            select_kernels("scalar");
+            Image expected = run_filter(f, image);
+            for (int k = 0; k < 2; k++)
+            {
+                if (select_kernels(kernel_sets[k]) && !same_pixels(run_filter(f, image), expected))
+                {
+                    cout << kernel_sets[k] << " " << FILTER_NAMES[f] << " differs from scalar at "
+                         << sizes[s][0] << "x" << sizes[s][1] << endl;
+                    correct = false;
+                }
+            }
+            select_kernels("auto");
+
+            // In place gives the same bytes
+            Image copy = image;
+            switch (f)
+            {
+                case 0 : box_blur(copy, copy, 3); break;
+                case 3 : gaussian_blur(copy, copy, 7); break;
+                case 4 : unsharp_mask(copy, copy, 1.5, 2); break;
+                case 5 : sobel_edges(copy, copy); break;
+                default : copy = run_filter(f, copy);
+            }
+            if (!same_pixels(copy, expected))
+            {
+                cout << FILTER_NAMES[f] << " in place differs at " << sizes[s][0] << "x" << sizes[s][1] << endl;
+                correct = false;
+            }
+        }
+    }
+
+    // separate_kernel finds kernels of rank 1 only
+    vector<double> column, row;
+    ConvolutionKernel laplacian = { 3, 3, { 0, -1, 0, -1, 4, -1, 0, -1, 0 } };
+    ConvolutionKernel wide = { 5, 1, { 0.1, 0.2, 0.4, 0.2, 0.1 } };
+    if (!separate_kernel(gaussian_kernel(2), column, row) || !separate_kernel(outer_product(vector<double>{1, 2, 1}, vector<double>{-1, 0, 1}), column, row)
+        || !separate_kernel(wide, column, row) || separate_kernel(laplacian, column, row))
+    {
+        cout << "separate_kernel misjudges a kernel" << endl;
+        correct = false;
+    }
+    ConvolutionKernel even = { 2, 1, { 0.5, 0.5 } };
+    Image small = test_image(33, 21), unused;
+    if (convolve(small, unused, even))
+    {
+        cout << "convolve accepts a kernel of even width" << endl;
+        correct = false;
+    }
+
+    // Flat images stay flat
+    Image flat(97, 89);
+    for (int i = 0; i < flat.height(); i++)
+    {
+        memset(flat.row(i), 200, flat.row_bytes());
+    }
+    for (int f = 0; f < 5; f++)
+    {
+        if (!same_pixels(run_filter(f, flat), flat))
+        {
+            cout << FILTER_NAMES[f] << " changes a flat image" << endl;
+            correct = false;
+        }
+    }
+
+    // Against double precision
+    cout << "largest difference from double precision:" << endl;
+    Image image = test_image(211, 157);
+    Image result;
+    struct Check { const char* name; ConvolutionKernel kernel; int limit; };
+    const Check checks[] = {
+        { "box 2", outer_product(vector<double>(5, 0.2), vector<double>(5, 0.2)), 1 },
+        { "box 3x1", outer_product(vector<double>(1, 1.0), vector<double>(7, 1.0 / 7)), 1 },
+        { "gaussian 1", gaussian_kernel(1), 1 },
+        { "gaussian 3", gaussian_kernel(3), 1 },
+        { "sobel x", outer_product(vector<double>{1, 2, 1}, vector<double>{-1, 0, 1}), 1 },
+        { "laplacian", { 3, 3, { 0, -1, 0, -1, 5, -1, 0, -1, 0 } }, 1 },
+        { "emboss", { 3, 3, { -2, -1, 0, -1, 1, 1, 0, 1, 2 } }, 1 },
+    };
+    for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++)
+    {
+        convolve(image, result, checks[c].kernel);
+        int difference = max_difference(result, reference_convolve(image, checks[c].kernel));
+        cout << "  " << left << setw(12) << checks[c].name << right << difference << endl;
+        correct = correct && difference <= checks[c].limit;
+    }
+
+    // Three box passes stay close to the true Gaussian (they match its variance, not its shape)
+    for (double sigma = 4; sigma <= 16; sigma *= 2)
+    {
+        gaussian_blur(image, result, sigma);
+        int difference = max_difference(result, reference_convolve(image, gaussian_kernel(sigma)));
+        cout << "  gaussian " << left << setw(3) << sigma << right << difference << " (three boxes)" << endl;
+        correct = correct && difference <= 8;
+    }
+
+    sobel_edges(image, result);
+    int difference = max_difference(result, reference_sobel(image));
+    cout << "  " << left << setw(12) << "edges" << right << difference << endl;
+    correct = correct && difference == 0;
+
+    // Timings: the box blur and the wide Gaussian should take about the same time at every radius
+    Image big = test_image(width, height);
+    double megabytes = static_cast<double>(big.row_bytes()) * height / 1e6;
+    cout << fixed << setprecision(1);
+    cout << width << "x" << height << " image, " << active_kernels().name << " kernels" << endl;
+    const int radii[] = { 1, 4, 16, 64, 256 };
+    for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++)
+    {
+        double ms = time_ms([&]() { box_blur(big, result, radii[r]); }, 3);
+        cout << "  blur=" << left << setw(14) << radii[r] << right << setw(8) << ms << " ms " << setw(8) << megabytes / ms * 1000 << " MB/s" << endl;
+    }
+    const double sigmas[] = { 1, 2, 3, 4, 16, 64 };
+    for (size_t s = 0; s < sizeof(sigmas) / sizeof(sigmas[0]); s++)
+    {
+        double ms = time_ms([&]() { gaussian_blur(big, result, sigmas[s]); }, 3);
+        cout << "  gaussian=" << left << setw(10) << sigmas[s] << right << setw(8) << ms << " ms " << setw(8) << megabytes / ms * 1000 << " MB/s" << endl;
+    }
+    double ms = time_ms([&]() { unsharp_mask(big, result, 1, 1); }, 3);
+    cout << "  " << left << setw(19) << "sharpen=1,1" << right << setw(8) << ms << " ms " << setw(8) << megabytes / ms * 1000 << " MB/s" << endl;
+    ms = time_ms([&]() { sobel_edges(big, result); }, 3);
+    cout << "  " << left << setw(19) << "edges" << right << setw(8) << ms << " ms " << setw(8) << megabytes / ms * 1000 << " MB/s" << endl;
+
+    cout << (correct ? "PASS" : "FAIL") << endl;
+    return correct ? 0 : 1;
+}
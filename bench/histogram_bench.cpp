@@ -0,0 +1,294 @@
+// Checks the histogram engine: image_histogram against a plain count of
+// every value and of the luma gray=bt601 computes, on color and gray images
+// of awkward sizes with one thread and with the whole pool, the
+// percentiles against a sorted copy of the values and otsu_threshold
+// against a search for the least within-class variance. Then checks
+// levels, equalize and threshold against their maps applied pixel by
+// pixel, and through the pipeline. Then times a histogram of a
+// 50-megapixel image against copying it, which reads it once and writes
+// it once, and times the three operations.
+//
+// Usage: histogram_bench [width height]    (default 8660 5773, 50 megapixels)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "histogram.h"
+#include "pipeline.h"
+#include "thread_pool.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// BT.601 luma of a pixel, as gray=bt601 computes it
+static int luma_of(const unsigned char* pixel)
+{
+    const short* weights = gray_weights(GRAY_BT601);
+    return (weights[0] * pixel[0] + weights[1] * pixel[1] + weights[2] * pixel[2] + (1 << (LUMA_SHIFT - 1))) >> LUMA_SHIFT;
+}
+
+// Every value of a channel (or the luma, channel -1), in the image's order
+template <class ImageType>
+static vector<int> channel_values(const ImageType& image, int channel)
+{
+    vector<int> values;
+    for (int i = 0; i < image.height(); i++)
+    {
+        for (int j = 0; j < image.width(); j++)
+        {
+            const unsigned char* pixel = image.pixel(i, j);
+            values.push_back(channel >= 0 ? pixel[channel] : ImageType::CHANNELS == 1 ? pixel[0] : luma_of(pixel));
+        }
+    }
+    return values;
+}
+
+// A histogram against the values it was counted from: counts, min, max, mean and percentiles
+static bool check_channel(const ChannelHistogram& histogram, vector<int> values, const string& what)
+{
+    vector<size_t> counts(256, 0);
+    double sum = 0;
+    for (size_t k = 0; k < values.size(); k++)
+    {
+        counts[values[k]]++;
+        sum += values[k];
+    }
+    sort(values.begin(), values.end());
+    bool correct = histogram.total == values.size() && histogram.min == values.front() && histogram.max == values.back()
+                   && fabs(histogram.mean - sum / values.size()) < 1e-9;
+    for (int v = 0; v < 256 && correct; v++)
+    {
+        correct = histogram.counts[v] == counts[v];
+    }
+    const double fractions[] = { 0, 0.001, 0.01, 0.25, 0.5, 0.75, 0.99, 1 };
+    for (int f = 0; f < 8 && correct; f++)
+    {
+        size_t rank = max(static_cast<size_t>(ceil(fractions[f] * values.size())), static_cast<size_t>(1)) - 1;
+        correct = histogram.percentile(fractions[f]) == values[rank];
+    }
+    if (!correct)
+    {
+        cout << what << " histogram differs from a plain count" << endl;
+    }
+    return correct;
+}
+
+template <class ImageType>
+static bool check_histogram(int width, int height)
+{
+    ImageType image = test_image<ImageType>(width, height, 29, 40, 190);
+    string size = to_string(width) + "x" + to_string(height) + (ImageType::CHANNELS == 1 ? " gray" : " color");
+    bool correct = true;
+    const int threads[] = { 1, 0 };
+    for (int t = 0; t < 2; t++)
+    {
+        set_thread_count(threads[t]);
+        ImageHistogram histogram = image_histogram(image);
+        correct = histogram.channels == ImageType::CHANNELS && correct;
+        for (int c = 0; c < ImageType::CHANNELS; c++)
+        {
+            correct = check_channel(histogram.channel[c], channel_values(image, c), size + " channel " + to_string(c)) && correct;
+        }
+        correct = check_channel(histogram.luma, channel_values(image, -1), size + " luma") && correct;
+    }
+    set_thread_count(0);
+    return correct;
+}
+
+// Otsu against the threshold with the least weighted within-class variance, computed from the values directly
+static bool check_otsu(const vector<int>& values)
+{
+    ChannelHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    for (size_t k = 0; k < values.size(); k++)
+    {
+        histogram.counts[values[k]]++;
+    }
+    histogram.total = values.size();
+
+    int expected = 127;
+    double best = 0;
+    bool found = false;
+    for (int t = 0; t < 255; t++)
+    {
+        double n[2] = {0, 0}, sum[2] = {0, 0}, squares[2] = {0, 0};
+        for (size_t k = 0; k < values.size(); k++)
+        {
+            int side = values[k] > t;
+            n[side]++;
+            sum[side] += values[k];
+            squares[side] += static_cast<double>(values[k]) * values[k];
+        }
+        if (n[0] == 0 || n[1] == 0)
+        {
+            continue;
+        }
+        double within = squares[0] - sum[0] * sum[0] / n[0] + squares[1] - sum[1] * sum[1] / n[1];
+        if (!found || within < best - 1e-6 * best)
+        {
+            best = within;
+            expected = t;
+            found = true;
+        }
+    }
+    int threshold = otsu_threshold(histogram);
+    if (threshold != expected)
+    {
+        cout << "otsu_threshold gives " << threshold << ", the least within-class variance is at " << expected << endl;
+        return false;
+    }
+    return true;
+}
+
+// The operations against their maps applied pixel by pixel, directly and through the pipeline
+template <class ImageType>
+static bool check_operations(int width, int height)
+{
+    ImageType image = test_image<ImageType>(width, height, 41, 40, 190);
+    ImageHistogram histogram = image_histogram(image);
+    int channels = ImageType::CHANNELS;
+    bool correct = true;
+
+    // levels: each channel's 1st and 99th percentiles go to 0 and 255
+    ImageType levels = image;
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            for (int c = 0; c < channels; c++)
+            {
+                int low = histogram.channel[c].percentile(0.01), high = histogram.channel[c].percentile(0.99);
+                int v = image.pixel(i, j)[c];
+                double stretched = (v - low) * 255.0 / (high - low);
+                levels.pixel(i, j)[c] = static_cast<unsigned char>(min(255.0, max(0.0, floor(stretched + 0.5))));
+            }
+        }
+    }
+
+    // equalize: the share of the luma at or below each value, the darkest value at 0
+    const ChannelHistogram& luma = histogram.luma;
+    ImageType equalized = image;
+    vector<double> below(256, 0);
+    for (int v = 0, seen = 0; v < 256; v++)
+    {
+        seen += static_cast<int>(luma.counts[v]);
+        double darkest = static_cast<double>(luma.counts[luma.min]);
+        below[v] = v < luma.min ? 0 : (seen - darkest) * 255 / (luma.total - darkest);
+    }
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            for (int c = 0; c < channels; c++)
+            {
+                equalized.pixel(i, j)[c] = static_cast<unsigned char>(floor(below[image.pixel(i, j)[c]] + 0.5));
+            }
+        }
+    }
+
+    // threshold: white above the Otsu threshold of the luma
+    int threshold = otsu_threshold(luma);
+    ImageType thresholded = image;
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            int value = (channels == 1 ? image.pixel(i, j)[0] : luma_of(image.pixel(i, j))) > threshold ? 255 : 0;
+            memset(thresholded.pixel(i, j), value, channels);
+        }
+    }
+
+    const char* const names[] = { "levels=1", "equalize", "threshold" };
+    const ImageType* expected[] = { &levels, &equalized, &thresholded };
+    for (int n = 0; n < 3; n++)
+    {
+        Operation operation;
+        parse_operation(names[n], operation);
+        vector<Operation> operations(1, operation);
+        ImageType copy = image;
+        ImageType result = run_pipeline(std::move(copy), operations);
+        if (!same_pixels(result, *expected[n]))
+        {
+            cout << names[n] << " on " << width << "x" << height << " (" << channels << " channels) differs from its map" << endl;
+            correct = false;
+        }
+    }
+    return correct;
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 8660;
+    int height = argc > 2 ? atoi(argv[2]) : 5773;
+    bool correct = true;
+
+    const int sizes[][2] = { {1, 1}, {3, 2}, {37, 19}, {640, 480}, {1001, 333} };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        correct = check_histogram<Image>(sizes[s][0], sizes[s][1]) && correct;
+        correct = check_histogram<GrayImage>(sizes[s][0], sizes[s][1]) && correct;
+    }
+
+    // Otsu on two humps, on a spread of noise, on two values and on one value
+    vector<int> humps, noise, pair, single(100, 200);
+    unsigned int state = 12345;
+    for (int k = 0; k < 20000; k++)
+    {
+        state = state * 1664525u + 1013904223u;
+        humps.push_back(min(255, static_cast<int>((k % 3 == 0 ? 60 : 170) + (state >> 24) % 40)));
+        noise.push_back(static_cast<int>(state >> 24));
+        pair.push_back(k % 5 == 0 ? 30 : 220);
+    }
+    correct = check_otsu(humps) && check_otsu(noise) && check_otsu(pair) && check_otsu(single) && correct;
+
+    correct = check_operations<Image>(333, 217) && correct;
+    correct = check_operations<GrayImage>(333, 217) && correct;
+    {
+        // An image of one value: levels and equalize leave it alone
+        Image flat(50, 40);
+        memset(flat.row(0), 90, flat.row_bytes());
+        for (int i = 1; i < flat.height(); i++)
+        {
+            memcpy(flat.row(i), flat.row(0), flat.row_bytes());
+        }
+        Image leveled, equalized;
+        auto_levels(flat, leveled);
+        equalize(flat, equalized);
+        if (!same_pixels(flat, leveled) || !same_pixels(flat, equalized))
+        {
+            cout << "levels or equalize changed an image of one value" << endl;
+            correct = false;
+        }
+    }
+
+    // Timings: a histogram reads the image once; a copy reads it once and writes it once
+    cout << fixed << setprecision(1);
+    cout << width << "x" << height << " image (" << width * static_cast<double>(height) / 1e6 << " megapixels), "
+         << thread_count() << " threads" << endl;
+    Image big = test_image<Image>(width, height, 11, 40, 190);
+    GrayImage big_gray = to_gray(big);
+    double mb = big.row_bytes() * static_cast<double>(height) / 1e6;
+    Image copy(width, height);
+    double copy_ms = time_ms([&]() { copy = big; }, 5);
+    double histogram_ms = time_ms([&]() { image_histogram(big); }, 5);
+    double gray_ms = time_ms([&]() { image_histogram(big_gray); }, 5);
+    cout << "  copy (one read, one write)  " << setw(8) << copy_ms << " ms " << setw(8) << mb / copy_ms * 1000 << " MB/s" << endl;
+    cout << "  histogram, color + luma     " << setw(8) << histogram_ms << " ms " << setw(8) << mb / histogram_ms * 1000 << " MB/s" << endl;
+    cout << "  histogram, gray             " << setw(8) << gray_ms << " ms " << setw(8) << mb / 3 / gray_ms * 1000 << " MB/s" << endl;
+    double levels_ms = time_ms([&]() { auto_levels(big, copy); }, 5);
+    double equalize_ms = time_ms([&]() { equalize(big, copy); }, 5);
+    double threshold_ms = time_ms([&]() { adaptive_threshold(big, copy); }, 5);
+    cout << "  levels                      " << setw(8) << levels_ms << " ms" << endl;
+    cout << "  equalize                    " << setw(8) << equalize_ms << " ms" << endl;
+    cout << "  threshold                   " << setw(8) << threshold_ms << " ms" << endl;
+
+    cout << (correct ? "PASS" : "FAIL") << endl;
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+// Checks the four forms of every process (returning, into a destination,
+// in place and taking over the input) against each other: the bytes must
+// match, a destination of the right size must keep its buffer, and the in
+// place point operations must not change buffers. Then compares the time
+// and peak resident memory of a darken, grayscale and half turn on a large
+// image run as copies and in place (with the buffer pool off, so freed
+// buffers really go back to the system).
+//
+// Usage: inplace_bench [width height]    (default 6000 4000)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include "image.h"
+#include "buffer_pool.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// The four forms of one process
+struct Forms
+{
+    string name;
+    bool in_place; // The in-place form keeps the buffer
+    function<Image(const Image&)> copy;
+    function<void(const Image&, Image&)> into;
+    function<void(Image&)> inplace;
+    function<Image(Image&&)> take;
+};
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 6000;
+    int height = argc > 2 ? atoi(argv[2]) : 4000;
+    bool correct = true;
+
+    vector<Forms> forms = {
+        {"process_1", true, [](const Image& i) { return process_1(i); }, [](const Image& i, Image& d) { process_1(i, d); },
+         [](Image& i) { process_1_inplace(i); }, [](Image&& i) { return process_1(move(i)); }},
+        {"process_2", true, [](const Image& i) { return process_2(i); }, [](const Image& i, Image& d) { process_2(i, d); },
+         [](Image& i) { process_2_inplace(i); }, [](Image&& i) { return process_2(move(i)); }},
+        {"process_3", true, [](const Image& i) { return process_3(i); }, [](const Image& i, Image& d) { process_3(i, d); },
+         [](Image& i) { process_3_inplace(i); }, [](Image&& i) { return process_3(move(i)); }},
+        {"process_4", false, [](const Image& i) { return process_4(i); }, [](const Image& i, Image& d) { process_4(i, d); },
+         [](Image& i) { process_4_inplace(i); }, [](Image&& i) { return process_4(move(i)); }},
+        {"process_5 x1", false, [](const Image& i) { return process_5(i, 1); }, [](const Image& i, Image& d) { process_5(i, d, 1); },
+         [](Image& i) { process_5_inplace(i, 1); }, [](Image&& i) { return process_5(move(i), 1); }},
+        {"process_5 x2", true, [](const Image& i) { return process_5(i, 2); }, [](const Image& i, Image& d) { process_5(i, d, 2); },
+         [](Image& i) { process_5_inplace(i, 2); }, [](Image&& i) { return process_5(move(i), 2); }},
+        {"process_5 x3", false, [](const Image& i) { return process_5(i, 3); }, [](const Image& i, Image& d) { process_5(i, d, 3); },
+         [](Image& i) { process_5_inplace(i, 3); }, [](Image&& i) { return process_5(move(i), 3); }},
+        {"process_5 x4", true, [](const Image& i) { return process_5(i, 4); }, [](const Image& i, Image& d) { process_5(i, d, 4); },
+         [](Image& i) { process_5_inplace(i, 4); }, [](Image&& i) { return process_5(move(i), 4); }},
+        {"process_6", false, [](const Image& i) { return process_6(i, 2, 3); }, [](const Image& i, Image& d) { process_6(i, d, 2, 3); },
+         [](Image& i) { process_6(i, i, 2, 3); }, [](Image&& i) { return process_6(move(i), 2, 3); }},
+        {"process_7", true, [](const Image& i) { return process_7(i); }, [](const Image& i, Image& d) { process_7(i, d); },
+         [](Image& i) { process_7_inplace(i); }, [](Image&& i) { return process_7(move(i)); }},
+        {"process_8", true, [](const Image& i) { return process_8(i, 0.4); }, [](const Image& i, Image& d) { process_8(i, d, 0.4); },
+         [](Image& i) { process_8_inplace(i, 0.4); }, [](Image&& i) { return process_8(move(i), 0.4); }},
+        {"process_9", true, [](const Image& i) { return process_9(i, 0.4); }, [](const Image& i, Image& d) { process_9(i, d, 0.4); },
+         [](Image& i) { process_9_inplace(i, 0.4); }, [](Image&& i) { return process_9(move(i), 0.4); }},
+        {"process_10", true, [](const Image& i) { return process_10(i); }, [](const Image& i, Image& d) { process_10(i, d); },
+         [](Image& i) { process_10_inplace(i); }, [](Image&& i) { return process_10(move(i)); }},
+        {"process_11", false, [](const Image& i) { return process_11(i, 100, 57, RESAMPLE_LANCZOS3); },
+         [](const Image& i, Image& d) { process_11(i, d, 100, 57, RESAMPLE_LANCZOS3); },
+         [](Image& i) { process_11(i, i, 100, 57, RESAMPLE_LANCZOS3); },
+         [](Image&& i) { return process_11(move(i), 100, 57, RESAMPLE_LANCZOS3); }}
+    };
+
+    const int sizes[][2] = { {333, 217}, {64, 64}, {1, 1}, {97, 300} };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        const Image input = noise_image(sizes[s][0], sizes[s][1]);
+        for (size_t f = 0; f < forms.size(); f++)
+        {
+            const Forms& form = forms[f];
+            Image expected = form.copy(input);
+
+            Image fresh;
+            form.into(input, fresh);
+
+            Image prepared = Image::uninitialized(expected.width(), expected.height());
+            const unsigned char* buffer = prepared.data();
+            form.into(input, prepared);
+            bool kept = prepared.data() == buffer;
+
+            Image in_place = input;
+            buffer = in_place.data();
+            form.inplace(in_place);
+            bool stayed = in_place.data() == buffer;
+
+            Image taken = form.take(Image(input));
+
+            if (!same_pixels(fresh, expected) || !same_pixels(prepared, expected) || !same_pixels(in_place, expected)
+                || !same_pixels(taken, expected) || !kept || (form.in_place && !stayed))
+            {
+                cout << form.name << " forms differ at " << sizes[s][0] << "x" << sizes[s][1] << endl;
+                correct = false;
+            }
+        }
+    }
+
+    // Time and peak memory of a chain of point operations and a half turn, with freed buffers going back to the system
+    image_pool().set_limit(0);
+    cout << fixed << setprecision(1) << width << "x" << height << " image, darken, grayscale, rotate=2:" << endl;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        Image image = noise_image(width, height);
+        reset_peak();
+        size_t base = peak_resident();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (pass == 0)
+        {
+            image = process_9(image, 0.5);
+            image = process_3(image);
+            image = process_5(image, 2);
+        }
+        else
+        {
+            process_9_inplace(image, 0.5);
+            process_3_inplace(image);
+            process_5_inplace(image, 2);
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        size_t peak = peak_resident();
+        cout << "  " << (pass == 0 ? "copies  " : "in place") << setw(9) << ms << " ms, peak RSS +"
+             << setw(7) << (peak - base) / 1048576.0 << " MiB over the " << image.size_bytes() / 1048576.0
+             << " MiB image" << endl;
+    }
+    image_pool().set_limit(DEFAULT_POOL_LIMIT);
+
+    cout << (correct ? "all checks passed" : "CHECKS FAILED") << endl;
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+// Checks every SIMD color kernel against the scalar reference over all
+// 2^24 BGR colors (in an odd-width image, so row tails are covered too,
+// and both out of place and in place), then reports each kernel's speed.
+// The vignette kernel sees every 16-bit factor with every blue value, at
+// every number of fraction bits from 8 to 14 (one per row, in turn).
+// The scalar Clarendon kernel is in turn checked against the original
+// double-precision expressions, and the BGRA8 and Gray8 instantiations of
+// the scalar kernels against the BGR8 ones. The conversion to gray is
+// checked the same way for each set of weights, and the scalar luma
+// against the weights in double precision (within 1).
+//
+// Usage: kernel_bench
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include "image_buffer.h"
+#include "kernels.h"
+#include "bench_util.h"
+
+using namespace std;
+
+static const int KERNEL_COUNT = 5;
+
+// Vignette factors for each pixel of the test image: pixel p gets factor p >> 8
+static vector<short> vignette_factors;
+
+// Runs kernel number k of a set over every row
+static void run_kernel(const FilterKernels& kernels, int k, const Image& src, Image& dst)
+{
+    for (int i = 0; i < src.height(); i++)
+    {
+        const unsigned char* in = src.row(i);
+        unsigned char* out = dst.row(i);
+        switch (k)
+        {
+            case 0 : kernels.clarendon(in, out, src.width()); break;
+            case 1 : kernels.grayscale(in, out, src.width()); break;
+            case 2 : kernels.high_contrast(in, out, src.width()); break;
+            case 3 : kernels.primary_colors(in, out, src.width()); break;
+            case 4 : kernels.vignette(in, out, &vignette_factors[static_cast<size_t>(i) * src.width()], 8 + i % 7, src.width()); break;
+        }
+    }
+}
+
+static const char* const KERNEL_NAMES[] = { "clarendon", "grayscale", "high_contrast", "primary_colors", "vignette" };
+
+// Clarendon as process_2 was originally written, in double precision
+static void original_clarendon(const unsigned char* src, unsigned char* dst, int width)
+{
+    const double SCALING_FACTOR = 0.3;
+    for (int j = 0; j < width; j++)
+    {
+        int oldBlue = src[3 * j], oldGreen = src[3 * j + 1], oldRed = src[3 * j + 2];
+        double avg = (oldBlue + oldGreen + oldRed) / 3.0;
+        for (int c = 0; c < 3; c++)
+        {
+            int old = src[3 * j + c];
+            if (avg >= 170)
+            {
+                dst[3 * j + c] = static_cast<int>(255 - (255 - old) * SCALING_FACTOR);
+            }
+            else if (avg < 90)
+            {
+                dst[3 * j + c] = static_cast<int>(old * SCALING_FACTOR);
+            }
+            else
+            {
+                dst[3 * j + c] = old;
+            }
+        }
+    }
+}
+
+// Compares the table-driven scalar Clarendon kernel with the original expressions
+static bool check_reference(const Image& colors)
+{
+    Image expected(colors.width(), colors.height());
+    Image actual(colors.width(), colors.height());
+    for (int i = 0; i < colors.height(); i++)
+    {
+        original_clarendon(colors.row(i), expected.row(i), colors.width());
+        scalar_kernels().clarendon(colors.row(i), actual.row(i), colors.width());
+    }
+    bool exact = same_pixels(expected, actual);
+    cout << "scalar clarendon: " << (exact ? "exact" : "NOT exact") << " against the original expressions" << endl;
+    return exact;
+}
+
+// Compares one kernel set against the scalar kernels; returns false on any mismatch
+static bool check(const FilterKernels& kernels, const Image& colors)
+{
+    bool exact = true;
+    Image expected(colors.width(), colors.height());
+    Image actual(colors.width(), colors.height());
+
+    for (int k = 0; k < KERNEL_COUNT; k++)
+    {
+        run_kernel(scalar_kernels(), k, colors, expected);
+        run_kernel(kernels, k, colors, actual);
+        bool same = same_pixels(expected, actual);
+
+        actual = colors;
+        run_kernel(kernels, k, actual, actual);
+        bool same_in_place = same_pixels(expected, actual);
+
+        if (!same || !same_in_place)
+        {
+            cout << kernels.name << " " << KERNEL_NAMES[k] << ": MISMATCH" << (same ? " in place" : "") << endl;
+            exact = false;
+        }
+    }
+    cout << kernels.name << ": " << (exact ? "exact" : "NOT exact") << " over all 2^24 colors" << endl;
+    return exact;
+}
+
+// Runs kernel number k of a set over one row
+static void run_row_kernel(const FilterKernels& kernels, int k, const unsigned char* in, unsigned char* out, int width, int row)
+{
+    switch (k)
+    {
+        case 0 : kernels.clarendon(in, out, width); break;
+        case 1 : kernels.grayscale(in, out, width); break;
+        case 2 : kernels.high_contrast(in, out, width); break;
+        case 3 : kernels.primary_colors(in, out, width); break;
+        case 4 : kernels.vignette(in, out, &vignette_factors[static_cast<size_t>(row) * width], 8 + row % 7, width); break;
+    }
+}
+
+// Checks the BGRA8 kernels (colors as BGR8, alpha kept) over every color and the Gray8 kernels (the average of the
+// BGR8 result of the equal gray color) over every gray value
+static bool check_formats(const Image& colors)
+{
+    const FilterKernels& bgr = scalar_kernels(PIXEL_BGR8);
+    const FilterKernels& bgra = scalar_kernels(PIXEL_BGRA8);
+    const FilterKernels& gray = scalar_kernels(PIXEL_GRAY8);
+    int width = colors.width();
+    vector<unsigned char> expected(3 * width), wide(4 * width), wide_out(4 * width);
+    vector<unsigned char> gray_in(width), gray_out(width), gray_bgr(3 * width);
+    bool exact = true;
+
+    for (int k = 0; k < KERNEL_COUNT; k++)
+    {
+        bool same = true;
+        for (int i = 0; i < colors.height(); i++)
+        {
+            const unsigned char* row = colors.row(i);
+            for (int j = 0; j < width; j++)
+            {
+                memcpy(&wide[4 * j], row + 3 * j, 3);
+                wide[4 * j + 3] = static_cast<unsigned char>(j * 7);
+                gray_in[j] = static_cast<unsigned char>(i + j);
+                memset(&gray_bgr[3 * j], gray_in[j], 3);
+            }
+            run_row_kernel(bgr, k, row, expected.data(), width, i);
+            run_row_kernel(bgra, k, wide.data(), wide_out.data(), width, i);
+            run_row_kernel(gray, k, gray_in.data(), gray_out.data(), width, i);
+            run_row_kernel(bgr, k, gray_bgr.data(), gray_bgr.data(), width, i);
+            for (int j = 0; j < width && same; j++)
+            {
+                int average = (gray_bgr[3 * j] + gray_bgr[3 * j + 1] + gray_bgr[3 * j + 2]) / 3;
+                same = memcmp(&wide_out[4 * j], &expected[3 * j], 3) == 0 && wide_out[4 * j + 3] == wide[4 * j + 3]
+                    && gray_out[j] == average;
+            }
+        }
+        if (!same)
+        {
+            cout << "bgra8/gray8 " << KERNEL_NAMES[k] << ": MISMATCH" << endl;
+            exact = false;
+        }
+    }
+    cout << "scalar bgra8 and gray8: " << (exact ? "exact" : "NOT exact") << " against bgr8" << endl;
+    return exact;
+}
+
+// Converts every color to gray with each set of weights, comparing a kernel set with the scalar kernels (and, for
+// the scalar set, the luma with the exact weights); returns false on any mismatch
+static bool check_gray(const FilterKernels& kernels, const Image& colors)
+{
+    static const double EXACT[3][3] = { {0, 0, 0}, {0.114, 0.587, 0.299}, {0.0722, 0.7152, 0.2126} };
+    GrayImage expected(colors.width(), colors.height());
+    GrayImage actual(colors.width(), colors.height());
+    bool exact = true;
+
+    for (int w = GRAY_AVERAGE; w <= GRAY_BT709; w++)
+    {
+        const short* weights = gray_weights(static_cast<GrayWeights>(w));
+        bool same = true;
+        for (int i = 0; i < colors.height() && same; i++)
+        {
+            const unsigned char* in = colors.row(i);
+            scalar_kernels().to_gray(in, expected.row(i), weights, colors.width());
+            kernels.to_gray(in, actual.row(i), weights, colors.width());
+            same = memcmp(expected.row(i), actual.row(i), expected.row_bytes()) == 0;
+            for (int j = 0; j < colors.width() && same && &kernels == &scalar_kernels(); j++)
+            {
+                double value = w == GRAY_AVERAGE ? (in[3 * j] + in[3 * j + 1] + in[3 * j + 2]) / 3
+                    : EXACT[w][0] * in[3 * j] + EXACT[w][1] * in[3 * j + 1] + EXACT[w][2] * in[3 * j + 2];
+                same = fabs(actual.row(i)[j] - value) <= 1;
+            }
+        }
+        if (!same)
+        {
+            cout << kernels.name << " to_gray weights " << w << ": MISMATCH" << endl;
+            exact = false;
+        }
+    }
+    cout << kernels.name << " to_gray: " << (exact ? "exact" : "NOT exact") << " for the average, BT.601 and BT.709" << endl;
+    return exact;
+}
+
+// Prints megapixels per second for each kernel of a set
+static void measure(const FilterKernels& kernels, const Image& colors)
+{
+    Image output(colors.width(), colors.height());
+    double megapixels = static_cast<double>(colors.width()) * colors.height() / 1e6;
+
+    cout << left << setw(8) << kernels.name << right;
+    for (int k = 0; k < KERNEL_COUNT; k++)
+    {
+        double best = 1e9;
+        for (int rep = 0; rep < 3; rep++)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            run_kernel(kernels, k, colors, output);
+            double elapsed = seconds_since(start);
+            best = elapsed < best ? elapsed : best;
+        }
+        cout << setw(16) << fixed << setprecision(0) << megapixels / best;
+    }
+    cout << endl;
+}
+
+int main()
+{
+    // Every 24-bit color at least once: pixel p gets color p mod 2^24
+    const int width = 4099;
+    const int height = (1 << 24) / width + 1;
+    Image colors(width, height);
+    unsigned int p = 0;
+    vignette_factors.resize(static_cast<size_t>(width) * height);
+    for (int i = 0; i < height; i++)
+    {
+        unsigned char* row = colors.row(i);
+        for (int j = 0; j < width; j++, p++)
+        {
+            vignette_factors[p] = static_cast<short>(p >> 8);
+            row[3 * j] = p;
+            row[3 * j + 1] = p >> 8;
+            row[3 * j + 2] = p >> 16;
+        }
+    }
+
+    vector<const FilterKernels*> sets;
+    sets.push_back(&scalar_kernels());
+    if (sse2_kernels() != nullptr)
+    {
+        sets.push_back(sse2_kernels());
+    }
+    if (avx2_kernels() != nullptr)
+    {
+        sets.push_back(avx2_kernels());
+    }
+
+    bool exact = check_reference(colors);
+    exact = check_formats(colors) && exact;
+    exact = check_gray(scalar_kernels(), colors) && exact;
+    for (size_t i = 1; i < sets.size(); i++)
+    {
+        exact = check(*sets[i], colors) && exact;
+        exact = check_gray(*sets[i], colors) && exact;
+    }
+
+    cout << endl << "Megapixels per second (active: " << active_kernels().name << ")" << endl;
+    cout << left << setw(8) << "" << right;
+    for (int k = 0; k < KERNEL_COUNT; k++)
+    {
+        cout << setw(16) << KERNEL_NAMES[k];
+    }
+    cout << endl;
+    for (size_t i = 0; i < sets.size(); i++)
+    {
+        measure(*sets[i], colors);
+    }
+    return exact ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// Compares the nested-vector image layout with the contiguous Image layout.
+// Each layout runs in its own child process (read, grayscale, darken, write)
+// so that its peak resident set size can be reported on its own.
+//
+// Usage: layout_bench [megapixels]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "image.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Grayscale over the nested-vector layout, as process_3 was originally written
+static vector<vector<vector<int> > > nested_grayscale(const vector<vector<vector<int> > >& image)
+{
+    vector<vector<vector<int> > > empty;
+    int height = image.size();
+    int width = image[0].size();
+    for (int i = 0; i < height; i++)
+    {
+        vector<vector<int> > w;
+        for (int j = 0; j < width; j++)
+        {
+            vector<int> vals;
+            int gray = (image[i][j][0] + image[i][j][1] + image[i][j][2]) / 3;
+            vals.push_back(gray);
+            vals.push_back(gray);
+            vals.push_back(gray);
+            w.push_back(vals);
+        }
+        empty.push_back(w);
+    }
+    return empty;
+}
+
+// Darken over the nested-vector layout, as process_9 was originally written
+static vector<vector<vector<int> > > nested_darken(const vector<vector<vector<int> > >& image, double scaling_factor)
+{
+    vector<vector<vector<int> > > empty;
+    int height = image.size();
+    int width = image[0].size();
+    for (int i = 0; i < height; i++)
+    {
+        vector<vector<int> > w;
+        for (int j = 0; j < width; j++)
+        {
+            vector<int> pxl;
+            pxl.push_back(static_cast<int>(image[i][j][0] * scaling_factor));
+            pxl.push_back(static_cast<int>(image[i][j][1] * scaling_factor));
+            pxl.push_back(static_cast<int>(image[i][j][2] * scaling_factor));
+            w.push_back(pxl);
+        }
+        empty.push_back(w);
+    }
+    return empty;
+}
+
+static void run_nested(const string& filename)
+{
+    vector<vector<vector<int> > > image = read_image(filename);
+    image = nested_darken(nested_grayscale(image), 0.5);
+    write_image("/dev/null", image);
+}
+
+static void run_contiguous(const string& filename)
+{
+    Image image;
+    read_image(filename, image);
+    image = process_9(process_3(image), 0.5);
+    write_image("/dev/null", image);
+}
+
+// Runs one layout in a child process and prints its time and peak RSS
+static void measure(const char* name, void (*run)(const string&), const string& filename, double megapixels)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        run(filename);
+        double elapsed = seconds_since(start);
+        ssize_t written = write(fds[1], &elapsed, sizeof(elapsed));
+        _exit(written == sizeof(elapsed) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    double elapsed = 0;
+    ssize_t got = read(fds[0], &elapsed, sizeof(elapsed));
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    if (got != sizeof(elapsed) || status != 0)
+    {
+        cout << name << ": failed" << endl;
+        return;
+    }
+
+    cout << left << setw(12) << name << right
+         << setw(10) << fixed << setprecision(1) << usage.ru_maxrss / 1024.0 << " MiB peak RSS"
+         << setw(10) << setprecision(2) << elapsed * 1000 / megapixels << " ms/MP" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    double megapixels = argc > 1 ? atof(argv[1]) : 4.0;
+    int width = 4000;
+    int height = static_cast<int>(megapixels * 1e6 / width);
+    if (height < 1)
+    {
+        height = 1;
+    }
+    megapixels = static_cast<double>(width) * height / 1e6;
+
+    // Synthetic test image with a deterministic pseudo-random pattern
+    Image image(width, height);
+    unsigned int state = 12345;
+    for (int i = 0; i < height; i++)
+    {
+        unsigned char* row = image.row(i);
+        for (size_t j = 0; j < image.row_bytes(); j++)
+        {
+            state = state * 1103515245 + 12345;
+            row[j] = state >> 24;
+        }
+    }
+
+    string filename = "/tmp/layout_bench.bmp";
+    if (!write_image(filename, image))
+    {
+        cout << "Unable to write " << filename << endl;
+        return 1;
+    }
+    image = Image();
+
+    cout << "Read, grayscale, darken and write a " << width << "x" << height
+         << " image (" << setprecision(1) << fixed << megapixels << " MP)" << endl;
+    measure("nested", run_nested, filename, megapixels);
+    measure("contiguous", run_contiguous, filename, megapixels);
+
+    unlink(filename.c_str());
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Soak test for the image buffer pool: runs a chain of filters over images
+// of several sizes many times, like a long-running worker, and samples the
+// resident memory every 1000 iterations. Runs once with the pool turned off
+// and once with it on, then checks that the resident memory stayed flat
+// with the pool and that nearly every buffer was reused.
+//
+// Usage: pool_bench [iterations]    (default 10000)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+#include "image.h"
+#include "buffer_pool.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Resident memory now, in bytes, from /proc/self/statm
+static size_t resident_bytes()
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    long pages = 0, resident = 0;
+    if (file != nullptr)
+    {
+        if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(file);
+    }
+    return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+static double mebibytes(size_t bytes)
+{
+    return bytes / 1048576.0;
+}
+
+struct SoakResult
+{
+    double seconds;
+    vector<size_t> resident; // Sampled every 1000 iterations
+    PoolStats stats;
+};
+
+// Runs the chain over the images in turn, keeping the last result alive like a worker handing it on
+static SoakResult soak(const vector<Image>& inputs, int iterations)
+{
+    SoakResult soak_result;
+    image_pool().clear();
+    Image result;
+    long checksum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++)
+    {
+        const Image& input = inputs[n % inputs.size()];
+        Image image = process_3(input);
+        image = process_8(image, 1.2);
+        image = process_4(image);
+        result = process_1(image);
+        checksum += result.row(0)[0];
+        if ((n + 1) % 1000 == 0)
+        {
+            soak_result.resident.push_back(resident_bytes());
+        }
+    }
+    soak_result.seconds = seconds_since(start);
+    soak_result.stats = image_pool().stats();
+    if (checksum < 0)
+    {
+        cout << checksum << endl;
+    }
+    return soak_result;
+}
+
+// Prints the samples; returns the growth in resident memory from the first sample to the largest later one
+static size_t report(const string& label, const SoakResult& result)
+{
+    size_t requests = result.stats.hits + result.stats.misses;
+    cout << label << ": " << setprecision(2) << result.seconds << " s, " << result.stats.hits << " hits, "
+         << result.stats.misses << " misses (" << setprecision(1)
+         << (requests > 0 ? 100.0 * result.stats.hits / requests : 0.0) << "% reused), "
+         << result.stats.evictions << " evictions" << endl;
+    cout << "  RSS MiB every 1000 iterations:";
+    size_t growth = 0;
+    for (size_t i = 0; i < result.resident.size(); i++)
+    {
+        cout << " " << setprecision(1) << mebibytes(result.resident[i]);
+        if (result.resident[i] > result.resident[0])
+        {
+            growth = max(growth, result.resident[i] - result.resident[0]);
+        }
+    }
+    cout << endl;
+    return growth;
+}
+
+int main(int argc, char* argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    iterations = max(iterations, 1000);
+
+    // Several sizes, as a worker taking requests would see
+    const int sizes[][2] = { {640, 480}, {333, 217}, {800, 600}, {512, 512}, {1024, 200} };
+    vector<Image> inputs;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        inputs.push_back(noise_image(sizes[s][0], sizes[s][1]));
+    }
+
+    cout << fixed << iterations << " iterations of grayscale, lighten, rotate90 and vignette over "
+         << inputs.size() << " image sizes" << endl;
+
+    image_pool().set_limit(0);
+    SoakResult off = soak(inputs, iterations);
+    report("pool off", off);
+
+    image_pool().set_limit(DEFAULT_POOL_LIMIT);
+    SoakResult on = soak(inputs, iterations);
+    size_t growth = report("pool on ", on);
+
+    size_t requests = on.stats.hits + on.stats.misses;
+    bool flat = growth <= (4u << 20);
+    bool reused = requests > 0 && on.stats.hits >= requests * 99 / 100;
+    cout << setprecision(2) << "pool on: RSS grew " << mebibytes(growth) << " MiB after the first 1000 iterations, "
+         << "time " << on.seconds / off.seconds * 100 << "% of pool off" << endl;
+    cout << (flat && reused ? "all checks passed" : "CHECKS FAILED") << endl;
+    return flat && reused ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// Checks and times reading ahead in batch mode: a FilePrefetcher reads
+// exactly the files in its window ahead of the consumer and skips those
+// the consumer has passed. Then the same batch runs without reading ahead,
+// with pread and with io_uring, and the outputs must match byte for byte.
+// Before each run the input files are dropped from the page cache
+// (posix_fadvise DONTNEED), so the reads come from the disk; the summary's
+// stage times show how much of the reading the other stages hid.
+//
+// Usage: prefetch_bench [files [width height]]    (default 48 files of 1920 x 1080)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "image.h"
+#include "batch.h"
+#include "prefetch.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Writes a file's dirty pages out and asks the kernel to drop it from the page cache
+static void drop_from_cache(const string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static string file_contents(const string& filename)
+{
+    ifstream file(filename.c_str(), ios::binary);
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static size_t total_size(const vector<string>& files)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        struct stat info;
+        bytes += stat(files[i].c_str(), &info) == 0 ? info.st_size : 0;
+    }
+    return bytes;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 48;
+    int width = argc > 3 ? atoi(argv[2]) : 1920;
+    int height = argc > 3 ? atoi(argv[3]) : 1080;
+    bool correct = true;
+
+    string directory = "/tmp/prefetch_bench_" + to_string(getpid());
+    mkdir(directory.c_str(), 0777);
+    vector<string> inputs;
+    for (int i = 0; i < count; i++)
+    {
+        string name = directory + "/in_" + to_string(1000 + i) + ".bmp";
+        write_image(name, test_image(width, height, 7 + i));
+        inputs.push_back(name);
+    }
+    size_t input_bytes = total_size(inputs);
+    cout << count << " files of " << width << "x" << height << " (" << fixed << setprecision(1) << input_bytes / 1e6
+         << " MB)" << endl;
+
+    // With the consumer on file 0, files 1 to 3 are read; once it moves to file 5, files 6 to 8 are too
+    // (4 and 5 it reached first). Then a prefetcher destroyed with reads possibly in flight
+    for (int uring = 0; uring < 2 && count >= 9; uring++)
+    {
+        size_t file_bytes = total_size(vector<string>(1, inputs[0]));
+        FilePrefetcher prefetcher(inputs, 3, uring == 1);
+        size_t waited = 0;
+        while (prefetcher.bytes_read() < 3 * file_bytes && waited++ < 5000)
+        {
+            usleep(1000);
+        }
+        size_t first = prefetcher.bytes_read();
+        prefetcher.advance(5);
+        while (prefetcher.bytes_read() < 6 * file_bytes && waited++ < 5000)
+        {
+            usleep(1000);
+        }
+        usleep(20000);
+        size_t second = prefetcher.bytes_read();
+        if (uring == 1 && !prefetcher.uses_io_uring())
+        {
+            cout << "io_uring is not available here; reading ahead falls back to pread" << endl;
+        }
+        if (first != 3 * file_bytes || second != 6 * file_bytes)
+        {
+            cout << (prefetcher.uses_io_uring() ? "io_uring" : "pread") << " prefetcher read " << first << " then "
+                 << second << " bytes, expected " << 3 * file_bytes << " then " << 6 * file_bytes << endl;
+            correct = false;
+        }
+        FilePrefetcher abandoned(inputs, 8, uring == 1);
+    }
+
+    // The same batch without reading ahead, with pread and with io_uring
+    vector<Operation> operations;
+    const char* const names[] = { "clarendon", "blur=2", "vignette" };
+    for (int n = 0; n < 3; n++)
+    {
+        Operation operation;
+        parse_operation(names[n], operation);
+        operations.push_back(operation);
+    }
+    struct Mode
+    {
+        const char* name;
+        int prefetch;
+        bool uring;
+    };
+    const Mode modes[] = { {"none", 0, false}, {"pread", BATCH_PREFETCH_DEPTH, false}, {"io_uring", BATCH_PREFETCH_DEPTH, true} };
+    vector<string> reference;
+    cout << "  read-ahead     wall s   read s  filter s  write s   images/s" << endl;
+    for (int m = 0; m < 3; m++)
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            drop_from_cache(inputs[i]);
+        }
+        string output_dir = directory + "/out_" + modes[m].name;
+        BatchSummary summary = run_batch(inputs, output_dir, operations, BATCH_QUEUE_DEPTH, modes[m].prefetch, modes[m].uring);
+        cout << "  " << left << setw(10) << modes[m].name << right << setprecision(2) << setw(10) << summary.seconds
+             << setw(9) << summary.read_seconds << setw(10) << summary.filter_seconds << setw(9) << summary.write_seconds
+             << setw(11) << setprecision(1) << summary.images / max(summary.seconds, 1e-9)
+             << (modes[m].uring && !summary.io_uring ? "  (pread: io_uring not available)" : "") << endl;
+        if (summary.images != count || summary.failed != 0)
+        {
+            cout << modes[m].name << ": " << summary.images << " images written, " << summary.failed << " failed" << endl;
+            correct = false;
+        }
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            string output = output_dir + "/in_" + to_string(1000 + i) + ".bmp";
+            string contents = file_contents(output);
+            if (m == 0)
+            {
+                reference.push_back(contents);
+            }
+            else if (contents != reference[i])
+            {
+                cout << modes[m].name << ": " << output << " differs from the run without reading ahead" << endl;
+                correct = false;
+            }
+            unlink(output.c_str());
+        }
+        rmdir(output_dir.c_str());
+    }
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        unlink(inputs[i].c_str());
+    }
+    rmdir(directory.c_str());
+
+    cout << (correct ? "PASS" : "FAIL") << endl;
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+// Checks region processing: run_region over random rectangles (at the
+// edges, in the middle, one pixel, the whole image) gives exactly the
+// pixels run_pipeline gives, for chains of row operations, every
+// neighbourhood filter and mixes of both, on color and gray images; and a
+// PreviewCache stays equal to run_pipeline over a series of random edits.
+// Then times a full render against the render after a small edit, for
+// each chain, to show the edit's cost following its size.
+//
+// Usage: preview_bench [width height]    (default 6000 4000)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "pipeline.h"
+#include "preview.h"
+#include "bench_util.h"
+
+using namespace std;
+
+static vector<Operation> parse_chain(const string& text)
+{
+    vector<Operation> operations;
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t space = text.find(' ', start);
+        string word = text.substr(start, space == string::npos ? string::npos : space - start);
+        Operation operation;
+        if (!parse_operation(word, operation))
+        {
+            cout << "bad operation " << word << endl;
+            exit(1);
+        }
+        operations.push_back(operation);
+        start = space == string::npos ? text.size() : space + 1;
+    }
+    return operations;
+}
+
+static unsigned int state = 12345;
+
+static int random_below(int limit)
+{
+    state = state * 1664525u + 1013904223u;
+    return static_cast<int>((state >> 8) % static_cast<unsigned int>(limit));
+}
+
+// A random rectangle of the image, sometimes reaching past its edges
+static Region random_region(int width, int height)
+{
+    Region region;
+    region.x = random_below(width + 20) - 10;
+    region.y = random_below(height + 20) - 10;
+    region.width = 1 + random_below(width / 2 + 1);
+    region.height = 1 + random_below(height / 2 + 1);
+    return region;
+}
+
+// Checks run_region over many rectangles against run_pipeline; the pixels outside each must stay as they were
+template <class ImageType>
+static bool check_regions(const ImageType& image, const vector<Operation>& operations, const string& chain)
+{
+    ImageType expected = run_pipeline(ImageType(image), operations);
+    ImageType result = ImageType(image.width(), image.height());
+    Region regions[] = { {0, 0, image.width(), image.height()}, {0, 0, 1, 1},
+                         {image.width() - 1, image.height() - 1, 1, 1}, {image.width() / 2, image.height() / 3, 5, 7} };
+    for (int r = 0; r < 24; r++)
+    {
+        Region region = r < 4 ? regions[r] : random_region(image.width(), image.height());
+        ImageType before = result;
+        if (!run_region(image, result, region, operations))
+        {
+            cout << chain << ": run_region failed" << endl;
+            return false;
+        }
+        for (int i = 0; i < image.height(); i++)
+        {
+            for (int j = 0; j < image.width(); j++)
+            {
+                bool inside = j >= region.x && j < region.x + region.width && i >= region.y && i < region.y + region.height;
+                const unsigned char* want = inside ? expected.pixel(i, j) : before.pixel(i, j);
+                if (memcmp(result.pixel(i, j), want, ImageType::CHANNELS) != 0)
+                {
+                    cout << chain << ": pixel " << j << "," << i << (inside ? " inside" : " outside") << " region "
+                         << region.x << "," << region.y << " " << region.width << "x" << region.height << " differs" << endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    // In place, over the whole image
+    ImageType copy = image;
+    run_region(copy, copy, regions[0], operations);
+    if (!same_pixels(copy, expected))
+    {
+        cout << chain << ": run_region in place differs" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Scribbles over a rectangle, as an edit in a preview would
+static void edit(Image& image, const Region& region)
+{
+    for (int i = max(region.y, 0); i < min(region.y + region.height, image.height()); i++)
+    {
+        for (int j = max(region.x, 0); j < min(region.x + region.width, image.width()); j++)
+        {
+            image.pixel(i, j)[random_below(3)] = static_cast<unsigned char>(random_below(256));
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 6000;
+    int height = argc > 2 ? atoi(argv[2]) : 4000;
+    bool correct = true;
+
+    const char* const chains[] = {
+        "vignette", "clarendon lighten=1.5 darken=0.5 primary", "blur=3", "blur=0", "gaussian=1.5", "gaussian=6",
+        "sharpen=2,1", "sharpen=1,4", "edges", "grayscale blur=2 vignette edges", "vignette gaussian=2 contrast sharpen=1"
+    };
+    const int sizes[][2] = { {211, 157}, {1, 1}, {3, 90}, {150, 2}, {700, 2} }; // 700 x 2: a vignette without fixed point
+    for (size_t c = 0; c < sizeof(chains) / sizeof(chains[0]); c++)
+    {
+        vector<Operation> operations = parse_chain(chains[c]);
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            correct = correct && check_regions(test_image<Image>(sizes[s][0], sizes[s][1], 7), operations, chains[c]);
+            correct = correct && check_regions(test_image<GrayImage>(sizes[s][0], sizes[s][1], 9), operations, chains[c]);
+        }
+    }
+    Image square(8, 8);
+    Region whole = {0, 0, 8, 8};
+    if (run_region(square, square, whole, parse_chain("rotate90")))
+    {
+        cout << "run_region accepted a rotation" << endl;
+        correct = false;
+    }
+
+    // A cache over a series of edits matches the whole chain run each time
+    const char* const cached[] = { "blur=5 vignette", "sharpen=1,2", "rotate90 contrast", "edges" };
+    for (size_t c = 0; c < sizeof(cached) / sizeof(cached[0]) && correct; c++)
+    {
+        vector<Operation> operations = parse_chain(cached[c]);
+        Image image = test_image<Image>(301, 245, 3);
+        PreviewCache cache(32);
+        for (int step = 0; step < 12 && correct; step++)
+        {
+            for (int e = step % 3; e > 0; e--) // Some renders follow no edit, some several
+            {
+                Region region = random_region(image.width() / 4, image.height() / 4);
+                region.x += random_below(image.width());
+                region.y += random_below(image.height());
+                edit(image, region);
+                cache.invalidate("image", region);
+            }
+            if (!same_pixels(cache.render("image", image, operations), run_pipeline(image, operations)))
+            {
+                cout << cached[c] << ": cached render differs after " << step << " edits" << endl;
+                correct = false;
+            }
+        }
+    }
+
+    // Timings: a full render, then an edit of 32 x 32 pixels in the middle
+    Image big = test_image<Image>(width, height, 5);
+    cout << fixed << setprecision(2);
+    cout << width << "x" << height << " image, " << PREVIEW_TILE_SIZE << "-pixel tiles, edit of 32x32 pixels" << endl;
+    cout << "  " << left << setw(36) << "chain" << right << setw(10) << "full" << setw(10) << "edit" << setw(8) << "tiles" << endl;
+    const char* const timed[] = { "clarendon vignette", "blur=8", "gaussian=2", "gaussian=20", "sharpen=1,1", "edges",
+                                  "vignette gaussian=2 contrast sharpen=1" };
+    for (size_t c = 0; c < sizeof(timed) / sizeof(timed[0]); c++)
+    {
+        vector<Operation> operations = parse_chain(timed[c]);
+        PreviewCache cache;
+        double full = time_ms([&]() { cache.forget("big"); cache.render("big", big, operations); }, 3);
+        Region region = {width / 2, height / 2, 32, 32};
+        double incremental = time_ms([&]()
+        {
+            edit(big, region);
+            cache.invalidate("big", region);
+            cache.render("big", big, operations);
+        }, 5);
+        cout << "  " << left << setw(36) << timed[c] << right << setw(7) << full << " ms" << setw(7) << incremental << " ms"
+             << setw(8) << cache.stats().tiles << endl;
+    }
+
+    cout << (correct ? "PASS" : "FAIL") << endl;
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+// Checks the preview pyramid: the SIMD halve kernels against the scalar
+// one on random rows of every length up to a few registers, halve_image
+// against the 2 x 2 averages on odd and even sizes, the levels and
+// level_for of a pyramid, and the pyramid cache's hits, reloads of changed
+// files and evictions. Then times previews of a 50-megapixel file: reading
+// it and resizing at full resolution for every preview, against loading
+// its pyramid once and resizing the level that fits.
+//
+// Usage: pyramid_bench [width height]    (default 8660 5773, 50 megapixels)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "image.h"
+#include "kernels.h"
+#include "pipeline.h"
+#include "pyramid.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Checks one set of SIMD kernels against the scalar one on random rows of every width up to 200 output pixels
+static bool check_kernels(const FilterKernels& kernels)
+{
+    unsigned int state = 88172645u;
+    vector<unsigned char> top(6 * 200 + 6), bottom(top.size()), expected(3 * 200), actual(3 * 200);
+    for (int width = 0; width <= 200; width++)
+    {
+        for (size_t x = 0; x < top.size(); x++)
+        {
+            state = state * 1664525u + 1013904223u;
+            top[x] = static_cast<unsigned char>(state >> 24);
+            bottom[x] = static_cast<unsigned char>(state >> 16);
+        }
+        scalar_kernels().halve(top.data(), bottom.data(), expected.data(), width);
+        kernels.halve(top.data(), bottom.data(), actual.data(), width);
+        if (memcmp(expected.data(), actual.data(), 3 * width) != 0)
+        {
+            cout << kernels.name << " halve differs from scalar at " << width << " pixels" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// halve_image against the averages of each 2 x 2 block, through every set of kernels
+template <class ImageType>
+static bool check_halve(int width, int height)
+{
+    ImageType image = test_image<ImageType>(width, height, 17);
+    ImageType expected(width / 2, height / 2);
+    for (int i = 0; i < expected.height(); i++)
+    {
+        for (int j = 0; j < expected.width(); j++)
+        {
+            for (int c = 0; c < ImageType::CHANNELS; c++)
+            {
+                int sum = image.pixel(2 * i, 2 * j)[c] + image.pixel(2 * i, 2 * j + 1)[c] + image.pixel(2 * i + 1, 2 * j)[c]
+                          + image.pixel(2 * i + 1, 2 * j + 1)[c];
+                expected.pixel(i, j)[c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+    const char* const sets[] = { "scalar", "sse2", "avx2" };
+    bool correct = true;
+    for (int s = 0; s < 3; s++)
+    {
+        if (!select_kernels(sets[s]))
+        {
+            continue;
+        }
+        ImageType result;
+        halve_image(image, result);
+        if (!same_pixels(result, expected))
+        {
+            cout << "halve_image of " << width << "x" << height << " (" << ImageType::CHANNELS << " channels) with "
+                 << sets[s] << " kernels differs" << endl;
+            correct = false;
+        }
+    }
+    select_kernels("auto");
+    return correct;
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 8660;
+    int height = argc > 2 ? atoi(argv[2]) : 5773;
+    bool correct = true;
+
+    const FilterKernels* kernel_sets[] = { sse2_kernels(), avx2_kernels() };
+    for (int k = 0; k < 2; k++)
+    {
+        correct = (kernel_sets[k] == nullptr || check_kernels(*kernel_sets[k])) && correct;
+    }
+    const int sizes[][2] = { {2, 2}, {3, 3}, {129, 65}, {130, 2}, {333, 217}, {640, 480} };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        correct = check_halve<Image>(sizes[s][0], sizes[s][1]) && correct;
+        correct = check_halve<GrayImage>(sizes[s][0], sizes[s][1]) && correct;
+    }
+
+    // Levels halve down to a side of 1, and level_for picks the smallest that covers the size asked for
+    Pyramid pyramid(test_image<Image>(1000, 300, 3));
+    const int level_sizes[][2] = { {1000, 300}, {500, 150}, {250, 75}, {125, 37}, {62, 18}, {31, 9}, {15, 4}, {7, 2}, {3, 1} };
+    bool levels_right = pyramid.levels() == 9;
+    for (int l = 0; l < pyramid.levels() && levels_right; l++)
+    {
+        levels_right = pyramid.level(l).width() == level_sizes[l][0] && pyramid.level(l).height() == level_sizes[l][1];
+    }
+    levels_right = levels_right && &pyramid.level_for(250, 75) == &pyramid.level(2) && &pyramid.level_for(251, 10) == &pyramid.level(1)
+                   && &pyramid.level_for(2000, 10) == &pyramid.level(0) && &pyramid.level_for(1, 1) == &pyramid.level(8);
+    if (!levels_right)
+    {
+        cout << "pyramid levels or level_for wrong" << endl;
+        correct = false;
+    }
+
+    // The cache: a hit while the file is unchanged, a new read once it changes, evictions over the limit
+    string small_file = "/tmp/pyramid_bench_" + to_string(getpid()) + "_small.bmp";
+    string large_file = "/tmp/pyramid_bench_" + to_string(getpid()) + ".bmp";
+    PyramidCache cache(DEFAULT_PYRAMID_CACHE_LIMIT);
+    Image small = test_image<Image>(300, 200, 5);
+    write_image(small_file, small);
+    shared_ptr<const Pyramid> first = cache.load(small_file);
+    shared_ptr<const Pyramid> second = cache.load(small_file);
+    small.pixel(0, 0)[0] ^= 0xFF;
+    sleep(1); // Let the modification time tick over on file systems with coarse times
+    write_image(small_file, small);
+    shared_ptr<const Pyramid> third = cache.load(small_file);
+    PyramidCacheStats stats = cache.stats();
+    if (!first || first != second || !third || third == first || !same_pixels(third->level(0), small)
+        || stats.hits != 1 || stats.misses != 2 || stats.evictions != 1 || stats.cached_bytes != third->size_bytes())
+    {
+        cout << "pyramid cache hits, misses or reloads wrong" << endl;
+        correct = false;
+    }
+    cache.set_limit(third->size_bytes() - 1);
+    if (cache.stats().cached_bytes != 0 || !cache.load(small_file) || cache.stats().cached_bytes != 0)
+    {
+        cout << "pyramid cache kept a pyramid over its limit" << endl;
+        correct = false;
+    }
+
+    // preview_image gives the level that fits, resized, through the operations
+    vector<Operation> operations;
+    Operation operation;
+    parse_operation("clarendon", operation);
+    operations.push_back(operation);
+    parse_operation("vignette", operation);
+    operations.push_back(operation);
+    Image preview;
+    correct = preview_image(small_file, 100, 0, operations, preview) && correct;
+    shared_ptr<const Pyramid> loaded = pyramid_cache().load(small_file);
+    int preview_width = 100, preview_height = 0;
+    resize_dimensions(small.width(), small.height(), preview_width, preview_height);
+    if (!same_pixels(preview, run_pipeline(resample(loaded->level(1), preview_width, preview_height, RESAMPLE_BILINEAR), operations)))
+    {
+        cout << "preview_image differs from the resized level" << endl;
+        correct = false;
+    }
+    unlink(small_file.c_str());
+
+    // Timings
+    cout << fixed << setprecision(1);
+    Image big = test_image<Image>(width, height, 11);
+    const char* const sets[] = { "scalar", "sse2", "avx2" };
+    cout << width << "x" << height << " image (" << setprecision(1) << width * static_cast<double>(height) / 1e6 << " megapixels)" << endl;
+    for (int s = 0; s < 3; s++)
+    {
+        if (select_kernels(sets[s]))
+        {
+            Image half;
+            double ms = time_ms([&]() { halve_image(big, half); }, 5);
+            cout << "  halve_image, " << left << setw(7) << sets[s] << right << setw(8) << ms << " ms "
+                 << setw(8) << big.row_bytes() * static_cast<double>(height) / 1e6 / ms * 1000 << " MB/s" << endl;
+        }
+    }
+    select_kernels("auto");
+    double ms = time_ms([&]() { Image copy = big; Pyramid levels(std::move(copy)); }, 3);
+    cout << "  pyramid of every level " << setw(9) << ms << " ms (with a copy of the image)" << endl;
+
+    write_image(large_file, big);
+    big = Image();
+    const int previews[][2] = { {1920, 1080}, {1024, 683}, {256, 171} };
+    cout << "  preview         full read + resize   first preview   cached preview" << endl;
+    for (int p = 0; p < 3; p++)
+    {
+        double full = time_ms([&]()
+        {
+            Image image;
+            read_image(large_file, image);
+            Image result = run_pipeline(resample(image, previews[p][0], previews[p][1], RESAMPLE_BILINEAR), operations);
+        }, 3);
+        pyramid_cache().clear();
+        double first_ms = time_ms([&]() { preview_image(large_file, previews[p][0], previews[p][1], operations, preview); }, 1);
+        double cached = time_ms([&]() { preview_image(large_file, previews[p][0], previews[p][1], operations, preview); }, 5);
+        cout << "  " << setw(4) << previews[p][0] << "x" << left << setw(4) << previews[p][1] << right << setw(18) << full
+             << " ms" << setw(14) << first_ms << " ms" << setw(14) << cached << " ms" << endl;
+    }
+    unlink(large_file.c_str());
+
+    cout << (correct ? "PASS" : "FAIL") << endl;
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// Measures read_image throughput in MB/s over the BMP files in a directory
+// and over large synthetic BMPs, both bottom-up and top-down.
+//
+// Usage: read_bench [directory]   (default: sample_images)
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Reads the file repeatedly for at least half a second and prints MB/s
+static void measure(const string& filename, const string& label)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+    {
+        return;
+    }
+
+    Image image;
+    read_image(filename, image); // Warm up the page cache
+
+    int reads = 0;
+    double elapsed = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (elapsed < 0.5 || reads < 3)
+    {
+        if (!read_image(filename, image))
+        {
+            cout << label << ": read failed" << endl;
+            return;
+        }
+        reads++;
+        elapsed = seconds_since(start);
+    }
+
+    double megabytes = static_cast<double>(info.st_size) * reads / 1e6;
+    cout << left << setw(40) << label << right << setw(6) << image.width() << "x" << left << setw(6) << image.height()
+         << right << setw(10) << fixed << setprecision(1) << megabytes / elapsed << " MB/s" << endl;
+}
+
+// Writes a synthetic BMP, optionally flipped to the top-down layout (negative height)
+static bool make_synthetic(const string& filename, int width, int height, bool top_down)
+{
+    Image image(width, height);
+    for (int i = 0; i < height; i++)
+    {
+        unsigned char* row = image.row(i);
+        for (size_t j = 0; j < image.row_bytes(); j++)
+        {
+            row[j] = static_cast<unsigned char>(i * 7 + j);
+        }
+    }
+    if (!write_image(filename, image))
+    {
+        return false;
+    }
+
+    if (top_down)
+    {
+        int fd = open(filename.c_str(), O_WRONLY);
+        unsigned char bytes[4];
+        int negative = -height;
+        for (int i = 0; i < 4; i++)
+        {
+            bytes[i] = static_cast<unsigned char>(negative >> (i * 8));
+        }
+        bool written = fd >= 0 && pwrite(fd, bytes, 4, 22) == 4;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return written;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    string directory = argc > 1 ? argv[1] : "sample_images";
+
+    glob_t files;
+    if (glob((directory + "/*.bmp").c_str(), 0, nullptr, &files) == 0)
+    {
+        for (size_t i = 0; i < files.gl_pathc; i++)
+        {
+            measure(files.gl_pathv[i], files.gl_pathv[i]);
+        }
+        globfree(&files);
+    }
+
+    const int sizes[][2] = { {4000, 3000}, {8000, 6000}, {4001, 3001} };
+    for (int i = 0; i < 3; i++)
+    {
+        for (int top_down = 0; top_down < 2; top_down++)
+        {
+            string filename = "/tmp/read_bench.bmp";
+            string label = string("synthetic ") + (top_down ? "top-down" : "bottom-up");
+            if (make_synthetic(filename, sizes[i][0], sizes[i][1], top_down))
+            {
+                measure(filename, label);
+            }
+            unlink(filename.c_str());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,259 @@
+// Checks the resampler: process_6 against the original per-pixel
+// enlargement, the SIMD resampling kernels against the scalar ones (the
+// bytes must match), flat images staying flat, and the fixed-point
+// filters against the same filters in double precision, and shrinks by
+// thousands of times averaging stripes correctly. Then times
+// thumbnails, an upscale and process_6.
+//
+// Usage: resample_bench [width height]    (default 6000 4000)
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "image.h"
+#include "kernels.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// process_6 before row replication
+static Image original_enlarge(const Image& image, int x_scale, int y_scale)
+{
+    Image result(image.width() * x_scale, image.height() * y_scale);
+    for (int i = 0; i < result.height(); i++)
+    {
+        unsigned char* out = result.row(i);
+        for (int j = 0; j < result.width(); j++)
+        {
+            const unsigned char* in = image.pixel(i / y_scale, j / x_scale);
+            out[3 * j] = in[0];
+            out[3 * j + 1] = in[1];
+            out[3 * j + 2] = in[2];
+        }
+    }
+    return result;
+}
+
+static double filter_value(ResampleFilter filter, double x)
+{
+    if (filter == RESAMPLE_BOX)
+    {
+        return x >= -0.5 && x < 0.5 ? 1 : 0;
+    }
+    if (filter == RESAMPLE_BILINEAR)
+    {
+        return fabs(x) < 1 ? 1 - fabs(x) : 0;
+    }
+    if (x == 0)
+    {
+        return 1;
+    }
+    if (x <= -3 || x >= 3)
+    {
+        return 0;
+    }
+    return sin(M_PI * x) / (M_PI * x) * sin(M_PI * x / 3) / (M_PI * x / 3);
+}
+
+// One pass of the same filter in double precision along rows (vertical) or columns, rounded to bytes
+static Image reference_pass(const Image& image, int size, ResampleFilter filter, bool vertical)
+{
+    int in_size = vertical ? image.height() : image.width();
+    Image result(vertical ? image.width() : size, vertical ? size : image.height());
+    double scale = static_cast<double>(in_size) / size;
+    double filter_scale = max(scale, 1.0);
+    double support = (filter == RESAMPLE_BOX ? 0.5 : filter == RESAMPLE_BILINEAR ? 1 : 3) * filter_scale;
+
+    for (int o = 0; o < size; o++)
+    {
+        double center = (o + 0.5) * scale;
+        int first = max(static_cast<int>(center - support + 0.5), 0);
+        int last = min(static_cast<int>(center + support + 0.5), in_size);
+        last = max(last, first + 1);
+        vector<double> weights;
+        double total = 0;
+        for (int k = first; k < last; k++)
+        {
+            weights.push_back(filter_value(filter, (k - center + 0.5) / filter_scale));
+            total += weights.back();
+        }
+
+        int lines = vertical ? result.width() : result.height();
+        for (int l = 0; l < lines; l++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                double sum = 0;
+                for (int k = first; k < last; k++)
+                {
+                    const unsigned char* pixel = vertical ? image.pixel(k, l) : image.pixel(l, k);
+                    sum += weights[k - first] / total * pixel[c];
+                }
+                unsigned char* out = vertical ? result.pixel(o, l) : result.pixel(l, o);
+                out[c] = static_cast<unsigned char>(min(255.0, max(0.0, floor(sum + 0.5))));
+            }
+        }
+    }
+    return result;
+}
+
+// Largest difference between two images' values
+static int max_difference(const Image& a, const Image& b)
+{
+    int largest = 0;
+    for (int i = 0; i < a.height(); i++)
+    {
+        for (size_t j = 0; j < a.row_bytes(); j++)
+        {
+            largest = max(largest, abs(a.row(i)[j] - b.row(i)[j]));
+        }
+    }
+    return largest;
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 6000;
+    int height = argc > 2 ? atoi(argv[2]) : 4000;
+    bool correct = true;
+
+    // process_6 must match the original enlargement exactly
+    const int enlarge_sizes[][4] = { {1, 1, 1, 1}, {333, 217, 2, 3}, {401, 61, 3, 2}, {7, 130, 5, 1}, {64, 48, 4, 4}, {17, 9, 1, 7} };
+    for (size_t s = 0; s < sizeof(enlarge_sizes) / sizeof(enlarge_sizes[0]); s++)
+    {
+        const int* e = enlarge_sizes[s];
+        Image image = test_image(e[0], e[1]);
+        if (!same_pixels(process_6(image, e[2], e[3]), original_enlarge(image, e[2], e[3])))
+        {
+            cout << "process_6 differs from the original at " << e[0] << "x" << e[1] << " by " << e[2] << "x" << e[3] << endl;
+            correct = false;
+        }
+    }
+
+    // Every set of kernels gives the same bytes, flat images stay flat, and the fixed-point result is close to double precision
+    const int resize_sizes[][4] = {
+        {333, 217, 100, 66}, {401, 61, 1003, 150}, {7, 130, 3, 400}, {1, 1, 5, 3}, {640, 480, 64, 48}, {97, 89, 96, 90}, {50, 40, 50, 13}
+    };
+    const char* const kernel_sets[] = { "sse2", "avx2" };
+    cout << "largest difference from double precision:" << endl;
+    for (int f = RESAMPLE_BOX; f <= RESAMPLE_LANCZOS3; f++)
+    {
+        ResampleFilter filter = static_cast<ResampleFilter>(f);
+        int worst = 0;
+        for (size_t s = 0; s < sizeof(resize_sizes) / sizeof(resize_sizes[0]); s++)
+        {
+            const int* r = resize_sizes[s];
+            Image image = test_image(r[0], r[1]);
+            select_kernels("scalar");
+            Image expected = resample(image, r[2], r[3], filter);
+            for (int k = 0; k < 2; k++)
+            {
+                if (select_kernels(kernel_sets[k]) && !same_pixels(resample(image, r[2], r[3], filter), expected))
+                {
+                    cout << kernel_sets[k] << " " << resample_filter_name(filter) << " differs from scalar at "
+                         << r[0] << "x" << r[1] << " to " << r[2] << "x" << r[3] << endl;
+                    correct = false;
+                }
+            }
+            select_kernels("auto");
+
+            Image reference = image;
+            if (r[3] != r[1])
+            {
+                reference = reference_pass(reference, r[3], filter, true);
+            }
+            if (r[2] != r[0])
+            {
+                reference = reference_pass(reference, r[2], filter, false);
+            }
+            worst = max(worst, max_difference(expected, reference));
+
+            Image flat(r[0], r[1]);
+            for (int i = 0; i < flat.height(); i++)
+            {
+                memset(flat.row(i), 200, flat.row_bytes());
+            }
+            Image resized = resample(flat, r[2], r[3], filter);
+            for (int i = 0; i < resized.height(); i++)
+            {
+                for (size_t j = 0; j < resized.row_bytes(); j++)
+                {
+                    if (resized.row(i)[j] != 200)
+                    {
+                        cout << resample_filter_name(filter) << " changes a flat image at " << r[0] << "x" << r[1] << endl;
+                        correct = false;
+                        i = resized.height();
+                        break;
+                    }
+                }
+            }
+        }
+        cout << "  " << left << setw(9) << resample_filter_name(filter) << right << worst << endl;
+        correct = correct && worst <= 2;
+    }
+
+    // Large shrinks of 0/200 stripes along each axis average to 100 with every filter
+    const int stripe_sizes[] = { 4000, 20000, 40000 };
+    for (size_t s = 0; s < sizeof(stripe_sizes) / sizeof(stripe_sizes[0]); s++)
+    {
+        for (int vertical = 0; vertical < 2; vertical++)
+        {
+            int size = stripe_sizes[s];
+            Image stripes(vertical ? 3 : size, vertical ? size : 3);
+            for (int i = 0; i < stripes.height(); i++)
+            {
+                for (int j = 0; j < stripes.width(); j++)
+                {
+                    memset(stripes.pixel(i, j), ((vertical ? i : j) % 2) * 200, Image::CHANNELS);
+                }
+            }
+            for (int f = RESAMPLE_BOX; f <= RESAMPLE_LANCZOS3; f++)
+            {
+                ResampleFilter filter = static_cast<ResampleFilter>(f);
+                Image shrunk = resample(stripes, 1, 1, filter);
+                if (abs(shrunk.pixel(0, 0)[0] - 100) > 1)
+                {
+                    cout << resample_filter_name(filter) << " shrinks " << stripes.width() << "x" << stripes.height()
+                         << " stripes to " << static_cast<int>(shrunk.pixel(0, 0)[0]) << ", not 100" << endl;
+                    correct = false;
+                }
+            }
+        }
+    }
+
+    Image image = test_image(width, height);
+    Image result;
+    cout << fixed << setprecision(1);
+    cout << width << "x" << height << " image, " << active_kernels().name << " kernels" << endl;
+    int thumb_width = max(1, width / 15);
+    int thumb_height = max(1, height / 15);
+    for (int f = RESAMPLE_NEAREST; f <= RESAMPLE_LANCZOS3; f++)
+    {
+        ResampleFilter filter = static_cast<ResampleFilter>(f);
+        double ms = time_ms([&] { result = resample(image, thumb_width, thumb_height, filter); }, 5);
+        cout << "thumbnail " << thumb_width << "x" << thumb_height << ", " << left << setw(9) << resample_filter_name(filter)
+             << right << setw(9) << ms << " ms" << endl;
+    }
+
+    Image part = test_image(min(width, 1500), min(height, 1000));
+    double upscale_ms = time_ms([&] { result = resample(part, part.width() * 3 / 2, part.height() * 3 / 2, RESAMPLE_LANCZOS3); }, 5);
+    cout << "upscale " << part.width() << "x" << part.height() << " by 1.5, lanczos" << setw(9) << upscale_ms << " ms" << endl;
+
+    select_kernels("scalar");
+    double scalar_ms = time_ms([&] { result = resample(image, thumb_width, thumb_height, RESAMPLE_LANCZOS3); }, 3);
+    select_kernels("auto");
+    cout << "thumbnail, lanczos, scalar kernels" << setw(9) << scalar_ms << " ms" << endl;
+
+    double original_ms = time_ms([&] { result = original_enlarge(part, 2, 2); }, 5);
+    double enlarge_ms = time_ms([&] { result = process_6(part, 2, 2); }, 5);
+    cout << "process_6 2x2 of " << part.width() << "x" << part.height() << ": original" << setw(8) << original_ms
+         << " ms, row replication" << setw(8) << enlarge_ms << " ms" << endl;
+
+    cout << (correct ? "all checks passed" : "CHECKS FAILED") << endl;
+    return correct ? 0 : 1;
+}
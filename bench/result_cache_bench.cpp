@@ -0,0 +1,314 @@
+// Checks and times the result cache: Hash64 against the reference XXH64
+// values, however the bytes are split between updates; keys that change
+// with the pixels, operations and output format but not with the input's
+// file name; least recently used eviction under the limit, kept across
+// reopening the directory; and hard linked outputs that are replaced, not
+// written through. Then the same batch runs without a cache, filling one,
+// and served from it by copying and by hard links, and the outputs must
+// match byte for byte.
+//
+// Usage: result_cache_bench [files [width height]]    (default 24 files of 1920 x 1080)
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "image.h"
+#include "batch.h"
+#include "hash.h"
+#include "result_cache.h"
+#include "bench_util.h"
+
+using namespace std;
+
+static string file_contents(const string& filename)
+{
+    ifstream file(filename.c_str(), ios::binary);
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static bool exists(const string& filename)
+{
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0;
+}
+
+static vector<Operation> parse_chain(const char* const* names, int count)
+{
+    vector<Operation> operations;
+    for (int n = 0; n < count; n++)
+    {
+        Operation operation;
+        parse_operation(names[n], operation);
+        operations.push_back(operation);
+    }
+    return operations;
+}
+
+// Deletes the files in a directory, then the directory
+static void remove_directory(const string& directory)
+{
+    DIR* opened = opendir(directory.c_str());
+    for (struct dirent* item = opened ? readdir(opened) : nullptr; item != nullptr; item = readdir(opened))
+    {
+        if (string(item->d_name) != "." && string(item->d_name) != "..")
+        {
+            unlink((directory + "/" + item->d_name).c_str());
+        }
+    }
+    if (opened != nullptr)
+    {
+        closedir(opened);
+    }
+    rmdir(directory.c_str());
+}
+
+// The reference XXH64 values, and the same hashes of longer input fed in pieces of every size from 1 to 40 bytes
+static bool check_hash()
+{
+    struct Vector
+    {
+        const char* text;
+        uint64_t seed;
+        uint64_t expected;
+    };
+    const Vector vectors[] = {
+        {"", 0, 0xEF46DB3751D8E999ULL},
+        {"a", 0, 0xD24EC4F1A98C6E5BULL},
+        {"abc", 0, 0x44BC2CF5AD770999ULL},
+    };
+    bool correct = true;
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++)
+    {
+        uint64_t hash = hash64(vectors[v].text, string(vectors[v].text).size(), vectors[v].seed);
+        if (hash != vectors[v].expected)
+        {
+            cout << "XXH64(\"" << vectors[v].text << "\") = " << hex << hash << ", expected " << vectors[v].expected
+                 << dec << endl;
+            correct = false;
+        }
+    }
+
+    vector<unsigned char> bytes(1000);
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        bytes[i] = static_cast<unsigned char>(i * 7 + (i >> 3));
+    }
+    uint64_t whole = hash64(bytes.data(), bytes.size(), 42);
+    for (size_t piece = 1; piece <= 40; piece++)
+    {
+        Hash64 hash(42);
+        for (size_t i = 0; i < bytes.size(); i += piece)
+        {
+            hash.update(bytes.data() + i, min(piece, bytes.size() - i));
+        }
+        if (hash.digest() != whole)
+        {
+            cout << "Hashing in pieces of " << piece << " bytes gives a different hash" << endl;
+            correct = false;
+        }
+    }
+    return correct;
+}
+
+// Keys depend on exactly the pixels, the operations and their parameters, and the output's format
+static bool check_keys(const string& directory)
+{
+    const char* const blur[] = { "blur=2" };
+    const char* const wider[] = { "blur=3" };
+    const char* const vignette[] = { "vignette" };
+    Image image = test_image(64, 48, 1);
+    Image other = image;
+    other.pixel(10, 10)[1] ^= 1;
+    string bmp = directory + "/key.bmp";
+    string ppm = directory + "/key.ppm";
+    write_image(ppm, image);
+    Image from_ppm;
+    read_image(ppm, from_ppm);
+    unlink(ppm.c_str());
+
+    string key = result_key(image, parse_chain(blur, 1), bmp);
+    bool correct = key.size() == 16 && result_key(from_ppm, parse_chain(blur, 1), bmp) == key
+                   && result_key(image, parse_chain(blur, 1), directory + "/other_name.bmp") == key
+                   && result_key(other, parse_chain(blur, 1), bmp) != key
+                   && result_key(image, parse_chain(wider, 1), bmp) != key
+                   && result_key(image, parse_chain(vignette, 1), bmp) != key
+                   && result_key(image, parse_chain(blur, 1), ppm) != key
+                   && result_key(image, parse_chain(blur, 1), "-") == "";
+    if (!correct)
+    {
+        cout << "Result keys do not follow the pixels, operations and output format" << endl;
+    }
+    return correct;
+}
+
+// With room for two results, storing a third drops the least recently used; a hit counts as a use, and the order
+// survives reopening the directory
+static bool check_eviction(const string& directory)
+{
+    const char* const blur[] = { "blur=1" };
+    vector<Operation> operations = parse_chain(blur, 1);
+    string cache_dir = directory + "/lru";
+    vector<string> outputs, keys;
+    for (int i = 0; i < 3; i++)
+    {
+        Image image = test_image(100, 100, 11 + i);
+        outputs.push_back(directory + "/lru_" + to_string(i) + ".bmp");
+        keys.push_back(result_key(image, operations, outputs[i]));
+        write_image(outputs[i], run_pipeline(move(image), operations));
+    }
+    size_t size = file_contents(outputs[0]).size();
+    bool correct = true;
+    {
+        ResultCache cache(cache_dir, 2 * size + size / 2);
+        cache.store(keys[0], outputs[0]);
+        usleep(10000); // Distinct modification times
+        cache.store(keys[1], outputs[1]);
+        usleep(10000);
+        correct = cache.fetch(keys[0], directory + "/lru_hit.bmp"); // 1 is now the least recently used
+        usleep(10000);
+        cache.store(keys[2], outputs[2]);
+        ResultCacheStats stats = cache.stats();
+        correct = correct && stats.hits == 1 && stats.stores == 3 && stats.evictions == 1 && stats.entries == 2
+                  && stats.cached_bytes == 2 * size && !exists(cache_dir + "/" + keys[1])
+                  && file_contents(directory + "/lru_hit.bmp") == file_contents(outputs[0]);
+    }
+    {
+        ResultCache reopened(cache_dir, size + size / 2); // Room for one: keeps 2, the most recently used
+        correct = correct && reopened.stats().entries == 1 && reopened.stats().evictions == 1
+                  && !reopened.fetch(keys[0], directory + "/lru_hit.bmp") && !reopened.fetch(keys[1], directory + "/lru_hit.bmp")
+                  && reopened.fetch(keys[2], directory + "/lru_hit.bmp") && reopened.stats().misses == 2;
+    }
+    if (!correct)
+    {
+        cout << "The cache did not drop the least recently used results" << endl;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        unlink(outputs[i].c_str());
+    }
+    unlink((directory + "/lru_hit.bmp").c_str());
+    remove_directory(cache_dir);
+    return correct;
+}
+
+// An output hard linked to a cached result is replaced when it is written again, leaving the result as it was
+static bool check_links(const string& directory)
+{
+    const char* const blur[] = { "blur=1" };
+    vector<Operation> operations = parse_chain(blur, 1);
+    string cache_dir = directory + "/links";
+    string output = directory + "/linked.bmp";
+    Image image = test_image(80, 60, 21);
+    string key = result_key(image, operations, output);
+    write_image(output, run_pipeline(move(image), operations));
+    string result = file_contents(output);
+
+    ResultCache cache(cache_dir, DEFAULT_RESULT_CACHE_LIMIT, true);
+    cache.store(key, output);
+    struct stat linked, cached;
+    bool correct = cache.fetch(key, output) && stat(output.c_str(), &linked) == 0
+                   && stat((cache_dir + "/" + key).c_str(), &cached) == 0 && linked.st_ino == cached.st_ino;
+    release_output(output);
+    write_image(output, test_image(80, 60, 22));
+    correct = correct && file_contents(cache_dir + "/" + key) == result;
+    if (!correct)
+    {
+        cout << "A hard linked output was not replaced apart from its cached result" << endl;
+    }
+    unlink(output.c_str());
+    remove_directory(cache_dir);
+    return correct;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 24;
+    int width = argc > 3 ? atoi(argv[2]) : 1920;
+    int height = argc > 3 ? atoi(argv[3]) : 1080;
+
+    string directory = "/tmp/result_cache_bench_" + to_string(getpid());
+    mkdir(directory.c_str(), 0777);
+    bool correct = check_hash();
+    correct = check_keys(directory) && correct;
+    correct = check_eviction(directory) && correct;
+    correct = check_links(directory) && correct;
+
+    vector<string> inputs;
+    for (int i = 0; i < count; i++)
+    {
+        string name = directory + "/in_" + to_string(1000 + i) + ".bmp";
+        write_image(name, test_image(width, height, 7 + i));
+        inputs.push_back(name);
+    }
+    cout << count << " files of " << width << "x" << height << endl;
+
+    // Hashing alone, the cost a hit adds to reading
+    Image sample = test_image(width, height, 3);
+    const char* const names[] = { "clarendon", "gaussian=2", "vignette" };
+    vector<Operation> operations = parse_chain(names, 3);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    result_key(sample, operations, inputs[0]);
+    double hash_seconds = seconds_since(start);
+    cout << "  hash " << fixed << setprecision(2) << hash_seconds * 1e3 << " ms per image, "
+         << sample.row_bytes() * sample.height() / 1e9 / max(hash_seconds, 1e-9) << " GB/s" << endl;
+
+    // The same batch without a cache, filling one, then served from it by copying and by linking
+    struct Mode
+    {
+        const char* name;
+        bool cache;
+        bool link;
+        int hits;
+    };
+    const Mode modes[] = { {"none", false, false, 0}, {"cold", true, false, 0}, {"copy", true, false, count},
+                           {"link", true, true, count} };
+    string cache_dir = directory + "/cache";
+    vector<string> reference;
+    cout << "  cache     wall s   filter s   images/s" << endl;
+    for (int m = 0; m < 4; m++)
+    {
+        ResultCache cache(cache_dir, DEFAULT_RESULT_CACHE_LIMIT, modes[m].link);
+        string output_dir = directory + "/out_" + modes[m].name;
+        BatchSummary summary = run_batch(inputs, output_dir, operations, BATCH_QUEUE_DEPTH, BATCH_PREFETCH_DEPTH, true,
+                                         modes[m].cache ? &cache : nullptr);
+        cout << "  " << left << setw(6) << modes[m].name << right << setprecision(2) << setw(10) << summary.seconds
+             << setw(11) << summary.filter_seconds << setw(11) << setprecision(1)
+             << summary.images / max(summary.seconds, 1e-9) << endl;
+        if (summary.images != count || summary.failed != 0 || summary.cached != modes[m].hits)
+        {
+            cout << modes[m].name << ": " << summary.images << " images written (" << summary.cached << " from the cache), "
+                 << summary.failed << " failed" << endl;
+            correct = false;
+        }
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            string output = output_dir + "/in_" + to_string(1000 + i) + ".bmp";
+            string contents = file_contents(output);
+            if (m == 0)
+            {
+                reference.push_back(contents);
+            }
+            else if (contents != reference[i])
+            {
+                cout << modes[m].name << ": " << output << " differs from the run without a cache" << endl;
+                correct = false;
+            }
+        }
+        remove_directory(output_dir);
+    }
+
+    remove_directory(cache_dir);
+    remove_directory(directory);
+
+    cout << (correct ? "PASS" : "FAIL") << endl;
+    return correct ? 0 : 1;
+}
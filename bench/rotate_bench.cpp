@@ -0,0 +1,170 @@
+// Checks every rotation, flip and transpose against a pixel-by-pixel
+// reference on awkward sizes, then compares the old way of rotating by
+// 270 degrees (three per-pixel quarter turns, as process_5(image, 3) used
+// to do) with the direct tiled rotate_270, and times the other transforms.
+//
+// Usage: rotate_bench [width height]    (default 8000 6000)
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "image_buffer.h"
+#include "transform.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// The per-pixel quarter turn that process_4 used before the tiled kernels
+static Image legacy_rotate_90(const Image& image)
+{
+    int height = image.height();
+    int width = image.width();
+    Image result(height, width);
+
+    for (int x = 0; x < height; x++)
+    {
+        for (int y = 0; y < width; y++)
+        {
+            const unsigned char* in = image.pixel(x, y);
+            unsigned char* out = result.pixel(width - 1 - y, x);
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+        }
+    }
+    return result;
+}
+
+// process_5(image, 3) before the direct kernels
+static Image legacy_rotate_270(const Image& image)
+{
+    return legacy_rotate_90(legacy_rotate_90(legacy_rotate_90(image)));
+}
+
+// Where each transform takes result pixel (y, x) from, for a width x height source
+enum Transform { ROTATE_90, ROTATE_180, ROTATE_270, TRANSPOSE, FLIP_H, FLIP_V };
+
+static void source_of(Transform t, int width, int height, int y, int x, int& sy, int& sx)
+{
+    switch (t)
+    {
+        case ROTATE_90 : sy = x; sx = width - 1 - y; break;
+        case ROTATE_180 : sy = height - 1 - y; sx = width - 1 - x; break;
+        case ROTATE_270 : sy = height - 1 - x; sx = y; break;
+        case TRANSPOSE : sy = x; sx = y; break;
+        case FLIP_H : sy = y; sx = width - 1 - x; break;
+        case FLIP_V : sy = height - 1 - y; sx = x; break;
+    }
+}
+
+static bool matches(Transform t, const Image& source, const Image& result)
+{
+    bool swapped = t == ROTATE_90 || t == ROTATE_270 || t == TRANSPOSE;
+    if (result.width() != (swapped ? source.height() : source.width())
+        || result.height() != (swapped ? source.width() : source.height()))
+    {
+        return false;
+    }
+    for (int y = 0; y < result.height(); y++)
+    {
+        for (int x = 0; x < result.width(); x++)
+        {
+            int sy, sx;
+            source_of(t, source.width(), source.height(), y, x, sy, sx);
+            if (memcmp(result.pixel(y, x), source.pixel(sy, sx), Image::CHANNELS) != 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Checks every transform, out of place and in place, on sizes around the tile size
+static int check_all()
+{
+    const int sizes[][2] = { {1, 1}, {1, 7}, {7, 1}, {31, 33}, {32, 32}, {64, 65}, {333, 217}, {97, 401} };
+    int failures = 0;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        Image source = noise_image(sizes[s][0], sizes[s][1], s * 2654435761u + 1);
+        Image results[] = {
+            rotate_90(source), rotate_180(source), rotate_270(source),
+            transpose(source), flip_horizontal(source), flip_vertical(source)
+        };
+        for (int t = 0; t < 6; t++)
+        {
+            failures += !matches(static_cast<Transform>(t), source, results[t]);
+        }
+        failures += !same_pixels(results[ROTATE_90], legacy_rotate_90(source));
+
+        Image in_place = source;
+        rotate_180_inplace(in_place);
+        failures += !same_pixels(in_place, results[ROTATE_180]);
+        in_place = source;
+        flip_horizontal_inplace(in_place);
+        failures += !same_pixels(in_place, results[FLIP_H]);
+        in_place = source;
+        flip_vertical_inplace(in_place);
+        failures += !same_pixels(in_place, results[FLIP_V]);
+    }
+    return failures;
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 8000;
+    int height = argc > 2 ? atoi(argv[2]) : 6000;
+
+    int failures = check_all();
+    cout << "exactness: " << (failures == 0 ? "all transforms match the per-pixel reference" : "MISMATCH") << endl;
+
+    Image image = noise_image(width, height, 42 * 2654435761u + 1);
+    Image result;
+    double megapixels = width * static_cast<double>(height) / 1e6;
+
+    cout << width << "x" << height << " image" << endl;
+    cout << left << setw(32) << "transform" << right << setw(10) << "ms" << setw(10) << "MP/s" << endl;
+    cout << fixed << setprecision(1);
+
+    Image legacy = legacy_rotate_270(image);
+    double legacy_ms = time_ms([&] { result = legacy_rotate_270(image); }, 3);
+    cout << left << setw(32) << "3x per-pixel rotate (old 270)" << right << setw(10) << legacy_ms << setw(10) << megapixels / legacy_ms * 1000 << endl;
+
+    double direct_ms = time_ms([&] { result = rotate_270(image); }, 5);
+    cout << left << setw(32) << "rotate_270 (tiled)" << right << setw(10) << direct_ms << setw(10) << megapixels / direct_ms * 1000 << endl;
+    if (!same_pixels(legacy, result))
+    {
+        failures++;
+        cout << "rotate_270 differs from three per-pixel quarter turns" << endl;
+    }
+    cout << "speedup: " << setprecision(2) << legacy_ms / direct_ms << "x" << setprecision(1) << endl;
+
+    struct { const char* name; Image (*run)(const Image&); } others[] = {
+        { "rotate_90", rotate_90 }, { "rotate_180", rotate_180 }, { "transpose", transpose },
+        { "flip_horizontal", flip_horizontal }, { "flip_vertical", flip_vertical }
+    };
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++)
+    {
+        double ms = time_ms([&] { result = others[i].run(image); }, 5);
+        cout << left << setw(32) << others[i].name << right << setw(10) << ms << setw(10) << megapixels / ms * 1000 << endl;
+    }
+
+    struct { const char* name; void (*run)(Image&); } in_place[] = {
+        { "rotate_180_inplace", rotate_180_inplace }, { "flip_horizontal_inplace", flip_horizontal_inplace },
+        { "flip_vertical_inplace", flip_vertical_inplace }
+    };
+    result = image;
+    for (size_t i = 0; i < sizeof(in_place) / sizeof(in_place[0]); i++)
+    {
+        double ms = time_ms([&] { in_place[i].run(result); }, 5);
+        cout << left << setw(32) << in_place[i].name << right << setw(10) << ms << setw(10) << megapixels / ms * 1000 << endl;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
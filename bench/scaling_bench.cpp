@@ -0,0 +1,82 @@
+// Reports how the per-pixel filters scale with the number of threads and
+// checks that every thread count produces the same bytes as one thread.
+//
+// Usage: scaling_bench [megapixels]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "image.h"
+#include "thread_pool.h"
+#include "bench_util.h"
+
+using namespace std;
+
+struct Filter
+{
+    const char* name;
+    Image (*run)(const Image&);
+};
+
+static Image lighten(const Image& image) { return process_8(image, 0.5); }
+static Image darken(const Image& image) { return process_9(image, 0.5); }
+
+// Median time in seconds of several runs of the filter
+static double time_filter(const Filter& filter, const Image& image, Image& output)
+{
+    return time_ms([&]() { output = filter.run(image); }, 5) / 1000;
+}
+
+int main(int argc, char* argv[])
+{
+    double megapixels = argc > 1 ? atof(argv[1]) : 24.0;
+    int width = 6000;
+    int height = max(1, static_cast<int>(megapixels * 1e6 / width));
+
+    Image image = noise_image(width, height);
+
+    const Filter filters[] = {
+        { "process_1", process_1 }, { "process_2", process_2 }, { "process_3", process_3 },
+        { "process_7", process_7 }, { "process_8", lighten }, { "process_9", darken },
+        { "process_10", process_10 },
+    };
+    const int thread_counts[] = { 1, 2, 4, 8, 16, 32 };
+
+    cout << width << "x" << height << " image; speedup over 1 thread (ms at 1 thread)" << endl;
+    cout << left << setw(12) << "filter" << right << setw(10) << "1 (ms)";
+    for (int t = 1; t < 6; t++)
+    {
+        cout << setw(8) << thread_counts[t];
+    }
+    cout << endl;
+
+    for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++)
+    {
+        Image serial, output;
+        double base = 0;
+        cout << left << setw(12) << filters[f].name << right << fixed;
+        for (int t = 0; t < 6; t++)
+        {
+            set_thread_count(thread_counts[t]);
+            double elapsed = time_filter(filters[f], image, output);
+            if (t == 0)
+            {
+                base = elapsed;
+                serial = output;
+                cout << setw(10) << setprecision(1) << elapsed * 1000;
+            }
+            else
+            {
+                cout << setw(7) << setprecision(2) << base / elapsed << (same_pixels(serial, output) ? "x" : "!");
+            }
+        }
+        cout << endl;
+    }
+    cout << "(! marks output that differs from the 1-thread result)" << endl;
+    return 0;
+}
@@ -0,0 +1,460 @@
+// The benchmark suite run by 'make bench': times read_image, write_image
+// and every process_N on synthetic images from VGA up to 50 megapixels,
+// with warm-up runs and repetitions, and reports the median and 99th
+// percentile time, nanoseconds per pixel and GB/s of each. Results can be
+// saved as JSON and compared against the results of another build, so a
+// slowdown is caught before the new build is deployed.
+//
+// Usage: suite [options] [RESULTS.json]
+//   --sizes=LIST     Comma-separated sizes to run: vga, hd, 12mp, 24mp,
+//                    50mp or WIDTHxHEIGHT (default: all five names)
+//   --only=TEXT      Run only the cases whose name contains TEXT
+//   --warmup=N       Untimed runs before the timed ones (default 1)
+//   --reps=N         Fewest timed runs of each case (default 5)
+//   --time=SECONDS   Keep repeating a case until this much time is spent,
+//                    up to 200 runs (default 1)
+//   --dir=DIR        Where the synthetic BMP files are written (default /tmp)
+//   --label=TEXT     Name of this build in the JSON output
+//   --json=FILE      Write the results as JSON to FILE ('-' for stdout, which
+//                    moves the table of timings to stderr)
+//   --compare=BASE   Compare the results with those in BASE, a JSON file
+//                    from an earlier run, and exit with status 1 if any
+//                    median is more than the threshold slower
+//   --threshold=PCT  Slowdown that counts as a regression (default 10)
+//
+// Given a RESULTS.json file instead of running anything, the suite loads
+// it, which compares two saved runs:  suite --compare=old.json new.json
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "histogram.h"
+#include "kernels.h"
+#include "thread_pool.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// Most timed runs of one case, however fast it is
+const int MAX_REPS = 200;
+
+// Where the table of timings goes; stderr when the JSON goes to stdout
+static ostream* report = &cout;
+
+struct Size
+{
+    string name;
+    int width;
+    int height;
+};
+
+struct Options
+{
+    vector<Size> sizes;
+    string only;
+    int warmup;
+    int reps;
+    double seconds;
+    string dir;
+    string label;
+    string json;
+    string compare;
+    double threshold;
+    string load;
+};
+
+// The timings of one case on one image size
+struct Result
+{
+    string name;        // Case name, e.g. "process_3"
+    string size;        // Size name, e.g. "12mp"
+    int width;
+    int height;
+    int reps;           // Timed runs
+    double median_ms;
+    double p99_ms;
+    double ns_per_pixel; // Median time per source pixel
+    double gb_per_s;     // Bytes read and written per second at the median time
+};
+
+static bool parse_size(const string& text, Size& size)
+{
+    static const Size named[] = {
+        {"vga", 640, 480}, {"hd", 1920, 1080}, {"12mp", 4000, 3000}, {"24mp", 6000, 4000}, {"50mp", 8660, 5774}
+    };
+    for (size_t i = 0; i < sizeof(named) / sizeof(named[0]); i++)
+    {
+        if (text == named[i].name)
+        {
+            size = named[i];
+            return true;
+        }
+    }
+    char separator;
+    istringstream in(text);
+    if (in >> size.width >> separator >> size.height && separator == 'x' && in.eof() && size.width > 0 && size.height > 0)
+    {
+        size.name = text;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_options(int argc, char* argv[], Options& options)
+{
+    options.warmup = 1;
+    options.reps = 5;
+    options.seconds = 1;
+    options.dir = "/tmp";
+    options.threshold = 10;
+    string sizes = "vga,hd,12mp,24mp,50mp";
+
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        size_t equals = argument.find('=');
+        string key = argument.substr(0, equals);
+        string value = equals == string::npos ? "" : argument.substr(equals + 1);
+
+        if (argument.compare(0, 2, "--") != 0)
+        {
+            options.load = argument;
+        }
+        else if (key == "--sizes") sizes = value;
+        else if (key == "--only") options.only = value;
+        else if (key == "--warmup") options.warmup = max(0, atoi(value.c_str()));
+        else if (key == "--reps") options.reps = max(1, atoi(value.c_str()));
+        else if (key == "--time") options.seconds = atof(value.c_str());
+        else if (key == "--dir") options.dir = value;
+        else if (key == "--label") options.label = value;
+        else if (key == "--json") options.json = value;
+        else if (key == "--compare") options.compare = value;
+        else if (key == "--threshold") options.threshold = atof(value.c_str());
+        else
+        {
+            cerr << "Unknown option " << argument << endl;
+            return false;
+        }
+    }
+
+    istringstream list(sizes);
+    string item;
+    while (getline(list, item, ','))
+    {
+        Size size;
+        if (!parse_size(item, size))
+        {
+            cerr << "Unknown size " << item << endl;
+            return false;
+        }
+        options.sizes.push_back(size);
+    }
+    return true;
+}
+
+static size_t file_size(const string& filename)
+{
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 ? info.st_size : 0;
+}
+
+// Nearest-rank percentile of sorted times
+static double percentile(const vector<double>& sorted, double fraction)
+{
+    size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+/**
+ * Times one case: options.warmup untimed runs, then timed runs until there
+ * are at least options.reps of them and options.seconds have passed.
+ * @param bytes Bytes read plus bytes written by one run
+ * @return False if a run failed
+ */
+static bool time_case(const Options& options, const string& name, const Size& size, double bytes,
+                      const function<bool()>& run, vector<Result>& results)
+{
+    if (!options.only.empty() && name.find(options.only) == string::npos)
+    {
+        return true;
+    }
+
+    for (int i = 0; i < options.warmup; i++)
+    {
+        if (!run())
+        {
+            cerr << name << " failed on " << size.name << endl;
+            return false;
+        }
+    }
+
+    vector<double> times;
+    double total = 0;
+    while (static_cast<int>(times.size()) < options.reps || (total < options.seconds && times.size() < MAX_REPS))
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool succeeded = run();
+        double seconds = seconds_since(start);
+        if (!succeeded)
+        {
+            cerr << name << " failed on " << size.name << endl;
+            return false;
+        }
+        times.push_back(seconds * 1000);
+        total += seconds;
+    }
+    sort(times.begin(), times.end());
+
+    Result result;
+    result.name = name;
+    result.size = size.name;
+    result.width = size.width;
+    result.height = size.height;
+    result.reps = static_cast<int>(times.size());
+    result.median_ms = percentile(times, 0.5);
+    result.p99_ms = percentile(times, 0.99);
+    result.ns_per_pixel = result.median_ms * 1e6 / (static_cast<double>(size.width) * size.height);
+    result.gb_per_s = bytes / (result.median_ms * 1e6);
+    results.push_back(result);
+
+    *report << left << setw(11) << name << setw(11) << size.name << right << fixed
+         << setw(5) << result.reps << " runs"
+         << setw(11) << setprecision(3) << result.median_ms << " ms"
+         << setw(11) << result.p99_ms << " ms p99"
+         << setw(9) << setprecision(2) << result.ns_per_pixel << " ns/px"
+         << setw(8) << result.gb_per_s << " GB/s" << endl;
+    return true;
+}
+
+// Runs every case on one image size
+static bool run_size(const Options& options, const Size& size, vector<Result>& results)
+{
+    Image image = noise_image(size.width, size.height);
+    Image result;
+    string filename = options.dir + "/suite_bench_" + to_string(getpid()) + ".bmp";
+    double image_bytes = static_cast<double>(image.row_bytes()) * image.height();
+    bool succeeded = true;
+
+    // write_image first, so read_image has a file to read
+    if (!write_image(filename, image))
+    {
+        cerr << "Cannot write " << filename << endl;
+        return false;
+    }
+    double bmp_bytes = static_cast<double>(file_size(filename));
+    succeeded &= time_case(options, "write", size, bmp_bytes, [&] { return write_image(filename, image); }, results);
+    succeeded &= time_case(options, "read", size, bmp_bytes, [&] { return read_image(filename, result); }, results);
+    unlink(filename.c_str());
+
+    // Filters read the image once and write an image of the same size, except enlarge quadruples it and resize quarters each side
+    struct Filter
+    {
+        const char* name;
+        double output_scale;
+        function<Image(const Image&)> apply;
+    };
+    const Filter filters[] = {
+        {"process_1", 1, [](const Image& in) { return process_1(in); }},
+        {"process_2", 1, [](const Image& in) { return process_2(in); }},
+        {"process_3", 1, [](const Image& in) { return process_3(in); }},
+        {"process_4", 1, [](const Image& in) { return process_4(in); }},
+        {"process_5", 1, [](const Image& in) { return process_5(in, 2); }},
+        {"process_6", 4, [](const Image& in) { return process_6(in, 2, 2); }},
+        {"process_7", 1, [](const Image& in) { return process_7(in); }},
+        {"process_8", 1, [](const Image& in) { return process_8(in, 0.5); }},
+        {"process_9", 1, [](const Image& in) { return process_9(in, 0.5); }},
+        {"process_10", 1, [](const Image& in) { return process_10(in); }},
+        {"process_11", 1.0 / 16, [](const Image& in) { return process_11(in, in.width() / 4, in.height() / 4, RESAMPLE_LANCZOS3); }},
+        {"process_13", 1, [](const Image& in) { return process_13(in, 2); }},
+        {"process_14", 1, [](const Image& in) { return process_14(in, 2.0); }},
+        {"process_15", 1, [](const Image& in) { return process_15(in, 50, 1.0); }},
+        {"process_16", 1, [](const Image& in) { return process_16(in); }},
+        {"process_17", 1, [](const Image& in) { return process_17(in, DEFAULT_LEVELS_CLIP); }},
+        {"process_18", 1, [](const Image& in) { return process_18(in); }},
+        {"process_19", 1, [](const Image& in) { return process_19(in); }},
+    };
+    for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++)
+    {
+        const Filter& filter = filters[i];
+        result = Image(); // Free the last result before the next one is made
+        succeeded &= time_case(options, filter.name, size, image_bytes * (1 + filter.output_scale),
+                               [&] { result = filter.apply(image); return result.width() > 0; }, results);
+    }
+    return succeeded;
+}
+
+static void write_json(ostream& out, const Options& options, const vector<Result>& results)
+{
+    out << "{\n";
+    out << "  \"label\": \"" << options.label << "\",\n";
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "  \"kernels\": \"" << active_kernels().name << "\",\n";
+    out << "  \"threads\": " << thread_count() << ",\n";
+    out << "  \"results\": [\n";
+    out << setprecision(6) << defaultfloat;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        // One result per line, which is what read_json expects
+        out << "    {\"name\": \"" << result.name << "\", \"size\": \"" << result.size << "\", \"width\": " << result.width
+            << ", \"height\": " << result.height << ", \"reps\": " << result.reps << ", \"median_ms\": " << result.median_ms
+            << ", \"p99_ms\": " << result.p99_ms << ", \"ns_per_pixel\": " << result.ns_per_pixel
+            << ", \"gb_per_s\": " << result.gb_per_s << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// The string or number after "key": in a line of write_json's output
+static string json_field(const string& line, const string& key)
+{
+    size_t at = line.find("\"" + key + "\":");
+    if (at == string::npos)
+    {
+        return "";
+    }
+    at = line.find_first_not_of(' ', at + key.size() + 3);
+    if (at == string::npos)
+    {
+        return "";
+    }
+    if (line[at] == '"')
+    {
+        size_t end = line.find('"', at + 1);
+        return end == string::npos ? "" : line.substr(at + 1, end - at - 1);
+    }
+    return line.substr(at, line.find_first_of(",}", at) - at);
+}
+
+// Loads the results saved by write_json
+static bool read_json(const string& filename, vector<Result>& results)
+{
+    ifstream in(filename.c_str());
+    if (!in)
+    {
+        cerr << "Cannot open " << filename << endl;
+        return false;
+    }
+    string line;
+    while (getline(in, line))
+    {
+        if (json_field(line, "median_ms").empty())
+        {
+            continue;
+        }
+        Result result;
+        result.name = json_field(line, "name");
+        result.size = json_field(line, "size");
+        result.width = atoi(json_field(line, "width").c_str());
+        result.height = atoi(json_field(line, "height").c_str());
+        result.reps = atoi(json_field(line, "reps").c_str());
+        result.median_ms = atof(json_field(line, "median_ms").c_str());
+        result.p99_ms = atof(json_field(line, "p99_ms").c_str());
+        result.ns_per_pixel = atof(json_field(line, "ns_per_pixel").c_str());
+        result.gb_per_s = atof(json_field(line, "gb_per_s").c_str());
+        results.push_back(result);
+    }
+    return true;
+}
+
+/**
+ * Prints the change in median time of every case found in both runs.
+ * @return The number of cases more than threshold percent slower
+ */
+static int compare(const vector<Result>& base, const vector<Result>& results, double threshold)
+{
+    map<string, const Result*> earlier;
+    for (size_t i = 0; i < base.size(); i++)
+    {
+        earlier[base[i].name + " " + base[i].size] = &base[i];
+    }
+
+    int regressions = 0;
+    cout << endl << left << setw(22) << "case" << right << setw(13) << "base ms" << setw(13) << "new ms" << setw(10) << "change" << endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        map<string, const Result*>::const_iterator found = earlier.find(results[i].name + " " + results[i].size);
+        if (found == earlier.end())
+        {
+            continue;
+        }
+        double before = found->second->median_ms;
+        double change = before > 0 ? (results[i].median_ms / before - 1) * 100 : 0;
+        bool regressed = change > threshold;
+        regressions += regressed;
+        cout << left << setw(22) << results[i].name + " " + results[i].size << right << fixed << setprecision(3)
+             << setw(13) << before << setw(13) << results[i].median_ms
+             << setw(9) << showpos << setprecision(1) << change << noshowpos << "%"
+             << (regressed ? "  SLOWER" : "") << endl;
+    }
+    cout << regressions << " case(s) more than " << threshold << "% slower" << endl;
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        return 2;
+    }
+
+    vector<Result> results;
+    bool succeeded = true;
+    if (!options.load.empty())
+    {
+        succeeded = read_json(options.load, results);
+    }
+    else
+    {
+        if (options.json == "-")
+        {
+            report = &cerr;
+        }
+        *report << "kernels " << active_kernels().name << ", " << thread_count() << " thread(s)" << endl;
+        for (size_t i = 0; i < options.sizes.size(); i++)
+        {
+            succeeded &= run_size(options, options.sizes[i], results);
+        }
+    }
+
+    if (!options.json.empty())
+    {
+        if (options.json == "-")
+        {
+            write_json(cout, options, results);
+        }
+        else
+        {
+            ofstream out(options.json.c_str());
+            write_json(out, options, results);
+            if (!out)
+            {
+                cerr << "Cannot write " << options.json << endl;
+                succeeded = false;
+            }
+        }
+    }
+
+    if (!options.compare.empty())
+    {
+        vector<Result> base;
+        if (!read_json(options.compare, base) || compare(base, results, options.threshold) > 0)
+        {
+            return 1;
+        }
+    }
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// Checks the fixed-point vignette against the original double-precision
+// expression on a range of image shapes (every value must be within 1),
+// then compares their speed, with and without a cached mask.
+//
+// Usage: vignette_bench [width height]    (default 6000 4000)
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "image.h"
+#include "vignette.h"
+#include "bench_util.h"
+
+using namespace std;
+
+// process_1 before the fixed-point factors
+static Image original_vignette(const Image& image)
+{
+    int height = image.height();
+    int width = image.width();
+    Image result(width, height);
+
+    for (int row = 0; row < height; row++)
+    {
+        const unsigned char* in = image.row(row);
+        unsigned char* out = result.row(row);
+        for (int col = 0; col < width; col++)
+        {
+            double distance = sqrt(pow(col - (static_cast<double>(width) / 2), 2) + pow(static_cast<double>(row) - (height / 2), 2));
+            double scaling_factor = (height - distance) / height;
+            out[3 * col] = static_cast<int>(scaling_factor * in[3 * col]);
+            out[3 * col + 1] = static_cast<int>(scaling_factor * in[3 * col + 1]);
+            out[3 * col + 2] = static_cast<int>(scaling_factor * in[3 * col + 2]);
+        }
+    }
+    return result;
+}
+
+// Largest difference between two images' values, counted around the byte wrap (far corners of wide images go negative)
+static int max_difference(const Image& a, const Image& b, long& differing)
+{
+    int largest = 0;
+    differing = 0;
+    for (int i = 0; i < a.height(); i++)
+    {
+        for (size_t j = 0; j < a.row_bytes(); j++)
+        {
+            int difference = abs(a.row(i)[j] - b.row(i)[j]);
+            difference = min(difference, 256 - difference);
+            largest = max(largest, difference);
+            differing += difference != 0;
+        }
+    }
+    return largest;
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 2 ? atoi(argv[1]) : 6000;
+    int height = argc > 2 ? atoi(argv[2]) : 4000;
+
+    // Odd and even sizes, very wide and very tall shapes (negative factors), and one that needs the double fallback
+    const int sizes[][2] = { {1, 1}, {2, 3}, {333, 217}, {401, 61}, {7, 130}, {640, 480}, {1000, 3}, {4000, 1} };
+    int worst = 0;
+    cout << "accuracy against the original expression:" << endl;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        Image image = noise_image(sizes[s][0], sizes[s][1]);
+        long differing;
+        int largest = max_difference(process_1(image), original_vignette(image), differing);
+        worst = max(worst, largest);
+        cout << "  " << setw(5) << sizes[s][0] << "x" << left << setw(5) << sizes[s][1] << right
+             << " max difference " << largest << ", " << differing << " of " << image.row_bytes() * image.height()
+             << " values differ" << endl;
+    }
+
+    Image image = noise_image(width, height);
+    Image result;
+    double megapixels = width * static_cast<double>(height) / 1e6;
+
+    cout << fixed << setprecision(1);
+    cout << width << "x" << height << " image" << endl;
+    double original_ms = time_ms([&] { result = original_vignette(image); }, 3);
+    cout << left << setw(36) << "original (sqrt and pow per pixel)" << right << setw(9) << original_ms << " ms"
+         << setw(9) << megapixels / original_ms * 1000 << " MP/s" << endl;
+
+    // A mask of a new size is built on each call; the same size reuses the cached one
+    int size_change = 0;
+    double uncached_ms = time_ms([&] { vignette_mask(1, ++size_change); result = process_1(image); }, 5);
+    cout << left << setw(36) << "process_1, new mask each call" << right << setw(9) << uncached_ms << " ms"
+         << setw(9) << megapixels / uncached_ms * 1000 << " MP/s" << endl;
+
+    double cached_ms = time_ms([&] { result = process_1(image); }, 5);
+    cout << left << setw(36) << "process_1, cached mask" << right << setw(9) << cached_ms << " ms"
+         << setw(9) << megapixels / cached_ms * 1000 << " MP/s" << endl;
+
+    cout << "mask: " << setprecision(1) << VignetteMask::stored_bytes(width, height) / 1048576.0 << " MiB"
+         << (VignetteMask::stored_bytes(width, height) <= VIGNETTE_CACHE_BYTES ? " (cached)" : " (over the cache limit)") << endl;
+    return worst <= 1 ? 0 : 1;
+}
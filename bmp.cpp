@@ -0,0 +1,1115 @@
+#include "bmp.h"
+#include "trace.h"
+#include <iostream>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+// Size in bytes of the red, green and blue masks that follow the DIB header of a BMP_BITFIELDS file
+static const int BMP_MASKS_SIZE = 12;
+
+/**
+ * Gets a little-endian integer from a byte array.
+ * @param bytes  The array
+ * @param offset The offset at which the integer starts
+ * @param size   Number of bytes in the integer (2 or 4)
+ * @return The integer, sign-extended from its size
+ */
+static int get_int(const unsigned char bytes[], int offset, int size)
+{
+    unsigned int result = 0;
+    for (int i = size - 1; i >= 0; i--)
+    {
+        result = (result << 8) | bytes[offset + i];
+    }
+    if (size == 2)
+    {
+        return static_cast<short>(result);
+    }
+    return static_cast<int>(result);
+}
+
+bool parse_bmp_header(const unsigned char bytes[], BmpHeader& header)
+{
+    if (bytes[0] != 'B' || bytes[1] != 'M' || get_int(bytes, 14, 4) < 40)
+    {
+        return false;
+    }
+
+    int height = get_int(bytes, 22, 4);
+
+    header.file_size = get_int(bytes, 2, 4);
+    header.pixel_offset = get_int(bytes, 10, 4);
+    header.width = get_int(bytes, 18, 4);
+    header.top_down = height < 0;
+    header.height = height == INT_MIN ? 0 : (height < 0 ? -height : height);
+    header.bits_per_pixel = get_int(bytes, 28, 2);
+    header.compression = get_int(bytes, 30, 4);
+    header.palette_offset = 14 + get_int(bytes, 14, 4);
+    int colors_used = get_int(bytes, 46, 4);
+    header.palette_colors = header.bits_per_pixel > 8 ? 0 : colors_used != 0 ? colors_used : 1 << header.bits_per_pixel;
+    return header.width > 0 && header.height > 0;
+}
+
+long bmp_scanline_size(int width, int bits_per_pixel)
+{
+    // Scan lines must occupy multiples of four bytes
+    return (static_cast<long>(width) * (bits_per_pixel / 8) + 3) / 4 * 4;
+}
+
+// Bytes of pixel data in one scanline of the file, without its padding
+static size_t scanline_pixels(const BmpHeader& header)
+{
+    return static_cast<size_t>(header.width) * (header.bits_per_pixel / 8);
+}
+
+// Bytes open_bmp reads before the rest of the file: the headers, and the color masks of a BMP_BITFIELDS file
+static long headers_read(const BmpHeader& header)
+{
+    return BMP_HEADERS_SIZE + (header.compression == BMP_BITFIELDS ? BMP_MASKS_SIZE : 0);
+}
+
+// Index of the image row that holds the given scanline of the file
+static int image_row(const BmpHeader& header, int scanline)
+{
+    return header.top_down ? header.height - 1 - scanline : scanline;
+}
+
+// Copies the part of an 8-bit file's palette found in count bytes that start at the given file position
+static void keep_palette(const BmpHeader& header, long position, const unsigned char* bytes, long count, unsigned char palette[])
+{
+    long first = max(position, static_cast<long>(header.palette_offset));
+    long last = min(position + count, header.palette_offset + 4L * header.palette_colors);
+    if (first < last)
+    {
+        memcpy(palette + (first - header.palette_offset), bytes + (first - position), last - first);
+    }
+}
+
+// Reads past anything between the headers and the pixel array, keeping an 8-bit file's palette
+static bool skip_to_pixels(int fd, const BmpHeader& header, unsigned char palette[])
+{
+    unsigned char scratch[4096];
+    long position = headers_read(header);
+    while (position < header.pixel_offset)
+    {
+        long chunk = min(header.pixel_offset - position, static_cast<long>(sizeof(scratch)));
+        if (!read_fully(fd, scratch, chunk))
+        {
+            return false;
+        }
+        keep_palette(header, position, scratch, chunk, palette);
+        position += chunk;
+    }
+    return true;
+}
+
+// Expands width color indices at the start of a row into blue, green and red through the palette, in place
+static void expand_indices(const unsigned char palette[], unsigned char* row, int width)
+{
+    for (int x = width - 1; x >= 0; x--) // Backwards, so no index is overwritten before it is read
+    {
+        const unsigned char* entry = palette + 4 * row[x];
+        row[3 * x + 2] = entry[2];
+        row[3 * x + 1] = entry[1];
+        row[3 * x] = entry[0];
+    }
+}
+
+// Copies the blue, green and red bytes of width 32-bit pixels, dropping the fourth (alpha or unused) byte
+static void drop_alpha(const unsigned char* src, unsigned char* dst, int width)
+{
+    int x = 0;
+    for (; x < width - 1; x++) // Four bytes at a time; the fourth is overwritten by the next pixel
+    {
+        memcpy(dst + 3 * x, src + 4 * x, 4);
+    }
+    if (x < width)
+    {
+        memcpy(dst + 3 * x, src + 4 * x, 3);
+    }
+}
+
+/**
+ * Decodes the RLE8 pixel array of an 8-bit file a scanline at a time,
+ * from a mapping of the file or by reading a file descriptor in chunks.
+ * Pixels the data skips (with a delta, an early end of line or the end of
+ * the bitmap) get color index 0, and pixels past the width are dropped.
+ */
+class Rle8Decoder
+{
+public:
+    // Decodes size bytes of mapped data
+    Rle8Decoder(const unsigned char* data, size_t size, int width)
+        : fd_(-1), data_(data), size_(size), position_(0), refilled_(0), width_(width), skip_rows_(0), start_x_(0),
+          ended_(false)
+    {
+    }
+
+    // Decodes what follows in a file positioned at the pixel array
+    Rle8Decoder(int fd, int width)
+        : fd_(fd), data_(nullptr), size_(0), position_(0), refilled_(0), width_(width), skip_rows_(0), start_x_(0),
+          ended_(false), buffer_(1 << 16)
+    {
+    }
+
+    // Writes the color indices of the next scanline to row[0] to row[width - 1]; false if the data ends early
+    bool next_row(unsigned char* row)
+    {
+        memset(row, 0, width_);
+        if (ended_)
+        {
+            return true;
+        }
+        if (skip_rows_ > 0)
+        {
+            skip_rows_--;
+            return true;
+        }
+
+        int x = start_x_;
+        start_x_ = 0;
+        unsigned char count, value;
+        while (next_byte(count) && next_byte(value))
+        {
+            if (count > 0) // A run of count pixels of one index
+            {
+                if (x < width_)
+                {
+                    memset(row + x, value, min(static_cast<int>(count), width_ - x));
+                }
+                x = min(x + count, width_);
+            }
+            else if (value == 0) // End of line
+            {
+                return true;
+            }
+            else if (value == 1) // End of bitmap
+            {
+                ended_ = true;
+                return true;
+            }
+            else if (value == 2) // Delta: move right, and up to a later scanline
+            {
+                unsigned char right, up;
+                if (!next_byte(right) || !next_byte(up))
+                {
+                    return false;
+                }
+                x = min(x + right, width_);
+                if (up > 0)
+                {
+                    skip_rows_ = up - 1;
+                    start_x_ = x;
+                    return true;
+                }
+            }
+            else // Absolute mode: value indices as they are, padded to an even count
+            {
+                unsigned char index;
+                for (int i = 0; i < value; i++)
+                {
+                    if (!next_byte(index))
+                    {
+                        return false;
+                    }
+                    if (x < width_)
+                    {
+                        row[x++] = index;
+                    }
+                }
+                if ((value & 1) != 0 && !next_byte(index))
+                {
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Bytes of the pixel array decoded so far
+    long consumed() const
+    {
+        return refilled_ + static_cast<long>(position_);
+    }
+
+private:
+    bool next_byte(unsigned char& value)
+    {
+        if (position_ == size_ && !refill())
+        {
+            return false;
+        }
+        value = data_[position_++];
+        return true;
+    }
+
+    // Reads the next chunk of the file; false at its end, or when decoding a mapping
+    bool refill()
+    {
+        ssize_t got = fd_ < 0 ? 0 : read(fd_, buffer_.data(), buffer_.size());
+        if (got <= 0)
+        {
+            return false;
+        }
+        refilled_ += size_;
+        data_ = buffer_.data();
+        size_ = got;
+        position_ = 0;
+        return true;
+    }
+
+    int fd_;
+    const unsigned char* data_;
+    size_t size_;
+    size_t position_;
+    long refilled_; // Bytes of the chunks read before the current one
+    int width_;
+    int skip_rows_; // Scanlines left blank by a delta before decoding resumes
+    int start_x_;   // Column at which decoding resumes after a delta
+    bool ended_;
+    vector<unsigned char> buffer_;
+};
+
+// Copies every scanline out of a mapping of the whole file
+template <class ImageType>
+static void copy_mapped(const unsigned char* file, const BmpHeader& header, ImageType& image)
+{
+    const unsigned char* scanline = file + header.pixel_offset;
+    long scanline_size = bmp_scanline_size(header.width, header.bits_per_pixel);
+    size_t bytes = scanline_pixels(header);
+
+    for (int i = 0; i < header.height; i++)
+    {
+        memcpy(image.row(image_row(header, i)), scanline, bytes);
+        scanline += scanline_size;
+    }
+}
+
+// Reads every scanline straight into the image, sending the padding to a scratch buffer
+template <class ImageType>
+static bool read_vectored(int fd, const BmpHeader& header, ImageType& image, unsigned char palette[])
+{
+    if (!skip_to_pixels(fd, header, palette))
+    {
+        return false;
+    }
+
+    unsigned char scratch[4];
+    size_t bytes = scanline_pixels(header);
+    size_t padding = bmp_scanline_size(header.width, header.bits_per_pixel) - bytes;
+    struct iovec iov[MAX_IOVECS];
+    int count = 0;
+
+    for (int i = 0; i < header.height; i++)
+    {
+        iov[count].iov_base = image.row(image_row(header, i));
+        iov[count].iov_len = bytes;
+        count++;
+        if (padding > 0)
+        {
+            iov[count].iov_base = scratch;
+            iov[count].iov_len = padding;
+            count++;
+        }
+
+        if (count > MAX_IOVECS - 2 || i == header.height - 1)
+        {
+            if (!readv_fully(fd, iov, count))
+            {
+                return false;
+            }
+            count = 0;
+        }
+    }
+    return true;
+}
+
+// Decodes an RLE8 pixel array into the color indices of each row (the format is always bottom-up)
+template <class ImageType>
+static bool read_rle(Rle8Decoder& decoder, ImageType& image)
+{
+    for (int i = 0; i < image.height(); i++)
+    {
+        if (!decoder.next_row(image.row(i)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True if read_bmp can decode a file with this header, from a file whose first bytes after the headers are masks
+static bool supported(const BmpHeader& header, const unsigned char masks[])
+{
+    switch (header.bits_per_pixel)
+    {
+        case 24:
+            return header.compression == BMP_RGB;
+        case 32: // Blue, green and red bytes in that order, then alpha or nothing
+            return header.compression == BMP_RGB
+                || (header.compression == BMP_BITFIELDS && header.pixel_offset >= BMP_HEADERS_SIZE + BMP_MASKS_SIZE
+                    && get_int(masks, 0, 4) == 0xFF0000 && get_int(masks, 4, 4) == 0xFF00 && get_int(masks, 8, 4) == 0xFF);
+        case 8: // RLE8 files are always bottom-up
+            return (header.compression == BMP_RGB || (header.compression == BMP_RLE8 && !header.top_down))
+                && header.palette_colors <= 256 && header.palette_offset >= BMP_HEADERS_SIZE
+                && header.palette_offset + 4L * header.palette_colors <= header.pixel_offset;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Opens a BMP file and checks that it is a complete image read_bmp can decode.
+ * @param filename   The BMP file name to open
+ * @param header     Receives the parsed header fields
+ * @param file_bytes Receives the size of the headers and pixel array (for
+ *                   RLE8 files, the size of the file, or of the headers if
+ *                   it is not a regular file)
+ * @param regular    Receives true if the file is a regular file
+ * @return The open file descriptor (positioned after the headers), or -1
+ */
+static int open_bmp(const string& filename, BmpHeader& header, long& file_bytes, bool& regular)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    // Read both headers with a single read, then the masks of a BMP_BITFIELDS file
+    unsigned char bytes[BMP_HEADERS_SIZE + BMP_MASKS_SIZE];
+    bool valid = read_fully(fd, bytes, BMP_HEADERS_SIZE) && parse_bmp_header(bytes, header)
+        && header.pixel_offset >= BMP_HEADERS_SIZE
+        && (header.compression != BMP_BITFIELDS || read_fully(fd, bytes + BMP_HEADERS_SIZE, BMP_MASKS_SIZE))
+        && supported(header, bytes + BMP_HEADERS_SIZE);
+
+    struct stat info;
+    regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    bool rle = header.compression == BMP_RLE8;
+    file_bytes = !valid ? 0 : rle ? (regular ? static_cast<long>(info.st_size) : header.pixel_offset)
+        : header.pixel_offset + bmp_scanline_size(header.width, header.bits_per_pixel) * header.height;
+    if (valid && regular && (info.st_size < file_bytes || info.st_size < header.pixel_offset))
+    {
+        valid = false; // Truncated pixel array
+    }
+
+    if (!valid)
+    {
+        cout << "Not a 24-bit or 32-bit true color or 8-bit palettized image file." << endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool read_bmp_header(const string& filename, BmpHeader& header)
+{
+    long file_bytes;
+    bool regular;
+    int fd = open_bmp(filename, header, file_bytes, regular);
+    if (fd < 0)
+    {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+// Expands the color indices read into each row (one byte per pixel) into blue, green and red through the palette
+static void map_indices(const unsigned char palette[], Image& image, const short*)
+{
+    for (int i = 0; i < image.height(); i++)
+    {
+        expand_indices(palette, image.row(i), image.width());
+    }
+}
+
+// Replaces the color indices read into each row by the gray values of their palette entries
+static void map_indices(const unsigned char palette[], GrayImage& image, const short* weights)
+{
+    unsigned char colors[3 * 256], gray[256];
+    bool identity = true;
+    for (int i = 0; i < 256; i++)
+    {
+        memcpy(colors + 3 * i, palette + 4 * i, 3);
+    }
+    scalar_kernels().to_gray(colors, gray, weights, 256);
+    for (int i = 0; i < 256; i++)
+    {
+        identity = identity && gray[i] == i;
+    }
+    if (identity) // A gray palette: the indices are the values
+    {
+        return;
+    }
+
+    for (int i = 0; i < image.height(); i++)
+    {
+        unsigned char* row = image.row(i);
+        for (int x = 0; x < image.width(); x++)
+        {
+            row[x] = gray[row[x]];
+        }
+    }
+}
+
+// Converts a 24-bit or 32-bit scanline into a row of a color image (dropping the fourth byte of 32-bit pixels)
+static void convert_scanline(const unsigned char* scanline, const BmpHeader& header, Image& image, int i, const short*,
+                             unsigned char*)
+{
+    drop_alpha(scanline, image.row(image_row(header, i)), header.width);
+}
+
+// Converts a 24-bit or 32-bit scanline into a row of a gray image with the to_gray kernel; scratch holds a 24-bit row
+static void convert_scanline(const unsigned char* scanline, const BmpHeader& header, GrayImage& image, int i,
+                             const short* weights, unsigned char* scratch)
+{
+    if (header.bits_per_pixel == 32)
+    {
+        drop_alpha(scanline, scratch, header.width);
+        scanline = scratch;
+    }
+    active_kernels().to_gray(scanline, image.row(image_row(header, i)), weights, header.width);
+}
+
+// Converts the scanlines of a 24-bit or 32-bit file that are not copied as they are (gray images, or 32 bits), from
+// the mapping of the file if there is one (file is not null), otherwise by reading a band of scanlines at a time
+template <class ImageType>
+static bool read_converted(int fd, const unsigned char* file, const BmpHeader& header, ImageType& image,
+                           const short* weights, unsigned char palette[])
+{
+    long scanline_size = bmp_scanline_size(header.width, header.bits_per_pixel);
+    vector<unsigned char> scratch(3 * static_cast<size_t>(header.width));
+    if (file != nullptr)
+    {
+        const unsigned char* scanline = file + header.pixel_offset;
+        for (int i = 0; i < header.height; i++)
+        {
+            convert_scanline(scanline, header, image, i, weights, scratch.data());
+            scanline += scanline_size;
+        }
+        return true;
+    }
+
+    if (!skip_to_pixels(fd, header, palette))
+    {
+        return false;
+    }
+    int band = static_cast<int>(max(1L, (1L << 20) / scanline_size));
+    vector<unsigned char> scanlines(scanline_size * min(band, header.height));
+    for (int first = 0; first < header.height; first += band)
+    {
+        int count = min(band, header.height - first);
+        if (!read_fully(fd, scanlines.data(), scanline_size * count))
+        {
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            convert_scanline(scanlines.data() + scanline_size * i, header, image, first + i, weights, scratch.data());
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads a file that open_bmp accepted into an image: the scanlines are
+ * copied in (from a mapping of the file, or with vectored reads), then
+ * 8-bit indices are mapped through the palette. 32-bit files, and 24-bit
+ * files read into a gray image, are converted as they are read instead;
+ * RLE8 files are decoded into indices first.
+ */
+template <class ImageType>
+static bool read_bmp_file(const string& filename, ImageType& image, const short* weights)
+{
+    BmpHeader header;
+    long file_bytes;
+    bool regular;
+    int fd = open_bmp(filename, header, file_bytes, regular);
+    if (fd < 0)
+    {
+        image = ImageType();
+        return false;
+    }
+
+    ImageType result = ImageType::uninitialized(header.width, header.height);
+    unsigned char palette[BMP_PALETTE_SIZE] = {};
+    bool rle = header.compression == BMP_RLE8;
+    bool convert = header.bits_per_pixel == 32 || (ImageType::CHANNELS == 1 && header.bits_per_pixel == 24);
+    bool success = false;
+
+    void* mapping = regular ? mmap(nullptr, file_bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (mapping != MAP_FAILED)
+    {
+        const unsigned char* file = static_cast<const unsigned char*>(mapping);
+        madvise(mapping, file_bytes, MADV_SEQUENTIAL);
+        keep_palette(header, 0, file, header.pixel_offset, palette);
+        if (rle)
+        {
+            Rle8Decoder decoder(file + header.pixel_offset, file_bytes - header.pixel_offset, header.width);
+            success = read_rle(decoder, result);
+        }
+        else if (convert)
+        {
+            success = read_converted(fd, file, header, result, weights, palette);
+        }
+        else
+        {
+            copy_mapped(file, header, result);
+            success = true;
+        }
+        munmap(mapping, file_bytes);
+    }
+    else if (rle)
+    {
+        Rle8Decoder decoder(fd, header.width);
+        success = skip_to_pixels(fd, header, palette) && read_rle(decoder, result);
+        file_bytes += decoder.consumed();
+    }
+    else
+    {
+        success = convert ? read_converted(fd, nullptr, header, result, weights, palette)
+                          : read_vectored(fd, header, result, palette);
+    }
+
+    close(fd);
+    if (success && header.bits_per_pixel == 8)
+    {
+        map_indices(palette, result, weights);
+    }
+    if (success)
+    {
+        trace_count(TRACE_BYTES_READ, file_bytes);
+        image.swap(result);
+    }
+    else
+    {
+        image = ImageType();
+    }
+    return success;
+}
+
+bool read_bmp(const string& filename, Image& image)
+{
+    return read_bmp_file(filename, image, nullptr);
+}
+
+bool read_bmp(const string& filename, GrayImage& image, GrayWeights weights)
+{
+    return read_bmp_file(filename, image, gray_weights(weights));
+}
+
+BmpRowReader::BmpRowReader()
+    : fd_(-1), next_row_(0)
+{
+    header_.width = 0;
+    header_.height = 0;
+}
+
+BmpRowReader::~BmpRowReader()
+{
+    close_file();
+}
+
+bool BmpRowReader::open_file(const string& filename)
+{
+    close_file();
+    long file_bytes;
+    bool regular;
+    fd_ = open_bmp(filename, header_, file_bytes, regular);
+    next_row_ = 0;
+    if (fd_ < 0)
+    {
+        header_.width = 0;
+        header_.height = 0;
+        return false;
+    }
+
+    if (header_.top_down && lseek(fd_, 0, SEEK_CUR) < 0)
+    {
+        cout << "Top-down BMP files can only be streamed from a seekable file." << endl;
+        close_file();
+        return false;
+    }
+
+    // Read up to the pixel array, keeping the palette; top-down files seek back into it for each band
+    memset(palette_, 0, sizeof(palette_));
+    if (!skip_to_pixels(fd_, header_, palette_))
+    {
+        close_file();
+        return false;
+    }
+    if (header_.compression == BMP_RLE8)
+    {
+        decoder_.reset(new Rle8Decoder(fd_, header_.width));
+    }
+    else if (header_.bits_per_pixel == 32)
+    {
+        long scanline_size = bmp_scanline_size(header_.width, 32);
+        scanlines_.resize(scanline_size * min(static_cast<long>(header_.height), max(1L, (1L << 20) / scanline_size)));
+    }
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    trace_count(TRACE_BYTES_READ, header_.pixel_offset);
+    return true;
+}
+
+bool BmpRowReader::read_rows(Image& band, int count)
+{
+    if (fd_ < 0 || count < 0 || count > band.height() || next_row_ + count > header_.height)
+    {
+        return false;
+    }
+
+    // RLE8 scanlines are decoded in order and expanded through the palette
+    if (decoder_)
+    {
+        long before = decoder_->consumed();
+        for (int i = 0; i < count; i++)
+        {
+            if (!decoder_->next_row(band.row(i)))
+            {
+                return false;
+            }
+            expand_indices(palette_, band.row(i), header_.width);
+        }
+        next_row_ += count;
+        trace_count(TRACE_BYTES_READ, decoder_->consumed() - before);
+        return true;
+    }
+
+    long scanline_size = bmp_scanline_size(header_.width, header_.bits_per_pixel);
+
+    // A top-down file stores the band's rows last to first, ending at scanline height - next_row_
+    if (header_.top_down)
+    {
+        off_t offset = header_.pixel_offset + scanline_size * (header_.height - next_row_ - count);
+        if (lseek(fd_, offset, SEEK_SET) != offset)
+        {
+            return false;
+        }
+    }
+
+    if (header_.bits_per_pixel == 32)
+    {
+        // Read through a scratch band of scanlines and drop the fourth byte of each pixel
+        int chunk = static_cast<int>(scanlines_.size() / scanline_size);
+        for (int first = 0; first < count; first += chunk)
+        {
+            int rows = min(chunk, count - first);
+            if (!read_fully(fd_, scanlines_.data(), scanline_size * rows))
+            {
+                return false;
+            }
+            for (int i = first; i < first + rows; i++)
+            {
+                drop_alpha(scanlines_.data() + scanline_size * (i - first), band.row(header_.top_down ? count - 1 - i : i),
+                           header_.width);
+            }
+        }
+    }
+    else
+    {
+        // Read each scanline straight into its row (8-bit indices into the start of it)
+        size_t bytes = scanline_pixels(header_);
+        size_t padding = scanline_size - bytes;
+        unsigned char scratch[4];
+        struct iovec iov[MAX_IOVECS];
+        int vectors = 0;
+        for (int i = 0; i < count; i++)
+        {
+            iov[vectors].iov_base = band.row(header_.top_down ? count - 1 - i : i);
+            iov[vectors].iov_len = bytes;
+            vectors++;
+            if (padding > 0)
+            {
+                iov[vectors].iov_base = scratch;
+                iov[vectors].iov_len = padding;
+                vectors++;
+            }
+
+            if (vectors > MAX_IOVECS - 2 || i == count - 1)
+            {
+                if (!readv_fully(fd_, iov, vectors))
+                {
+                    return false;
+                }
+                vectors = 0;
+            }
+        }
+        for (int i = 0; header_.bits_per_pixel == 8 && i < count; i++)
+        {
+            expand_indices(palette_, band.row(i), header_.width);
+        }
+    }
+    next_row_ += count;
+    trace_count(TRACE_BYTES_READ, scanline_size * count);
+    return true;
+}
+
+void BmpRowReader::close_file()
+{
+    if (fd_ >= 0)
+    {
+        close(fd_);
+        fd_ = -1;
+    }
+    decoder_.reset();
+}
+
+/**
+ * Sets a value to the char array starting at the offset using the size
+ * specified by the bytes.
+ * This is a helper function for make_bmp_header()
+ * @param arr    Array to set values for
+ * @param offset Starting index offset
+ * @param bytes  Number of bytes to set
+ * @param value  Value to set
+ */
+static void set_bytes(unsigned char arr[], int offset, int bytes, int value) {
+    for (int i = 0; i < bytes; i++) {
+        arr[offset+i] = (unsigned char)(value>>(i*8));
+    }
+}
+
+// Offset of the pixel array in the files make_bmp_header describes: the headers, and for 8 bits the palette
+static int bmp_pixel_offset(int bits_per_pixel)
+{
+    return BMP_HEADERS_SIZE + (bits_per_pixel == 8 ? BMP_PALETTE_SIZE : 0);
+}
+
+void make_bmp_header(unsigned char bytes[], int width, int height, int bits_per_pixel) {
+    // Pixel array size in bytes, including padding. Files over 4 GiB record
+    // 0 for both sizes, which readers treat as "work it out from the dimensions".
+    long array_bytes = bmp_scanline_size(width, bits_per_pixel) * height;
+    long file_bytes = bmp_pixel_offset(bits_per_pixel) + array_bytes;
+    if (file_bytes > 0xFFFFFFFFL)
+    {
+        array_bytes = 0;
+        file_bytes = 0;
+    }
+
+    // Create the BMP and DIB Headers
+    const int BMP_HEADER_SIZE = 14;
+    const int DIB_HEADER_SIZE = 40;
+    unsigned char* bmp_header = bytes;
+    unsigned char* dib_header = bytes + BMP_HEADER_SIZE;
+    memset(bytes, 0, BMP_HEADERS_SIZE);
+
+    // BMP Header
+    set_bytes(bmp_header,  0, 1, 'B');              // ID field
+    set_bytes(bmp_header,  1, 1, 'M');              // ID field
+    set_bytes(bmp_header,  2, 4, file_bytes);       // Size of BMP file
+    set_bytes(bmp_header,  6, 2, 0);                // Reserved
+    set_bytes(bmp_header,  8, 2, 0);                // Reserved
+    set_bytes(bmp_header, 10, 4, bmp_pixel_offset(bits_per_pixel)); // Pixel array offset
+
+    // DIB Header
+    set_bytes(dib_header,  0, 4, DIB_HEADER_SIZE);  // DIB header size
+    set_bytes(dib_header,  4, 4, width);            // Width of bitmap in pixels
+    set_bytes(dib_header,  8, 4, height);           // Height of bitmap in pixels
+    set_bytes(dib_header, 12, 2, 1);                // Number of color planes
+    set_bytes(dib_header, 14, 2, bits_per_pixel);   // Number of bits per pixel
+    set_bytes(dib_header, 16, 4, 0);                // Compression method (0=BI_RGB)
+    set_bytes(dib_header, 20, 4, array_bytes);      // Size of raw bitmap data (including padding)
+    set_bytes(dib_header, 24, 4, 2835);             // Print resolution of image (2835 pixels/meter)
+    set_bytes(dib_header, 28, 4, 2835);             // Print resolution of image (2835 pixels/meter)
+    set_bytes(dib_header, 32, 4, bits_per_pixel == 8 ? 256 : 0); // Number of colors in palette
+    set_bytes(dib_header, 36, 4, 0);                // Number of important colors
+
+    // Gray palette: entry v is blue, green and red v
+    for (int v = 0; bits_per_pixel == 8 && v < 256; v++)
+    {
+        unsigned char* entry = bytes + BMP_HEADERS_SIZE + 4 * v;
+        entry[0] = entry[1] = entry[2] = static_cast<unsigned char>(v);
+        entry[3] = 0;
+    }
+}
+
+// Bits per pixel of the files an image is written to
+template <class ImageType>
+static int file_bits(const ImageType&)
+{
+    return 8 * ImageType::CHANNELS;
+}
+
+// Fills a mapping of the whole output file: headers (and palette), then each scanline and its padding
+template <class ImageType>
+static void fill_mapped(unsigned char* file, const unsigned char header[], int header_bytes, const ImageType& image)
+{
+    memcpy(file, header, header_bytes);
+
+    unsigned char* scanline = file + header_bytes;
+    long scanline_size = bmp_scanline_size(image.width(), file_bits(image));
+    size_t padding = scanline_size - image.row_bytes();
+
+    for (int i = 0; i < image.height(); i++)
+    {
+        memcpy(scanline, image.row(i), image.row_bytes());
+        memset(scanline + image.row_bytes(), 0, padding);
+        scanline += scanline_size;
+    }
+}
+
+// Writes the headers (and palette) and every scanline with writev, taking padding from a zeroed buffer
+template <class ImageType>
+static bool write_vectored(int fd, const unsigned char header[], int header_bytes, const ImageType& image)
+{
+    static const unsigned char padding_bytes[3] = {0};
+    size_t padding = bmp_scanline_size(image.width(), file_bits(image)) - image.row_bytes();
+    struct iovec iov[MAX_IOVECS];
+    int count = 0;
+
+    iov[count].iov_base = const_cast<unsigned char*>(header);
+    iov[count].iov_len = header_bytes;
+    count++;
+
+    for (int i = 0; i < image.height(); i++)
+    {
+        iov[count].iov_base = const_cast<unsigned char*>(image.row(i));
+        iov[count].iov_len = image.row_bytes();
+        count++;
+        if (padding > 0)
+        {
+            iov[count].iov_base = const_cast<unsigned char*>(padding_bytes);
+            iov[count].iov_len = padding;
+            count++;
+        }
+
+        if (count > MAX_IOVECS - 2)
+        {
+            if (!writev_fully(fd, iov, count))
+            {
+                return false;
+            }
+            count = 0;
+        }
+    }
+    return writev_fully(fd, iov, count);
+}
+
+// write_bmp for either kind of image: 24-bit files for color images, 8-bit for gray ones
+template <class ImageType>
+static bool write_bmp_file(const string& filename, const ImageType& image)
+{
+    bool to_stdout = filename == "-";
+    int fd = to_stdout ? STDOUT_FILENO : open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+    // If there was a problem opening the file, return false
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    int bits = file_bits(image);
+    unsigned char header[BMP_HEADERS_SIZE + BMP_PALETTE_SIZE];
+    make_bmp_header(header, image.width(), image.height(), bits);
+    int header_bytes = bmp_pixel_offset(bits);
+    long file_bytes = header_bytes + bmp_scanline_size(image.width(), bits) * image.height();
+
+    // Reserve the blocks of regular files up front and fill them through a mapping. Only reserved blocks are mapped:
+    // a store into a hole the disk has no room for raises SIGBUS instead of failing
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (!to_stdout && fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        if (posix_fallocate(fd, 0, file_bytes) == 0)
+        {
+            mapping = mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (mapping == MAP_FAILED && ftruncate(fd, 0) != 0) // Written with writev instead, which reports a full disk
+        {
+            close(fd);
+            return false;
+        }
+    }
+
+    bool success = true;
+    if (mapping != MAP_FAILED)
+    {
+        madvise(mapping, file_bytes, MADV_SEQUENTIAL);
+        fill_mapped(static_cast<unsigned char*>(mapping), header, header_bytes, image);
+        success = munmap(mapping, file_bytes) == 0;
+    }
+    else
+    {
+        success = write_vectored(fd, header, header_bytes, image);
+    }
+
+    if (!to_stdout)
+    {
+        success = close(fd) == 0 && success;
+    }
+    if (success)
+    {
+        trace_count(TRACE_BYTES_WRITTEN, file_bytes);
+    }
+    return success;
+}
+
+bool write_bmp(const string& filename, const Image& image)
+{
+    return write_bmp_file(filename, image);
+}
+
+bool write_bmp(const string& filename, const GrayImage& image)
+{
+    return write_bmp_file(filename, image);
+}
+
+BmpRowWriter::BmpRowWriter()
+    : fd_(-1), width_(0), height_(0), rows_written_(0), failed_(false)
+{
+}
+
+BmpRowWriter::~BmpRowWriter()
+{
+    close_file();
+}
+
+bool BmpRowWriter::open_file(const string& filename, int width, int height)
+{
+    close_file();
+    bool to_stdout = filename == "-";
+    fd_ = to_stdout ? STDOUT_FILENO : open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_ < 0)
+    {
+        return false;
+    }
+
+    width_ = width;
+    height_ = height;
+    rows_written_ = 0;
+    failed_ = false;
+
+    unsigned char header[BMP_HEADERS_SIZE];
+    make_bmp_header(header, width, height);
+    struct iovec iov = { header, BMP_HEADERS_SIZE };
+    failed_ = !writev_fully(fd_, &iov, 1);
+    if (!failed_)
+    {
+        trace_count(TRACE_BYTES_WRITTEN, BMP_HEADERS_SIZE);
+    }
+    return !failed_;
+}
+
+bool BmpRowWriter::write_rows(const Image& band, int count)
+{
+    if (fd_ < 0 || failed_ || band.width() != width_ || count < 0 || count > band.height()
+        || rows_written_ + count > height_)
+    {
+        failed_ = true;
+        return false;
+    }
+
+    static const unsigned char padding_bytes[3] = {0};
+    size_t padding = bmp_scanline_size(width_) - band.row_bytes();
+    struct iovec iov[MAX_IOVECS];
+    int vectors = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        iov[vectors].iov_base = const_cast<unsigned char*>(band.row(i));
+        iov[vectors].iov_len = band.row_bytes();
+        vectors++;
+        if (padding > 0)
+        {
+            iov[vectors].iov_base = const_cast<unsigned char*>(padding_bytes);
+            iov[vectors].iov_len = padding;
+            vectors++;
+        }
+
+        if (vectors > MAX_IOVECS - 2 || i == count - 1)
+        {
+            if (!writev_fully(fd_, iov, vectors))
+            {
+                failed_ = true;
+                return false;
+            }
+            vectors = 0;
+        }
+    }
+    rows_written_ += count;
+    trace_count(TRACE_BYTES_WRITTEN, bmp_scanline_size(width_) * count);
+    return true;
+}
+
+bool BmpRowWriter::close_file()
+{
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    bool success = !failed_ && rows_written_ == height_;
+    if (fd_ != STDOUT_FILENO)
+    {
+        success = close(fd_) == 0 && success;
+    }
+    fd_ = -1;
+    return success;
+}
+
+// True if the bytes start a BMP file
+static bool sniff_bmp(const unsigned char bytes[], size_t count)
+{
+    return count >= 2 && bytes[0] == 'B' && bytes[1] == 'M';
+}
+
+static bool read_bmp_info(const string& filename, ImageInfo& info)
+{
+    BmpHeader header;
+    if (!read_bmp_header(filename, header))
+    {
+        return false;
+    }
+    info.width = header.width;
+    info.height = header.height;
+    return true;
+}
+
+static bool read_bmp_color(const string& filename, Image& image)
+{
+    return read_bmp(filename, image);
+}
+
+static bool read_bmp_gray(const string& filename, GrayImage& image, GrayWeights weights)
+{
+    return read_bmp(filename, image, weights);
+}
+
+static bool write_bmp_color(const string& filename, const Image& image)
+{
+    return write_bmp(filename, image);
+}
+
+static bool write_bmp_gray(const string& filename, const GrayImage& image)
+{
+    return write_bmp(filename, image);
+}
+
+static RowReader* new_bmp_reader()
+{
+    return new BmpRowReader();
+}
+
+static RowWriter* new_bmp_writer()
+{
+    return new BmpRowWriter();
+}
+
+const ImageCodec& bmp_codec()
+{
+    static const ImageCodec codec = {
+        "BMP", ".bmp", false, sniff_bmp, read_bmp_info, read_bmp_color, read_bmp_gray, write_bmp_color, write_bmp_gray,
+        new_bmp_reader, new_bmp_writer
+    };
+    return codec;
+}
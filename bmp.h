@@ -0,0 +1,178 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include "image_buffer.h"
+#include "kernels.h"
+#include "codec.h"
+
+using namespace std;
+
+// Size in bytes of the BMP file header plus the BITMAPINFOHEADER that follows it
+const int BMP_HEADERS_SIZE = 54;
+
+// Compression methods in the DIB header
+const int BMP_RGB = 0;       // Uncompressed
+const int BMP_RLE8 = 1;      // Run-length encoded 8-bit color indices
+const int BMP_BITFIELDS = 3; // Uncompressed, with red, green and blue masks after the DIB header
+
+// Size in bytes of a full 8-bit palette: 256 entries of blue, green, red and a reserved byte
+const int BMP_PALETTE_SIZE = 1024;
+
+// The header fields of a BMP file needed to locate and decode its pixel array
+struct BmpHeader
+{
+    int file_size;       // Size of the file as recorded in the header
+    int pixel_offset;    // Offset of the pixel array from the start of the file
+    int width;           // Width in pixels
+    int height;          // Height in pixels (always positive, see top_down)
+    bool top_down;       // True if the first scanline is the top of the picture
+    int bits_per_pixel;  // Color depth
+    int compression;     // Compression method (BMP_RGB, BMP_RLE8 or BMP_BITFIELDS)
+    int palette_offset;  // Offset of the palette, just after the DIB header
+    int palette_colors;  // Entries in the palette (8 bits or fewer per pixel), otherwise 0
+};
+
+/**
+ * Parses the BMP and DIB headers from the first bytes of a file.
+ * @param bytes  The first BMP_HEADERS_SIZE bytes of the file
+ * @param header Receives the parsed header fields
+ * @return True if the bytes start a BMP file with a BITMAPINFOHEADER (or newer)
+ */
+bool parse_bmp_header(const unsigned char bytes[], BmpHeader& header);
+
+// Bytes in one scanline of a 24-bit (or 8-bit or 32-bit) uncompressed BMP, including padding to a multiple of four
+long bmp_scanline_size(int width, int bits_per_pixel = 24);
+
+/**
+ * Opens a BMP file and checks that read_bmp can read it, without reading
+ * the pixels. Prints a message if it cannot.
+ * @param filename The BMP file name to check
+ * @param header   Receives the parsed header fields
+ * @return True if the file is a complete image read_bmp can decode
+ */
+bool read_bmp_header(const string& filename, BmpHeader& header);
+
+/**
+ * Reads a 24-bit uncompressed or 8-bit palettized BMP file into a
+ * contiguous image. The pixel array is mapped (or, for files that cannot
+ * be mapped, read with vectored reads) and each scanline is copied once,
+ * without its padding, into the image; 8-bit color indices are then
+ * expanded through the palette in place. Bottom-up and top-down files are
+ * both supported. 32-bit files (uncompressed, or with the usual blue,
+ * green and red masks) lose their fourth byte as they are copied, and
+ * RLE8 files are decoded into color indices first.
+ * @param filename The BMP file name to read
+ * @param image    Receives the decoded image
+ * @return True if successful and false otherwise
+ */
+bool read_bmp(const string& filename, Image& image);
+
+/**
+ * Reads a BMP file into a gray image. An 8-bit file with a gray palette
+ * (as write_bmp makes) is copied straight in; other palettes are mapped
+ * through the gray value of each entry, and 24-bit files are converted
+ * (as are 32-bit files) scanline by scanline with the to_gray kernel, so the color image is
+ * never held in memory.
+ * @param filename The BMP file name to read
+ * @param image    Receives the decoded image
+ * @param weights  How colors are turned into gray
+ * @return True if successful and false otherwise
+ */
+bool read_bmp(const string& filename, GrayImage& image, GrayWeights weights = GRAY_AVERAGE);
+
+class Rle8Decoder;
+
+/**
+ * Reads any BMP file read_bmp reads a band of rows at a time, so only the
+ * band has to fit in memory. Rows come out in image order (row 0 first,
+ * as in read_bmp), expanded to blue, green and red. Bottom-up files
+ * (including every RLE8 file) are read straight through and may come from
+ * a pipe; top-down files must be seekable.
+ */
+class BmpRowReader : public RowReader
+{
+public:
+    BmpRowReader();
+    ~BmpRowReader();
+
+    bool open_file(const string& filename);
+
+    int width() const { return header_.width; }
+    int height() const { return header_.height; }
+
+    bool read_rows(Image& band, int count);
+
+    void close_file();
+
+private:
+    BmpRowReader(const BmpRowReader&);
+    BmpRowReader& operator=(const BmpRowReader&);
+
+    int fd_;
+    BmpHeader header_;
+    int next_row_; // Index of the next image row to read
+    unsigned char palette_[BMP_PALETTE_SIZE];
+    vector<unsigned char> scanlines_;  // Scratch band of 32-bit scanlines
+    unique_ptr<Rle8Decoder> decoder_; // Set for RLE8 files
+};
+
+/**
+ * Writes a 24-bit BMP file a band of rows at a time: the headers first,
+ * then each row in image order with its padding, using vectored writes.
+ * Produces the same bytes as write_bmp. Filename "-" is standard output.
+ */
+class BmpRowWriter : public RowWriter
+{
+public:
+    BmpRowWriter();
+    ~BmpRowWriter();
+
+    bool open_file(const string& filename, int width, int height);
+
+    bool write_rows(const Image& band, int count);
+
+    bool close_file();
+
+private:
+    BmpRowWriter(const BmpRowWriter&);
+    BmpRowWriter& operator=(const BmpRowWriter&);
+
+    int fd_;
+    int width_;
+    int height_;
+    int rows_written_;
+    bool failed_;
+};
+
+/**
+ * Builds the BMP and DIB headers of a bottom-up 24-bit or 8-bit BMP file.
+ * @param bytes          Receives the BMP_HEADERS_SIZE header bytes, followed
+ *                       for 8 bits by a BMP_PALETTE_SIZE gray palette
+ * @param width          Width of the image in pixels
+ * @param height         Height of the image in pixels
+ * @param bits_per_pixel 24, or 8 for a gray image
+ */
+void make_bmp_header(unsigned char bytes[], int width, int height, int bits_per_pixel = 24);
+
+/**
+ * Writes an image to a 24-bit BMP file. Regular files have their blocks
+ * reserved up front (posix_fallocate), then are mapped and filled one
+ * padded scanline at a time; pipes, devices, standard output (filename
+ * "-") and files whose blocks cannot be reserved are written with vectored
+ * writes. Both paths produce the same bytes.
+ * @param filename The BMP file name to save the image to
+ * @param image    The input image to save
+ * @return True if successful and false otherwise
+ */
+bool write_bmp(const string& filename, const Image& image);
+
+// Writes a gray image to an 8-bit BMP file with a gray palette, in the same way
+bool write_bmp(const string& filename, const GrayImage& image);
+
+// The BMP entry of the codec registry (see codec.h)
+const ImageCodec& bmp_codec();
+
+#endif
@@ -0,0 +1,131 @@
+#include <cstdlib>
+#include <new>
+#include "buffer_pool.h"
+#include "image_buffer.h"
+
+using namespace std;
+
+BufferPool::BufferPool(size_t limit)
+{
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+    stats_.idle_bytes = 0;
+    stats_.limit_bytes = limit;
+}
+
+BufferPool::~BufferPool()
+{
+    for (list<Buffer>::iterator it = idle_.begin(); it != idle_.end(); ++it)
+    {
+        free(it->data);
+    }
+}
+
+unsigned char* BufferPool::acquire(size_t bytes, bool& reused)
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        for (list<Buffer>::iterator it = idle_.begin(); it != idle_.end(); ++it)
+        {
+            if (it->bytes == bytes)
+            {
+                unsigned char* data = it->data;
+                stats_.idle_bytes -= bytes;
+                stats_.hits++;
+                idle_.erase(it);
+                reused = true;
+                return data;
+            }
+        }
+        stats_.misses++;
+    }
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, IMAGE_ALIGNMENT, bytes) != 0)
+    {
+        // Idle buffers of other sizes may be what is in the way
+        {
+            lock_guard<mutex> lock(lock_);
+            trim(0);
+        }
+        if (posix_memalign(&memory, IMAGE_ALIGNMENT, bytes) != 0)
+        {
+            throw bad_alloc();
+        }
+    }
+    reused = false;
+    return static_cast<unsigned char*>(memory);
+}
+
+void BufferPool::release(unsigned char* data, size_t bytes)
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+
+    lock_guard<mutex> lock(lock_);
+    if (bytes > stats_.limit_bytes)
+    {
+        free(data);
+        stats_.evictions++;
+        return;
+    }
+    Buffer buffer = {bytes, data};
+    idle_.push_front(buffer);
+    stats_.idle_bytes += bytes;
+    trim(stats_.limit_bytes);
+}
+
+void BufferPool::trim(size_t keep)
+{
+    while (stats_.idle_bytes > keep)
+    {
+        free(idle_.back().data);
+        stats_.idle_bytes -= idle_.back().bytes;
+        stats_.evictions++;
+        idle_.pop_back();
+    }
+}
+
+void BufferPool::set_limit(size_t limit)
+{
+    lock_guard<mutex> lock(lock_);
+    stats_.limit_bytes = limit;
+    trim(limit);
+}
+
+void BufferPool::clear()
+{
+    lock_guard<mutex> lock(lock_);
+    for (list<Buffer>::iterator it = idle_.begin(); it != idle_.end(); ++it)
+    {
+        free(it->data);
+    }
+    idle_.clear();
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+    stats_.idle_bytes = 0;
+}
+
+PoolStats BufferPool::stats() const
+{
+    lock_guard<mutex> lock(lock_);
+    return stats_;
+}
+
+// DEFAULT_POOL_LIMIT, unless overridden by the IMAGE_EDITOR_POOL_MB environment variable
+static size_t default_pool_limit()
+{
+    const char* value = getenv("IMAGE_EDITOR_POOL_MB");
+    return value != nullptr ? static_cast<size_t>(atol(value)) << 20 : DEFAULT_POOL_LIMIT;
+}
+
+BufferPool& image_pool()
+{
+    // Never destroyed, so images in other static objects can still be released at exit
+    static BufferPool* pool = new BufferPool(default_pool_limit());
+    return *pool;
+}
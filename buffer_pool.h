@@ -0,0 +1,78 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+
+using namespace std;
+
+// Most bytes of idle buffers the image pool keeps by default
+const size_t DEFAULT_POOL_LIMIT = 256 << 20;
+
+// Counts of a pool's activity since it was created or last cleared
+struct PoolStats
+{
+    size_t hits;        // Requests served by an idle buffer
+    size_t misses;      // Requests that needed a new allocation
+    size_t evictions;   // Idle buffers freed to stay under the limit
+    size_t idle_bytes;  // Bytes held by idle buffers now
+    size_t limit_bytes; // Most bytes of idle buffers kept
+};
+
+/**
+ * Recycles IMAGE_ALIGNMENT-aligned pixel buffers. A released buffer is
+ * kept, and the next request for a buffer of exactly the same size (the
+ * same row stride times height, so the same dimensions) gets it back
+ * without calling the allocator. Idle buffers are freed, least recently
+ * released first, whenever they would hold more than the limit. Safe to
+ * use from several threads.
+ */
+class BufferPool
+{
+public:
+    explicit BufferPool(size_t limit);
+    ~BufferPool();
+
+    /**
+     * A buffer of the given size: an idle one of exactly that size if there
+     * is one, otherwise a new one. Its contents are undefined.
+     * @param bytes  Size of the buffer, more than 0
+     * @param reused Set to true if the buffer was idle in the pool
+     * @return The buffer; throws bad_alloc if none can be allocated
+     */
+    unsigned char* acquire(size_t bytes, bool& reused);
+
+    // Returns a buffer from acquire to the pool (or frees it, if it cannot be kept under the limit)
+    void release(unsigned char* data, size_t bytes);
+
+    // Sets the most bytes of idle buffers to keep, freeing any over it; 0 turns the pool off
+    void set_limit(size_t limit);
+
+    // Frees every idle buffer and resets the counts
+    void clear();
+
+    PoolStats stats() const;
+
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    struct Buffer
+    {
+        size_t bytes;
+        unsigned char* data;
+    };
+
+    // Frees the least recently released buffers until the idle ones hold at most keep bytes; lock_ must be held
+    void trim(size_t keep);
+
+    mutable mutex lock_;
+    list<Buffer> idle_; // Most recently released first
+    PoolStats stats_;
+};
+
+// The pool behind every Image's pixels; its limit starts at IMAGE_EDITOR_POOL_MB mebibytes if set, else DEFAULT_POOL_LIMIT
+BufferPool& image_pool();
+
+#endif
@@ -0,0 +1,219 @@
+#include "codec.h"
+#include "bmp.h"
+#include "pnm.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// The registry, with the built-in formats first
+static vector<ImageCodec>& codecs()
+{
+    static vector<ImageCodec> registered = { bmp_codec(), pnm_codec() };
+    return registered;
+}
+
+void register_codec(const ImageCodec& codec)
+{
+    codecs().push_back(codec);
+}
+
+const vector<ImageCodec>& image_codecs()
+{
+    return codecs();
+}
+
+// True if the name ends in one of the space-separated extensions, in any case
+static bool has_extension(const string& filename, const char* extensions)
+{
+    size_t dot = filename.rfind('.');
+    if (dot == string::npos || filename.find('/', dot) != string::npos)
+    {
+        return false;
+    }
+    string extension = filename.substr(dot);
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    string list = string(" ") + extensions + " ";
+    return list.find(" " + extension + " ") != string::npos;
+}
+
+// The format whose extension the name has, or BMP
+static const ImageCodec* codec_by_extension(const string& filename)
+{
+    const vector<ImageCodec>& all = codecs();
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        if (has_extension(filename, all[i].extensions))
+        {
+            return &all[i];
+        }
+    }
+    return &all[0];
+}
+
+// True if the name is that of an existing file that is not a regular file (a pipe or device)
+static bool is_special_file(const string& filename)
+{
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 && !S_ISREG(info.st_mode);
+}
+
+const ImageCodec* input_codec(const string& filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        return codec_by_extension(filename); // Missing files fail in the codec's reader
+    }
+
+    unsigned char bytes[SNIFF_BYTES];
+    ssize_t count = 0;
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        count = max(static_cast<ssize_t>(0), read(fd, bytes, sizeof(bytes)));
+        close(fd);
+    }
+
+    const vector<ImageCodec>& all = codecs();
+    string names;
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        if (all[i].sniff(bytes, count))
+        {
+            return &all[i];
+        }
+        names += (i == 0 ? "" : i + 1 == all.size() ? " or " : ", ") + string(all[i].name);
+    }
+    cout << "Not a " << names << " image file." << endl;
+    return nullptr;
+}
+
+const ImageCodec* output_codec(const string& filename)
+{
+    return codec_by_extension(filename);
+}
+
+bool has_image_extension(const string& filename)
+{
+    const vector<ImageCodec>& all = codecs();
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        if (has_extension(filename, all[i].extensions))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool read_image_info(const string& filename, ImageInfo& info)
+{
+    const ImageCodec* codec = input_codec(filename);
+    return codec != nullptr && codec->read_info(filename, info);
+}
+
+bool can_stream(const string& input, const string& output)
+{
+    return !(is_special_file(input) && codec_by_extension(input)->needs_seek)
+        && !((output == "-" || is_special_file(output)) && output_codec(output)->needs_seek);
+}
+
+unique_ptr<RowReader> open_row_reader(const string& filename)
+{
+    const ImageCodec* codec = input_codec(filename);
+    unique_ptr<RowReader> reader(codec != nullptr ? codec->new_row_reader() : nullptr);
+    if (reader && !reader->open_file(filename))
+    {
+        reader.reset();
+    }
+    return reader;
+}
+
+unique_ptr<RowWriter> open_row_writer(const string& filename, int width, int height)
+{
+    unique_ptr<RowWriter> writer(output_codec(filename)->new_row_writer());
+    if (!writer->open_file(filename, width, height))
+    {
+        writer.reset();
+    }
+    return writer;
+}
+
+bool read_fully(int fd, void* buffer, size_t count)
+{
+    unsigned char* position = static_cast<unsigned char*>(buffer);
+    while (count > 0)
+    {
+        ssize_t got = read(fd, position, count);
+        if (got <= 0)
+        {
+            return false;
+        }
+        position += got;
+        count -= got;
+    }
+    return true;
+}
+
+bool readv_fully(int fd, struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t got = readv(fd, iov, count);
+        if (got <= 0)
+        {
+            return false;
+        }
+
+        // Drop the buffers that were filled and advance into a partly filled one
+        while (count > 0 && static_cast<size_t>(got) >= iov->iov_len)
+        {
+            got -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = static_cast<unsigned char*>(iov->iov_base) + got;
+            iov->iov_len -= got;
+        }
+    }
+    return true;
+}
+
+bool write_fully(int fd, const void* buffer, size_t count)
+{
+    struct iovec iov = { const_cast<void*>(buffer), count };
+    return writev_fully(fd, &iov, 1);
+}
+
+bool writev_fully(int fd, struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t done = writev(fd, iov, count);
+        if (done < 0)
+        {
+            return false;
+        }
+
+        // Drop the buffers that were written and advance into a partly written one
+        while (count > 0 && static_cast<size_t>(done) >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = static_cast<unsigned char*>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
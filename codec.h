@@ -0,0 +1,138 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
+#include "image_buffer.h"
+#include "kernels.h"
+
+using namespace std;
+
+// Bytes read from the start of a regular file to recognize its format
+const int SNIFF_BYTES = 16;
+
+// Dimensions of an image file, read from its header without decoding the pixels
+struct ImageInfo
+{
+    int width;
+    int height;
+};
+
+/**
+ * Reads an image file a band of rows at a time, so only the band has to
+ * fit in memory. Rows come out in image order (row 0, the bottom of the
+ * picture, first), decoded to blue, green and red bytes. Each codec
+ * derives its own.
+ */
+class RowReader
+{
+public:
+    virtual ~RowReader() {}
+
+    // Opens the file and reads its headers; prints a message and returns false if it cannot be streamed
+    virtual bool open_file(const string& filename) = 0;
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    /**
+     * Reads the next count rows of the image into rows 0 to count - 1 of
+     * band, which must be width() pixels wide and at least count rows tall.
+     * @return True if successful and false otherwise
+     */
+    virtual bool read_rows(Image& band, int count) = 0;
+
+    virtual void close_file() = 0;
+};
+
+// Writes an image file a band of rows at a time, taking rows in image order
+class RowWriter
+{
+public:
+    virtual ~RowWriter() {}
+
+    // Creates the file and writes the headers for a width x height image; prints a message if the file cannot be streamed
+    virtual bool open_file(const string& filename, int width, int height) = 0;
+
+    // Appends rows 0 to count - 1 of band, which must be as wide as the image
+    virtual bool write_rows(const Image& band, int count) = 0;
+
+    // Closes the file; false if any write failed or not every row was written
+    virtual bool close_file() = 0;
+};
+
+/**
+ * A file format: how to recognize it and its readers and writers. The
+ * whole-image functions behave as read_bmp and write_bmp do, printing a
+ * message when a file is in the format but cannot be read. Color images
+ * and gray images may be written as different variants of the format.
+ */
+struct ImageCodec
+{
+    const char* name;       // Shown in messages, e.g. "BMP"
+    const char* extensions; // Lower-case file name extensions that select the format for writing, space separated
+    bool needs_seek;        // Rows are stored top first, so streams in image order need regular files
+
+    // True if a file whose first count bytes (up to SNIFF_BYTES) are bytes is in this format
+    bool (*sniff)(const unsigned char bytes[], size_t count);
+
+    bool (*read_info)(const string& filename, ImageInfo& info);
+    bool (*read)(const string& filename, Image& image);
+    bool (*read_gray)(const string& filename, GrayImage& image, GrayWeights weights);
+    bool (*write)(const string& filename, const Image& image);
+    bool (*write_gray)(const string& filename, const GrayImage& image);
+
+    // New, unopened row streams for the format
+    RowReader* (*new_row_reader)();
+    RowWriter* (*new_row_writer)();
+};
+
+/**
+ * Adds a format to the registry, after the built-in BMP and PGM/PPM
+ * codecs. Call it before any image is read or written; the registry is
+ * not locked.
+ */
+void register_codec(const ImageCodec& codec);
+
+// The registered formats, BMP first
+const vector<ImageCodec>& image_codecs();
+
+/**
+ * Picks the format of an input file. Regular files are recognized by
+ * their first bytes; pipes and devices, which cannot be read twice, by the
+ * extension of their name. Names with no known extension are taken as
+ * BMP.
+ * @return The format, or nullptr (after printing a message) if a regular file is in none of them
+ */
+const ImageCodec* input_codec(const string& filename);
+
+// The format an output file is written in, chosen by its extension; BMP for other names and standard output ("-")
+const ImageCodec* output_codec(const string& filename);
+
+// True if the name ends in the extension of a registered format, in any case
+bool has_image_extension(const string& filename);
+
+// Reads the dimensions of an image file in any registered format; prints a message if it cannot be read
+bool read_image_info(const string& filename, ImageInfo& info);
+
+// True if a streamed run can read input and write output: formats stored top first need regular files
+bool can_stream(const string& input, const string& output);
+
+// Opens a row stream over an input file in any registered format; nullptr if it cannot be streamed
+unique_ptr<RowReader> open_row_reader(const string& filename);
+
+// Creates an output file in the format output_codec picks and opens a row stream to it; nullptr on failure
+unique_ptr<RowWriter> open_row_writer(const string& filename, int width, int height);
+
+// File helpers shared by the codecs, retrying short transfers; false on error (or, for reads, end of file)
+bool read_fully(int fd, void* buffer, size_t count);
+bool readv_fully(int fd, struct iovec* iov, int count);
+bool write_fully(int fd, const void* buffer, size_t count);
+bool writev_fully(int fd, struct iovec* iov, int count);
+
+// Maximum number of buffers handed to a single readv() or writev() call
+const int MAX_IOVECS = 1024;
+
+#endif
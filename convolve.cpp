@@ -0,0 +1,607 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "convolve.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// Repeats the first and last of width pixels into the left pixels before them and the right pixels after them
+static void pad_edges(unsigned char* line, int width, int left, int right, int channels)
+{
+    unsigned char* first = line + static_cast<size_t>(left) * channels;
+    unsigned char* last = first + static_cast<size_t>(width - 1) * channels;
+    for (int k = 1; k <= left; k++)
+    {
+        memcpy(first - k * channels, first, channels);
+    }
+    for (int k = 1; k <= right; k++)
+    {
+        memcpy(last + k * channels, last, channels);
+    }
+}
+
+/**
+ * Rounds weights to RESAMPLE_SHIFT fixed point, padded with zeros to taps.
+ * The rounding error goes to the largest weight, so the fixed-point
+ * weights sum to their rounded total and flat areas stay flat.
+ */
+static vector<short> fixed_weights(const vector<double>& values, int taps)
+{
+    vector<short> weights(taps, 0);
+    double total = 0;
+    int sum = 0, largest = 0;
+    for (size_t k = 0; k < values.size(); k++)
+    {
+        weights[k] = static_cast<short>(lround(values[k] * (1 << RESAMPLE_SHIFT)));
+        total += values[k];
+        sum += weights[k];
+        largest = fabs(values[k]) > fabs(values[largest]) ? static_cast<int>(k) : largest;
+    }
+    weights[largest] += static_cast<short>(lround(total * (1 << RESAMPLE_SHIFT)) - sum);
+    return weights;
+}
+
+bool separate_kernel(const ConvolutionKernel& kernel, vector<double>& column, vector<double>& row)
+{
+    int pivot = 0;
+    for (size_t k = 0; k < kernel.values.size(); k++)
+    {
+        pivot = fabs(kernel.values[k]) > fabs(kernel.values[pivot]) ? static_cast<int>(k) : pivot;
+    }
+    int pivot_row = pivot / kernel.width, pivot_column = pivot % kernel.width;
+    double largest = kernel.values[pivot];
+
+    column.resize(kernel.height);
+    row.resize(kernel.width);
+    for (int k = 0; k < kernel.height; k++)
+    {
+        column[k] = kernel.values[k * kernel.width + pivot_column];
+    }
+    for (int j = 0; j < kernel.width; j++)
+    {
+        row[j] = largest != 0 ? kernel.values[pivot_row * kernel.width + j] / largest : 0;
+    }
+
+    for (int k = 0; k < kernel.height; k++)
+    {
+        for (int j = 0; j < kernel.width; j++)
+        {
+            if (fabs(column[k] * row[j] - kernel.values[k * kernel.width + j]) > 1e-9 * fabs(largest))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Two-pass convolution by a column of non-negative weights summing to 1
+ * (top first) and then a row of weights under 2 in magnitude (left first).
+ * Each output row is the vertical pass over its column.size() source rows,
+ * clamped at the edges, into a scratch row padded with the edge pixels,
+ * then the horizontal pass along it. The vertical result is a weighted
+ * average of bytes, so nothing is lost by storing it as bytes.
+ */
+template <class ImageType>
+static void convolve_separable(const ImageType& image, ImageType& dst, const vector<double>& column, const vector<double>& row)
+{
+    if (&image == &dst) // Every output row reads the rows around it
+    {
+        ImageType result;
+        convolve_separable(image, result, column, row);
+        dst.swap(result);
+        return;
+    }
+    const int CHANNELS = ImageType::CHANNELS;
+    int width = image.width();
+    int height = image.height();
+    dst.reshape(width, height);
+
+    int column_taps = static_cast<int>(column.size());
+    int column_half = column_taps / 2;
+    int row_half = static_cast<int>(row.size()) / 2;
+    int row_taps = static_cast<int>(row.size()) + 1; // resample_row takes an even number of taps
+    const vector<short> column_weights = fixed_weights(column, column_taps);
+    const vector<short> one_row = fixed_weights(row, row_taps);
+
+    // resample_row takes weights for every output pixel; here they are all the same
+    vector<short> row_weights(static_cast<size_t>(width) * row_taps);
+    vector<int> starts(width);
+    for (int j = 0; j < width; j++)
+    {
+        copy(one_row.begin(), one_row.end(), row_weights.begin() + static_cast<size_t>(j) * row_taps);
+        starts[j] = j;
+    }
+
+    const FilterKernels& kernels = active_kernels();
+    const FilterKernels& row_kernels = active_kernels(ImageType::Format::FORMAT);
+    bool vertical = column_taps > 1;
+    bool horizontal = row_half > 0 || one_row[0] != 1 << RESAMPLE_SHIFT;
+
+    parallel_rows(height, image.row_bytes() * (column_taps + 1), [&](int begin, int end)
+    {
+        // The vertical pass's result, with the edge pixels repeated for the horizontal pass and a pixel to spare
+        vector<unsigned char> line(static_cast<size_t>(width + 2 * row_half + 2) * CHANNELS);
+        unsigned char* middle = line.data() + static_cast<size_t>(row_half) * CHANNELS;
+        vector<const unsigned char*> sources(column_taps);
+        for (int i = begin; i < end; i++)
+        {
+            unsigned char* out = horizontal ? middle : dst.row(i);
+            if (vertical)
+            {
+                for (int k = 0; k < column_taps; k++) // Tap k is k - column_half rows below the top of the column
+                {
+                    sources[k] = image.row(min(max(i + column_half - k, 0), height - 1));
+                }
+                kernels.resample_columns(sources.data(), column_weights.data(), column_taps, out, static_cast<int>(image.row_bytes()));
+            }
+            else
+            {
+                memcpy(out, image.row(i), image.row_bytes());
+            }
+
+            if (horizontal)
+            {
+                pad_edges(line.data(), width, row_half, row_half + 1, CHANNELS);
+                row_kernels.resample_row(line.data(), dst.row(i), width, starts.data(), row_weights.data(), row_taps);
+            }
+        }
+    });
+}
+
+// Any kernel, summed directly in RESAMPLE_SHIFT fixed point: each row of the kernel over a padded copy of its source row
+template <class ImageType>
+static void convolve_direct(const ImageType& image, ImageType& dst, const ConvolutionKernel& kernel)
+{
+    if (&image == &dst)
+    {
+        ImageType result;
+        convolve_direct(image, result, kernel);
+        dst.swap(result);
+        return;
+    }
+    const int CHANNELS = ImageType::CHANNELS;
+    int width = image.width();
+    int height = image.height();
+    int bytes = static_cast<int>(image.row_bytes());
+    dst.reshape(width, height);
+
+    int half_width = kernel.width / 2, half_height = kernel.height / 2;
+    vector<int> weights(kernel.values.size());
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        weights[k] = static_cast<int>(lround(kernel.values[k] * (1 << RESAMPLE_SHIFT)));
+    }
+
+    parallel_rows(height, image.row_bytes() * (kernel.height + 1), [&](int begin, int end)
+    {
+        vector<unsigned char> line(static_cast<size_t>(width + 2 * half_width) * CHANNELS);
+        vector<int> sums(bytes);
+        for (int i = begin; i < end; i++)
+        {
+            fill(sums.begin(), sums.end(), 1 << (RESAMPLE_SHIFT - 1));
+            for (int k = 0; k < kernel.height; k++)
+            {
+                memcpy(line.data() + static_cast<size_t>(half_width) * CHANNELS,
+                       image.row(min(max(i + half_height - k, 0), height - 1)), image.row_bytes());
+                pad_edges(line.data(), width, half_width, half_width, CHANNELS);
+                for (int j = 0; j < kernel.width; j++)
+                {
+                    int weight = weights[k * kernel.width + j];
+                    const unsigned char* in = line.data() + static_cast<size_t>(j) * CHANNELS;
+                    for (int x = 0; weight != 0 && x < bytes; x++)
+                    {
+                        sums[x] += weight * in[x];
+                    }
+                }
+            }
+
+            unsigned char* out = dst.row(i);
+            for (int x = 0; x < bytes; x++)
+            {
+                int value = sums[x] >> RESAMPLE_SHIFT;
+                out[x] = static_cast<unsigned char>(value < 0 ? 0 : value > 255 ? 255 : value);
+            }
+        }
+    });
+}
+
+/**
+ * Horizontal box pass. The window's totals are slid along the row into
+ * totals, one per byte, with the edge pixels standing in for those past
+ * the ends; that loop carries a dependency from pixel to pixel, so the
+ * rounding to bytes is left to a second, SIMD pass (box_columns, with
+ * nothing added or taken away).
+ */
+template <int CHANNELS>
+static void box_row(const unsigned char* src, unsigned char* dst, int* totals, int width, int radius, float scale,
+                    const FilterKernels& kernels)
+{
+    // The window of pixel 0 holds pixel 0 radius + 1 times, pixels 1 to radius, and the last pixel for any past the end
+    int sums[CHANNELS];
+    int last = width - 1;
+    int inside = min(radius, last);
+    for (int c = 0; c < CHANNELS; c++)
+    {
+        sums[c] = (radius + 1) * src[c] + (radius - inside) * src[CHANNELS * last + c];
+    }
+    for (int k = 1; k <= inside; k++)
+    {
+        for (int c = 0; c < CHANNELS; c++)
+        {
+            sums[c] += src[CHANNELS * k + c];
+        }
+    }
+
+    for (int j = 0; j < width; j++)
+    {
+        const unsigned char* entering = src + CHANNELS * min(j + radius + 1, last);
+        const unsigned char* leaving = src + CHANNELS * max(j - radius, 0);
+        for (int c = 0; c < CHANNELS; c++)
+        {
+            totals[CHANNELS * j + c] = sums[c];
+            sums[c] += entering[c] - leaving[c];
+        }
+    }
+    kernels.box_columns(totals, src, src, dst, scale, CHANNELS * width);
+}
+
+// Adds count times each byte of a row to the totals
+static void add_row(int* sums, const unsigned char* row, int count, int bytes)
+{
+    for (int x = 0; x < bytes; x++)
+    {
+        sums[x] += count * row[x];
+    }
+}
+
+/**
+ * Box blur with separate horizontal and vertical radii. Each band of rows
+ * starts from the column totals of its first row's window, its halo of
+ * y_radius rows either side (the edge rows counted once for every row
+ * past the edge), and box_columns slides them down the band. Bands are
+ * made long enough that building the first window is a small part of
+ * their work.
+ */
+template <class ImageType>
+static void box_image(const ImageType& image, ImageType& dst, int x_radius, int y_radius)
+{
+    if (&image == &dst) // Every output row reads the rows around it
+    {
+        ImageType result;
+        box_image(image, result, x_radius, y_radius);
+        dst.swap(result);
+        return;
+    }
+    const int CHANNELS = ImageType::CHANNELS;
+    int width = image.width();
+    int height = image.height();
+    int bytes = static_cast<int>(image.row_bytes());
+    dst.reshape(width, height);
+
+    const FilterKernels& kernels = active_kernels();
+    float x_scale = 1.0f / (2 * x_radius + 1);
+    float y_scale = 1.0f / (2 * y_radius + 1);
+    int window = min(2 * y_radius + 1, height);
+    int grain = max((height + 2 * thread_count() - 1) / (2 * thread_count()), min(8 * window, height));
+
+    filter_pool().parallel_for(height, grain, [&](int begin, int end)
+    {
+        vector<unsigned char> line(x_radius > 0 && y_radius > 0 ? bytes : 0);
+        vector<int> sums(y_radius > 0 ? bytes : 0);
+        vector<int> totals(x_radius > 0 ? bytes : 0);
+        if (y_radius > 0)
+        {
+            int first = begin - y_radius, last = begin + y_radius;
+            for (int k = max(first, 0); k <= min(last, height - 1); k++)
+            {
+                int count = 1 + (k == 0 ? max(-first, 0) : 0) + (k == height - 1 ? max(last - (height - 1), 0) : 0);
+                add_row(sums.data(), image.row(k), count, bytes);
+            }
+        }
+
+        for (int i = begin; i < end; i++)
+        {
+            const unsigned char* in = image.row(i);
+            if (y_radius > 0)
+            {
+                unsigned char* out = x_radius > 0 ? line.data() : dst.row(i);
+                kernels.box_columns(sums.data(), image.row(min(i + y_radius + 1, height - 1)), image.row(max(i - y_radius, 0)),
+                                    out, y_scale, bytes);
+                in = out;
+            }
+            if (x_radius > 0)
+            {
+                box_row<CHANNELS>(in, dst.row(i), totals.data(), width, x_radius, x_scale, kernels);
+            }
+            else if (y_radius == 0)
+            {
+                memcpy(dst.row(i), in, bytes);
+            }
+        }
+    });
+}
+
+// The weights of a Gaussian sampled out to 3 sigma, summing to 1
+static vector<double> gaussian_weights(double sigma)
+{
+    int radius = max(1, static_cast<int>(ceil(3 * sigma)));
+    vector<double> weights(2 * radius + 1);
+    double total = 0;
+    for (int k = -radius; k <= radius; k++)
+    {
+        weights[k + radius] = exp(-0.5 * k * k / (sigma * sigma));
+        total += weights[k + radius];
+    }
+    for (size_t k = 0; k < weights.size(); k++)
+    {
+        weights[k] /= total;
+    }
+    return weights;
+}
+
+/**
+ * The radii of three box blurs whose combined variance is closest to
+ * sigma^2: the first passes use the largest odd width under the ideal one
+ * and the rest the next odd width up.
+ */
+static void gaussian_boxes(double sigma, int radii[3])
+{
+    double variance = 12 * sigma * sigma;
+    int lower = static_cast<int>(sqrt(variance / 3 + 1));
+    lower -= lower % 2 == 0 ? 1 : 0;
+    int narrow = static_cast<int>(lround((variance - 3.0 * lower * lower - 12.0 * lower - 9) / (-4.0 * lower - 4)));
+    for (int i = 0; i < 3; i++)
+    {
+        radii[i] = min(((i < narrow ? lower : lower + 2) - 1) / 2, MAX_BLUR_RADIUS);
+    }
+}
+
+int gaussian_reach(double sigma)
+{
+    sigma = min(sigma, MAX_BLUR_SIGMA);
+    if (sigma <= GAUSSIAN_BOX_SIGMA)
+    {
+        return static_cast<int>(gaussian_weights(sigma).size() / 2);
+    }
+    int radii[3];
+    gaussian_boxes(sigma, radii);
+    return radii[0] + radii[1] + radii[2];
+}
+
+template <class ImageType>
+static void gaussian_image(const ImageType& image, ImageType& dst, double sigma)
+{
+    sigma = min(sigma, MAX_BLUR_SIGMA);
+    if (sigma <= GAUSSIAN_BOX_SIGMA)
+    {
+        vector<double> weights = gaussian_weights(sigma);
+        convolve_separable(image, dst, weights, weights);
+        return;
+    }
+
+    // Three box passes, back and forth between dst and a scratch image (dst is only written once the image is read)
+    int radii[3];
+    gaussian_boxes(sigma, radii);
+    ImageType scratch = ImageType::uninitialized(image.width(), image.height());
+    box_image(image, scratch, radii[0], radii[0]);
+    box_image(scratch, dst, radii[1], radii[1]);
+    box_image(dst, scratch, radii[2], radii[2]);
+    dst.swap(scratch);
+}
+
+template <class ImageType>
+static void unsharp_image(const ImageType& image, ImageType& dst, double amount, double sigma)
+{
+    ImageType blurred;
+    gaussian_image(image, blurred, sigma);
+    dst.reshape(image.width(), image.height());
+
+    const FilterKernels& kernels = active_kernels();
+    int fixed = static_cast<int>(lround(min(max(amount, 0.0), 100.0) * 256));
+    parallel_rows(image.height(), image.row_bytes() * 3, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            kernels.unsharp(image.row(i), blurred.row(i), dst.row(i), fixed, static_cast<int>(image.row_bytes()));
+        }
+    });
+}
+
+// Sobel edges over padded copies of each output row's three source rows, kept in turn as the band moves up
+template <class ImageType>
+static void sobel_image(const ImageType& image, ImageType& dst)
+{
+    if (&image == &dst)
+    {
+        ImageType result;
+        sobel_image(image, result);
+        dst.swap(result);
+        return;
+    }
+    const int CHANNELS = ImageType::CHANNELS;
+    int width = image.width();
+    int height = image.height();
+    int bytes = static_cast<int>(image.row_bytes());
+    dst.reshape(width, height);
+    const FilterKernels& kernels = active_kernels();
+
+    parallel_rows(height, image.row_bytes() * 4, [&](int begin, int end)
+    {
+        size_t padded = static_cast<size_t>(width + 2) * CHANNELS;
+        vector<unsigned char> lines(3 * padded);
+        unsigned char* rows[3] = { lines.data(), lines.data() + padded, lines.data() + 2 * padded }; // Below, row, above
+
+        // Copies source row k (clamped to the image) into a padded line
+        auto load = [&](unsigned char* line, int k)
+        {
+            memcpy(line + CHANNELS, image.row(min(max(k, 0), height - 1)), bytes);
+            pad_edges(line, width, 1, 1, CHANNELS);
+        };
+        load(rows[0], begin - 1);
+        load(rows[1], begin);
+        for (int i = begin; i < end; i++)
+        {
+            load(rows[2], i + 1);
+            kernels.sobel(rows[2] + CHANNELS, rows[1] + CHANNELS, rows[0] + CHANNELS, dst.row(i), bytes, CHANNELS);
+            rotate(rows, rows + 1, rows + 3); // The row becomes the one below, and the one above the row
+        }
+    });
+}
+
+// An empty image is copied unchanged by every filter
+template <class ImageType>
+static bool copied_if_empty(const ImageType& image, ImageType& dst)
+{
+    if (image.width() > 0 && image.height() > 0)
+    {
+        return false;
+    }
+    if (&image != &dst)
+    {
+        dst = image;
+    }
+    return true;
+}
+
+template <class ImageType>
+static bool convolve_image(const ImageType& image, ImageType& dst, const ConvolutionKernel& kernel)
+{
+    double magnitude = 0;
+    for (size_t k = 0; k < kernel.values.size(); k++)
+    {
+        magnitude += fabs(kernel.values[k]);
+    }
+    if (kernel.width % 2 == 0 || kernel.height % 2 == 0 || kernel.width < 1 || kernel.height < 1
+        || kernel.values.size() != static_cast<size_t>(kernel.width) * kernel.height || magnitude >= 256)
+    {
+        return false;
+    }
+    if (copied_if_empty(image, dst))
+    {
+        return true;
+    }
+
+    vector<double> column, row;
+    if (separate_kernel(kernel, column, row))
+    {
+        // Move the column's sum into the row, so the vertical pass is a weighted average of bytes
+        double total = 0;
+        for (size_t k = 0; k < column.size(); k++)
+        {
+            total += column[k];
+        }
+        bool averages = total != 0;
+        for (size_t k = 0; k < column.size(); k++)
+        {
+            column[k] /= averages ? total : 1;
+            averages = averages && column[k] >= 0;
+        }
+        bool fits = true, equal = true;
+        for (size_t j = 0; j < row.size(); j++)
+        {
+            row[j] *= total;
+            fits = fits && fabs(row[j]) * (1 << RESAMPLE_SHIFT) < 32767;
+            equal = equal && fabs(row[j] - row[0]) < 1e-9;
+        }
+        for (size_t k = 0; k < column.size(); k++)
+        {
+            equal = equal && fabs(column[k] - column[0]) < 1e-9;
+        }
+
+        if (averages && equal && fabs(row[0] * row.size() - 1) < 1e-9)
+        {
+            box_image(image, dst, kernel.width / 2, kernel.height / 2);
+            return true;
+        }
+        if (averages && fits)
+        {
+            convolve_separable(image, dst, column, row);
+            return true;
+        }
+    }
+    convolve_direct(image, dst, kernel);
+    return true;
+}
+
+bool convolve(const Image& image, Image& dst, const ConvolutionKernel& kernel)
+{
+    return convolve_image(image, dst, kernel);
+}
+
+bool convolve(const GrayImage& image, GrayImage& dst, const ConvolutionKernel& kernel)
+{
+    return convolve_image(image, dst, kernel);
+}
+
+template <class ImageType>
+static void box_blur_image(const ImageType& image, ImageType& dst, int radius)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        radius = min(max(radius, 0), MAX_BLUR_RADIUS);
+        box_image(image, dst, radius, radius);
+    }
+}
+
+void box_blur(const Image& image, Image& dst, int radius)
+{
+    box_blur_image(image, dst, radius);
+}
+
+void box_blur(const GrayImage& image, GrayImage& dst, int radius)
+{
+    box_blur_image(image, dst, radius);
+}
+
+void gaussian_blur(const Image& image, Image& dst, double sigma)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        gaussian_image(image, dst, sigma);
+    }
+}
+
+void gaussian_blur(const GrayImage& image, GrayImage& dst, double sigma)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        gaussian_image(image, dst, sigma);
+    }
+}
+
+void unsharp_mask(const Image& image, Image& dst, double amount, double sigma)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        unsharp_image(image, dst, amount, sigma);
+    }
+}
+
+void unsharp_mask(const GrayImage& image, GrayImage& dst, double amount, double sigma)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        unsharp_image(image, dst, amount, sigma);
+    }
+}
+
+void sobel_edges(const Image& image, Image& dst)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        sobel_image(image, dst);
+    }
+}
+
+void sobel_edges(const GrayImage& image, GrayImage& dst)
+{
+    if (!copied_if_empty(image, dst))
+    {
+        sobel_image(image, dst);
+    }
+}
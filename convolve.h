@@ -0,0 +1,104 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include <vector>
+#include "image_buffer.h"
+
+using namespace std;
+
+// Largest box blur radius: the window totals stay exact in single precision (255 * (2 * radius + 1) < 2^24)
+const int MAX_BLUR_RADIUS = 32767;
+
+// Largest Gaussian standard deviation, whose three box passes stay within MAX_BLUR_RADIUS
+const double MAX_BLUR_SIGMA = 10000;
+
+// Standard deviations up to this blur with the sampled Gaussian; larger ones with three box passes
+const double GAUSSIAN_BOX_SIGMA = 3;
+
+/**
+ * A convolution kernel of odd width and height. values[k * width + j]
+ * weights the pixel k - height / 2 rows above and j - width / 2 columns
+ * right of the output pixel, so the rows are listed top first, as the
+ * kernel is usually written. Pixels past the edges repeat the edge pixel.
+ */
+struct ConvolutionKernel
+{
+    int width;
+    int height;
+    vector<double> values;
+};
+
+/**
+ * Splits a kernel into a column and a row whose product it is, if it is
+ * separable (of rank 1): the kernel's column and row through its largest
+ * value, checked against every value in turn.
+ * @param kernel The kernel to split
+ * @param column Receives the height weights of the column, top first
+ * @param row    Receives the width weights of the row, left first
+ * @return True if every value is the product of its row's and column's weights
+ */
+bool separate_kernel(const ConvolutionKernel& kernel, vector<double>& column, vector<double>& row);
+
+/**
+ * Convolves an image with a kernel, channel by channel, rounding and
+ * clamping the results to bytes. Separable kernels are found with
+ * separate_kernel and run as two passes per output row, as resample does:
+ * a vertical pass over the source rows the row needs (its halo), into a
+ * scratch row, then a horizontal pass along it, both in the SIMD
+ * resampling kernels with 14-bit weights. A separable kernel of equal
+ * weights summing to 1 is a box and runs in box_blur's sliding window.
+ * Other kernels are summed directly. Bands of output rows are spread
+ * over the filter thread pool.
+ * @param image  The input image
+ * @param dst    Receives the result, the image's size; may be image
+ * @param kernel The kernel, with weights whose magnitudes sum to under 256
+ * @return False if the kernel's sizes are not odd or its weights too large
+ */
+bool convolve(const Image& image, Image& dst, const ConvolutionKernel& kernel);
+bool convolve(const GrayImage& image, GrayImage& dst, const ConvolutionKernel& kernel);
+
+/**
+ * Averages each pixel with the (2 radius + 1)^2 pixels around it. The
+ * window's column totals are kept for a band of rows and slid down one
+ * row at a time (adding the row that enters and subtracting the one that
+ * leaves, in the SIMD box_columns kernel), and each row's totals are slid
+ * along it in the same way, so the cost per pixel does not depend on the
+ * radius.
+ * @param radius Radius of the window, 0 to MAX_BLUR_RADIUS
+ */
+void box_blur(const Image& image, Image& dst, int radius);
+void box_blur(const GrayImage& image, GrayImage& dst, int radius);
+
+/**
+ * Gaussian blur with the standard deviation given, in pixels. Up to
+ * GAUSSIAN_BOX_SIGMA the kernel is sampled out to 3 sigma and run as a
+ * separable convolution; wider blurs are three box blurs whose sizes give
+ * the same variance, which keeps the cost per pixel constant.
+ * @param sigma Standard deviation, over 0 and at most MAX_BLUR_SIGMA
+ */
+void gaussian_blur(const Image& image, Image& dst, double sigma);
+void gaussian_blur(const GrayImage& image, GrayImage& dst, double sigma);
+
+// How many pixels on each side of a pixel its gaussian_blur (and unsharp_mask) result depends on
+int gaussian_reach(double sigma);
+
+/**
+ * Unsharp mask: adds amount times the difference between the image and
+ * its Gaussian blur back to the image, sharpening detail of about sigma
+ * pixels.
+ * @param amount Strength, 0 to 100 (in steps of 1/256)
+ * @param sigma  Standard deviation of the blur, as for gaussian_blur
+ */
+void unsharp_mask(const Image& image, Image& dst, double amount, double sigma);
+void unsharp_mask(const GrayImage& image, GrayImage& dst, double amount, double sigma);
+
+/**
+ * Sobel edge detection, channel by channel: each value becomes
+ * |gx| + |gy| (clamped to 255), the horizontal and vertical gradients of
+ * the separable 3 x 3 Sobel kernels, computed in one pass in the SIMD
+ * sobel kernel.
+ */
+void sobel_edges(const Image& image, Image& dst);
+void sobel_edges(const GrayImage& image, GrayImage& dst);
+
+#endif
@@ -0,0 +1,151 @@
+#include <cstring>
+#include "hash.h"
+
+using namespace std;
+
+// The XXH64 primes
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotate_left(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads, whatever the machine's order (memcpy compiles to a plain load)
+static inline uint64_t load64(const unsigned char* bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint32_t load32(const unsigned char* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline uint64_t round64(uint64_t lane, uint64_t word)
+{
+    lane += word * PRIME2;
+    return rotate_left(lane, 31) * PRIME1;
+}
+
+static inline uint64_t merge_lane(uint64_t hash, uint64_t lane)
+{
+    hash ^= round64(0, lane);
+    return hash * PRIME1 + PRIME4;
+}
+
+// Takes blocks of 32 bytes into the four lanes; returns the bytes taken
+static size_t take_blocks(uint64_t* lanes, const unsigned char* bytes, size_t size)
+{
+    uint64_t a = lanes[0], b = lanes[1], c = lanes[2], d = lanes[3];
+    size_t taken = 0;
+    for (; taken + 32 <= size; taken += 32)
+    {
+        a = round64(a, load64(bytes + taken));
+        b = round64(b, load64(bytes + taken + 8));
+        c = round64(c, load64(bytes + taken + 16));
+        d = round64(d, load64(bytes + taken + 24));
+    }
+    lanes[0] = a;
+    lanes[1] = b;
+    lanes[2] = c;
+    lanes[3] = d;
+    return taken;
+}
+
+Hash64::Hash64(uint64_t seed) : buffered_(0), total_(0), seed_(seed)
+{
+    lanes_[0] = seed + PRIME1 + PRIME2;
+    lanes_[1] = seed + PRIME2;
+    lanes_[2] = seed;
+    lanes_[3] = seed - PRIME1;
+}
+
+void Hash64::update(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    total_ += size;
+    if (buffered_ + size < 32)
+    {
+        memcpy(buffer_ + buffered_, bytes, size);
+        buffered_ += size;
+        return;
+    }
+    if (buffered_ > 0) // Complete the block begun by an earlier call
+    {
+        size_t fill = 32 - buffered_;
+        memcpy(buffer_ + buffered_, bytes, fill);
+        take_blocks(lanes_, buffer_, 32);
+        bytes += fill;
+        size -= fill;
+        buffered_ = 0;
+    }
+    size_t taken = take_blocks(lanes_, bytes, size);
+    buffered_ = size - taken;
+    memcpy(buffer_, bytes + taken, buffered_);
+}
+
+uint64_t Hash64::digest() const
+{
+    uint64_t hash;
+    if (total_ >= 32)
+    {
+        hash = rotate_left(lanes_[0], 1) + rotate_left(lanes_[1], 7) + rotate_left(lanes_[2], 12) + rotate_left(lanes_[3], 18);
+        for (int l = 0; l < 4; l++)
+        {
+            hash = merge_lane(hash, lanes_[l]);
+        }
+    }
+    else
+    {
+        hash = seed_ + PRIME5;
+    }
+    hash += total_;
+
+    // The last bytes: 8, then 4, then 1 at a time
+    size_t i = 0;
+    for (; i + 8 <= buffered_; i += 8)
+    {
+        hash ^= round64(0, load64(buffer_ + i));
+        hash = rotate_left(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (i + 4 <= buffered_)
+    {
+        hash ^= static_cast<uint64_t>(load32(buffer_ + i)) * PRIME1;
+        hash = rotate_left(hash, 23) * PRIME2 + PRIME3;
+        i += 4;
+    }
+    for (; i < buffered_; i++)
+    {
+        hash ^= buffer_[i] * PRIME5;
+        hash = rotate_left(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed)
+{
+    Hash64 hash(seed);
+    hash.update(data, size);
+    return hash.digest();
+}
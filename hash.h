@@ -0,0 +1,38 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * A 64-bit hash of a stream of bytes, by the XXH64 algorithm (xxHash):
+ * four lanes of 8-byte words are multiplied and rotated independently, so
+ * it runs at several bytes per cycle, and the same bytes give the same
+ * value as the reference XXH64 with the same seed however they are split
+ * between calls to update. Not a cryptographic hash.
+ */
+class Hash64
+{
+public:
+    explicit Hash64(uint64_t seed = 0);
+
+    // Adds size bytes to the stream
+    void update(const void* data, size_t size);
+
+    // The hash of the bytes added so far; more may be added afterwards
+    uint64_t digest() const;
+
+private:
+    uint64_t lanes_[4];
+    unsigned char buffer_[32]; // Bytes not yet taken into the lanes
+    size_t buffered_;
+    uint64_t total_;
+    uint64_t seed_;
+};
+
+// The XXH64 hash of size bytes
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+#endif
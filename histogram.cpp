@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "histogram.h"
+#include "kernels.h"
+#include "lut.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+using namespace std;
+
+int ChannelHistogram::percentile(double fraction) const
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+    double wanted = ceil(std::min(std::max(fraction, 0.0), 1.0) * total); // The members hide min and max
+    size_t needed = std::min(std::max(static_cast<size_t>(wanted), static_cast<size_t>(1)), total);
+    size_t seen = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        seen += counts[v];
+        if (seen >= needed)
+        {
+            return v;
+        }
+    }
+    return 255;
+}
+
+// Takes the total, min, max and mean from the counts
+static void finish_channel(ChannelHistogram& histogram)
+{
+    histogram.total = 0;
+    histogram.min = 0;
+    histogram.max = 0;
+    double sum = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        if (histogram.counts[v] == 0)
+        {
+            continue;
+        }
+        if (histogram.total == 0)
+        {
+            histogram.min = v;
+        }
+        histogram.max = v;
+        histogram.total += histogram.counts[v];
+        sum += static_cast<double>(histogram.counts[v]) * v;
+    }
+    histogram.mean = histogram.total > 0 ? sum / histogram.total : 0;
+}
+
+ImageHistogram image_histogram(const Image& image)
+{
+    TRACE_SCOPE("histogram");
+    ImageHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.channels = Image::CHANNELS;
+    int width = image.width();
+    const FilterKernels& kernels = active_kernels(PIXEL_BGR8);
+    const short* weights = gray_weights(GRAY_BT601);
+    mutex merge;
+
+    parallel_rows(image.height(), image.row_bytes() + width, [&](int begin, int end)
+    {
+        // Blue, green, red and luma counts for this band, twice over: even and odd pixels count into separate
+        // tables, so neighbouring pixels of the same value do not wait on each other's increments
+        vector<unsigned int> counts(8 * 256, 0);
+        vector<unsigned char> luma(width);
+        for (int i = begin; i < end; i++)
+        {
+            const unsigned char* row = image.row(i);
+            kernels.to_gray(row, luma.data(), weights, width);
+            int j = 0;
+            for (; j + 2 <= width; j += 2)
+            {
+                const unsigned char* pair = row + 3 * j;
+                counts[pair[0]]++;
+                counts[256 + pair[1]]++;
+                counts[512 + pair[2]]++;
+                counts[768 + luma[j]]++;
+                counts[1024 + pair[3]]++;
+                counts[1280 + pair[4]]++;
+                counts[1536 + pair[5]]++;
+                counts[1792 + luma[j + 1]]++;
+            }
+            for (; j < width; j++)
+            {
+                counts[row[3 * j]]++;
+                counts[256 + row[3 * j + 1]]++;
+                counts[512 + row[3 * j + 2]]++;
+                counts[768 + luma[j]]++;
+            }
+        }
+
+        lock_guard<mutex> lock(merge);
+        for (int v = 0; v < 256; v++)
+        {
+            histogram.channel[0].counts[v] += counts[v] + counts[1024 + v];
+            histogram.channel[1].counts[v] += counts[256 + v] + counts[1280 + v];
+            histogram.channel[2].counts[v] += counts[512 + v] + counts[1536 + v];
+            histogram.luma.counts[v] += counts[768 + v] + counts[1792 + v];
+        }
+    });
+
+    for (int c = 0; c < 3; c++)
+    {
+        finish_channel(histogram.channel[c]);
+    }
+    finish_channel(histogram.luma);
+    return histogram;
+}
+
+ImageHistogram image_histogram(const GrayImage& image)
+{
+    TRACE_SCOPE("histogram");
+    ImageHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.channels = GrayImage::CHANNELS;
+    int width = image.width();
+    mutex merge;
+
+    parallel_rows(image.height(), image.row_bytes(), [&](int begin, int end)
+    {
+        // Four tables that neighbouring pixels take turns at, so runs of one value do not wait on the same count
+        vector<unsigned int> counts(4 * 256, 0);
+        for (int i = begin; i < end; i++)
+        {
+            const unsigned char* row = image.row(i);
+            int j = 0;
+            for (; j + 4 <= width; j += 4)
+            {
+                counts[row[j]]++;
+                counts[256 + row[j + 1]]++;
+                counts[512 + row[j + 2]]++;
+                counts[768 + row[j + 3]]++;
+            }
+            for (; j < width; j++)
+            {
+                counts[row[j]]++;
+            }
+        }
+
+        lock_guard<mutex> lock(merge);
+        for (int v = 0; v < 256; v++)
+        {
+            histogram.channel[0].counts[v] += counts[v] + counts[256 + v] + counts[512 + v] + counts[768 + v];
+        }
+    });
+
+    finish_channel(histogram.channel[0]);
+    histogram.luma = histogram.channel[0];
+    return histogram;
+}
+
+int otsu_threshold(const ChannelHistogram& histogram)
+{
+    double sum = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        sum += static_cast<double>(histogram.counts[v]) * v;
+    }
+
+    // Between-class variance, up to a constant factor, for values up to t against values above t
+    int threshold = 127; // No split at all: the middle
+    double best = 0, below = 0, below_sum = 0;
+    for (int t = 0; t < 255; t++)
+    {
+        below += histogram.counts[t];
+        below_sum += static_cast<double>(histogram.counts[t]) * t;
+        double above = histogram.total - below;
+        if (below == 0 || above == 0)
+        {
+            continue;
+        }
+        double difference = below_sum / below - (sum - below_sum) / above;
+        double variance = below * above * difference * difference;
+        if (variance > best)
+        {
+            best = variance;
+            threshold = t;
+        }
+    }
+    return threshold;
+}
+
+// Maps every pixel of image through the table into dst
+template <class ImageType>
+static void apply_table(const ImageType& image, ImageType& dst, const Lut& lut)
+{
+    int width = image.width();
+    dst.reshape(width, image.height());
+    parallel_rows(image.height(), image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            if (ImageType::CHANNELS == 1)
+            {
+                apply_gray_lut(lut, image.row(i), dst.row(i), width);
+            }
+            else
+            {
+                apply_lut(lut, image.row(i), dst.row(i), width);
+            }
+        }
+    });
+}
+
+// Table that stretches the channel's clip to 1 - clip percentiles over 0 to 255
+static void levels_table(const ChannelHistogram& histogram, double clip, unsigned char* table)
+{
+    int low = histogram.percentile(clip);
+    int high = histogram.percentile(1 - clip);
+    for (int v = 0; v < 256; v++)
+    {
+        int range = high - low;
+        table[v] = static_cast<unsigned char>(range <= 0 ? v : v <= low ? 0 : v >= high ? 255 : ((v - low) * 255 + range / 2) / range);
+    }
+}
+
+void auto_levels(const Image& image, Image& dst, double clip)
+{
+    TRACE_SCOPE("auto_levels");
+    ImageHistogram histogram = image_histogram(image);
+    Lut lut;
+    for (int c = 0; c < 3; c++)
+    {
+        levels_table(histogram.channel[c], clip, lut.table[c]);
+    }
+    apply_table(image, dst, lut);
+}
+
+void auto_levels(const GrayImage& image, GrayImage& dst, double clip)
+{
+    TRACE_SCOPE("auto_levels");
+    Lut lut;
+    levels_table(image_histogram(image).channel[0], clip, lut.table[0]);
+    apply_table(image, dst, lut);
+}
+
+// The table that spreads the histogram's values evenly over 0 to 255, for every channel
+static Lut equalize_table(const ChannelHistogram& histogram)
+{
+    Lut lut;
+    size_t darkest = histogram.counts[histogram.min];
+    size_t range = histogram.total - darkest; // Samples above the darkest value
+    size_t seen = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        seen += histogram.counts[v];
+        unsigned char mapped = static_cast<unsigned char>(range == 0 ? v
+            : v < histogram.min ? 0 : ((seen - darkest) * 255 + range / 2) / range);
+        lut.table[0][v] = lut.table[1][v] = lut.table[2][v] = mapped;
+    }
+    return lut;
+}
+
+void equalize(const Image& image, Image& dst)
+{
+    TRACE_SCOPE("equalize");
+    apply_table(image, dst, equalize_table(image_histogram(image).luma));
+}
+
+void equalize(const GrayImage& image, GrayImage& dst)
+{
+    TRACE_SCOPE("equalize");
+    apply_table(image, dst, equalize_table(image_histogram(image).luma));
+}
+
+void adaptive_threshold(const Image& image, Image& dst)
+{
+    TRACE_SCOPE("adaptive_threshold");
+    int threshold = otsu_threshold(image_histogram(image).luma);
+    int width = image.width();
+    dst.reshape(width, image.height());
+    const FilterKernels& kernels = active_kernels(PIXEL_BGR8);
+    const short* weights = gray_weights(GRAY_BT601);
+    parallel_rows(image.height(), image.row_bytes() * 2 + width, [&](int begin, int end)
+    {
+        vector<unsigned char> luma(width);
+        for (int i = begin; i < end; i++)
+        {
+            kernels.to_gray(image.row(i), luma.data(), weights, width); // Before the row is written, for dst == image
+            unsigned char* out = dst.row(i);
+            for (int j = 0; j < width; j++)
+            {
+                unsigned char value = luma[j] > threshold ? 255 : 0;
+                out[3 * j] = value;
+                out[3 * j + 1] = value;
+                out[3 * j + 2] = value;
+            }
+        }
+    });
+}
+
+void adaptive_threshold(const GrayImage& image, GrayImage& dst)
+{
+    TRACE_SCOPE("adaptive_threshold");
+    int threshold = otsu_threshold(image_histogram(image).luma);
+    Lut lut;
+    for (int v = 0; v < 256; v++)
+    {
+        lut.table[0][v] = v > threshold ? 255 : 0;
+    }
+    apply_table(image, dst, lut);
+}
@@ -0,0 +1,80 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+#include "image_buffer.h"
+
+using namespace std;
+
+// Default fraction of the values auto_levels clips at each end: 0.5%
+const double DEFAULT_LEVELS_CLIP = 0.005;
+
+// Counts of each value of one channel, and the statistics taken from them
+struct ChannelHistogram
+{
+    size_t counts[256]; // counts[v]: samples of value v
+    size_t total;       // Samples counted
+    int min;            // Smallest value present (0 if there are none)
+    int max;            // Largest value present (0 if there are none)
+    double mean;
+
+    // The smallest value that at least fraction (0 to 1) of the samples are at or below
+    int percentile(double fraction) const;
+};
+
+// Histograms of an image's channels and of its luma
+struct ImageHistogram
+{
+    int channels;                // 3 for an Image, 1 for a GrayImage
+    ChannelHistogram channel[3]; // Blue, green and red (only the first for a gray image)
+    ChannelHistogram luma;       // BT.601 luma, as gray=bt601 computes it (the values themselves for a gray image)
+};
+
+/**
+ * Counts the values of every channel and the luma of every pixel in a
+ * single pass over the image. Bands of rows are counted on the filter
+ * thread pool, each into its own partial histograms of 32-bit counts, which
+ * are added into the result when the band is done. A row's luma is
+ * computed into a scratch row by the SIMD to_gray kernel while the row is
+ * in cache, so the image is read from memory once.
+ */
+ImageHistogram image_histogram(const Image& image);
+ImageHistogram image_histogram(const GrayImage& image);
+
+/**
+ * The threshold that best splits a histogram into two classes by Otsu's
+ * method: the value t for which values up to t and values above t have the
+ * largest variance between their means.
+ */
+int otsu_threshold(const ChannelHistogram& histogram);
+
+/**
+ * Stretches each channel so that its clip percentile becomes 0 and its
+ * 1 - clip percentile 255 (auto-levels); a channel whose two percentiles
+ * are equal is left alone. As each channel is stretched separately, a
+ * color cast is removed along with the lack of contrast. The map is
+ * applied as a lookup table.
+ * @param clip Fraction of the values to clip at each end, 0 to 0.5
+ */
+void auto_levels(const Image& image, Image& dst, double clip = DEFAULT_LEVELS_CLIP);
+void auto_levels(const GrayImage& image, GrayImage& dst, double clip = DEFAULT_LEVELS_CLIP);
+
+/**
+ * Histogram equalization: each value v becomes 255 times the fraction of
+ * the luma histogram below or at v (rescaled so the darkest value present
+ * becomes 0), which spreads the values evenly over 0 to 255. A color
+ * image's three channels all go through the luma's map, which keeps their
+ * balance.
+ */
+void equalize(const Image& image, Image& dst);
+void equalize(const GrayImage& image, GrayImage& dst);
+
+/**
+ * Black and white by a threshold taken from the image: pixels whose luma
+ * is above the Otsu threshold of the luma histogram become white and the
+ * rest black.
+ */
+void adaptive_threshold(const Image& image, Image& dst);
+void adaptive_threshold(const GrayImage& image, GrayImage& dst);
+
+#endif
@@ -4,529 +4,790 @@
 #include <cstdlib>
 #include <string>
 #include <cmath>
+#include <utility>
+#include "image.h"
+#include "codec.h"
+#include "thread_pool.h"
+#include "kernels.h"
+#include "lut.h"
+#include "transform.h"
+#include "convolve.h"
+#include "histogram.h"
+#include "vignette.h"
+#include "trace.h"
 
 using namespace std;
 
 /**
- * Sets a value to the char array starting at the offset using the size
- * specified by the bytes.
- * This is a helper function for write_image()
- * @param arr    Array to set values for
- * @param offset Starting index offset
- * @param bytes  Number of bytes to set
- * @param value  Value to set
- */
-void set_bytes(unsigned char arr[], int offset, int bytes, int value) {
-    for (int i = 0; i < bytes; i++) {
-        arr[offset+i] = (unsigned char)(value>>(i*8));
-    }
-}
-
-/**
- * Write the input image to a BMP file name specified
- * @param filename The BMP file name to save the image to
+ * Write the input image to the file name specified, in the format its extension selects
+ * @param filename The file name to save the image to
  * @param image    The input image to save
  * @return True if successful and false otherwise
  */
-bool write_image(string filename, const vector<vector<vector<int> > >& image) {
-    // Get the image width and height in pixels
-    int width_pixels = image[0].size();
-    int height_pixels = image.size();
-
-    // Calculate the width in bytes incorporating padding (4 byte alignment)
-    int width_bytes = width_pixels * 3;
-    int padding_bytes = 0;
-    padding_bytes = (4 - width_bytes % 4) % 4;
-    width_bytes = width_bytes + padding_bytes;
-
-    // Pixel array size in bytes, including padding
-    int array_bytes = width_bytes * height_pixels;
-
-    // Open a file stream for writing to a binary file
-    fstream stream;
-    stream.open(filename, ios::out | ios::binary);
-
-    // If there was a problem opening the file, return false
-    if (!stream.is_open()) {
+bool write_image(string filename, const Image& image)
+{
+    TRACE_SCOPE("write_image");
+    return output_codec(filename)->write(filename, image);
+}
+
+// Reads the image file specified, in whichever format it is, into a contiguous image
+bool read_image(string filename, Image& image)
+{
+    TRACE_SCOPE("read_image");
+    const ImageCodec* codec = input_codec(filename);
+    if (codec == nullptr)
+    {
+        image = Image();
         return false;
     }
+    return codec->read(filename, image);
+}
+
+// Adds vignette effect to the input image, writing the result into result (which may be the input image itself)
+void process_1(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_1");
+    int height = image.height();
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+
+    shared_ptr<const VignetteMask> mask = vignette_mask(width, height); // Reused by later calls of the same size
 
-    // Create the BMP and DIB Headers
-    const int BMP_HEADER_SIZE = 14;
-    const int DIB_HEADER_SIZE = 40;
-    unsigned char bmp_header[BMP_HEADER_SIZE] = {0};
-    unsigned char dib_header[DIB_HEADER_SIZE] = {0};
-
-    // BMP Header
-    set_bytes(bmp_header,  0, 1, 'B');              // ID field
-    set_bytes(bmp_header,  1, 1, 'M');              // ID field
-    set_bytes(bmp_header,  2, 4, BMP_HEADER_SIZE+DIB_HEADER_SIZE+array_bytes); // Size of BMP file
-    set_bytes(bmp_header,  6, 2, 0);                // Reserved
-    set_bytes(bmp_header,  8, 2, 0);                // Reserved
-    set_bytes(bmp_header, 10, 4, BMP_HEADER_SIZE+DIB_HEADER_SIZE); // Pixel array offset
-
-    // DIB Header
-    set_bytes(dib_header,  0, 4, DIB_HEADER_SIZE);  // DIB header size
-    set_bytes(dib_header,  4, 4, width_pixels);     // Width of bitmap in pixels
-    set_bytes(dib_header,  8, 4, height_pixels);    // Height of bitmap in pixels
-    set_bytes(dib_header, 12, 2, 1);                // Number of color planes
-    set_bytes(dib_header, 14, 2, 24);               // Number of bits per pixel
-    set_bytes(dib_header, 16, 4, 0);                // Compression method (0=BI_RGB)
-    set_bytes(dib_header, 20, 4, array_bytes);      // Size of raw bitmap data (including padding)                     
-    set_bytes(dib_header, 24, 4, 2835);             // Print resolution of image (2835 pixels/meter)
-    set_bytes(dib_header, 28, 4, 2835);             // Print resolution of image (2835 pixels/meter)
-    set_bytes(dib_header, 32, 4, 0);                // Number of colors in palette
-    set_bytes(dib_header, 36, 4, 0);                // Number of important colors
-
-    // Write the BMP and DIB Headers to the file
-    stream.write((char*)bmp_header, sizeof(bmp_header));
-    stream.write((char*)dib_header, sizeof(dib_header));
-
-    // Initialize pixel and padding
-    unsigned char pixel[3] = {0};
-    unsigned char padding[3] = {0};
-
-    // Pixel Array (Left to right, bottom to top, with padding)
-    for (int h = 0; h < height_pixels; h++) {
-        for (int w = 0; w < width_pixels; w++) {
-            // Write the pixel (Blue, Green, Red)
-            pixel[0] = image[h][w][0];
-            pixel[1] = image[h][w][1];
-            pixel[2] = image[h][w][2];
-            stream.write((char*)pixel, 3);
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        vector<short> scratch;
+        for (int row = begin; row < end; row++) // For each row in the band
+        {
+            vignette_row(*mask, image.row(row), result.row(row), row, scratch);
         }
-        // Write the padding bytes
-        stream.write((char *)padding, padding_bytes);
-    }
+    });
+}
 
-    // Close the stream and return true
-    stream.close();
-    return true;
-}
-
-/** 
- * Gets an integer from a binary stream.
- * @param stream the stream
- * @param offset the offset at which to read the integer
- * @return the integer starting at the given offset
- */ 
-int get_int(fstream& stream, int offset)
-{
-    stream.seekg(offset);
-    int result = 0;
-    int base = 1;
-    for (int i = 0; i < 4; i++)
-    {   
-        result = result + stream.get() * base;
-        base = base * 256;
-    }
+Image process_1(const Image& image)
+{
+    Image result;
+    process_1(image, result);
     return result;
 }
 
-// Reads the BMP image specified and returns the resulting image
-vector<vector<vector<int > > > read_image(string filename)
+void process_1_inplace(Image& image)
 {
-    vector<vector<vector< int > > > empty; // Initialize 3D vector
-
-    fstream stream; // Create stream variable, read in binary file
-    stream.open(filename, ios::in | ios::out | ios::binary);
-
-    int file_size = get_int(stream, 2); // Get image dimensions
-    int start = get_int(stream, 10);
-    int width = get_int(stream, 18);
-    int height = get_int(stream, 22);
+    process_1(image, image);
+}
 
-    // Scan lines must occupy multiples of four bytes
-    int scanline_size = width * 3;
-    int padding = 0;
-    if (scanline_size % 4 != 0)
-    {
-        padding = 4 - scanline_size % 4;
-    }
+Image process_1(Image&& image)
+{
+    process_1_inplace(image);
+    return std::move(image);
+}
 
-    if (file_size != start + (scanline_size + padding) * height)
-    {
-        cout << "Not a 24-bit true color image file." << endl;
-        return empty;
-    }
-    
-    int pos = start;
+// Adds claredon effect to the input image, writing the result into result (which may be the input image itself)
+void process_2(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_2");
+    int height = image.height(); // Get image dimensions
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+    const FilterKernels& kernels = active_kernels();
 
-    for (int i = 0; i < height; i++) // For each row
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
     {
-        vector<vector<int> > w; // Create a vector for the row
-        for (int j = 0; j < width; j++) // For each column
+        for (int i = begin; i < end; i++) // For each row in the band
         {
-            stream.seekg(pos); // Move to the start position
-
-            // Extract blue, green, and red values for the pixel
-            int blue = stream.get();
-            int green = stream.get();
-            int red = stream.get();
-
-            vector<int> vals = {blue, green, red}; // Create vector for the pixel
-            w.push_back(vals); // Add pixel to column
-            
-            pos += 3; // Move over to next pixel
+            kernels.clarendon(image.row(i), result.row(i), width);
         }
+    });
+}
 
-        empty.push_back(w); // Add row to the 3D output vector
-        stream.seekg(padding, ios::cur); // Skip padding
-        pos += padding;
-    }
+Image process_2(const Image& image)
+{
+    Image result;
+    process_2(image, result);
+    return result;
+}
 
-    return empty;
+void process_2_inplace(Image& image)
+{
+    process_2(image, image);
 }
 
-// Adds vignette effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_1(const vector<vector<vector<int> > >& image)
+Image process_2(Image&& image)
 {
-    vector<vector<vector<int> > > empty; // Initialize 3D vector for result
-    int height = image.size();
-    int width = image[0].size();
+    process_2_inplace(image);
+    return std::move(image);
+}
+
+// Adds grayscale effect to the input image, writing the result into result (which may be the input image itself)
+void process_3(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_3");
+    int height = image.height(); // Get image dimensions
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+    const FilterKernels& kernels = active_kernels();
 
-    for (int row = 0; row < height; row++)
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
     {
-        vector<vector<int> > w;
-        for (int col = 0; col < width; col++)
+        for (int i = begin; i < end; i++) // For each row in the band
         {
-            vector<int> vals;
-            double distance = sqrt(pow(col - (static_cast<double>(width) / 2), 2) + pow(static_cast<double>(row) - (height / 2), 2));
-            double scaling_factor = (height - distance) / height;
-            
-            int newBlue = scaling_factor * image[row][col][0];
-            int newGreen = scaling_factor * image[row][col][1];
-            int newRed = scaling_factor * image[row][col][2];
-
-            vals.push_back(newBlue);
-            vals.push_back(newGreen);
-            vals.push_back(newRed);
-
-            w.push_back(vals);
+            kernels.grayscale(image.row(i), result.row(i), width);
         }
-        empty.push_back(w);
-    }
-    return empty;
+    });
 }
 
-// Adds claredon effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_2(const vector<vector<vector<int> > >& image)
+Image process_3(const Image& image)
 {
-    vector<vector<vector<int> > > empty; // Create output vector
-    int height = image.size(); // Get height and width for image
-    int width = image[0].size();
-    const double SCALING_FACTOR = 0.3; // Set scaling factor
+    Image result;
+    process_3(image, result);
+    return result;
+}
 
-    for (int i = 0; i < height; i++) // For each row in image
-    {
-        vector<vector<int> > w; // Create a row for the output vector
-        for (int j = 0; j < width; j++) // For each column in the row
-        {
-            vector<int> vals; // Create column for the output pixel
+void process_3_inplace(Image& image)
+{
+    process_3(image, image);
+}
 
-            // Store old RGB vals and declare new ones
-            int oldBlue = image[i][j][0], oldGreen = image[i][j][1], oldRed = image[i][j][2]; 
-            int newBlue, newGreen, newRed;
+Image process_3(Image&& image)
+{
+    process_3_inplace(image);
+    return std::move(image);
+}
 
-            double avg = (oldBlue + oldGreen + oldRed) / 3.0; // Compute average of rgb values
+// Rotates the input image by 90 degrees clockwise, writing the result into result (which may be the input image itself)
+void process_4(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_4");
+    rotate_90(image, result); // Each column in image becomes a row in the output
+}
 
-            if (avg >= 170) // If the pixel is light, make it lighter
-            {
-                newBlue = 255 - (255 - oldBlue) * SCALING_FACTOR;
-                newGreen = 255 - (255 - oldGreen) * SCALING_FACTOR;
-                newRed = 255 - (255 - oldRed) * SCALING_FACTOR;
-            }
+Image process_4(const Image& image)
+{
+    Image result;
+    process_4(image, result);
+    return result;
+}
 
-            else if (avg < 90) // If the pixel is dark, make it darker
-            {
-                newBlue = oldBlue * SCALING_FACTOR;
-                newGreen = oldGreen * SCALING_FACTOR;
-                newRed = oldRed * SCALING_FACTOR;
-            }
+void process_4_inplace(Image& image)
+{
+    process_4(image, image);
+}
 
-            else // If the pixel is moderate, keep it as it is
-            {
-                newBlue = oldBlue;
-                newGreen = oldGreen;
-                newRed = oldRed;
-            }
-            
-            vals.push_back(newBlue); // Add the new values to the pixel
-            vals.push_back(newGreen);
-            vals.push_back(newRed);
+Image process_4(Image&& image)
+{
+    Image source(std::move(image)); // Back to the pool as soon as the result is made
+    return process_4(source);
+}
 
-            w.push_back(vals); // Add the new pixel to the row
+// Rotates image by the specified multiple of 90 degrees clockwise, writing the result into result (which may be the input image itself)
+void process_5(const Image& image, Image& result, int number)
+{
+    TRACE_SCOPE("process_5");
+    rotate(image, result, number); // The number of turns mod 4 picks the rotation once for the whole image
+}
 
-        }
-        empty.push_back(w); // Add the row to the output vector
+Image process_5(const Image& image, int number)
+{
+    Image result;
+    process_5(image, result, number);
+    return result;
+}
+
+void process_5_inplace(Image& image, int number)
+{
+    process_5(image, image, number);
+}
+
+Image process_5(Image&& image, int number)
+{
+    process_5_inplace(image, number);
+    return std::move(image);
+}
+
+// Enlarges the input image in the x and y direction by the scales specified, writing the result into result (which may be the input image itself)
+void process_6(const Image& image, Image& result, int x_scale, int y_scale)
+{
+    TRACE_SCOPE("process_6");
+    if (&image == &result) // The input is read until the last row is written
+    {
+        Image enlarged;
+        process_6(image, enlarged, x_scale, y_scale);
+        result.swap(enlarged);
+        return;
     }
-    return empty;
+    result.reshape(image.width() * x_scale, image.height() * y_scale); // Create output image, unless result already is one of this size
+
+    // Each row is widened once and the copies below it are copied whole
+    enlarge_rows(image, image.height(), result, x_scale, y_scale);
 }
 
-// Adds grayscale effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_3(const vector<vector<vector<int> > >& image)
+Image process_6(const Image& image, int x_scale, int y_scale)
 {
-    vector<vector<vector<int> > > empty; // Create output vector
+    Image result;
+    process_6(image, result, x_scale, y_scale);
+    return result;
+}
 
-    int height = image.size(); // Get dimensions of image
-    int width = image[0].size();
+Image process_6(Image&& image, int x_scale, int y_scale)
+{
+    Image source(std::move(image)); // Back to the pool as soon as the result is made
+    return process_6(source, x_scale, y_scale);
+}
+
+// Converts the input image to high contrast, writing the result into result (which may be the input image itself)
+void process_7(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_7");
+    int height = image.height(); // Get image dimensions
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+    const FilterKernels& kernels = active_kernels();
 
-    for (int i = 0; i < height; i++) // For each row in image
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
     {
-        vector<vector<int> > w; // Create row for output vector
-        for (int j = 0; j < width; j++) // For each pixel in image
+        for (int i = begin; i < end; i++) // For each row in the band
         {
-            vector<int> vals; // Create vector for the RGB values
+            kernels.high_contrast(image.row(i), result.row(i), width);
+        }
+    });
+}
+
+Image process_7(const Image& image)
+{
+    Image result;
+    process_7(image, result);
+    return result;
+}
+
+void process_7_inplace(Image& image)
+{
+    process_7(image, image);
+}
 
-            // Gray value is the average of the RGB values
-            int gray = (image[i][j][0] + image[i][j][1] + image[i][j][2]) / 3;
+Image process_7(Image&& image)
+{
+    process_7_inplace(image);
+    return std::move(image);
+}
 
-            vals.push_back(gray); // RGB values for the new pixel are all the gray value
-            vals.push_back(gray);
-            vals.push_back(gray);
+// Lightens the input image, writing the result into result (which may be the input image itself)
+void process_8(const Image& image, Image& result, double scaling_factor)
+{
+    TRACE_SCOPE("process_8");
+    int height = image.height(); // Get image dimensions
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+    const Lut lut = lighten_lut(scaling_factor); // The new value of every channel depends only on its old value
 
-            w.push_back(vals); // Add new pixel to the row
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            apply_lut(lut, image.row(i), result.row(i), width);
         }
-        empty.push_back(w); // Add new row to the output vector
-    }
+    });
+}
 
-    return empty;
+Image process_8(const Image& image, double scaling_factor)
+{
+    Image result;
+    process_8(image, result, scaling_factor);
+    return result;
 }
 
-// Rotates the input image by 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_4(const vector<vector<vector<int> > >& image)
+void process_8_inplace(Image& image, double scaling_factor)
 {
-    int height = image.size(); // Find dimensions of image
-    int width = image[0].size();
-    vector<vector<vector<int> > > empty; // Create 3D output vector
+    process_8(image, image, scaling_factor);
+}
+
+Image process_8(Image&& image, double scaling_factor)
+{
+    process_8_inplace(image, scaling_factor);
+    return std::move(image);
+}
+
+// Darkens image the input image, writing the result into result (which may be the input image itself)
+void process_9(const Image& image, Image& result, double scaling_factor)
+{
+    TRACE_SCOPE("process_9");
+    int height = image.height(); // Get image dimensions
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+    const Lut lut = darken_lut(scaling_factor); // The new value of every channel depends only on its old value
 
-    for (int i = 0; i < width; i++) // For each column in image, create a row in the output vector
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
     {
-        vector<vector<int > > row;
-        for (int j = 0; j < height; j++) // For each row in image, create a column in the output vector
+        for (int i = begin; i < end; i++) // For each row in the band
         {
-            vector<int> vals = {0,0,0}; // Add an empty pixel at each column
-            row.push_back(vals);
+            apply_lut(lut, image.row(i), result.row(i), width);
         }
-        empty.push_back(row);
-    }
-    for (int x = 0; x < height; x++) // For each row in image 
+    });
+}
+
+Image process_9(const Image& image, double scaling_factor)
+{
+    Image result;
+    process_9(image, result, scaling_factor);
+    return result;
+}
+
+void process_9_inplace(Image& image, double scaling_factor)
+{
+    process_9(image, image, scaling_factor);
+}
+
+Image process_9(Image&& image, double scaling_factor)
+{
+    process_9_inplace(image, scaling_factor);
+    return std::move(image);
+}
+
+// Converts the input image to black, white, red, blue, and green only, writing the result into result (which may be the input image itself)
+void process_10(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_10");
+    int height = image.height(); // Get image dimensions
+    int width = image.width();
+    result.reshape(width, height); // Create output image, unless result already is one of this size
+    const FilterKernels& kernels = active_kernels();
+
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
         {
-            for (int y = 0; y < width; y++) // For each pixel in row
-            {
-                empty[width - 1 - y][x] = image[x][y]; // Rotate pixel 90 degrees
-            }
+            kernels.primary_colors(image.row(i), result.row(i), width);
         }
+    });
+}
 
-    return empty;
+Image process_10(const Image& image)
+{
+    Image result;
+    process_10(image, result);
+    return result;
 }
 
-// Rotates image by the specified multiple of 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_5(const vector<vector<vector<int> > >& image, int number)
+void process_10_inplace(Image& image)
 {
-    vector<vector<vector<int> > > empty; // Create output vector
+    process_10(image, image);
+}
 
-    if (number % 4 == 0) // If the number of rotations mod 4 is 0, the image isn't rotated
-    {
-        empty = image;
-    }
+Image process_10(Image&& image)
+{
+    process_10_inplace(image);
+    return std::move(image);
+}
 
-    else if (number % 4 == 1) // If number mod 4 is 1, rotate once
-    {
-        empty = process_4(image);
-    }
+// Resizes the input image to width x height pixels with the filter specified, writing the result into result (which may be the input image itself)
+void process_11(const Image& image, Image& result, int width, int height, ResampleFilter filter)
+{
+    TRACE_SCOPE("process_11");
+    resample(image, result, width, height, filter);
+}
 
-    else if (number % 4 == 2) // If number mod 4 is 2, rotate twice
-    {
-        empty = process_4(process_4(image));
-    }
+Image process_11(const Image& image, int width, int height, ResampleFilter filter)
+{
+    Image result;
+    process_11(image, result, width, height, filter);
+    return result;
+}
+
+Image process_11(Image&& image, int width, int height, ResampleFilter filter)
+{
+    Image source(std::move(image)); // Back to the pool as soon as the result is made
+    return process_11(source, width, height, filter);
+}
+
+// Blurs the input image with a box of the radius specified, writing the result into result (which may be the input image itself)
+void process_13(const Image& image, Image& result, int radius)
+{
+    TRACE_SCOPE("process_13");
+    box_blur(image, result, radius); // Constant cost per pixel at any radius
+}
+
+Image process_13(const Image& image, int radius)
+{
+    Image result;
+    process_13(image, result, radius);
+    return result;
+}
+
+void process_13_inplace(Image& image, int radius)
+{
+    process_13(image, image, radius);
+}
+
+Image process_13(Image&& image, int radius)
+{
+    process_13_inplace(image, radius);
+    return std::move(image);
+}
+
+// Blurs the input image with a Gaussian of the standard deviation specified, writing the result into result (which may be the input image itself)
+void process_14(const Image& image, Image& result, double sigma)
+{
+    TRACE_SCOPE("process_14");
+    gaussian_blur(image, result, sigma);
+}
+
+Image process_14(const Image& image, double sigma)
+{
+    Image result;
+    process_14(image, result, sigma);
+    return result;
+}
+
+void process_14_inplace(Image& image, double sigma)
+{
+    process_14(image, image, sigma);
+}
+
+Image process_14(Image&& image, double sigma)
+{
+    process_14_inplace(image, sigma);
+    return std::move(image);
+}
+
+// Sharpens the input image with an unsharp mask, writing the result into result (which may be the input image itself)
+void process_15(const Image& image, Image& result, double amount, double sigma)
+{
+    TRACE_SCOPE("process_15");
+    unsharp_mask(image, result, amount, sigma);
+}
+
+Image process_15(const Image& image, double amount, double sigma)
+{
+    Image result;
+    process_15(image, result, amount, sigma);
+    return result;
+}
+
+void process_15_inplace(Image& image, double amount, double sigma)
+{
+    process_15(image, image, amount, sigma);
+}
+
+Image process_15(Image&& image, double amount, double sigma)
+{
+    process_15_inplace(image, amount, sigma);
+    return std::move(image);
+}
+
+// Replaces the input image with its Sobel edges, writing the result into result (which may be the input image itself)
+void process_16(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_16");
+    sobel_edges(image, result);
+}
+
+Image process_16(const Image& image)
+{
+    Image result;
+    process_16(image, result);
+    return result;
+}
 
-    else // If number mod 4 is 3, rotate thrice
+void process_16_inplace(Image& image)
+{
+    process_16(image, image);
+}
+
+Image process_16(Image&& image)
+{
+    process_16_inplace(image);
+    return std::move(image);
+}
+
+// Stretches each channel of the input image over 0 to 255 (see auto_levels in histogram.h), writing the result into result (which may be the input image itself)
+void process_17(const Image& image, Image& result, double clip)
+{
+    TRACE_SCOPE("process_17");
+    auto_levels(image, result, clip);
+}
+
+Image process_17(const Image& image, double clip)
+{
+    Image result;
+    process_17(image, result, clip);
+    return result;
+}
+
+void process_17_inplace(Image& image, double clip)
+{
+    process_17(image, image, clip);
+}
+
+Image process_17(Image&& image, double clip)
+{
+    process_17_inplace(image, clip);
+    return std::move(image);
+}
+
+// Equalizes the histogram of the input image, writing the result into result (which may be the input image itself)
+void process_18(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_18");
+    equalize(image, result);
+}
+
+Image process_18(const Image& image)
+{
+    Image result;
+    process_18(image, result);
+    return result;
+}
+
+void process_18_inplace(Image& image)
+{
+    process_18(image, image);
+}
+
+Image process_18(Image&& image)
+{
+    process_18_inplace(image);
+    return std::move(image);
+}
+
+// Converts the input image to black and white at its Otsu threshold, writing the result into result (which may be the input image itself)
+void process_19(const Image& image, Image& result)
+{
+    TRACE_SCOPE("process_19");
+    adaptive_threshold(image, result);
+}
+
+Image process_19(const Image& image)
+{
+    Image result;
+    process_19(image, result);
+    return result;
+}
+
+void process_19_inplace(Image& image)
+{
+    process_19(image, image);
+}
+
+Image process_19(Image&& image)
+{
+    process_19_inplace(image);
+    return std::move(image);
+}
+
+bool write_image(string filename, const GrayImage& image)
+{
+    TRACE_SCOPE("write_image");
+    return output_codec(filename)->write_gray(filename, image);
+}
+
+bool read_image(string filename, GrayImage& image, GrayWeights weights)
+{
+    TRACE_SCOPE("read_image");
+    const ImageCodec* codec = input_codec(filename);
+    if (codec == nullptr)
     {
-        empty = process_4(process_4(process_4(image)));
+        image = GrayImage();
+        return false;
     }
-    
-    return empty;
+    return codec->read_gray(filename, image, weights);
 }
 
-// Enlarges the input image in the x and y direction by the scales specified and returns the resulting image
-vector<vector<vector<int> > > process_6(const vector<vector<vector<int> > >& image, int x_scale, int y_scale)
+void to_gray(const Image& image, GrayImage& dst, GrayWeights weights)
 {
-    vector<vector<vector<int> > > empty; // Create output vector
-    int height = image.size(); // Get image dimensions
-    int width = image[0].size();
-    for (int i = 0; i < (height * y_scale); i++) // For row in image, add y_scale rows to output
+    TRACE_SCOPE("to_gray");
+    int height = image.height();
+    int width = image.width();
+    dst.reshape(width, height);
+    const FilterKernels& kernels = active_kernels();
+    const short* luma = gray_weights(weights);
+
+    parallel_rows(height, image.row_bytes() + dst.row_bytes(), [&](int begin, int end)
     {
-        vector<vector<int> > w;
-        for (int j = 0; j < (width * x_scale); j++) // For col in image, add x_scale pixels to output
+        for (int i = begin; i < end; i++) // For each row in the band
         {
-            vector<int> pxl;
-
-            // Calculate RGB values for output
-            int blueval = image[i / y_scale][j / x_scale][0];
-            int greenval = image[i / y_scale][j / x_scale][1];
-            int redval = image[i / y_scale][j / x_scale][2];
+            kernels.to_gray(image.row(i), dst.row(i), luma, width);
+        }
+    });
+}
 
-            // Add new values to pixel
-            pxl.push_back(blueval);
-            pxl.push_back(greenval);
-            pxl.push_back(redval);
+GrayImage to_gray(const Image& image, GrayWeights weights)
+{
+    GrayImage result;
+    to_gray(image, result, weights);
+    return result;
+}
 
-            w.push_back(pxl); // Add pixel to row
+void to_color(const GrayImage& image, Image& dst)
+{
+    int height = image.height();
+    int width = image.width();
+    dst.reshape(width, height);
 
+    parallel_rows(height, image.row_bytes() + dst.row_bytes(), [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            const unsigned char* in = image.row(i);
+            unsigned char* out = dst.row(i);
+            for (int j = 0; j < width; j++)
+            {
+                out[3 * j] = out[3 * j + 1] = out[3 * j + 2] = in[j];
+            }
         }
-        empty.push_back(w); // Add row to output
-    }
-    return empty;
+    });
 }
 
-// Converts the input image to high contrast and returns the resulting image
-vector<vector<vector<int> > > process_7(const vector<vector<vector<int> > >& image)
+Image to_color(const GrayImage& image)
+{
+    Image result;
+    to_color(image, result);
+    return result;
+}
+
+
+//
+// Compatibility adapter for the nested-vector image layout
+//
+
+// Copies a nested-vector image into a contiguous image (values are stored as bytes, as write_image does)
+Image to_image(const vector<vector<vector<int> > >& image)
 {
-    vector<vector<vector<int> > > empty; // Create output vector
-    int height = image.size(); // Get image dimensions
+    if (image.empty())
+    {
+        return Image();
+    }
+
+    int height = image.size();
     int width = image[0].size();
+    Image result(width, height);
 
-    for (int i = 0; i < height; i++) // For each row in image, add a row to output
+    for (int i = 0; i < height; i++)
     {
-        vector<vector<int> > w;
-        for (int j = 0; j < width; j++) // For each col in image, add pixel to output
+        for (int j = 0; j < width; j++)
         {
-            vector<int> pxl;
-            double avg = (image[i][j][0] + image[i][j][1] + image[i][j][2]) / 3; // Find average RGB value of pixel in image
+            unsigned char* pixel = result.pixel(i, j);
+            pixel[0] = image[i][j][0];
+            pixel[1] = image[i][j][1];
+            pixel[2] = image[i][j][2];
+        }
+    }
+    return result;
+}
 
-            if (avg >= (255 / 2.0)) // If pixel is light, make it lighter
-            {
-                pxl = {255,255,255};
-            }
+// Copies a contiguous image into a nested-vector image
+vector<vector<vector<int> > > to_vector(const Image& image)
+{
+    vector<vector<vector<int> > > empty(image.height()); // Create 3D output vector
 
-            else // If pixel is dark, make it darker
-            {
-                pxl = {0,0,0};
-            }
-            
-            w.push_back(pxl); // Add pixel to row
+    for (int i = 0; i < image.height(); i++)
+    {
+        empty[i].reserve(image.width());
+        for (int j = 0; j < image.width(); j++)
+        {
+            const unsigned char* pixel = image.pixel(i, j);
+            vector<int> vals = {pixel[0], pixel[1], pixel[2]};
+            empty[i].push_back(vals);
         }
-        empty.push_back(w); // Add row to output
     }
     return empty;
 }
 
-// Lightens the input image and returns the resulting image
-vector<vector<vector<int> > > process_8(const vector<vector<vector<int> > >& image, double scaling_factor)
+bool write_image(string filename, const vector<vector<vector<int> > >& image)
 {
-    vector<vector<vector<int> > > empty;
-    int height = image.size(); // Get image dimensions
-    int width = image[0].size();
+    return write_image(filename, to_image(image));
+}
 
-    for (int i = 0; i < height; i++) // For each row in image, add a row to output
-    {
-        vector<vector<int> > w;
-        for (int j = 0; j < width; j++) // For each col in image, add pixel to output
-        {
-            vector<int> pxl;
+vector<vector<vector<int> > > read_image(string filename)
+{
+    Image image;
+    read_image(filename, image);
+    return to_vector(image);
+}
 
-            // Scale old RGB values with scaling factor
-            double blueScaled = (255 - image[i][j][0]) * scaling_factor;
-            double greenScaled = (255 - image[i][j][1]) * scaling_factor;
-            double redScaled = (255 - image[i][j][2]) * scaling_factor;
+vector<vector<vector<int> > > process_1(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_1(to_image(image)));
+}
 
-            // Set new pixel to the lightened RGB values
-            int newBlue = static_cast<int>(255 - blueScaled);
-            int newGreen = static_cast<int>(255 - greenScaled);
-            int newRed = static_cast<int>(255 - redScaled);
+vector<vector<vector<int> > > process_2(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_2(to_image(image)));
+}
 
-            pxl.push_back(newBlue);
-            pxl.push_back(newGreen);
-            pxl.push_back(newRed);
+vector<vector<vector<int> > > process_3(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_3(to_image(image)));
+}
 
-            w.push_back(pxl); // Add pixel to row
-        }
-        empty.push_back(w); // Add row to output
-    }
-    return empty;
+vector<vector<vector<int> > > process_4(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_4(to_image(image)));
 }
 
-// Darkens image the input image and returns the resulting image
-vector<vector<vector<int> > > process_9(const vector<vector<vector<int> > >& image, double scaling_factor)
+vector<vector<vector<int> > > process_5(const vector<vector<vector<int> > >& image, int number)
 {
-    vector<vector<vector<int> > > empty;
-    int height = image.size(); // Get image dimensions
-    int width = image[0].size();
+    return to_vector(process_5(to_image(image), number));
+}
 
-    for (int i = 0; i < height; i++) // For each row in image, add a row to output
-    {
-        vector<vector<int> > w;
-        for (int j = 0; j < width; j++) // For each col in image, add pixel to output
-        {
-            vector<int> pxl;
+vector<vector<vector<int> > > process_6(const vector<vector<vector<int> > >& image, int x_scale, int y_scale)
+{
+    return to_vector(process_6(to_image(image), x_scale, y_scale));
+}
 
-            // Reduce (darken) old RGB values by the scaling factor
-            int newBlue = static_cast<int>(image[i][j][0] * scaling_factor);
-            int newGreen = static_cast<int>(image[i][j][1] * scaling_factor);
-            int newRed = static_cast<int>(image[i][j][2] * scaling_factor);
+vector<vector<vector<int> > > process_7(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_7(to_image(image)));
+}
 
-            pxl.push_back(newBlue); // Add darkened values to pixel
-            pxl.push_back(newGreen);
-            pxl.push_back(newRed);
+vector<vector<vector<int> > > process_8(const vector<vector<vector<int> > >& image, double scaling_factor)
+{
+    return to_vector(process_8(to_image(image), scaling_factor));
+}
 
-            w.push_back(pxl); // Add pixel to row
-        }
-        empty.push_back(w); // Add row to output
-    }
-    return empty;
+vector<vector<vector<int> > > process_9(const vector<vector<vector<int> > >& image, double scaling_factor)
+{
+    return to_vector(process_9(to_image(image), scaling_factor));
 }
 
-// Converts the input image to black, white, red, blue, and green only and returns the resulting image
 vector<vector<vector<int> > > process_10(const vector<vector<vector<int> > >& image)
 {
-    vector<vector<vector<int> > > empty;
-    int height = image.size(); // Get image dimensions
-    int width = image[0].size();
-
-    for (int i = 0; i < height; i++) // For each row in image, add a row to output
-    {
-        vector<vector<int> > w;
-        for (int j = 0; j < width; j++) // For each col in image, add pixel to output
-        {
-            vector<int> pixel;
+    return to_vector(process_10(to_image(image)));
+}
 
-            int oldBlue = image[i][j][0]; // Store old RGB values
-            int oldGreen = image[i][j][1];
-            int oldRed = image[i][j][2];
-            int totalRGB = oldBlue + oldGreen + oldRed; // Find total RGB value
+vector<vector<vector<int> > > process_11(const vector<vector<vector<int> > >& image, int width, int height, ResampleFilter filter)
+{
+    return to_vector(process_11(to_image(image), width, height, filter));
+}
 
+vector<vector<vector<int> > > process_13(const vector<vector<vector<int> > >& image, int radius)
+{
+    return to_vector(process_13(to_image(image), radius));
+}
 
-            if (totalRGB >= 550) // If total is 550 or more, set pixel to white
-            {
-                pixel = {255,255,255};
-            }
+vector<vector<vector<int> > > process_14(const vector<vector<vector<int> > >& image, double sigma)
+{
+    return to_vector(process_14(to_image(image), sigma));
+}
 
-            else if (totalRGB <= 150) // If total is 150 or less, set pixel to black
-            {
-                pixel = {0,0,0};
-            }
+vector<vector<vector<int> > > process_15(const vector<vector<vector<int> > >& image, double amount, double sigma)
+{
+    return to_vector(process_15(to_image(image), amount, sigma));
+}
 
-            else if (oldRed > oldBlue && oldRed > oldGreen) // Set pixel to whichever color has the highest value
-            {
-                pixel = {0,0,255};
-            }
-            
-            else if (oldGreen > oldBlue && oldGreen > oldRed)
-            {
-                pixel = {0,255,0};
-            }
+vector<vector<vector<int> > > process_16(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_16(to_image(image)));
+}
 
-            else
-            {
-                pixel = {255,0,0};
-            }
-            
-            w.push_back(pixel); // Add pixel to row
-        }
-        empty.push_back(w); // Add row to output
-    }
-    return empty;
+vector<vector<vector<int> > > process_17(const vector<vector<vector<int> > >& image, double clip)
+{
+    return to_vector(process_17(to_image(image), clip));
 }
 
+vector<vector<vector<int> > > process_18(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_18(to_image(image)));
+}
 
+vector<vector<vector<int> > > process_19(const vector<vector<vector<int> > >& image)
+{
+    return to_vector(process_19(to_image(image)));
+}
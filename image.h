@@ -3,49 +3,207 @@
 
 #include <vector>
 #include <fstream>
+#include <string>
+#include "image_buffer.h"
+#include "kernels.h"
+#include "resample.h"
 
 using namespace std;
 
 /**
- * Write the input image to a BMP file name specified
- * @param filename The BMP file name to save the image to
+ * Write the input image to the file name specified, as a PPM file if the
+ * name ends in .ppm, .pgm or .pnm and as a 24-bit BMP otherwise (see
+ * output_codec in codec.h)
+ * @param filename The file name to save the image to
  * @param image    The input image to save
  * @return True if successful and false otherwise
  */
-bool write_image(string filename, const vector<vector<vector<int> > >& image);
+bool write_image(string filename, const Image& image);
 
-// Reads the BMP image specified and returns the resulting image
-vector<vector<vector<int> > > read_image(string filename);
+/**
+ * Reads the image file specified into a contiguous image, in whichever
+ * registered format its first bytes show (BMP of 8, 24 or 32 bits, RLE8,
+ * or binary PGM or PPM; see input_codec in codec.h)
+ * @param filename The file name to read
+ * @param image    Receives the decoded image
+ * @return True if successful and false otherwise
+ */
+bool read_image(string filename, Image& image);
+
+//
+// Every process comes in up to four forms:
+//   Image process_N(const Image& image, ...)            returns a new image and leaves the input alone
+//   void process_N(const Image& image, Image& dst, ...) writes into dst, keeping dst's buffer if it is
+//                                                       already the result's size; dst may be image
+//   void process_N_inplace(Image& image, ...)           replaces the image with the result
+//   Image process_N(Image&& image, ...)                 takes over the input's buffer: the point operations
+//                                                       (1 to 3, 7 to 10 and 17 to 19) and half turns write into
+//                                                       it, the others return it to the buffer pool once the
+//                                                       result is made
+// The point operations and half turns work in place with no second buffer; so do the histogram operations
+// (17 to 19), which count the image's values in one pass and then map them. Quarter turns and the
+// neighbourhood filters (13 to 16), which read the pixels around each one, build the result in a new
+// buffer in place and then swap it in. Enlarging and resizing change the size, so they have no _inplace form.
+//
 
 // Adds vignette effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_1(const vector<vector<vector<int> > >& image);
+Image process_1(const Image& image);
+void process_1(const Image& image, Image& dst);
+void process_1_inplace(Image& image);
+Image process_1(Image&& image);
 
 // Adds claredon effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_2(const vector<vector<vector<int> > >& image);
+Image process_2(const Image& image);
+void process_2(const Image& image, Image& dst);
+void process_2_inplace(Image& image);
+Image process_2(Image&& image);
 
 // Adds grayscale effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_3(const vector<vector<vector<int> > >& image);
+Image process_3(const Image& image);
+void process_3(const Image& image, Image& dst);
+void process_3_inplace(Image& image);
+Image process_3(Image&& image);
 
 // Rotates the input image by 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_4(const vector<vector<vector<int> > >& image);
+Image process_4(const Image& image);
+void process_4(const Image& image, Image& dst);
+void process_4_inplace(Image& image);
+Image process_4(Image&& image);
 
 // Rotates image by the specified multiple of 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_5(const vector<vector<vector<int> > >& image, int number);
+Image process_5(const Image& image, int number);
+void process_5(const Image& image, Image& dst, int number);
+void process_5_inplace(Image& image, int number);
+Image process_5(Image&& image, int number);
 
 // Enlarges the input image in the x and y direction by the scales specified and returns the resulting image
-vector<vector<vector<int> > > process_6(const vector<vector<vector<int> > >& image, int x_scale, int y_scale);
+Image process_6(const Image& image, int x_scale, int y_scale);
+void process_6(const Image& image, Image& dst, int x_scale, int y_scale);
+Image process_6(Image&& image, int x_scale, int y_scale);
 
 // Converts the input image to high contrast and returns the resulting image
-vector<vector<vector<int> > > process_7(const vector<vector<vector<int> > >& image);
+Image process_7(const Image& image);
+void process_7(const Image& image, Image& dst);
+void process_7_inplace(Image& image);
+Image process_7(Image&& image);
 
 // Lightens the input image and returns the resulting image
-vector<vector<vector<int> > > process_8(const vector<vector<vector<int> > >& image, double scaling_factor);
+Image process_8(const Image& image, double scaling_factor);
+void process_8(const Image& image, Image& dst, double scaling_factor);
+void process_8_inplace(Image& image, double scaling_factor);
+Image process_8(Image&& image, double scaling_factor);
 
 // Darkens image the input image and returns the resulting image
-vector<vector<vector<int> > > process_9(const vector<vector<vector<int> > >& image, double scaling_factor);
+Image process_9(const Image& image, double scaling_factor);
+void process_9(const Image& image, Image& dst, double scaling_factor);
+void process_9_inplace(Image& image, double scaling_factor);
+Image process_9(Image&& image, double scaling_factor);
 
 // Converts the input image to black, white, red, blue, and green only and returns the resulting image
+Image process_10(const Image& image);
+void process_10(const Image& image, Image& dst);
+void process_10_inplace(Image& image);
+Image process_10(Image&& image);
+
+// Resizes the input image to width x height pixels with the filter specified and returns the resulting image
+Image process_11(const Image& image, int width, int height, ResampleFilter filter);
+void process_11(const Image& image, Image& dst, int width, int height, ResampleFilter filter);
+Image process_11(Image&& image, int width, int height, ResampleFilter filter);
+
+// Blurs the input image with a box of the radius specified (see box_blur in convolve.h) and returns the resulting image
+Image process_13(const Image& image, int radius);
+void process_13(const Image& image, Image& dst, int radius);
+void process_13_inplace(Image& image, int radius);
+Image process_13(Image&& image, int radius);
+
+// Blurs the input image with a Gaussian of the standard deviation specified and returns the resulting image
+Image process_14(const Image& image, double sigma);
+void process_14(const Image& image, Image& dst, double sigma);
+void process_14_inplace(Image& image, double sigma);
+Image process_14(Image&& image, double sigma);
+
+// Sharpens the input image with an unsharp mask of the amount and blur specified and returns the resulting image
+Image process_15(const Image& image, double amount, double sigma);
+void process_15(const Image& image, Image& dst, double amount, double sigma);
+void process_15_inplace(Image& image, double amount, double sigma);
+Image process_15(Image&& image, double amount, double sigma);
+
+// Replaces the input image with its Sobel edges and returns the resulting image
+Image process_16(const Image& image);
+void process_16(const Image& image, Image& dst);
+void process_16_inplace(Image& image);
+Image process_16(Image&& image);
+
+// Stretches each channel of the input image over 0 to 255, clipping the fraction given at each end, and returns the resulting image
+Image process_17(const Image& image, double clip);
+void process_17(const Image& image, Image& dst, double clip);
+void process_17_inplace(Image& image, double clip);
+Image process_17(Image&& image, double clip);
+
+// Equalizes the histogram of the input image and returns the resulting image
+Image process_18(const Image& image);
+void process_18(const Image& image, Image& dst);
+void process_18_inplace(Image& image);
+Image process_18(Image&& image);
+
+// Converts the input image to black and white at the threshold that best splits its luma and returns the resulting image
+Image process_19(const Image& image);
+void process_19(const Image& image, Image& dst);
+void process_19_inplace(Image& image);
+Image process_19(Image&& image);
+
+//
+// Gray images hold one byte per pixel, a third of the memory of an Image,
+// and are saved as 8-bit palettized BMP (or PGM) files, a third of the size. Unlike
+// process_3, which stores the average in all three channels of an Image,
+// to_gray makes a GrayImage directly.
+//
+
+// Writes a gray image to an 8-bit BMP file with a gray palette, or to a PGM file
+bool write_image(string filename, const GrayImage& image);
+
+// Reads an image file into a gray image; color files are converted with the weights given
+bool read_image(string filename, GrayImage& image, GrayWeights weights = GRAY_AVERAGE);
+
+// Converts the input image to gray with the weights given, writing the result into dst (reshaped to fit)
+void to_gray(const Image& image, GrayImage& dst, GrayWeights weights = GRAY_AVERAGE);
+GrayImage to_gray(const Image& image, GrayWeights weights = GRAY_AVERAGE);
+
+// Expands a gray image to a color image with the gray value in all three channels
+void to_color(const GrayImage& image, Image& dst);
+Image to_color(const GrayImage& image);
+
+//
+// Compatibility adapter for the nested-vector image layout. Each function
+// below converts to an Image, runs the Image version, and converts back.
+//
+
+// Copies a nested-vector image into a contiguous image (values are stored as bytes, as write_image does)
+Image to_image(const vector<vector<vector<int> > >& image);
+
+// Copies a contiguous image into a nested-vector image
+vector<vector<vector<int> > > to_vector(const Image& image);
+
+bool write_image(string filename, const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > read_image(string filename);
+vector<vector<vector<int> > > process_1(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_2(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_3(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_4(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_5(const vector<vector<vector<int> > >& image, int number);
+vector<vector<vector<int> > > process_6(const vector<vector<vector<int> > >& image, int x_scale, int y_scale);
+vector<vector<vector<int> > > process_7(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_8(const vector<vector<vector<int> > >& image, double scaling_factor);
+vector<vector<vector<int> > > process_9(const vector<vector<vector<int> > >& image, double scaling_factor);
 vector<vector<vector<int> > > process_10(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_11(const vector<vector<vector<int> > >& image, int width, int height, ResampleFilter filter);
+vector<vector<vector<int> > > process_13(const vector<vector<vector<int> > >& image, int radius);
+vector<vector<vector<int> > > process_14(const vector<vector<vector<int> > >& image, double sigma);
+vector<vector<vector<int> > > process_15(const vector<vector<vector<int> > >& image, double amount, double sigma);
+vector<vector<vector<int> > > process_16(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_17(const vector<vector<vector<int> > >& image, double clip);
+vector<vector<vector<int> > > process_18(const vector<vector<vector<int> > >& image);
+vector<vector<vector<int> > > process_19(const vector<vector<vector<int> > >& image);
 
 
 //
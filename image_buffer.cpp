@@ -0,0 +1,148 @@
+#include "image_buffer.h"
+#include "buffer_pool.h"
+#include "trace.h"
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+/**
+ * Takes a buffer aligned to IMAGE_ALIGNMENT from the image pool.
+ * @param bytes Size of the buffer in bytes
+ * @param zero  True to fill the buffer with zeros
+ * @return Pointer to the buffer, or nullptr if bytes is 0
+ */
+static unsigned char* allocate_pixels(size_t bytes, bool zero)
+{
+    if (bytes == 0)
+    {
+        return nullptr;
+    }
+
+    bool reused = false;
+    unsigned char* memory = image_pool().acquire(bytes, reused);
+    if (zero)
+    {
+        memset(memory, 0, bytes);
+    }
+    if (reused)
+    {
+        trace_count(TRACE_POOL_HITS, 1);
+    }
+    else
+    {
+        trace_count(TRACE_IMAGE_BUFFERS, 1);
+        trace_count(TRACE_IMAGE_BYTES, bytes);
+    }
+    return memory;
+}
+
+// Rounds the number of bytes in a row of width pixels of channels bytes up to the next alignment boundary
+static size_t aligned_stride(int width, int channels)
+{
+    size_t bytes = static_cast<size_t>(width) * channels;
+    return (bytes + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+}
+
+template <class F>
+BasicImage<F>::BasicImage() : width_(0), height_(0), stride_(0), data_(nullptr)
+{
+}
+
+template <class F>
+BasicImage<F>::BasicImage(int width, int height) : BasicImage(width, height, true)
+{
+}
+
+template <class F>
+BasicImage<F>::BasicImage(int width, int height, bool zero)
+    : width_(width > 0 && height > 0 ? width : 0),
+      height_(width > 0 && height > 0 ? height : 0),
+      stride_(aligned_stride(width_, CHANNELS)),
+      data_(allocate_pixels(stride_ * height_, zero))
+{
+}
+
+template <class F>
+BasicImage<F> BasicImage<F>::uninitialized(int width, int height)
+{
+    return BasicImage(width, height, false);
+}
+
+template <class F>
+BasicImage<F>::BasicImage(const BasicImage& other)
+    : width_(other.width_), height_(other.height_), stride_(other.stride_),
+      data_(allocate_pixels(other.size_bytes(), false))
+{
+    if (data_ != nullptr)
+    {
+        memcpy(data_, other.data_, size_bytes());
+    }
+}
+
+template <class F>
+BasicImage<F>::BasicImage(BasicImage&& other) noexcept
+    : width_(other.width_), height_(other.height_), stride_(other.stride_), data_(other.data_)
+{
+    other.width_ = 0;
+    other.height_ = 0;
+    other.stride_ = 0;
+    other.data_ = nullptr;
+}
+
+template <class F>
+BasicImage<F>::~BasicImage()
+{
+    image_pool().release(data_, size_bytes());
+}
+
+template <class F>
+BasicImage<F>& BasicImage<F>::operator=(const BasicImage& other)
+{
+    if (this != &other && width_ == other.width_ && height_ == other.height_)
+    {
+        if (data_ != nullptr)
+        {
+            memcpy(data_, other.data_, size_bytes()); // Same dimensions: reuse the buffer
+        }
+    }
+    else if (this != &other)
+    {
+        BasicImage copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template <class F>
+BasicImage<F>& BasicImage<F>::operator=(BasicImage&& other)
+{
+    if (this != &other)
+    {
+        BasicImage moved(std::move(other));
+        swap(moved);
+    }
+    return *this;
+}
+
+template <class F>
+void BasicImage<F>::swap(BasicImage& other)
+{
+    std::swap(width_, other.width_);
+    std::swap(height_, other.height_);
+    std::swap(stride_, other.stride_);
+    std::swap(data_, other.data_);
+}
+
+template <class F>
+void BasicImage<F>::reshape(int width, int height)
+{
+    if (width != width_ || height != height_)
+    {
+        *this = BasicImage(); // Give the old buffer back before taking the new one
+        *this = uninitialized(width, height);
+    }
+}
+
+template class BasicImage<Bgr8>;
+template class BasicImage<Gray8>;
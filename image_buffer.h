@@ -0,0 +1,86 @@
+#ifndef IMAGE_BUFFER_H
+#define IMAGE_BUFFER_H
+
+#include <cstddef>
+#include "pixel_format.h"
+
+// Alignment, in bytes, of every image buffer and of every row within it
+const size_t IMAGE_ALIGNMENT = 64;
+
+/**
+ * An image held in one contiguous, 64-byte aligned buffer, with pixels of
+ * the format F (see pixel_format.h): Image holds BGR8 pixels and GrayImage
+ * one gray byte per pixel.
+ *
+ * Rows are kept in the same order as the nested-vector images: row 0 is the
+ * first scanline stored in the BMP file (the bottom of the picture). Every
+ * row starts on an IMAGE_ALIGNMENT boundary, so the distance between rows
+ * (the stride) may be larger than width * CHANNELS. Buffers come from and go
+ * back to image_pool() (see buffer_pool.h), so a buffer freed by one image
+ * is reused by the next image of the same dimensions.
+ */
+template <class F>
+class BasicImage
+{
+public:
+    typedef F Format;
+    static const int CHANNELS = F::CHANNELS; // Blue, green, red for BGR8; gray for Gray8
+
+    // Creates an empty (0 x 0) image
+    BasicImage();
+
+    // Creates a width x height image with every pixel set to black
+    BasicImage(int width, int height);
+
+    // Creates a width x height image whose pixels are undefined, for results that write every pixel
+    static BasicImage uninitialized(int width, int height);
+
+    BasicImage(const BasicImage& other);
+    BasicImage(BasicImage&& other) noexcept; // Leaves other empty; noexcept so that vectors of images move, not copy, them as they grow
+    ~BasicImage();
+
+    BasicImage& operator=(const BasicImage& other);
+    BasicImage& operator=(BasicImage&& other);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t stride() const { return stride_; }
+    bool empty() const { return width_ == 0 || height_ == 0; }
+
+    // Number of bytes holding pixel data in each row (width * CHANNELS)
+    size_t row_bytes() const { return static_cast<size_t>(width_) * CHANNELS; }
+
+    // Total size of the buffer in bytes, including row alignment padding
+    size_t size_bytes() const { return stride_ * height_; }
+
+    unsigned char* data() { return data_; }
+    const unsigned char* data() const { return data_; }
+
+    // Row view: pointer to the first byte of row y
+    unsigned char* row(int y) { return data_ + y * stride_; }
+    const unsigned char* row(int y) const { return data_ + y * stride_; }
+
+    // Pixel view: pointer to the CHANNELS bytes of pixel (y, x)
+    unsigned char* pixel(int y, int x) { return row(y) + x * CHANNELS; }
+    const unsigned char* pixel(int y, int x) const { return row(y) + x * CHANNELS; }
+
+    // Exchanges the contents of two images without copying pixel data
+    void swap(BasicImage& other);
+
+    // Makes this a width x height image for a result to be written into: the buffer is kept if the
+    // dimensions already match, otherwise replaced by one from the pool. The pixels are undefined afterwards.
+    void reshape(int width, int height);
+
+private:
+    BasicImage(int width, int height, bool zero);
+
+    int width_;
+    int height_;
+    size_t stride_;
+    unsigned char* data_;
+};
+
+typedef BasicImage<Bgr8> Image;      // Blue, green and red bytes
+typedef BasicImage<Gray8> GrayImage; // One gray byte per pixel
+
+#endif
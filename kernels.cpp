@@ -0,0 +1,386 @@
+#include <cstdlib>
+#include "kernels.h"
+
+using namespace std;
+
+// Kernel tables from kernels_sse2.cpp and kernels_avx2.cpp (nullptr where not built).
+// They must only be used after checking that the CPU supports them.
+const FilterKernels* sse2_kernel_table();
+const FilterKernels* avx2_kernel_table();
+
+//
+// Compile-time tables. make_table<F>(MakeIndices<N>::type()) is a ByteTable
+// of F::value(0) to F::value(N - 1), computed by the compiler. The indices
+// are built by halving, so long tables do not nest templates deeply.
+//
+
+template <int... I> struct Indices {};
+
+template <class First, class Second> struct JoinIndices;
+
+template <int... I, int... J>
+struct JoinIndices<Indices<I...>, Indices<J...> >
+{
+    typedef Indices<I..., static_cast<int>(sizeof...(I)) + J...> type;
+};
+
+template <int N>
+struct MakeIndices
+{
+    typedef typename JoinIndices<typename MakeIndices<N / 2>::type, typename MakeIndices<N - N / 2>::type>::type type;
+};
+
+template <> struct MakeIndices<0> { typedef Indices<> type; };
+template <> struct MakeIndices<1> { typedef Indices<0> type; };
+
+template <int N>
+struct ByteTable
+{
+    unsigned char values[N];
+};
+
+template <class F, int... I>
+constexpr ByteTable<sizeof...(I)> make_table(Indices<I...>)
+{
+    return ByteTable<sizeof...(I)>{ { static_cast<unsigned char>(F::value(I))... } };
+}
+
+// Largest total of a pixel's three values, plus one: the size of the tables indexed by total
+const int TOTALS = 3 * 255 + 1;
+
+// Clarendon: each total's curve (0 darker, 1 unchanged, 2 lighter)
+struct ClarendonCurve
+{
+    static constexpr int value(int total)
+    {
+        return total >= CLARENDON_LIGHT_TOTAL ? 2 : total < CLARENDON_DARK_TOTAL ? 0 : 1;
+    }
+};
+
+// Clarendon: entry 256 * curve + v is the new value of v, from the original expressions with a scaling factor of 0.3
+struct ClarendonValue
+{
+    static constexpr int value(int i)
+    {
+        return i < 256 ? static_cast<int>(i * 0.3) : i < 512 ? i - 256 : static_cast<int>(255 - (255 - (i - 512)) * 0.3);
+    }
+};
+
+// Primary colors: each total's color when it is extreme (3 white, 4 black), or 0 when it goes by the largest channel
+struct PrimaryExtreme
+{
+    static constexpr int value(int total)
+    {
+        return total >= PRIMARY_WHITE_TOTAL ? 3 : total <= PRIMARY_BLACK_TOTAL ? 4 : 0;
+    }
+};
+
+static constexpr ByteTable<TOTALS> CLARENDON_CURVE = make_table<ClarendonCurve>(MakeIndices<TOTALS>::type());
+static constexpr ByteTable<3 * 256> CLARENDON_VALUE = make_table<ClarendonValue>(MakeIndices<3 * 256>::type());
+static constexpr ByteTable<TOTALS> PRIMARY_EXTREME = make_table<PrimaryExtreme>(MakeIndices<TOTALS>::type());
+
+// Blue, green and red of each primary color: blue, green, red, white, black
+static constexpr unsigned char PRIMARY_COLORS[5][3] = {
+    {255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 255, 255}, {0, 0, 0}
+};
+
+// Clarendon reference kernel (process_2): light pixels get lighter and dark pixels darker
+template <class Format>
+static void scalar_clarendon(const unsigned char* src, unsigned char* dst, int width)
+{
+    for (int j = 0; j < width; j++) // For each pixel in the row
+    {
+        const unsigned char* in = src + Format::CHANNELS * j;
+        int blue, green, red;
+        Format::load(in, blue, green, red);
+        const unsigned char* curve = CLARENDON_VALUE.values + 256 * CLARENDON_CURVE.values[blue + green + red];
+        Format::store(dst + Format::CHANNELS * j, in, curve[blue], curve[green], curve[red]);
+    }
+}
+
+// Grayscale reference kernel (process_3)
+template <class Format>
+static void scalar_grayscale(const unsigned char* src, unsigned char* dst, int width)
+{
+    for (int j = 0; j < width; j++) // For each pixel in the row
+    {
+        const unsigned char* in = src + Format::CHANNELS * j;
+        int blue, green, red;
+        Format::load(in, blue, green, red);
+
+        // Gray value is the average of the RGB values
+        int gray = (blue + green + red) / 3;
+        Format::store(dst + Format::CHANNELS * j, in, gray, gray, gray);
+    }
+}
+
+// High contrast reference kernel (process_7)
+template <class Format>
+static void scalar_high_contrast(const unsigned char* src, unsigned char* dst, int width)
+{
+    for (int j = 0; j < width; j++) // For each pixel in the row
+    {
+        const unsigned char* in = src + Format::CHANNELS * j;
+        int blue, green, red;
+        Format::load(in, blue, green, red);
+
+        // If pixel is light, make it white, otherwise black
+        int value = (blue + green + red >= HIGH_CONTRAST_TOTAL) * 255;
+        Format::store(dst + Format::CHANNELS * j, in, value, value, value);
+    }
+}
+
+// Black, white, red, green and blue reference kernel (process_10)
+template <class Format>
+static void scalar_primary_colors(const unsigned char* src, unsigned char* dst, int width)
+{
+    for (int j = 0; j < width; j++) // For each pixel in the row
+    {
+        const unsigned char* in = src + Format::CHANNELS * j;
+        int blue, green, red;
+        Format::load(in, blue, green, red);
+
+        // White or black by the total, otherwise whichever of red or green is strictly largest, else blue
+        int largest = 2 * ((red > blue) & (red > green)) + ((green > blue) & (green > red));
+        int extreme = PRIMARY_EXTREME.values[blue + green + red];
+        const unsigned char* color = PRIMARY_COLORS[extreme != 0 ? extreme : largest];
+        Format::store(dst + Format::CHANNELS * j, in, color[0], color[1], color[2]);
+    }
+}
+
+// factor * value / 2^shift, truncated toward zero (negative products are rounded up before the shift)
+static inline int scale_fixed(int factor, int value, int shift)
+{
+    int product = factor * value;
+    return (product + ((product >> 31) & ((1 << shift) - 1))) >> shift;
+}
+
+// Vignette reference kernel (process_1)
+template <class Format>
+static void scalar_vignette(const unsigned char* src, unsigned char* dst, const short* factors, int shift, int width)
+{
+    for (int j = 0; j < width; j++) // For each pixel in the row
+    {
+        const unsigned char* in = src + Format::CHANNELS * j;
+        int blue, green, red;
+        Format::load(in, blue, green, red);
+
+        // Values are truncated toward zero like the original cast to int, then stored as bytes
+        int factor = factors[j];
+        Format::store(dst + Format::CHANNELS * j, in, scale_fixed(factor, blue, shift), scale_fixed(factor, green, shift),
+                      scale_fixed(factor, red, shift));
+    }
+}
+
+// Rounds a sum of weighted values to the nearest integer and clamps it to a byte
+static inline unsigned char resample_clamp(int sum)
+{
+    sum = (sum + (1 << (RESAMPLE_SHIFT - 1))) >> RESAMPLE_SHIFT;
+    return sum < 0 ? 0 : sum > 255 ? 255 : sum;
+}
+
+// Vertical resampling reference kernel (the same for every format)
+static void scalar_resample_columns(const unsigned char* const* rows, const short* weights, int taps, unsigned char* dst, int bytes)
+{
+    for (int x = 0; x < bytes; x++)
+    {
+        int sum = 0;
+        for (int k = 0; k < taps; k++)
+        {
+            sum += weights[k] * rows[k][x];
+        }
+        dst[x] = resample_clamp(sum);
+    }
+}
+
+// Luma weights in LUMA_SHIFT fixed point, blue first; each set is rounded so it sums to exactly 1 << LUMA_SHIFT
+static const short BT601_WEIGHTS[3] = {1868, 9617, 4899};
+static const short BT709_WEIGHTS[3] = {1183, 11718, 3483};
+
+const short* gray_weights(GrayWeights weights)
+{
+    return weights == GRAY_BT601 ? BT601_WEIGHTS : weights == GRAY_BT709 ? BT709_WEIGHTS : nullptr;
+}
+
+// Conversion to gray reference kernel
+template <class Format>
+static void scalar_to_gray(const unsigned char* src, unsigned char* dst, const short* weights, int width)
+{
+    for (int j = 0; j < width; j++) // For each pixel in the row
+    {
+        int blue, green, red;
+        Format::load(src + Format::CHANNELS * j, blue, green, red);
+        dst[j] = static_cast<unsigned char>(weights == nullptr ? (blue + green + red) / 3
+            : (weights[0] * blue + weights[1] * green + weights[2] * red + (1 << (LUMA_SHIFT - 1))) >> LUMA_SHIFT);
+    }
+}
+
+// Horizontal resampling reference kernel
+template <class Format>
+static void scalar_resample_row(const unsigned char* src, unsigned char* dst, int width, const int* starts, const short* weights, int taps)
+{
+    for (int i = 0; i < width; i++) // For each output pixel
+    {
+        const unsigned char* in = src + Format::CHANNELS * starts[i];
+        const short* w = weights + static_cast<size_t>(i) * taps;
+        int sums[Format::CHANNELS] = {};
+        for (int k = 0; k < taps; k++)
+        {
+            for (int c = 0; c < Format::CHANNELS; c++)
+            {
+                sums[c] += w[k] * in[Format::CHANNELS * k + c];
+            }
+        }
+        for (int c = 0; c < Format::CHANNELS; c++)
+        {
+            dst[Format::CHANNELS * i + c] = resample_clamp(sums[c]);
+        }
+    }
+}
+
+// Box blur vertical pass reference kernel (the same for every format)
+static void scalar_box_columns(int* sums, const unsigned char* add, const unsigned char* subtract, unsigned char* dst, float scale, int bytes)
+{
+    for (int x = 0; x < bytes; x++)
+    {
+        dst[x] = static_cast<unsigned char>(static_cast<int>(static_cast<float>(sums[x]) * scale + 0.5f));
+        sums[x] += add[x] - subtract[x];
+    }
+}
+
+// Unsharp mask reference kernel (the same for every format)
+static void scalar_unsharp(const unsigned char* src, const unsigned char* blurred, unsigned char* dst, int amount, int bytes)
+{
+    for (int x = 0; x < bytes; x++)
+    {
+        int value = src[x] + (((src[x] - blurred[x]) * amount + 128) >> 8);
+        dst[x] = static_cast<unsigned char>(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+}
+
+// Sobel reference kernel (the same for every format; channels sets the distance between neighbours)
+static void scalar_sobel(const unsigned char* above, const unsigned char* row, const unsigned char* below, unsigned char* dst,
+                         int bytes, int channels)
+{
+    for (int x = 0; x < bytes; x++)
+    {
+        int left = x - channels, right = x + channels;
+        int gx = (above[right] + 2 * row[right] + below[right]) - (above[left] + 2 * row[left] + below[left]);
+        int gy = (below[left] - above[left]) + 2 * (below[x] - above[x]) + (below[right] - above[right]);
+        int magnitude = abs(gx) + abs(gy);
+        dst[x] = static_cast<unsigned char>(magnitude > 255 ? 255 : magnitude);
+    }
+}
+
+// 2x downsampling reference kernel
+template <class Format>
+static void scalar_halve(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int width)
+{
+    const int channels = Format::CHANNELS;
+    for (int j = 0; j < width; j++) // For each output pixel
+    {
+        const unsigned char* t = top + 2 * channels * j;
+        const unsigned char* b = bottom + 2 * channels * j;
+        for (int c = 0; c < channels; c++)
+        {
+            dst[channels * j + c] = static_cast<unsigned char>((t[c] + t[channels + c] + b[c] + b[channels + c] + 2) >> 2);
+        }
+    }
+}
+
+// The scalar kernels instantiated for one format
+template <class Format>
+static FilterKernels scalar_kernel_set()
+{
+    FilterKernels kernels = {
+        "scalar", scalar_clarendon<Format>, scalar_grayscale<Format>, scalar_high_contrast<Format>,
+        scalar_primary_colors<Format>, scalar_vignette<Format>, scalar_resample_columns, scalar_resample_row<Format>,
+        scalar_to_gray<Format>, scalar_box_columns, scalar_unsharp, scalar_sobel, scalar_halve<Format>
+    };
+    return kernels;
+}
+
+const FilterKernels& scalar_kernels(PixelFormat format)
+{
+    static const FilterKernels kernels[PIXEL_FORMATS] = {
+        scalar_kernel_set<Bgr8>(), scalar_kernel_set<Bgra8>(), scalar_kernel_set<Gray8>()
+    };
+    return kernels[format];
+}
+
+const FilterKernels* sse2_kernels()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return sse2_kernel_table();
+    }
+#endif
+    return nullptr;
+}
+
+const FilterKernels* avx2_kernels()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return avx2_kernel_table();
+    }
+#endif
+    return nullptr;
+}
+
+// The widest kernels this CPU supports
+static const FilterKernels* widest_kernels()
+{
+    if (avx2_kernels() != nullptr)
+    {
+        return avx2_kernels();
+    }
+    if (sse2_kernels() != nullptr)
+    {
+        return sse2_kernels();
+    }
+    return &scalar_kernels();
+}
+
+// Kernels chosen by select_kernels, or nullptr for the widest supported set
+static const FilterKernels* selected = nullptr;
+
+const FilterKernels& active_kernels(PixelFormat format)
+{
+    if (format != PIXEL_BGR8)
+    {
+        return scalar_kernels(format);
+    }
+    static const FilterKernels* widest = widest_kernels();
+    return selected != nullptr ? *selected : *widest;
+}
+
+bool select_kernels(const string& name)
+{
+    const FilterKernels* kernels = nullptr;
+    if (name == "auto")
+    {
+        kernels = widest_kernels();
+    }
+    else if (name == "scalar")
+    {
+        kernels = &scalar_kernels();
+    }
+    else if (name == "sse2")
+    {
+        kernels = sse2_kernels();
+    }
+    else if (name == "avx2")
+    {
+        kernels = avx2_kernels();
+    }
+
+    if (kernels == nullptr)
+    {
+        return false;
+    }
+    selected = kernels;
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <string>
+#include "pixel_format.h"
+
+using namespace std;
+
+// Fraction bits of the resampling weights: each set of weights sums to 1 << RESAMPLE_SHIFT
+const int RESAMPLE_SHIFT = 14;
+
+// Fraction bits of the luma weights: each set of weights sums to 1 << LUMA_SHIFT
+const int LUMA_SHIFT = 14;
+
+// How to_gray turns a pixel's blue, green and red values into one gray value
+enum GrayWeights
+{
+    GRAY_AVERAGE, // (blue + green + red) / 3, the value process_3 stores in every channel
+    GRAY_BT601,   // Luma with the ITU-R BT.601 weights: 0.114 blue, 0.587 green, 0.299 red
+    GRAY_BT709    // Luma with the ITU-R BT.709 weights: 0.0722 blue, 0.7152 green, 0.2126 red
+};
+
+// The blue, green and red weights of a luma standard in LUMA_SHIFT fixed point, or nullptr for GRAY_AVERAGE
+const short* gray_weights(GrayWeights weights);
+
+// Thresholds on the total of a pixel's blue, green and red values, shared by every set of kernels
+const int CLARENDON_LIGHT_TOTAL = 510; // process_2 lightens pixels whose average is at least 170
+const int CLARENDON_DARK_TOTAL = 270;  // and darkens those whose average is under 90
+const int HIGH_CONTRAST_TOTAL = 384;   // process_7: an integer average of at least 127.5 becomes white
+const int PRIMARY_WHITE_TOTAL = 550;   // process_10: white at this total or more
+const int PRIMARY_BLACK_TOTAL = 150;   // and black at this total or less
+
+/**
+ * Row kernels for the color filters. Each kernel reads width interleaved
+ * pixels of one format (BGR8 unless noted) from src and writes width
+ * pixels to dst; src and dst may be the same row. Every set of kernels
+ * produces exactly the same bytes as the scalar reference set. (Lighten
+ * and darken are point operations and run through lookup tables instead;
+ * see lut.h.)
+ */
+struct FilterKernels
+{
+    const char* name;
+
+    // process_2: lightens light pixels and darkens dark ones
+    void (*clarendon)(const unsigned char* src, unsigned char* dst, int width);
+
+    // process_3: sets each channel to the average of the three
+    void (*grayscale)(const unsigned char* src, unsigned char* dst, int width);
+
+    // process_7: sets each pixel to black or white
+    void (*high_contrast)(const unsigned char* src, unsigned char* dst, int width);
+
+    // process_10: maps each pixel to black, white, red, green or blue
+    void (*primary_colors)(const unsigned char* src, unsigned char* dst, int width);
+
+    // process_1: scales pixel x by factors[x] / 2^shift (shift from 8 to 14), truncating toward zero and keeping the low byte
+    void (*vignette)(const unsigned char* src, unsigned char* dst, const short* factors, int shift, int width);
+
+    // Resampling, vertical pass: byte x of dst is the weighted sum of byte x of rows[0] to rows[taps - 1]
+    // (weights in RESAMPLE_SHIFT fixed point), rounded and clamped to 0..255; dst must not be one of the rows
+    void (*resample_columns)(const unsigned char* const* rows, const short* weights, int taps, unsigned char* dst, int bytes);
+
+    // Resampling, horizontal pass: pixel i of dst is the weighted sum of pixels starts[i] to starts[i] + taps - 1 of
+    // src, with weights i * taps to i * taps + taps - 1. taps must be even, and src must have one readable byte
+    // after the last pixel any tap reaches
+    void (*resample_row)(const unsigned char* src, unsigned char* dst, int width, const int* starts, const short* weights, int taps);
+
+    // Conversion to Gray8: byte x of dst is pixel x of src weighted by weights (from gray_weights) and rounded,
+    // or the integer average of its three values if weights is null
+    void (*to_gray)(const unsigned char* src, unsigned char* dst, const short* weights, int width);
+
+    // Box blur, vertical pass (the same for every format): byte x of dst is sums[x] * scale rounded in single precision
+    // (truncating sums[x] * scale + 0.5f), then sums[x] gains add[x] - subtract[x], sliding the window down a row
+    void (*box_columns)(int* sums, const unsigned char* add, const unsigned char* subtract, unsigned char* dst, float scale, int bytes);
+
+    // Unsharp mask: byte x of dst is src[x] + ((src[x] - blurred[x]) * amount + 128 >> 8), clamped to 0..255, with
+    // amount in 8-bit fixed point (at most 32767); dst may be src or blurred
+    void (*unsharp)(const unsigned char* src, const unsigned char* blurred, unsigned char* dst, int amount, int bytes);
+
+    // Sobel edges: byte x of dst is |gx| + |gy| clamped to 255, where gx is [1 2 1] down the rows times [-1 0 1]
+    // along them, and gy the transpose, over the bytes channels apart. Each row must have channels readable
+    // bytes before its first and after its last byte; dst must not be one of the rows
+    void (*sobel)(const unsigned char* above, const unsigned char* row, const unsigned char* below, unsigned char* dst,
+                  int bytes, int channels);
+
+    // 2x downsampling (any format): pixel x of dst is the rounded average (a + b + c + d + 2) >> 2, channel by
+    // channel, of pixels 2x and 2x + 1 of top and of bottom; dst must not be either row
+    void (*halve)(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int width);
+};
+
+/**
+ * The portable scalar kernels, instantiated for a pixel format. The BGR8
+ * set is the reference the SIMD kernels are checked against. Each kernel
+ * is a template on the format, with the filter thresholds and curves as
+ * compile-time constants and tables, so the per-pixel loops have no
+ * branches on either.
+ */
+const FilterKernels& scalar_kernels(PixelFormat format = PIXEL_BGR8);
+
+// SSE2 kernels, or nullptr if they were not built or the CPU lacks SSE2
+const FilterKernels* sse2_kernels();
+
+// AVX2 kernels, or nullptr if they were not built or the CPU lacks AVX2
+const FilterKernels* avx2_kernels();
+
+// The kernels the filters use for a format: for BGR8 the widest set the CPU supports, unless changed by
+// select_kernels; the other formats have scalar kernels only. Call once per image, not per row.
+const FilterKernels& active_kernels(PixelFormat format = PIXEL_BGR8);
+
+/**
+ * Chooses the kernels used by the filters. Must not be called while a
+ * filter is running.
+ * @param name "scalar", "sse2", "avx2", or "auto" for the widest supported set
+ * @return True if the named kernels are available on this CPU
+ */
+bool select_kernels(const string& name);
+
+#endif
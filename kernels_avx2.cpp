@@ -0,0 +1,217 @@
+#include "kernels.h"
+
+// This file is built with -mavx2. Nothing in it may run before kernels.cpp
+// has checked that the CPU supports AVX2.
+#if defined(__AVX2__)
+
+#include <cstring>
+#include <immintrin.h>
+#include "kernels_simd.h"
+
+namespace
+{
+
+// 256-bit vector interface for kernels_simd.h: two blocks of 32 pixels, one per 128-bit lane
+struct Avx2
+{
+    typedef __m256i reg;
+    static const int PIXELS = 64;
+
+    static inline void load(const unsigned char* src, reg c[6])
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * i));
+            __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 96 + 16 * i));
+            c[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+        }
+    }
+
+    static inline void store(unsigned char* dst, const reg c[6])
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16 * i), _mm256_castsi256_si128(c[i]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 96 + 16 * i), _mm256_extracti128_si256(c[i], 1));
+        }
+    }
+
+    static inline reg load16(const short* values)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + 32));
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+    }
+
+    static inline reg zero() { return _mm256_setzero_si256(); }
+    static inline reg set16(int value) { return _mm256_set1_epi16(static_cast<short>(value)); }
+    static inline reg unpacklo8(reg a, reg b) { return _mm256_unpacklo_epi8(a, b); }
+    static inline reg unpackhi8(reg a, reg b) { return _mm256_unpackhi_epi8(a, b); }
+    static inline reg packus16(reg a, reg b) { return _mm256_packus_epi16(a, b); }
+    static inline reg add16(reg a, reg b) { return _mm256_add_epi16(a, b); }
+    static inline reg sub16(reg a, reg b) { return _mm256_sub_epi16(a, b); }
+    static inline reg mulhi16(reg a, reg b) { return _mm256_mulhi_epu16(a, b); }
+    static inline reg srli16_1(reg a) { return _mm256_srli_epi16(a, 1); }
+    static inline reg srli16_8(reg a) { return _mm256_srli_epi16(a, 8); }
+    static inline reg sll16(reg a, int count) { return _mm256_sll_epi16(a, _mm_cvtsi32_si128(count)); }
+    static inline reg cmpgt16(reg a, reg b) { return _mm256_cmpgt_epi16(a, b); }
+    static inline reg and_(reg a, reg b) { return _mm256_and_si256(a, b); }
+    static inline reg or_(reg a, reg b) { return _mm256_or_si256(a, b); }
+    static inline reg andnot(reg a, reg b) { return _mm256_andnot_si256(a, b); }
+    static inline reg xor_(reg a, reg b) { return _mm256_xor_si256(a, b); }
+
+    static const int LANES = 2;
+
+    static inline reg load1(const unsigned char* src) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)); }
+    static inline void store1(unsigned char* dst, reg a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), a); }
+    static inline reg set32(int value) { return _mm256_set1_epi32(value); }
+    static inline reg unpacklo16(reg a, reg b) { return _mm256_unpacklo_epi16(a, b); }
+    static inline reg unpackhi16(reg a, reg b) { return _mm256_unpackhi_epi16(a, b); }
+    static inline reg madd16(reg a, reg b) { return _mm256_madd_epi16(a, b); }
+    static inline reg add32(reg a, reg b) { return _mm256_add_epi32(a, b); }
+    static inline reg srai32(reg a, int count) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(count)); }
+    static inline reg packs32(reg a, reg b) { return _mm256_packs_epi32(a, b); }
+
+    static inline reg load_pixels(const unsigned char* src, const int* starts, int k)
+    {
+        int first, second;
+        memcpy(&first, src + 3 * (starts[0] + k), 4);
+        memcpy(&second, src + 3 * (starts[1] + k), 4);
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_cvtsi32_si128(first)), _mm_cvtsi32_si128(second), 1);
+    }
+
+    static inline reg pair_weights(const short* weights, int taps)
+    {
+        unsigned int first = static_cast<unsigned short>(weights[0]) | static_cast<unsigned int>(static_cast<unsigned short>(weights[1])) << 16;
+        unsigned int second = static_cast<unsigned short>(weights[taps])
+                              | static_cast<unsigned int>(static_cast<unsigned short>(weights[taps + 1])) << 16;
+        return _mm256_inserti128_si256(_mm256_set1_epi32(static_cast<int>(first)), _mm_set1_epi32(static_cast<int>(second)), 1);
+    }
+
+    static inline void store_pixels(unsigned char* dst, reg a)
+    {
+        int first = _mm_cvtsi128_si32(_mm256_castsi256_si128(a));
+        int second = _mm_cvtsi128_si32(_mm256_extracti128_si256(a, 1));
+        memcpy(dst, &first, 3);
+        memcpy(dst + 3, &second, 3);
+    }
+
+    static inline void store_plane(unsigned char* dst, reg first, reg second)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+
+    static inline void load_sums(const int* sums, reg s[4])
+    {
+        for (int p = 0; p < 4; p++)
+        {
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + 4 * p));
+            __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + 16 + 4 * p));
+            s[p] = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+        }
+    }
+
+    static inline void store_sums(int* sums, const reg s[4])
+    {
+        for (int p = 0; p < 4; p++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 4 * p), _mm256_castsi256_si128(s[p]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 16 + 4 * p), _mm256_extracti128_si256(s[p], 1));
+        }
+    }
+
+    static inline reg round_scaled(reg a, float scale)
+    {
+        return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(a), _mm256_set1_ps(scale)), _mm256_set1_ps(0.5f)));
+    }
+
+    static inline void pair_lanes(reg& a, reg& b)
+    {
+        reg first = _mm256_permute2x128_si256(a, b, 0x20);
+        b = _mm256_permute2x128_si256(a, b, 0x31);
+        a = first;
+    }
+};
+
+void avx2_clarendon(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Avx2, ClarendonOp>(src, dst, width, scalar_kernels().clarendon);
+}
+
+void avx2_grayscale(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Avx2, GrayscaleOp>(src, dst, width, scalar_kernels().grayscale);
+}
+
+void avx2_high_contrast(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Avx2, HighContrastOp>(src, dst, width, scalar_kernels().high_contrast);
+}
+
+void avx2_primary_colors(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Avx2, PrimaryColorsOp>(src, dst, width, scalar_kernels().primary_colors);
+}
+
+void avx2_vignette(const unsigned char* src, unsigned char* dst, const short* factors, int shift, int width)
+{
+    run_vignette_row<Avx2>(src, dst, factors, shift, width, scalar_kernels().vignette);
+}
+
+void avx2_resample_columns(const unsigned char* const* rows, const short* weights, int taps, unsigned char* dst, int bytes)
+{
+    run_resample_columns<Avx2>(rows, weights, taps, dst, bytes, scalar_kernels().resample_columns);
+}
+
+void avx2_resample_row(const unsigned char* src, unsigned char* dst, int width, const int* starts, const short* weights, int taps)
+{
+    run_resample_row<Avx2>(src, dst, width, starts, weights, taps, scalar_kernels().resample_row);
+}
+
+void avx2_to_gray(const unsigned char* src, unsigned char* dst, const short* weights, int width)
+{
+    run_gray_row<Avx2>(src, dst, weights, width, scalar_kernels().to_gray);
+}
+
+void avx2_box_columns(int* sums, const unsigned char* add, const unsigned char* subtract, unsigned char* dst, float scale, int bytes)
+{
+    run_box_columns<Avx2>(sums, add, subtract, dst, scale, bytes, scalar_kernels().box_columns);
+}
+
+void avx2_unsharp(const unsigned char* src, const unsigned char* blurred, unsigned char* dst, int amount, int bytes)
+{
+    run_unsharp<Avx2>(src, blurred, dst, amount, bytes, scalar_kernels().unsharp);
+}
+
+void avx2_sobel(const unsigned char* above, const unsigned char* row, const unsigned char* below, unsigned char* dst,
+               int bytes, int channels)
+{
+    run_sobel<Avx2>(above, row, below, dst, bytes, channels, scalar_kernels().sobel);
+}
+
+void avx2_halve(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int width)
+{
+    run_halve<Avx2>(top, bottom, dst, width, scalar_kernels().halve);
+}
+
+}
+
+const FilterKernels* avx2_kernel_table()
+{
+    static const FilterKernels kernels = {
+        "avx2", avx2_clarendon, avx2_grayscale, avx2_high_contrast, avx2_primary_colors, avx2_vignette,
+        avx2_resample_columns, avx2_resample_row, avx2_to_gray, avx2_box_columns, avx2_unsharp, avx2_sobel,
+        avx2_halve
+    };
+    return &kernels;
+}
+
+#else
+
+const FilterKernels* avx2_kernel_table()
+{
+    return nullptr;
+}
+
+#endif
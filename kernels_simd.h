@@ -0,0 +1,590 @@
+#ifndef KERNELS_SIMD_H
+#define KERNELS_SIMD_H
+
+// Color filter kernels written once against a small vector interface V and
+// instantiated for each instruction set (see kernels_sse2.cpp and
+// kernels_avx2.cpp). V provides:
+//
+//   reg                        the vector register type
+//   PIXELS                     pixels handled per block (32 per 128-bit lane)
+//   load(src, c) / store(dst, c)  move one block of interleaved BGR8 bytes
+//                              to or from six registers; each 128-bit lane
+//                              holds its own run of 32 pixels
+//   load16(values)             eight 16-bit values per lane, lane k taking
+//                              them from values + 32 k (the lane's block)
+//   zero(), set16(value)       constant registers
+//   unpacklo8, unpackhi8, packus16, add16, sub16, mulhi16 (unsigned),
+//   srli16_1, srli16_8, sll16(a, count), cmpgt16 (signed), and_, or_,
+//   andnot (~a & b), xor_
+//
+// and, for resampling:
+//
+//   load1(src) / store1(dst, r)  move sizeof(reg) bytes
+//   set32(value), unpacklo16, unpackhi16, madd16 (signed pairs summed
+//   to 32 bits), add32, srai32(a, count), packs32
+//   LANES                      128-bit lanes per register
+//   load_pixels(src, starts, k)  lane l takes the 4 bytes at
+//                              src + 3 * (starts[l] + k) in its low 32 bits
+//   pair_weights(weights, taps)  lane l holds weights[l * taps] and
+//                              weights[l * taps + 1] in every 32-bit pair
+//   store_pixels(dst, r)       stores the low 3 bytes of lane l at dst + 3 l
+//
+// and, for conversion to gray:
+//
+//   store_plane(dst, first, second)  stores one byte per pixel of a block:
+//                              lane l of first then lane l of second go to
+//                              dst + 32 l
+//
+// and, for the neighbourhood filters (see convolve.h):
+//
+//   load_sums(sums, s) / store_sums(sums, s)  move the 32-bit totals of
+//                              one register of bytes to or from four
+//                              registers; s[p] holds the totals of bytes
+//                              4 p to 4 p + 3 of each lane's 16 bytes,
+//                              the order unpacklo8 then unpacklo16 (and
+//                              the hi forms) leave them in
+//   round_scaled(a, scale)     each 32-bit value times scale, plus 0.5,
+//                              truncated, all in single precision
+//
+// and, for downsampling:
+//
+//   pair_lanes(a, b)           replaces a with lane 0 of a then lane 0 of
+//                              b, and b with lane 1 of a then lane 1 of b
+//                              (nothing to do with one lane)
+//
+// Only operations that work within 128-bit lanes are used, so a 256-bit
+// register simply runs two independent 32-pixel blocks side by side.
+//
+// This header is only included by the per-instruction-set translation units.
+
+#include "kernels.h"
+
+/**
+ * Splits a block of 32 interleaved pixels per lane into planes: on return
+ * c[0..1] hold the blue bytes, c[2..3] the green and c[4..5] the red.
+ * Interleaving the two halves of 96 bytes (a perfect shuffle) moves the
+ * byte at position p to 2p mod 95; five rounds move it to 32p mod 95, and
+ * byte 3k + channel lands at 32 * channel + k.
+ */
+template <class V>
+inline void deinterleave(typename V::reg c[6])
+{
+    for (int round = 0; round < 5; round++)
+    {
+        typename V::reg n0 = V::unpacklo8(c[0], c[3]);
+        typename V::reg n1 = V::unpackhi8(c[0], c[3]);
+        typename V::reg n2 = V::unpacklo8(c[1], c[4]);
+        typename V::reg n3 = V::unpackhi8(c[1], c[4]);
+        typename V::reg n4 = V::unpacklo8(c[2], c[5]);
+        typename V::reg n5 = V::unpackhi8(c[2], c[5]);
+        c[0] = n0; c[1] = n1; c[2] = n2; c[3] = n3; c[4] = n4; c[5] = n5;
+    }
+}
+
+// Inverse of deinterleave: five rounds of gathering even bytes into the first half and odd bytes into the second
+template <class V>
+inline void interleave(typename V::reg c[6])
+{
+    const typename V::reg low = V::set16(0x00FF);
+    for (int round = 0; round < 5; round++)
+    {
+        typename V::reg n0 = V::packus16(V::and_(c[0], low), V::and_(c[1], low));
+        typename V::reg n1 = V::packus16(V::and_(c[2], low), V::and_(c[3], low));
+        typename V::reg n2 = V::packus16(V::and_(c[4], low), V::and_(c[5], low));
+        typename V::reg n3 = V::packus16(V::srli16_8(c[0]), V::srli16_8(c[1]));
+        typename V::reg n4 = V::packus16(V::srli16_8(c[2]), V::srli16_8(c[3]));
+        typename V::reg n5 = V::packus16(V::srli16_8(c[4]), V::srli16_8(c[5]));
+        c[0] = n0; c[1] = n1; c[2] = n2; c[3] = n3; c[4] = n4; c[5] = n5;
+    }
+}
+
+/**
+ * Runs a per-pixel operation over a row. Op::apply receives the blue,
+ * green and red values of a group of pixels widened to 16 bits and
+ * replaces them with the results (which must be in 0..255). Pixels left
+ * over after the last full block go through the scalar kernel.
+ */
+template <class V, class Op>
+void run_row(const unsigned char* src, unsigned char* dst, int width,
+             void (*scalar)(const unsigned char*, unsigned char*, int))
+{
+    const typename V::reg zero = V::zero();
+    int x = 0;
+
+    for (; x + V::PIXELS <= width; x += V::PIXELS)
+    {
+        typename V::reg c[6];
+        V::load(src + 3 * x, c);
+        deinterleave<V>(c);
+
+        for (int half = 0; half < 2; half++)
+        {
+            typename V::reg& b = c[half];
+            typename V::reg& g = c[2 + half];
+            typename V::reg& r = c[4 + half];
+
+            typename V::reg b_lo = V::unpacklo8(b, zero), b_hi = V::unpackhi8(b, zero);
+            typename V::reg g_lo = V::unpacklo8(g, zero), g_hi = V::unpackhi8(g, zero);
+            typename V::reg r_lo = V::unpacklo8(r, zero), r_hi = V::unpackhi8(r, zero);
+
+            Op::template apply<V>(b_lo, g_lo, r_lo);
+            Op::template apply<V>(b_hi, g_hi, r_hi);
+
+            b = V::packus16(b_lo, b_hi);
+            g = V::packus16(g_lo, g_hi);
+            r = V::packus16(r_lo, r_hi);
+        }
+
+        interleave<V>(c);
+        V::store(dst + 3 * x, c);
+    }
+
+    scalar(src + 3 * x, dst + 3 * x, width - x);
+}
+
+/**
+ * process_1: scales each pixel by its own signed factor with shift
+ * fraction bits. factor * value / 2^shift, truncated toward zero, is
+ * mulhi(|factor|, value << (16 - shift)) with the factor's sign put back
+ * (a shift of at least 8 keeps value << (16 - shift) within 16 bits); only
+ * the low byte is kept, as in the scalar kernel.
+ */
+template <class V>
+void run_vignette_row(const unsigned char* src, unsigned char* dst, const short* factors, int shift, int width,
+                      void (*scalar)(const unsigned char*, unsigned char*, const short*, int, int))
+{
+    const typename V::reg zero = V::zero();
+    const typename V::reg low = V::set16(0x00FF);
+    int x = 0;
+
+    for (; x + V::PIXELS <= width; x += V::PIXELS)
+    {
+        typename V::reg c[6];
+        V::load(src + 3 * x, c);
+        deinterleave<V>(c);
+
+        for (int half = 0; half < 2; half++) // Pixels 0-15 and 16-31 of each lane's block
+        {
+            const short* f = factors + x + 16 * half;
+            typename V::reg factor[2] = { V::load16(f), V::load16(f + 8) };
+            typename V::reg sign[2], magnitude[2];
+            for (int part = 0; part < 2; part++)
+            {
+                sign[part] = V::cmpgt16(zero, factor[part]);
+                magnitude[part] = V::sub16(V::xor_(factor[part], sign[part]), sign[part]);
+            }
+
+            for (int channel = 0; channel < 3; channel++)
+            {
+                typename V::reg& plane = c[2 * channel + half];
+                typename V::reg wide[2] = { V::unpacklo8(plane, zero), V::unpackhi8(plane, zero) };
+                for (int part = 0; part < 2; part++)
+                {
+                    typename V::reg scaled = V::mulhi16(magnitude[part], V::sll16(wide[part], 16 - shift));
+                    wide[part] = V::and_(V::sub16(V::xor_(scaled, sign[part]), sign[part]), low);
+                }
+                plane = V::packus16(wide[0], wide[1]);
+            }
+        }
+
+        interleave<V>(c);
+        V::store(dst + 3 * x, c);
+    }
+
+    scalar(src + 3 * x, dst + 3 * x, factors + x, shift, width - x);
+}
+
+/**
+ * Vertical resampling pass: two rows at a time are interleaved as 16-bit
+ * pairs and multiplied by their pair of weights with madd16, so each
+ * 32-bit sum gathers every tap of one byte position. The sums are exact,
+ * so the result matches the scalar kernel. A row shorter than a register
+ * goes to the scalar kernel; otherwise the last block is moved back to end
+ * at the end of the row and overlaps the one before it.
+ */
+template <class V>
+void run_resample_columns(const unsigned char* const* rows, const short* weights, int taps, unsigned char* dst, int bytes,
+                          void (*scalar)(const unsigned char* const*, const short*, int, unsigned char*, int))
+{
+    const int STEP = sizeof(typename V::reg);
+    if (bytes < STEP)
+    {
+        scalar(rows, weights, taps, dst, bytes);
+        return;
+    }
+
+    const typename V::reg zero = V::zero();
+    const typename V::reg round = V::set32(1 << (RESAMPLE_SHIFT - 1));
+    for (int x = 0; x < bytes; x += STEP)
+    {
+        int at = x + STEP <= bytes ? x : bytes - STEP;
+        typename V::reg sum[4] = { round, round, round, round };
+        for (int k = 0; k < taps; k += 2)
+        {
+            bool pair = k + 1 < taps;
+            typename V::reg a = V::load1(rows[k] + at);
+            typename V::reg b = pair ? V::load1(rows[k + 1] + at) : zero;
+            unsigned int second = pair ? static_cast<unsigned short>(weights[k + 1]) : 0;
+            typename V::reg w = V::set32(static_cast<int>(static_cast<unsigned short>(weights[k]) | second << 16));
+
+            typename V::reg a_lo = V::unpacklo8(a, zero), a_hi = V::unpackhi8(a, zero);
+            typename V::reg b_lo = V::unpacklo8(b, zero), b_hi = V::unpackhi8(b, zero);
+            sum[0] = V::add32(sum[0], V::madd16(V::unpacklo16(a_lo, b_lo), w));
+            sum[1] = V::add32(sum[1], V::madd16(V::unpackhi16(a_lo, b_lo), w));
+            sum[2] = V::add32(sum[2], V::madd16(V::unpacklo16(a_hi, b_hi), w));
+            sum[3] = V::add32(sum[3], V::madd16(V::unpackhi16(a_hi, b_hi), w));
+        }
+        for (int part = 0; part < 4; part++)
+        {
+            sum[part] = V::srai32(sum[part], RESAMPLE_SHIFT);
+        }
+        V::store1(dst + at, V::packus16(V::packs32(sum[0], sum[1]), V::packs32(sum[2], sum[3])));
+    }
+}
+
+/**
+ * Horizontal resampling pass: one output pixel per 128-bit lane. For each
+ * pair of taps, the two source pixels are widened and interleaved as
+ * (blue, blue, green, green, red, red, -, -), so one madd16 with the pair
+ * of weights adds both taps to all three channels.
+ */
+template <class V>
+void run_resample_row(const unsigned char* src, unsigned char* dst, int width, const int* starts, const short* weights, int taps,
+                      void (*scalar)(const unsigned char*, unsigned char*, int, const int*, const short*, int))
+{
+    const typename V::reg zero = V::zero();
+    const typename V::reg round = V::set32(1 << (RESAMPLE_SHIFT - 1));
+    int i = 0;
+
+    for (; i + V::LANES <= width; i += V::LANES)
+    {
+        const short* w = weights + static_cast<size_t>(i) * taps;
+        typename V::reg sum = round;
+        for (int k = 0; k < taps; k += 2)
+        {
+            typename V::reg a = V::unpacklo8(V::load_pixels(src, starts + i, k), zero);
+            typename V::reg b = V::unpacklo8(V::load_pixels(src, starts + i, k + 1), zero);
+            sum = V::add32(sum, V::madd16(V::unpacklo16(a, b), V::pair_weights(w + k, taps)));
+        }
+        sum = V::srai32(sum, RESAMPLE_SHIFT);
+        V::store_pixels(dst + 3 * i, V::packus16(V::packs32(sum, zero), zero));
+    }
+
+    scalar(src, dst + 3 * i, width - i, starts + i, weights + static_cast<size_t>(i) * taps, taps);
+}
+
+/**
+ * Conversion to gray: each block is split into planes as in run_row, and
+ * each half of 16 pixels per lane becomes one register of gray bytes. The
+ * luma is two madd16s per group of four pixels, on (blue, green) pairs
+ * and on (red, 1) pairs whose second weight is the rounding term, so the
+ * sums are exact and match the scalar kernel. The average uses
+ * GrayscaleOp's division by 3.
+ */
+template <class V>
+void run_gray_row(const unsigned char* src, unsigned char* dst, const short* weights, int width,
+                  void (*scalar)(const unsigned char*, unsigned char*, const short*, int))
+{
+    const typename V::reg zero = V::zero();
+    const typename V::reg one = V::set16(1);
+    const typename V::reg third = V::set16(43691);
+    const typename V::reg blue_green = V::set32(weights == nullptr ? 0
+        : static_cast<int>(static_cast<unsigned short>(weights[0]) | static_cast<unsigned int>(weights[1]) << 16));
+    const typename V::reg red_round = V::set32(weights == nullptr ? 0
+        : static_cast<int>(static_cast<unsigned short>(weights[2]) | static_cast<unsigned int>(1 << (LUMA_SHIFT - 1)) << 16));
+    int x = 0;
+
+    for (; x + V::PIXELS <= width; x += V::PIXELS)
+    {
+        typename V::reg c[6];
+        V::load(src + 3 * x, c);
+        deinterleave<V>(c);
+
+        typename V::reg gray[2];
+        for (int half = 0; half < 2; half++)
+        {
+            typename V::reg wide[2];
+            for (int part = 0; part < 2; part++) // Pixels 0-7 and 8-15 of the half
+            {
+                typename V::reg b = part == 0 ? V::unpacklo8(c[half], zero) : V::unpackhi8(c[half], zero);
+                typename V::reg g = part == 0 ? V::unpacklo8(c[2 + half], zero) : V::unpackhi8(c[2 + half], zero);
+                typename V::reg r = part == 0 ? V::unpacklo8(c[4 + half], zero) : V::unpackhi8(c[4 + half], zero);
+                if (weights == nullptr)
+                {
+                    wide[part] = V::srli16_1(V::mulhi16(V::add16(V::add16(b, g), r), third));
+                    continue;
+                }
+                typename V::reg low = V::add32(V::madd16(V::unpacklo16(b, g), blue_green), V::madd16(V::unpacklo16(r, one), red_round));
+                typename V::reg high = V::add32(V::madd16(V::unpackhi16(b, g), blue_green), V::madd16(V::unpackhi16(r, one), red_round));
+                wide[part] = V::packs32(V::srai32(low, LUMA_SHIFT), V::srai32(high, LUMA_SHIFT));
+            }
+            gray[half] = V::packus16(wide[0], wide[1]);
+        }
+        V::store_plane(dst + x, gray[0], gray[1]);
+    }
+
+    scalar(src + 3 * x, dst + x, weights, width - x);
+}
+
+/**
+ * Box blur, vertical pass: the totals are scaled and rounded to bytes,
+ * then the difference of the row entering and the row leaving the window
+ * is widened, sign-extended and added to them. The float rounding is the
+ * scalar kernel's, so the bytes match. Each byte's total is updated once,
+ * so the bytes after the last full register go to the scalar kernel.
+ */
+template <class V>
+void run_box_columns(int* sums, const unsigned char* add, const unsigned char* subtract, unsigned char* dst, float scale, int bytes,
+                     void (*scalar)(int*, const unsigned char*, const unsigned char*, unsigned char*, float, int))
+{
+    const int STEP = sizeof(typename V::reg);
+    const typename V::reg zero = V::zero();
+    int x = 0;
+
+    for (; x + STEP <= bytes; x += STEP)
+    {
+        typename V::reg s[4];
+        V::load_sums(sums + x, s);
+        typename V::reg low = V::packs32(V::round_scaled(s[0], scale), V::round_scaled(s[1], scale));
+        typename V::reg high = V::packs32(V::round_scaled(s[2], scale), V::round_scaled(s[3], scale));
+        V::store1(dst + x, V::packus16(low, high));
+
+        typename V::reg a = V::load1(add + x), b = V::load1(subtract + x);
+        typename V::reg difference[2] = { V::sub16(V::unpacklo8(a, zero), V::unpacklo8(b, zero)),
+                                          V::sub16(V::unpackhi8(a, zero), V::unpackhi8(b, zero)) };
+        for (int half = 0; half < 2; half++)
+        {
+            typename V::reg sign = V::cmpgt16(zero, difference[half]);
+            s[2 * half] = V::add32(s[2 * half], V::unpacklo16(difference[half], sign));
+            s[2 * half + 1] = V::add32(s[2 * half + 1], V::unpackhi16(difference[half], sign));
+        }
+        V::store_sums(sums + x, s);
+    }
+
+    scalar(sums + x, add + x, subtract + x, dst + x, scale, bytes - x);
+}
+
+/**
+ * Unsharp mask: the signed difference and a 1 are interleaved as 16-bit
+ * pairs, so one madd16 with (amount, 128) gives the rounded product in 32
+ * bits, which is shifted, added to the source and packed with saturation.
+ */
+template <class V>
+void run_unsharp(const unsigned char* src, const unsigned char* blurred, unsigned char* dst, int amount, int bytes,
+                 void (*scalar)(const unsigned char*, const unsigned char*, unsigned char*, int, int))
+{
+    const int STEP = sizeof(typename V::reg);
+    const typename V::reg zero = V::zero();
+    const typename V::reg one = V::set16(1);
+    const typename V::reg factor = V::set32(static_cast<int>(static_cast<unsigned int>(amount) | 128u << 16));
+    int x = 0;
+
+    for (; x + STEP <= bytes; x += STEP)
+    {
+        typename V::reg a = V::load1(src + x), b = V::load1(blurred + x);
+        typename V::reg wide[2];
+        for (int half = 0; half < 2; half++)
+        {
+            typename V::reg value = half == 0 ? V::unpacklo8(a, zero) : V::unpackhi8(a, zero);
+            typename V::reg difference = V::sub16(value, half == 0 ? V::unpacklo8(b, zero) : V::unpackhi8(b, zero));
+            typename V::reg low = V::add32(V::srai32(V::madd16(V::unpacklo16(difference, one), factor), 8), V::unpacklo16(value, zero));
+            typename V::reg high = V::add32(V::srai32(V::madd16(V::unpackhi16(difference, one), factor), 8), V::unpackhi16(value, zero));
+            wide[half] = V::packs32(low, high);
+        }
+        V::store1(dst + x, V::packus16(wide[0], wide[1]));
+    }
+
+    scalar(src + x, blurred + x, dst + x, amount, bytes - x);
+}
+
+/**
+ * Sobel edges: the column sums (above + 2 row + below) and differences
+ * (below - above) are formed in 16 bits at the three positions a pixel
+ * apart, then combined along the row. |gx| + |gy| is at most 2040, so
+ * packus16 does the clamping to 255.
+ */
+template <class V>
+void run_sobel(const unsigned char* above, const unsigned char* row, const unsigned char* below, unsigned char* dst,
+               int bytes, int channels,
+               void (*scalar)(const unsigned char*, const unsigned char*, const unsigned char*, unsigned char*, int, int))
+{
+    const int STEP = sizeof(typename V::reg);
+    const typename V::reg zero = V::zero();
+    int x = 0;
+
+    for (; x + STEP <= bytes; x += STEP)
+    {
+        typename V::reg smooth[3][2], difference[3][2]; // At x - channels, x and x + channels; low and high halves
+        for (int position = 0; position < 3; position++)
+        {
+            int at = x + (position - 1) * channels;
+            typename V::reg a = V::load1(above + at), r = V::load1(row + at), b = V::load1(below + at);
+            for (int half = 0; half < 2; half++)
+            {
+                typename V::reg wide_a = half == 0 ? V::unpacklo8(a, zero) : V::unpackhi8(a, zero);
+                typename V::reg wide_r = half == 0 ? V::unpacklo8(r, zero) : V::unpackhi8(r, zero);
+                typename V::reg wide_b = half == 0 ? V::unpacklo8(b, zero) : V::unpackhi8(b, zero);
+                smooth[position][half] = V::add16(V::add16(wide_a, wide_b), V::add16(wide_r, wide_r));
+                difference[position][half] = V::sub16(wide_b, wide_a);
+            }
+        }
+
+        typename V::reg magnitude[2];
+        for (int half = 0; half < 2; half++)
+        {
+            typename V::reg gx = V::sub16(smooth[2][half], smooth[0][half]);
+            typename V::reg gy = V::add16(V::add16(difference[0][half], difference[2][half]),
+                                          V::add16(difference[1][half], difference[1][half]));
+            typename V::reg sign_x = V::cmpgt16(zero, gx), sign_y = V::cmpgt16(zero, gy);
+            magnitude[half] = V::add16(V::sub16(V::xor_(gx, sign_x), sign_x), V::sub16(V::xor_(gy, sign_y), sign_y));
+        }
+        V::store1(dst + x, V::packus16(magnitude[0], magnitude[1]));
+    }
+
+    scalar(above + x, row + x, below + x, dst + x, bytes - x, channels);
+}
+
+/**
+ * 2x downsampling: each output pixel is the rounded average of a 2 x 2
+ * block. Two blocks of input pixels of each row are split into planes,
+ * where a channel's neighbouring pixels are neighbouring bytes, so masking
+ * and shifting the 16-bit values sums each pair; the two rows' sums are
+ * added, rounded and packed back. A lane's two halves of output come from
+ * the two input blocks, which pair_lanes puts back in pixel order.
+ */
+template <class V>
+void run_halve(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int width,
+               void (*scalar)(const unsigned char*, const unsigned char*, unsigned char*, int))
+{
+    const typename V::reg low = V::set16(0x00FF);
+    const typename V::reg two = V::set16(2);
+    int x = 0;
+
+    for (; x + V::PIXELS <= width; x += V::PIXELS)
+    {
+        typename V::reg planes[2][3]; // Output pixels of each channel, from the first and second input blocks
+        for (int part = 0; part < 2; part++)
+        {
+            typename V::reg t[6], b[6];
+            V::load(top + 3 * (2 * x + part * V::PIXELS), t);
+            V::load(bottom + 3 * (2 * x + part * V::PIXELS), b);
+            deinterleave<V>(t);
+            deinterleave<V>(b);
+
+            for (int channel = 0; channel < 3; channel++)
+            {
+                typename V::reg averages[2];
+                for (int half = 0; half < 2; half++)
+                {
+                    typename V::reg above = t[2 * channel + half], below = b[2 * channel + half];
+                    typename V::reg sum = V::add16(V::add16(V::and_(above, low), V::srli16_8(above)),
+                                                   V::add16(V::and_(below, low), V::srli16_8(below)));
+                    averages[half] = V::srli16_1(V::srli16_1(V::add16(sum, two)));
+                }
+                planes[part][channel] = V::packus16(averages[0], averages[1]);
+            }
+        }
+
+        typename V::reg c[6];
+        for (int channel = 0; channel < 3; channel++)
+        {
+            V::pair_lanes(planes[0][channel], planes[1][channel]);
+            c[2 * channel] = planes[0][channel];
+            c[2 * channel + 1] = planes[1][channel];
+        }
+        interleave<V>(c);
+        V::store(dst + 3 * x, c);
+    }
+
+    scalar(top + 6 * x, bottom + 6 * x, dst + 3 * x, width - x);
+}
+
+// process_2: sums of 510 or more (average >= 170) are lightened, sums under 270 (average < 90) darkened
+struct ClarendonOp
+{
+    template <class V>
+    static inline typename V::reg darker(typename V::reg value)
+    {
+        // int(value * 0.3) for every byte value
+        return V::mulhi16(value, V::set16(19661));
+    }
+
+    template <class V>
+    static inline typename V::reg lighter(typename V::reg value)
+    {
+        // int(255 - (255 - value) * 0.3) == 255 - ceil((255 - value) * 19635 / 2^16) for every byte value
+        typename V::reg distance = V::sub16(V::set16(255), value);
+        typename V::reg nonzero = V::cmpgt16(distance, V::zero());
+        typename V::reg reduced = V::sub16(V::mulhi16(distance, V::set16(19635)), nonzero);
+        return V::sub16(V::set16(255), reduced);
+    }
+
+    template <class V>
+    static inline typename V::reg blend(typename V::reg value, typename V::reg light, typename V::reg dark)
+    {
+        typename V::reg keep = V::andnot(V::or_(light, dark), value);
+        return V::or_(keep, V::or_(V::and_(light, lighter<V>(value)), V::and_(dark, darker<V>(value))));
+    }
+
+    template <class V>
+    static inline void apply(typename V::reg& b, typename V::reg& g, typename V::reg& r)
+    {
+        typename V::reg sum = V::add16(V::add16(b, g), r);
+        typename V::reg light = V::cmpgt16(sum, V::set16(CLARENDON_LIGHT_TOTAL - 1));
+        typename V::reg dark = V::cmpgt16(V::set16(CLARENDON_DARK_TOTAL), sum);
+        b = blend<V>(b, light, dark);
+        g = blend<V>(g, light, dark);
+        r = blend<V>(r, light, dark);
+    }
+};
+
+// process_3: sum / 3 == (sum * 43691) >> 17 for every sum of three bytes
+struct GrayscaleOp
+{
+    template <class V>
+    static inline void apply(typename V::reg& b, typename V::reg& g, typename V::reg& r)
+    {
+        typename V::reg sum = V::add16(V::add16(b, g), r);
+        typename V::reg gray = V::srli16_1(V::mulhi16(sum, V::set16(43691)));
+        b = gray;
+        g = gray;
+        r = gray;
+    }
+};
+
+// process_7: the integer average is at least 127.5 exactly when the sum is at least 384
+struct HighContrastOp
+{
+    template <class V>
+    static inline void apply(typename V::reg& b, typename V::reg& g, typename V::reg& r)
+    {
+        typename V::reg sum = V::add16(V::add16(b, g), r);
+        typename V::reg value = V::and_(V::cmpgt16(sum, V::set16(HIGH_CONTRAST_TOTAL - 1)), V::set16(255));
+        b = value;
+        g = value;
+        r = value;
+    }
+};
+
+// process_10: white at sums of 550 or more, black at 150 or less, otherwise the strictly largest of red or green, else blue
+struct PrimaryColorsOp
+{
+    template <class V>
+    static inline void apply(typename V::reg& b, typename V::reg& g, typename V::reg& r)
+    {
+        typename V::reg sum = V::add16(V::add16(b, g), r);
+        typename V::reg white = V::cmpgt16(sum, V::set16(PRIMARY_WHITE_TOTAL - 1));
+        typename V::reg black = V::cmpgt16(V::set16(PRIMARY_BLACK_TOTAL + 1), sum);
+        typename V::reg colored = V::andnot(V::or_(white, black), V::set16(-1));
+        typename V::reg red = V::and_(V::cmpgt16(r, b), V::cmpgt16(r, g));
+        typename V::reg green = V::and_(V::cmpgt16(g, b), V::cmpgt16(g, r));
+        typename V::reg blue = V::andnot(V::or_(red, green), colored);
+        typename V::reg full = V::set16(255);
+
+        b = V::and_(V::or_(white, blue), full);
+        g = V::and_(V::or_(white, V::and_(colored, green)), full);
+        r = V::and_(V::or_(white, V::and_(colored, red)), full);
+    }
+};
+
+#endif
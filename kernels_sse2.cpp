@@ -0,0 +1,197 @@
+#include "kernels.h"
+
+#if defined(__SSE2__)
+
+#include <cstring>
+#include <emmintrin.h>
+#include "kernels_simd.h"
+
+namespace
+{
+
+// 128-bit vector interface for kernels_simd.h: one block of 32 pixels
+struct Sse2
+{
+    typedef __m128i reg;
+    static const int PIXELS = 32;
+
+    static inline void load(const unsigned char* src, reg c[6])
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            c[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * i));
+        }
+    }
+
+    static inline void store(unsigned char* dst, const reg c[6])
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16 * i), c[i]);
+        }
+    }
+
+    static inline reg load16(const short* values)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+    }
+
+    static inline reg zero() { return _mm_setzero_si128(); }
+    static inline reg set16(int value) { return _mm_set1_epi16(static_cast<short>(value)); }
+    static inline reg unpacklo8(reg a, reg b) { return _mm_unpacklo_epi8(a, b); }
+    static inline reg unpackhi8(reg a, reg b) { return _mm_unpackhi_epi8(a, b); }
+    static inline reg packus16(reg a, reg b) { return _mm_packus_epi16(a, b); }
+    static inline reg add16(reg a, reg b) { return _mm_add_epi16(a, b); }
+    static inline reg sub16(reg a, reg b) { return _mm_sub_epi16(a, b); }
+    static inline reg mulhi16(reg a, reg b) { return _mm_mulhi_epu16(a, b); }
+    static inline reg srli16_1(reg a) { return _mm_srli_epi16(a, 1); }
+    static inline reg srli16_8(reg a) { return _mm_srli_epi16(a, 8); }
+    static inline reg sll16(reg a, int count) { return _mm_sll_epi16(a, _mm_cvtsi32_si128(count)); }
+    static inline reg cmpgt16(reg a, reg b) { return _mm_cmpgt_epi16(a, b); }
+    static inline reg and_(reg a, reg b) { return _mm_and_si128(a, b); }
+    static inline reg or_(reg a, reg b) { return _mm_or_si128(a, b); }
+    static inline reg andnot(reg a, reg b) { return _mm_andnot_si128(a, b); }
+    static inline reg xor_(reg a, reg b) { return _mm_xor_si128(a, b); }
+
+    static const int LANES = 1;
+
+    static inline reg load1(const unsigned char* src) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)); }
+    static inline void store1(unsigned char* dst, reg a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), a); }
+    static inline reg set32(int value) { return _mm_set1_epi32(value); }
+    static inline reg unpacklo16(reg a, reg b) { return _mm_unpacklo_epi16(a, b); }
+    static inline reg unpackhi16(reg a, reg b) { return _mm_unpackhi_epi16(a, b); }
+    static inline reg madd16(reg a, reg b) { return _mm_madd_epi16(a, b); }
+    static inline reg add32(reg a, reg b) { return _mm_add_epi32(a, b); }
+    static inline reg srai32(reg a, int count) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(count)); }
+    static inline reg packs32(reg a, reg b) { return _mm_packs_epi32(a, b); }
+
+    static inline reg load_pixels(const unsigned char* src, const int* starts, int k)
+    {
+        int value;
+        memcpy(&value, src + 3 * (starts[0] + k), 4);
+        return _mm_cvtsi32_si128(value);
+    }
+
+    static inline reg pair_weights(const short* weights, int)
+    {
+        return _mm_set1_epi32(static_cast<int>(static_cast<unsigned short>(weights[0])
+                                               | static_cast<unsigned int>(static_cast<unsigned short>(weights[1])) << 16));
+    }
+
+    static inline void store_pixels(unsigned char* dst, reg a)
+    {
+        int value = _mm_cvtsi128_si32(a);
+        memcpy(dst, &value, 3);
+    }
+
+    static inline void store_plane(unsigned char* dst, reg first, reg second)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), second);
+    }
+
+    static inline void load_sums(const int* sums, reg s[4])
+    {
+        for (int p = 0; p < 4; p++)
+        {
+            s[p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + 4 * p));
+        }
+    }
+
+    static inline void store_sums(int* sums, const reg s[4])
+    {
+        for (int p = 0; p < 4; p++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 4 * p), s[p]);
+        }
+    }
+
+    static inline reg round_scaled(reg a, float scale)
+    {
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), _mm_set1_ps(scale)), _mm_set1_ps(0.5f)));
+    }
+
+    static inline void pair_lanes(reg&, reg&) {}
+};
+
+void sse2_clarendon(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Sse2, ClarendonOp>(src, dst, width, scalar_kernels().clarendon);
+}
+
+void sse2_grayscale(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Sse2, GrayscaleOp>(src, dst, width, scalar_kernels().grayscale);
+}
+
+void sse2_high_contrast(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Sse2, HighContrastOp>(src, dst, width, scalar_kernels().high_contrast);
+}
+
+void sse2_primary_colors(const unsigned char* src, unsigned char* dst, int width)
+{
+    run_row<Sse2, PrimaryColorsOp>(src, dst, width, scalar_kernels().primary_colors);
+}
+
+void sse2_vignette(const unsigned char* src, unsigned char* dst, const short* factors, int shift, int width)
+{
+    run_vignette_row<Sse2>(src, dst, factors, shift, width, scalar_kernels().vignette);
+}
+
+void sse2_resample_columns(const unsigned char* const* rows, const short* weights, int taps, unsigned char* dst, int bytes)
+{
+    run_resample_columns<Sse2>(rows, weights, taps, dst, bytes, scalar_kernels().resample_columns);
+}
+
+void sse2_resample_row(const unsigned char* src, unsigned char* dst, int width, const int* starts, const short* weights, int taps)
+{
+    run_resample_row<Sse2>(src, dst, width, starts, weights, taps, scalar_kernels().resample_row);
+}
+
+void sse2_to_gray(const unsigned char* src, unsigned char* dst, const short* weights, int width)
+{
+    run_gray_row<Sse2>(src, dst, weights, width, scalar_kernels().to_gray);
+}
+
+void sse2_box_columns(int* sums, const unsigned char* add, const unsigned char* subtract, unsigned char* dst, float scale, int bytes)
+{
+    run_box_columns<Sse2>(sums, add, subtract, dst, scale, bytes, scalar_kernels().box_columns);
+}
+
+void sse2_unsharp(const unsigned char* src, const unsigned char* blurred, unsigned char* dst, int amount, int bytes)
+{
+    run_unsharp<Sse2>(src, blurred, dst, amount, bytes, scalar_kernels().unsharp);
+}
+
+void sse2_sobel(const unsigned char* above, const unsigned char* row, const unsigned char* below, unsigned char* dst,
+               int bytes, int channels)
+{
+    run_sobel<Sse2>(above, row, below, dst, bytes, channels, scalar_kernels().sobel);
+}
+
+void sse2_halve(const unsigned char* top, const unsigned char* bottom, unsigned char* dst, int width)
+{
+    run_halve<Sse2>(top, bottom, dst, width, scalar_kernels().halve);
+}
+
+}
+
+const FilterKernels* sse2_kernel_table()
+{
+    static const FilterKernels kernels = {
+        "sse2", sse2_clarendon, sse2_grayscale, sse2_high_contrast, sse2_primary_colors, sse2_vignette,
+        sse2_resample_columns, sse2_resample_row, sse2_to_gray, sse2_box_columns, sse2_unsharp, sse2_sobel,
+        sse2_halve
+    };
+    return &kernels;
+}
+
+#else
+
+const FilterKernels* sse2_kernel_table()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,102 @@
+#include "lut.h"
+
+Lut identity_lut()
+{
+    Lut lut;
+    for (int c = 0; c < 3; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            lut.table[c][v] = v;
+        }
+    }
+    return lut;
+}
+
+Lut uniform_lut(int (*map)(int value, double parameter), double parameter)
+{
+    Lut lut;
+    for (int v = 0; v < 256; v++)
+    {
+        unsigned char mapped = map(v, parameter);
+        lut.table[0][v] = mapped;
+        lut.table[1][v] = mapped;
+        lut.table[2][v] = mapped;
+    }
+    return lut;
+}
+
+static int lighten_value(int value, double scaling_factor)
+{
+    // Scale old value with scaling factor, then set the lightened value
+    double scaled = (255 - value) * scaling_factor;
+    return static_cast<int>(255 - scaled);
+}
+
+static int darken_value(int value, double scaling_factor)
+{
+    // Reduce (darken) old value by the scaling factor
+    return static_cast<int>(value * scaling_factor);
+}
+
+Lut lighten_lut(double scaling_factor)
+{
+    return uniform_lut(lighten_value, scaling_factor);
+}
+
+Lut darken_lut(double scaling_factor)
+{
+    return uniform_lut(darken_value, scaling_factor);
+}
+
+Lut compose(const Lut& first, const Lut& second)
+{
+    Lut lut;
+    for (int c = 0; c < 3; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            lut.table[c][v] = second.table[c][first.table[c][v]];
+        }
+    }
+    return lut;
+}
+
+void apply_lut(const Lut& lut, const unsigned char* src, unsigned char* dst, int width)
+{
+    const unsigned char* blue = lut.table[0];
+    const unsigned char* green = lut.table[1];
+    const unsigned char* red = lut.table[2];
+    int j = 0;
+
+    // Four pixels at a time: all twelve lookups are independent loads, stored after they are all read
+    for (; j + 4 <= width; j += 4)
+    {
+        const unsigned char* in = src + 3 * j;
+        unsigned char* out = dst + 3 * j;
+        unsigned char b0 = blue[in[0]], g0 = green[in[1]], r0 = red[in[2]];
+        unsigned char b1 = blue[in[3]], g1 = green[in[4]], r1 = red[in[5]];
+        unsigned char b2 = blue[in[6]], g2 = green[in[7]], r2 = red[in[8]];
+        unsigned char b3 = blue[in[9]], g3 = green[in[10]], r3 = red[in[11]];
+        out[0] = b0; out[1] = g0; out[2] = r0;
+        out[3] = b1; out[4] = g1; out[5] = r1;
+        out[6] = b2; out[7] = g2; out[8] = r2;
+        out[9] = b3; out[10] = g3; out[11] = r3;
+    }
+
+    for (; j < width; j++) // Remaining pixels
+    {
+        dst[3 * j] = blue[src[3 * j]];
+        dst[3 * j + 1] = green[src[3 * j + 1]];
+        dst[3 * j + 2] = red[src[3 * j + 2]];
+    }
+}
+
+void apply_gray_lut(const Lut& lut, const unsigned char* src, unsigned char* dst, int width)
+{
+    const unsigned char* table = lut.table[0];
+    for (int j = 0; j < width; j++)
+    {
+        dst[j] = table[src[j]];
+    }
+}
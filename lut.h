@@ -0,0 +1,36 @@
+#ifndef LUT_H
+#define LUT_H
+
+/**
+ * A point operation stored as one 256-entry table per channel: a value v
+ * in channel c (0=blue, 1=green, 2=red) becomes table[c][v]. Tables are
+ * built once per call from the operation's own expression, so applying
+ * one gives exactly the same bytes as evaluating the expression per pixel.
+ */
+struct Lut
+{
+    unsigned char table[3][256];
+};
+
+// Table that leaves every value unchanged
+Lut identity_lut();
+
+// Table that applies the same map to all three channels; map(v) is stored as a byte
+Lut uniform_lut(int (*map)(int value, double parameter), double parameter);
+
+// Table for process_8: int(255 - (255 - v) * scaling_factor)
+Lut lighten_lut(double scaling_factor);
+
+// Table for process_9: int(v * scaling_factor)
+Lut darken_lut(double scaling_factor);
+
+// Single table with the effect of applying first and then second
+Lut compose(const Lut& first, const Lut& second);
+
+// Maps width BGR8 pixels from src to dst through the table (src may equal dst)
+void apply_lut(const Lut& lut, const unsigned char* src, unsigned char* dst, int width);
+
+// Maps width Gray8 pixels through the blue table, for tables that treat every channel alike (lighten, darken)
+void apply_gray_lut(const Lut& lut, const unsigned char* src, unsigned char* dst, int width);
+
+#endif
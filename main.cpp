@@ -1,12 +1,566 @@
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include "image.h"
+#include "codec.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "histogram.h"
+#include "result_cache.h"
+#include "trace.h"
+#include "buffer_pool.h"
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <new>
+#include <sys/stat.h>
 
 using namespace std;
 
-int main()
+// Prints how to run the editor from the command line
+static void print_usage(const char* program)
 {
+    cerr << "Usage: " << program << " [OPTION...] INPUT OUTPUT OPERATION..." << endl;
+    cerr << "Applies the operations to INPUT in order and writes the result to OUTPUT." << endl;
+    cerr << "Operations (by name or number):" << endl;
+    cerr << "  1  vignette        6  enlarge=X,Y" << endl;
+    cerr << "  2  clarendon       7  contrast" << endl;
+    cerr << "  3  grayscale       8  lighten=FACTOR" << endl;
+    cerr << "  4  rotate90        9  darken=FACTOR" << endl;
+    cerr << "  5  rotate=N        10 primary" << endl;
+    cerr << "  11 resize=W,H[,FILTER]  W or H may be 0 to keep the aspect ratio;" << endl;
+    cerr << "                          FILTER is nearest, box, bilinear or lanczos (default)" << endl;
+    cerr << "  12 gray[=WEIGHTS]       convert to one byte per pixel and write an 8-bit file; WEIGHTS is" << endl;
+    cerr << "                          average (default, as grayscale), bt601 or bt709" << endl;
+    cerr << "  13 blur=RADIUS          box blur over (2 RADIUS + 1)^2 pixels" << endl;
+    cerr << "  14 gaussian=SIGMA       Gaussian blur with standard deviation SIGMA pixels" << endl;
+    cerr << "  15 sharpen=AMOUNT[,SIGMA]  unsharp mask of strength AMOUNT (0-100) over a blur of SIGMA (default 1)" << endl;
+    cerr << "  16 edges                Sobel edge magnitude of each channel" << endl;
+    cerr << "  17 levels[=PERCENT]     stretch each channel over 0-255, clipping PERCENT at each end (default 0.5)" << endl;
+    cerr << "  18 equalize             spread the luma histogram evenly over 0-255" << endl;
+    cerr << "  19 threshold            black and white at the luma threshold that best splits the image (Otsu)" << endl;
+    cerr << "Options:" << endl;
+    cerr << "  --max-memory=SIZE  limit image buffers to SIZE bytes (suffix K, M or G); turns the buffer pool off" << endl;
+    cerr << "  --report-memory    print the memory used to standard error" << endl;
+    cerr << "  --trace=FORMAT     time each stage and count bytes and image buffers; FORMAT is text, json" << endl;
+    cerr << "                     or chrome, optionally followed by :FILE (default standard error)" << endl;
+    cerr << "  --region=X,Y,W,H   apply the operations to the W x H pixels whose top left corner is X pixels from the" << endl;
+    cerr << "                     left and Y from the top, leaving the rest of the image as it is (not with rotations," << endl;
+    cerr << "                     resizing, gray or operations 17 to 19)" << endl;
+    cerr << "  --stats            print the result's minimum, maximum, mean and percentiles per channel and of its luma" << endl;
+    cerr << "  --cache=DIR        keep results in DIR by a hash of the input's pixels and the operations, and copy a" << endl;
+    cerr << "                     result from there when the same pixels get the same operations again (not with" << endl;
+    cerr << "                     --region or --stats; turns streaming off)" << endl;
+    cerr << "  --cache-limit=SIZE most bytes of results kept in DIR, dropping the least recently used (default "
+         << (DEFAULT_RESULT_CACHE_LIMIT >> 20) << "M)" << endl;
+    cerr << "  --cache-link       hard link cached results to the outputs instead of copying them" << endl;
+    cerr << "Chains without rotations, resizing, gray or operations 13 to 19 are streamed a window of rows at a time." << endl;
+    cerr << "INPUT may be a BMP (8-bit, RLE8, 24-bit or 32-bit) or binary PGM or PPM file, recognized by its contents." << endl;
+    cerr << "OUTPUT is written as PGM or PPM if it ends in .pgm, .ppm or .pnm, and as BMP otherwise." << endl;
+    cerr << "Freed image buffers are kept for reuse up to IMAGE_EDITOR_POOL_MB mebibytes (default "
+         << (DEFAULT_POOL_LIMIT >> 20) << ")." << endl;
+    cerr << "Example: " << program << " in.bmp out.bmp grayscale darken=0.5 vignette" << endl;
+    cerr << endl;
+    cerr << "Batch: " << program << " --batch [--queue=N] [--prefetch=N] [--no-uring] [--trace=FORMAT] [--cache=DIR...]" << endl;
+    cerr << "           OUTPUT_DIR OPERATION... -- INPUT..." << endl;
+    cerr << "Processes many files at once, writing each result to OUTPUT_DIR under its own name." << endl;
+    cerr << "An INPUT may be a file, a directory of image files or a quoted pattern such as 'scans/*.bmp'." << endl;
+    cerr << "  --queue=N          images held between the read, filter and write stages (default " << BATCH_QUEUE_DEPTH << ")" << endl;
+    cerr << "  --prefetch=N       input files read ahead into the page cache, 0 for none (default " << BATCH_PREFETCH_DEPTH << ")" << endl;
+    cerr << "  --no-uring         read ahead with pread instead of io_uring" << endl;
+    cerr << "  --trace=FORMAT     as above" << endl;
+    cerr << "  --cache=DIR, --cache-limit=SIZE, --cache-link  as above" << endl;
+    cerr << endl;
+    cerr << "Run without arguments for the interactive menu." << endl;
+}
+
+// Parses a size such as 512K, 64M or 2G; false if the text is not a positive size
+static bool parse_size(const string& text, size_t& bytes)
+{
+    char* end = nullptr;
+    double value = strtod(text.c_str(), &end);
+    string suffix = end;
+    double scale = suffix == "" ? 1 : suffix == "K" ? 1 << 10 : suffix == "M" ? 1 << 20 : suffix == "G" ? 1 << 30 : 0;
+    bytes = static_cast<size_t>(value * scale);
+    return end != text.c_str() && bytes > 0;
+}
+
+// True if the name is that of a regular file (not a pipe or device, which can be read only once)
+static bool is_regular_file(const string& filename)
+{
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// True if both names refer to the same existing file
+static bool same_file(const string& first, const string& second)
+{
+    struct stat a, b;
+    return stat(first.c_str(), &a) == 0 && stat(second.c_str(), &b) == 0
+        && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+static double mebibytes(size_t bytes)
+{
+    return bytes / 1048576.0;
+}
+
+// The image pool's hits and misses, for the memory reports
+static string pool_summary()
+{
+    PoolStats stats = image_pool().stats();
+    size_t requests = stats.hits + stats.misses;
+    ostringstream text;
+    text << "buffer pool " << stats.hits << " hits, " << stats.misses << " misses ("
+         << fixed << setprecision(0) << (requests > 0 ? 100.0 * stats.hits / requests : 0.0) << "% reused)";
+    return text.str();
+}
+
+// The --cache options
+struct CacheOptions
+{
+    string directory; // "" for no cache
+    size_t limit;
+    bool link;
+};
+
+// Takes a --cache, --cache-limit or --cache-link option; false if the option is not one of them or is invalid
+static bool parse_cache_option(const string& option, CacheOptions& cache)
+{
+    if (option.compare(0, 8, "--cache=") == 0)
+    {
+        cache.directory = option.substr(8);
+        return !cache.directory.empty();
+    }
+    if (option.compare(0, 14, "--cache-limit=") == 0)
+    {
+        return parse_size(option.substr(14), cache.limit);
+    }
+    if (option == "--cache-link")
+    {
+        cache.link = true;
+        return true;
+    }
+    return false;
+}
+
+// True for the options parse_cache_option takes, valid or not
+static bool is_cache_option(const string& option)
+{
+    return option.compare(0, 7, "--cache") == 0;
+}
+
+// Opens the cache the options ask for; null if none was asked for or the directory cannot be used, which is reported
+static unique_ptr<ResultCache> open_cache(const CacheOptions& options, bool& failed)
+{
+    unique_ptr<ResultCache> cache;
+    failed = false;
+    if (!options.directory.empty())
+    {
+        cache.reset(new ResultCache(options.directory, options.limit, options.link));
+        if (!cache->ok())
+        {
+            cerr << "Error! Could not use the cache directory " << options.directory << endl;
+            cache.reset();
+            failed = true;
+        }
+    }
+    return cache;
+}
+
+// Prints a result cache's counters
+static void print_cache_summary(const ResultCache& cache)
+{
+    ResultCacheStats stats = cache.stats();
+    cerr << fixed << setprecision(2) << "result cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+         << stats.stores << " stored, " << stats.evictions << " evicted; " << stats.entries << " results, "
+         << mebibytes(stats.cached_bytes) << " MiB of " << mebibytes(stats.limit_bytes) << " MiB" << endl;
+}
+
+// Prints an image's statistics, one line per channel and one for its luma
+static void print_statistics(const ImageHistogram& histogram)
+{
+    const char* const names[] = { "blue", "green", "red" };
+    for (int c = 0; c <= histogram.channels; c++)
+    {
+        bool luma = c == histogram.channels;
+        if (luma && histogram.channels == 1)
+        {
+            break; // A gray image's luma is its only channel
+        }
+        const ChannelHistogram& channel = luma ? histogram.luma : histogram.channel[c];
+        cerr << left << setw(6) << (luma ? "luma" : histogram.channels == 1 ? "gray" : names[c]) << right << fixed
+             << setprecision(2) << " min " << setw(3) << channel.min << "  max " << setw(3) << channel.max
+             << "  mean " << setw(6) << channel.mean << "  p1 " << setw(3) << channel.percentile(0.01)
+             << "  p50 " << setw(3) << channel.percentile(0.5) << "  p99 " << setw(3) << channel.percentile(0.99) << endl;
+    }
+}
+
+// Writes a result, printing its statistics first if asked
+template <class ImageType>
+static bool write_result(const string& output, const ImageType& image, bool statistics)
+{
+    if (statistics)
+    {
+        print_statistics(image_histogram(image));
+    }
+    return write_image(output, image);
+}
+
+// Parses the operations in argv[first] up to (not including) argv[last]; prints an error and returns false if one is invalid
+static bool parse_operations(char* argv[], int first, int last, vector<Operation>& operations)
+{
+    for (int i = first; i < last; i++)
+    {
+        Operation operation;
+        if (!parse_operation(argv[i], operation))
+        {
+            cerr << "Error! Invalid operation: " << argv[i] << endl;
+            print_usage(argv[0]);
+            return false;
+        }
+        operations.push_back(operation);
+    }
+    return true;
+}
+
+// Starts tracing for a --trace=FORMAT option; false if the format is invalid
+static bool parse_trace(const string& option)
+{
+    if (!start_trace(option.substr(8)))
+    {
+#ifdef IMAGE_EDITOR_NO_TRACE
+        cerr << "Error! Tracing is not built into this program" << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// Runs the operations over many files: --batch [--queue=N] [--prefetch=N] [--no-uring] [--trace=FORMAT] OUTPUT_DIR OPERATION... -- INPUT...
+static int run_batch_command(int argc, char* argv[])
+{
+    int queue_depth = BATCH_QUEUE_DEPTH;
+    int prefetch_depth = BATCH_PREFETCH_DEPTH;
+    bool allow_io_uring = true;
+    CacheOptions cache_options = {"", DEFAULT_RESULT_CACHE_LIMIT, false};
+    int arg = 2;
+    for (; arg < argc && string(argv[arg]).compare(0, 2, "--") == 0 && string(argv[arg]) != "--"; arg++)
+    {
+        string option = argv[arg];
+        bool valid = false;
+        if (option.compare(0, 8, "--queue=") == 0)
+        {
+            queue_depth = atoi(argv[arg] + 8);
+            valid = queue_depth >= 1;
+        }
+        else if (option.compare(0, 11, "--prefetch=") == 0)
+        {
+            prefetch_depth = atoi(argv[arg] + 11);
+            valid = prefetch_depth >= 0 && option.size() > 11;
+        }
+        else if (option == "--no-uring")
+        {
+            allow_io_uring = false;
+            valid = true;
+        }
+        else if (option.compare(0, 8, "--trace=") == 0)
+        {
+            valid = parse_trace(option);
+        }
+        else if (is_cache_option(option))
+        {
+            valid = parse_cache_option(option, cache_options);
+        }
+        if (!valid)
+        {
+            cerr << "Error! Invalid option: " << argv[arg] << endl;
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    int separator = arg;
+    while (separator < argc && string(argv[separator]) != "--")
+    {
+        separator++;
+    }
+    if (separator - arg < 2 || separator + 1 >= argc)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    vector<Operation> operations;
+    if (!parse_operations(argv, arg + 1, separator, operations))
+    {
+        return 2;
+    }
+    vector<string> inputs = expand_inputs(vector<string>(argv + separator + 1, argv + argc));
+    bool cache_failed = false;
+    unique_ptr<ResultCache> cache = open_cache(cache_options, cache_failed);
+    if (cache_failed)
+    {
+        return 1;
+    }
+
+    BatchSummary summary = run_batch(inputs, argv[arg], operations, queue_depth, prefetch_depth, allow_io_uring,
+                                     cache.get());
+    double seconds = summary.seconds > 0 ? summary.seconds : 1e-9;
+    cerr << fixed << setprecision(2) << summary.images << " images (" << summary.failed << " failed) in "
+         << summary.seconds << " s: " << summary.images / seconds << " images/s, "
+         << summary.bytes_read / 1e6 / seconds << " MB/s read, "
+         << summary.bytes_written / 1e6 / seconds << " MB/s written, " << pool_summary() << endl;
+    cerr << "Busy: read " << summary.read_seconds << " s, filter " << summary.filter_seconds << " s, write "
+         << summary.write_seconds << " s; read-ahead: "
+         << (prefetch_depth == 0 || inputs.size() < 2 ? "off" : summary.io_uring ? "io_uring" : "pread") << endl;
+    if (cache)
+    {
+        print_cache_summary(*cache);
+    }
+    return summary.failed == 0 ? 0 : 1;
+}
+
+// Runs the chain of operations given on the command line
+static int run_command_line(int argc, char* argv[])
+{
+    size_t memory_limit = 0;
+    bool report_memory = false;
+    bool statistics = false;
+    bool limited = false; // True if --region was given
+    Region region = {0, 0, 0, 0}; // From the top left of the picture, until the image's height is known
+    CacheOptions cache_options = {"", DEFAULT_RESULT_CACHE_LIMIT, false};
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).compare(0, 2, "--") == 0; arg++)
+    {
+        string option = argv[arg];
+        if (option == "--report-memory")
+        {
+            report_memory = true;
+        }
+        else if (option == "--stats")
+        {
+            statistics = true;
+        }
+        else if (option.compare(0, 8, "--trace=") == 0)
+        {
+            if (!parse_trace(option))
+            {
+                cerr << "Error! Invalid option: " << option << endl;
+                print_usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (is_cache_option(option))
+        {
+            if (!parse_cache_option(option, cache_options))
+            {
+                cerr << "Error! Invalid option: " << option << endl;
+                print_usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (option.compare(0, 9, "--region=") == 0)
+        {
+            char end = '\0';
+            limited = sscanf(option.c_str() + 9, "%d,%d,%d,%d%c", &region.x, &region.y, &region.width, &region.height, &end) == 4
+                      && region.x >= 0 && region.y >= 0 && region.width > 0 && region.height > 0;
+            if (!limited)
+            {
+                cerr << "Error! Invalid option: " << option << endl;
+                print_usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (option.compare(0, 13, "--max-memory=") != 0 || !parse_size(option.substr(13), memory_limit))
+        {
+            cerr << "Error! Invalid option: " << option << endl;
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (argc - arg < 3)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (memory_limit > 0)
+    {
+        image_pool().set_limit(0); // Idle buffers would count against the limit
+    }
+    string input = argv[arg];
+    string output = argv[arg + 1];
+
+    vector<Operation> operations;
+    if (!parse_operations(argv, arg + 2, argc, operations))
+    {
+        return 2;
+    }
+
+    if (limited && chain_reach(operations) < 0)
+    {
+        cerr << "Error! --region cannot be used with rotations, resizing, gray or operations 17 to 19" << endl;
+        return 2;
+    }
+    bool cache_failed = false;
+    unique_ptr<ResultCache> cache = limited || statistics ? nullptr : open_cache(cache_options, cache_failed);
+    if (cache_failed)
+    {
+        return 1;
+    }
+
+    // Stream whenever the chain and file allow it (writing over the input, --stats or the cache, which hashes the
+    // whole image, needs the whole image)
+    if (!limited && !statistics && !cache && is_streamable(operations) && !same_file(input, output) && can_stream(input, output))
+    {
+        StreamReport report;
+        bool streamed;
+        try
+        {
+            streamed = stream_pipeline(input, output, operations, memory_limit, report);
+        }
+        catch (const bad_alloc&) // The row buffers of an enlargement's window can be too large
+        {
+            cerr << "Error! Not enough memory for the row buffers" << endl;
+            return 1;
+        }
+        if (!streamed)
+        {
+            if (report.window_rows == 0 && report.buffer_bytes > 0)
+            {
+                cerr << "Error! One row needs " << report.buffer_bytes << " bytes, over the memory limit" << endl;
+            }
+            else
+            {
+                cerr << "Error! Could not process " << input << " into " << output << endl;
+            }
+            return 1;
+        }
+        if (report_memory)
+        {
+            cerr << fixed << setprecision(2) << "memory: streamed " << report.window_rows << " rows at a time, "
+                 << mebibytes(report.buffer_bytes) << " MiB of row buffers, peak RSS "
+                 << mebibytes(peak_resident_bytes()) << " MiB, " << pool_summary() << endl;
+        }
+        return 0;
+    }
+
+    // Rotations, resizing and gray need the whole image: check the limit before reading it (pipes can only be
+    // read once, so theirs is checked once the image is in)
+    ImageInfo info = {0, 0};
+    bool regular = is_regular_file(input);
+    if (regular && !read_image_info(input, info))
+    {
+        cerr << "Error! Could not read " << input << endl;
+        return 1;
+    }
+    if (regular && !chain_fits(info.width, info.height, operations))
+    {
+        cerr << "Error! This chain makes an image more than " << MAX_IMAGE_SIDE << " pixels wide or tall" << endl;
+        return 1;
+    }
+    size_t needed = pipeline_memory(info.width, info.height, operations);
+    if (memory_limit > 0 && needed > memory_limit)
+    {
+        cerr << "Error! This chain needs the whole image in memory: " << needed << " bytes, over the memory limit" << endl;
+        return 1;
+    }
+
+    try
+    {
+        // A chain starting with gray reads straight into a gray image; one that turns gray later converts on the way
+        Image input_image;
+        GrayImage gray_image;
+        bool read = starts_gray(operations) ? read_image(input, gray_image, operation_weights(operations.front()))
+                                            : read_image(input, input_image);
+        if (!read)
+        {
+            cerr << "Error! Could not read " << input << endl;
+            return 1;
+        }
+        if (!regular)
+        {
+            bool fits = starts_gray(operations) ? chain_fits(gray_image.width(), gray_image.height(), operations)
+                                                : chain_fits(input_image.width(), input_image.height(), operations);
+            if (!fits)
+            {
+                cerr << "Error! This chain makes an image more than " << MAX_IMAGE_SIDE << " pixels wide or tall" << endl;
+                return 1;
+            }
+            needed = starts_gray(operations) ? pipeline_memory(gray_image.width(), gray_image.height(), operations)
+                                             : pipeline_memory(input_image.width(), input_image.height(), operations);
+            if (memory_limit > 0 && needed > memory_limit)
+            {
+                cerr << "Error! This chain needs the whole image in memory: " << needed << " bytes, over the memory limit" << endl;
+                return 1;
+            }
+        }
+        string key;
+        if (cache)
+        {
+            key = starts_gray(operations) ? result_key(gray_image, operations, output)
+                                          : result_key(input_image, operations, output);
+            if (cache->fetch(key, output))
+            {
+                print_cache_summary(*cache);
+                return 0;
+            }
+            release_output(output);
+        }
+        if (limited) // Only the region's pixels change, in place
+        {
+            long top = static_cast<long>(input_image.height()) - region.y - region.height; // Can fall below an int
+            region.y = static_cast<int>(max(top, -static_cast<long>(region.height)));
+            run_region(input_image, input_image, region, operations);
+        }
+        bool written = limited ? write_result(output, input_image, statistics)
+            : !converts_to_gray(operations) ? write_result(output, run_pipeline(std::move(input_image), operations), statistics)
+            : starts_gray(operations) ? write_result(output, run_pipeline(std::move(gray_image), operations), statistics)
+            : write_result(output, run_gray_pipeline(std::move(input_image), operations), statistics);
+        if (!written)
+        {
+            cerr << "Error! Could not write " << output << endl;
+            return 1;
+        }
+        if (cache)
+        {
+            cache->store(key, output);
+            print_cache_summary(*cache);
+        }
+    }
+    catch (const bad_alloc&)
+    {
+        cerr << "Error! Not enough memory for the whole image: " << needed << " bytes" << endl;
+        return 1;
+    }
+    if (report_memory)
+    {
+        cerr << fixed << setprecision(2) << "memory: whole image, " << mebibytes(needed)
+             << " MiB of image buffers, peak RSS " << mebibytes(peak_resident_bytes()) << " MiB, " << pool_summary() << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* trace = getenv("IMAGE_EDITOR_TRACE"); // Same formats as --trace
+    if (trace && *trace)
+    {
+        start_trace(trace);
+    }
+
+    if (argc > 1)
+    {
+        int status = string(argv[1]) == "--batch" ? run_batch_command(argc, argv) : run_command_line(argc, argv);
+        finish_trace();
+        return status;
+    }
+
     bool done = false;
     while (!done)
     {
@@ -22,6 +576,14 @@ int main()
         cout << "8) Lighten" << endl;
         cout << "9) Darken" << endl;
         cout << "10) Black, white, red, green, and blue only" << endl;
+        cout << "11) Resize" << endl;
+        cout << "13) Box Blur" << endl;
+        cout << "14) Gaussian Blur" << endl;
+        cout << "15) Sharpen" << endl;
+        cout << "16) Edges" << endl;
+        cout << "17) Auto Levels" << endl;
+        cout << "18) Equalize" << endl;
+        cout << "19) Threshold" << endl;
         cout << "Please enter the number of your desired process (or Q to quit): ";
 
         int selection; // Take selection from user
@@ -33,7 +595,7 @@ int main()
             done = true;
         }
 
-        else if (selection > 10)
+        else if (selection > 19 || selection == 12)
         {
             cout << "Error! Invalid selection." << endl;
         }
@@ -43,7 +605,8 @@ int main()
             cout << endl << "Please enter the input BMP file name: ";
             string infile_name;
             cin >> infile_name;
-            vector<vector<vector<int> > > input_image = read_image(infile_name);
+            Image input_image;
+            read_image(infile_name, input_image);
 
             cout << "Please enter the output BMP file name: ";
             string outfile_name;
@@ -51,40 +614,84 @@ int main()
 
             switch (selection)
             {
-                case 1 : write_image(outfile_name, process_1(input_image)); break;
+                case 1 : write_image(outfile_name, process_1(std::move(input_image))); break;
 
-                case 2 : write_image(outfile_name, process_2(input_image)); break;
+                case 2 : write_image(outfile_name, process_2(std::move(input_image))); break;
 
-                case 3 : write_image(outfile_name, process_3(input_image)); break;
+                case 3 : write_image(outfile_name, process_3(std::move(input_image))); break;
 
-                case 4 : write_image(outfile_name, process_4(input_image)); break;
+                case 4 : write_image(outfile_name, process_4(std::move(input_image))); break;
 
                 case 5 : 
                     cout << "Enter the number of rotations: "; 
                     int n; cin >> n;
-                    write_image(outfile_name, process_5(input_image, n)); break;
+                    write_image(outfile_name, process_5(std::move(input_image), n)); break;
 
                 case 6 :
                     cout << "Enter the x scale, as an integer: ";
                     int x; cin >> x;
                     cout << "Enter the y scale, as an integer: ";
                     int y; cin >> y;
-                    write_image(outfile_name, process_6(input_image, x, y)); break;
+                    write_image(outfile_name, process_6(std::move(input_image), x, y)); break;
 
                 case 7 :
-                    write_image(outfile_name, process_7(input_image)); break;
+                    write_image(outfile_name, process_7(std::move(input_image))); break;
 
                 case 8 :
                     cout << "Enter a scaling factor between 0 and 1: ";
                     double scale; cin >> scale;
-                    write_image(outfile_name, process_8(input_image, scale)); break;
+                    write_image(outfile_name, process_8(std::move(input_image), scale)); break;
 
                 case 9 :
                     cout << "Enter a scaling factor between 0 and 1: ";
                     double scale_factor; cin >> scale_factor;
-                    write_image(outfile_name, process_9(input_image, scale_factor)); break;
+                    write_image(outfile_name, process_9(std::move(input_image), scale_factor)); break;
+
+                case 10 : write_image(outfile_name, process_10(std::move(input_image))); break;
+
+                case 11 :
+                {
+                    cout << "Enter the new width (0 to keep the aspect ratio): ";
+                    int width; cin >> width;
+                    cout << "Enter the new height (0 to keep the aspect ratio): ";
+                    int height; cin >> height;
+                    cout << "Enter the filter (nearest, box, bilinear or lanczos): ";
+                    string name; cin >> name;
+                    ResampleFilter filter = RESAMPLE_LANCZOS3;
+                    parse_resample_filter(name, filter);
+                    resize_dimensions(input_image.width(), input_image.height(), width, height);
+                    write_image(outfile_name, process_11(std::move(input_image), max(width, 1), max(height, 1), filter)); break;
+                }
+
+                case 13 :
+                    cout << "Enter the blur radius in pixels: ";
+                    int radius; cin >> radius;
+                    write_image(outfile_name, process_13(std::move(input_image), radius)); break;
+
+                case 14 :
+                    cout << "Enter the standard deviation in pixels: ";
+                    double sigma; cin >> sigma;
+                    write_image(outfile_name, process_14(std::move(input_image), max(sigma, 0.1))); break;
+
+                case 15 :
+                {
+                    cout << "Enter the amount (1 is a moderate sharpening): ";
+                    double amount; cin >> amount;
+                    cout << "Enter the blur's standard deviation in pixels: ";
+                    double blur; cin >> blur;
+                    write_image(outfile_name, process_15(std::move(input_image), amount, max(blur, 0.1))); break;
+                }
+
+                case 16 : write_image(outfile_name, process_16(std::move(input_image))); break;
+
+                case 17 :
+                    cout << "Enter the percent of values to clip at each end (0.5 is typical): ";
+                    double percent; cin >> percent;
+                    write_image(outfile_name, process_17(std::move(input_image), min(max(percent, 0.0), 50.0) / 100)); break;
+
+                case 18 : write_image(outfile_name, process_18(std::move(input_image))); break;
 
-                case 10 : write_image(outfile_name, process_10(input_image)); break;
+                case 19 : write_image(outfile_name, process_19(std::move(input_image))); break;
             }
 
             cout << endl << "Operation successful!" << endl << endl;
@@ -92,5 +699,6 @@ int main()
         
 
     }
+    finish_trace();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,792 @@
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "pipeline.h"
+#include "image.h"
+#include "codec.h"
+#include "kernels.h"
+#include "lut.h"
+#include "thread_pool.h"
+#include "transform.h"
+#include "vignette.h"
+#include "convolve.h"
+#include "histogram.h"
+#include "trace.h"
+
+using namespace std;
+
+// Names accepted by parse_operation, indexed by process number
+static const char* const OPERATION_NAMES[] = {
+    "", "vignette", "clarendon", "grayscale", "rotate90", "rotate",
+    "enlarge", "contrast", "lighten", "darken", "primary", "resize", "gray",
+    "blur", "gaussian", "sharpen", "edges", "levels", "equalize", "threshold"
+};
+
+// Number of parameters each process takes, indexed by process number (gray's and levels' parameters and sharpen's
+// second are optional)
+static const int PARAMETER_COUNTS[] = {0, 0, 0, 0, 0, 1, 2, 0, 1, 1, 0, 2, 1, 1, 1, 2, 0, 1, 0, 0};
+
+// Names of the gray weights, indexed by GrayWeights
+static const char* const WEIGHT_NAMES[] = { "average", "bt601", "bt709" };
+
+// Parses a whole string as a number; false if anything is left over
+static bool parse_number(const string& text, double& value)
+{
+    if (text.empty())
+    {
+        return false;
+    }
+    char* end = nullptr;
+    value = strtod(text.c_str(), &end);
+    return *end == '\0';
+}
+
+// Parses a whole number from low to high; false for fractions and anything out of range (including NaN)
+static bool parse_whole(const string& text, double& value, double low, double high)
+{
+    return parse_number(text, value) && value >= low && value <= high && value == floor(value);
+}
+
+bool parse_operation(const string& text, Operation& operation)
+{
+    size_t equals = text.find('=');
+    string name = text.substr(0, equals);
+    string parameters = equals == string::npos ? "" : text.substr(equals + 1);
+
+    int process = 0;
+    for (int i = 1; i <= LAST_PROCESS; i++)
+    {
+        if (name == OPERATION_NAMES[i] || name == to_string(i))
+        {
+            process = i;
+        }
+    }
+    if (process == 0 || ((equals != string::npos) != (PARAMETER_COUNTS[process] > 0) && process != GRAY_PROCESS && process != 17))
+    {
+        return false;
+    }
+
+    operation.process = process;
+    operation.first = 0;
+    operation.second = 0;
+    operation.filter = RESAMPLE_LANCZOS3;
+
+    if (process == 11) // resize=WIDTH,HEIGHT[,FILTER], where one of the sizes may be 0
+    {
+        size_t comma = parameters.find(',');
+        size_t second_comma = comma == string::npos ? string::npos : parameters.find(',', comma + 1);
+        return comma != string::npos
+            && parse_whole(parameters.substr(0, comma), operation.first, 0, MAX_IMAGE_SIDE)
+            && parse_whole(parameters.substr(comma + 1, second_comma - comma - 1), operation.second, 0, MAX_IMAGE_SIDE)
+            && (second_comma == string::npos || parse_resample_filter(parameters.substr(second_comma + 1), operation.filter))
+            && operation.first + operation.second > 0;
+    }
+
+    if (process == GRAY_PROCESS) // gray[=WEIGHTS]
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (parameters == WEIGHT_NAMES[i])
+            {
+                operation.first = i;
+            }
+        }
+        return equals == string::npos || operation.first != 0 || parameters == WEIGHT_NAMES[0];
+    }
+    if (process == 13) // blur=RADIUS, in whole pixels
+    {
+        return parse_number(parameters, operation.first) && operation.first == floor(operation.first)
+            && operation.first >= 0 && operation.first <= MAX_BLUR_RADIUS;
+    }
+    if (process == 14) // gaussian=SIGMA
+    {
+        return parse_number(parameters, operation.first) && operation.first > 0 && operation.first <= MAX_BLUR_SIGMA;
+    }
+    if (process == 15) // sharpen=AMOUNT[,SIGMA]
+    {
+        size_t comma = parameters.find(',');
+        operation.second = 1;
+        return parse_number(parameters.substr(0, comma), operation.first) && operation.first >= 0 && operation.first <= 100
+            && (comma == string::npos || (parse_number(parameters.substr(comma + 1), operation.second)
+                                          && operation.second > 0 && operation.second <= MAX_BLUR_SIGMA));
+    }
+    if (process == 17) // levels[=PERCENT]
+    {
+        operation.first = DEFAULT_LEVELS_CLIP * 100;
+        return equals == string::npos
+            || (parse_number(parameters, operation.first) && operation.first >= 0 && operation.first <= 50);
+    }
+    if (process == 5) // rotate=N, any whole number of quarter turns
+    {
+        return parse_whole(parameters, operation.first, INT_MIN, INT_MAX);
+    }
+    if (process == 6) // enlarge=X,Y, whole factors
+    {
+        size_t comma = parameters.find(',');
+        return comma != string::npos
+            && parse_whole(parameters.substr(0, comma), operation.first, 1, MAX_IMAGE_SIDE)
+            && parse_whole(parameters.substr(comma + 1), operation.second, 1, MAX_IMAGE_SIDE);
+    }
+    if (process == 8 || process == 9) // lighten=FACTOR, darken=FACTOR; 255 times the factor must fit an int
+    {
+        return parse_number(parameters, operation.first) && operation.first >= 0 && operation.first <= INT_MAX / 255;
+    }
+    return true;
+}
+
+string operation_name(const Operation& operation)
+{
+    if (operation.process < 1 || operation.process > LAST_PROCESS)
+    {
+        return "unknown";
+    }
+    return OPERATION_NAMES[operation.process];
+}
+
+// True for the filters that read the pixels around each pixel
+static bool is_neighbourhood_operation(const Operation& operation)
+{
+    return operation.process >= 13 && operation.process <= 16;
+}
+
+// True for the operations that map values by statistics of the whole image
+static bool is_histogram_operation(const Operation& operation)
+{
+    return operation.process >= 17 && operation.process <= 19;
+}
+
+bool is_row_operation(const Operation& operation)
+{
+    return operation.process != 4 && operation.process != 5 && operation.process != 6 && operation.process != 11
+        && operation.process != GRAY_PROCESS && !is_neighbourhood_operation(operation) && !is_histogram_operation(operation);
+}
+
+int operation_reach(const Operation& operation)
+{
+    switch (operation.process)
+    {
+        case 13 : return static_cast<int>(operation.first);
+        case 14 : return gaussian_reach(operation.first);
+        case 15 : return gaussian_reach(operation.second);
+        case 16 : return 1;
+    }
+    return is_row_operation(operation) ? 0 : -1;
+}
+
+int chain_reach(const vector<Operation>& operations)
+{
+    long reach = 0;
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        int step = operation_reach(operations[i]);
+        if (step < 0)
+        {
+            return -1;
+        }
+        reach = min(reach + step, static_cast<long>(INT_MAX));
+    }
+    return static_cast<int>(reach);
+}
+
+GrayWeights operation_weights(const Operation& operation)
+{
+    return static_cast<GrayWeights>(static_cast<int>(operation.first));
+}
+
+// The first gray operation of a chain, or its end
+static vector<Operation>::const_iterator find_gray(const vector<Operation>& operations)
+{
+    vector<Operation>::const_iterator op = operations.begin();
+    while (op != operations.end() && op->process != GRAY_PROCESS)
+    {
+        ++op;
+    }
+    return op;
+}
+
+bool converts_to_gray(const vector<Operation>& operations)
+{
+    return find_gray(operations) != operations.end();
+}
+
+bool starts_gray(const vector<Operation>& operations)
+{
+    return !operations.empty() && operations.front().process == GRAY_PROCESS;
+}
+
+// One step of a fused run, applied to a single row
+struct RowStep
+{
+    void (*kernel)(const unsigned char* src, unsigned char* dst, int width); // Color filter, or nullptr
+    shared_ptr<const VignetteMask> vignette; // Falloff for process_1, which depends on the row's position
+    Lut lut;        // Used when kernel and vignette are both null
+};
+
+// Turns a run of row operations on a width x height image into steps, folding neighbouring lighten and darken steps into one table
+static vector<RowStep> build_steps(vector<Operation>::const_iterator first, vector<Operation>::const_iterator last,
+                                   int width, int height, PixelFormat format = PIXEL_BGR8)
+{
+    const FilterKernels& kernels = active_kernels(format);
+    vector<RowStep> steps;
+    bool merging = false; // True while the last step is a table that the next table can be folded into
+
+    for (vector<Operation>::const_iterator op = first; op != last; ++op)
+    {
+        if (op->process == 8 || op->process == 9)
+        {
+            Lut lut = op->process == 8 ? lighten_lut(op->first) : darken_lut(op->first);
+            if (merging)
+            {
+                steps.back().lut = compose(steps.back().lut, lut);
+            }
+            else
+            {
+                RowStep step = {nullptr, nullptr, lut};
+                steps.push_back(step);
+                merging = true;
+            }
+            continue;
+        }
+
+        RowStep step = {nullptr, nullptr, Lut()};
+        if (op->process == 1)
+        {
+            step.vignette = vignette_mask(width, height);
+        }
+        switch (op->process)
+        {
+            case 2 : step.kernel = kernels.clarendon; break;
+            case 3 : step.kernel = kernels.grayscale; break;
+            case 7 : step.kernel = kernels.high_contrast; break;
+            case 10 : step.kernel = kernels.primary_colors; break;
+        }
+        steps.push_back(step);
+        merging = false;
+    }
+    return steps;
+}
+
+// Runs the steps over one row of an image, or over width pixels of it from column: the first step reads in, the
+// rest work in place on out
+static void apply_steps(const vector<RowStep>& steps, const unsigned char* in, unsigned char* out, int width, int row,
+                        vector<short>& scratch, PixelFormat format = PIXEL_BGR8, int column = 0)
+{
+    for (size_t s = 0; s < steps.size(); s++) // The row stays in cache between steps
+    {
+        const RowStep& step = steps[s];
+        if (step.kernel != nullptr)
+        {
+            step.kernel(in, out, width);
+        }
+        else if (step.vignette)
+        {
+            vignette_span(*step.vignette, in, out, row, column, width, scratch, format);
+        }
+        else if (format == PIXEL_GRAY8)
+        {
+            apply_gray_lut(step.lut, in, out, width);
+        }
+        else
+        {
+            apply_lut(step.lut, in, out, width);
+        }
+        in = out;
+    }
+}
+
+// Runs the steps over every row of the image into result, which may be the image itself
+template <class ImageType>
+static void run_fused(const ImageType& image, ImageType& result, const vector<RowStep>& steps)
+{
+    TRACE_SCOPE("fused_pass");
+    int height = image.height();
+    int width = image.width();
+    result.reshape(width, height);
+
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        vector<short> scratch;
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            apply_steps(steps, image.row(i), result.row(i), width, i, scratch, ImageType::Format::FORMAT);
+        }
+    });
+}
+
+// Applies a single geometric operation into result; when result is the image, only a half turn avoids a new buffer
+static void run_geometric(const Image& image, Image& result, const Operation& operation)
+{
+    switch (operation.process)
+    {
+        case 4 : process_4(image, result); break;
+        case 5 : process_5(image, result, static_cast<int>(operation.first)); break;
+        case 11 :
+        {
+            int width = static_cast<int>(operation.first), height = static_cast<int>(operation.second);
+            resize_dimensions(image.width(), image.height(), width, height);
+            process_11(image, result, width, height, operation.filter);
+            break;
+        }
+        case GRAY_PROCESS : to_color(to_gray(image, operation_weights(operation)), result); break;
+        case 13 : process_13(image, result, static_cast<int>(operation.first)); break;
+        case 14 : process_14(image, result, operation.first); break;
+        case 15 : process_15(image, result, operation.first, operation.second); break;
+        case 16 : process_16(image, result); break;
+        case 17 : process_17(image, result, operation.first / 100); break;
+        case 18 : process_18(image, result); break;
+        case 19 : process_19(image, result); break;
+        default : process_6(image, result, static_cast<int>(operation.first), static_cast<int>(operation.second));
+    }
+}
+
+// The same for a gray image, which a gray operation leaves unchanged
+static void run_geometric(const GrayImage& image, GrayImage& result, const Operation& operation)
+{
+    switch (operation.process)
+    {
+        case 4 : rotate(image, result, 1); break;
+        case 5 : rotate(image, result, static_cast<int>(operation.first)); break;
+        case 6 :
+            resample(image, result, image.width() * static_cast<int>(operation.first),
+                     image.height() * static_cast<int>(operation.second), RESAMPLE_NEAREST);
+            break;
+        case 11 :
+        {
+            int width = static_cast<int>(operation.first), height = static_cast<int>(operation.second);
+            resize_dimensions(image.width(), image.height(), width, height);
+            resample(image, result, width, height, operation.filter);
+            break;
+        }
+        case 13 : box_blur(image, result, static_cast<int>(operation.first)); break;
+        case 14 : gaussian_blur(image, result, operation.first); break;
+        case 15 : unsharp_mask(image, result, operation.first, operation.second); break;
+        case 16 : sobel_edges(image, result); break;
+        case 17 : auto_levels(image, result, operation.first / 100); break;
+        case 18 : equalize(image, result); break;
+        case 19 : adaptive_threshold(image, result); break;
+        default :
+            if (&image != &result)
+            {
+                result = image;
+            }
+    }
+}
+
+/**
+ * Runs the operations from source into current. Source is either the
+ * caller's input, which is only read, or current itself; after the first
+ * step it is always current, so fused runs and half turns work in place.
+ */
+template <class ImageType>
+static void run_operations(const ImageType& image, ImageType& current, const vector<Operation>& operations)
+{
+    const ImageType* source = &image;
+    vector<Operation>::const_iterator op = operations.begin();
+
+    while (op != operations.end())
+    {
+        if (!is_row_operation(*op))
+        {
+            run_geometric(*source, current, *op);
+            source = &current;
+            ++op;
+            continue;
+        }
+
+        vector<Operation>::const_iterator last = op;
+        while (last != operations.end() && is_row_operation(*last)) // Find the end of the run of row operations
+        {
+            ++last;
+        }
+        run_fused(*source, current, build_steps(op, last, source->width(), source->height(), ImageType::Format::FORMAT));
+        source = &current;
+        op = last;
+    }
+}
+
+Image run_pipeline(const Image& image, const vector<Operation>& operations)
+{
+    TRACE_SCOPE("run_pipeline");
+    if (operations.empty())
+    {
+        return image;
+    }
+
+    Image current; // The input is only read, never copied
+    run_operations(image, current, operations);
+    return current;
+}
+
+Image run_pipeline(Image&& image, const vector<Operation>& operations)
+{
+    TRACE_SCOPE("run_pipeline");
+    Image current(std::move(image));
+    run_operations(current, current, operations);
+    return current;
+}
+
+GrayImage run_gray_pipeline(Image&& image, const vector<Operation>& operations)
+{
+    TRACE_SCOPE("run_pipeline");
+    vector<Operation>::const_iterator gray = find_gray(operations);
+    GrayImage current;
+    {
+        Image color(std::move(image)); // Back to the pool once it is converted
+        run_operations(color, color, vector<Operation>(operations.begin(), gray));
+        to_gray(color, current, gray != operations.end() ? operation_weights(*gray) : GRAY_AVERAGE);
+    }
+    run_operations(current, current, vector<Operation>(gray, operations.end()));
+    return current;
+}
+
+GrayImage run_pipeline(GrayImage&& image, const vector<Operation>& operations)
+{
+    TRACE_SCOPE("run_pipeline");
+    GrayImage current(std::move(image));
+    run_operations(current, current, operations);
+    return current;
+}
+
+// Runs the chain over the pixels of image within area (clipped to the image, not empty) into the same pixels of result
+template <class ImageType>
+static void run_area(const ImageType& image, ImageType& result, const Region& area, const vector<Operation>& operations,
+                     int reach)
+{
+    const PixelFormat format = ImageType::Format::FORMAT;
+    const int channels = ImageType::CHANNELS;
+    if (all_of(operations.begin(), operations.end(), is_row_operation)) // One fused pass over the area's pixels
+    {
+        vector<RowStep> steps = build_steps(operations.begin(), operations.end(), image.width(), image.height(), format);
+        parallel_rows(area.height, static_cast<size_t>(area.width) * channels * 2, [&](int begin, int end)
+        {
+            vector<short> scratch;
+            for (int i = area.y + begin; i < area.y + end; i++)
+            {
+                apply_steps(steps, image.pixel(i, area.x), result.pixel(i, area.x), area.width, i, scratch, format, area.x);
+            }
+        });
+        return;
+    }
+
+    // The window of pixels the area's results depend on
+    int left = static_cast<int>(max(static_cast<long>(area.x) - reach, 0L));
+    int bottom = static_cast<int>(max(static_cast<long>(area.y) - reach, 0L));
+    int right = static_cast<int>(min(static_cast<long>(area.x) + area.width + reach, static_cast<long>(image.width())));
+    int top = static_cast<int>(min(static_cast<long>(area.y) + area.height + reach, static_cast<long>(image.height())));
+    ImageType window = ImageType::uninitialized(right - left, top - bottom);
+    for (int i = 0; i < window.height(); i++)
+    {
+        memcpy(window.row(i), image.pixel(bottom + i, left), window.row_bytes());
+    }
+
+    vector<Operation>::const_iterator op = operations.begin();
+    while (op != operations.end())
+    {
+        if (!is_row_operation(*op))
+        {
+            run_geometric(window, window, *op);
+            ++op;
+            continue;
+        }
+
+        // Row operations see the window's pixels at their places in the image, for the vignette
+        vector<Operation>::const_iterator last = op;
+        while (last != operations.end() && is_row_operation(*last))
+        {
+            ++last;
+        }
+        vector<RowStep> steps = build_steps(op, last, image.width(), image.height(), format);
+        parallel_rows(window.height(), window.row_bytes() * 2, [&](int begin, int end)
+        {
+            vector<short> scratch;
+            for (int i = begin; i < end; i++)
+            {
+                apply_steps(steps, window.row(i), window.row(i), window.width(), bottom + i, scratch, format, left);
+            }
+        });
+        op = last;
+    }
+
+    size_t bytes = static_cast<size_t>(area.width) * channels;
+    for (int i = area.y; i < area.y + area.height; i++)
+    {
+        memcpy(result.pixel(i, area.x), window.pixel(i - bottom, area.x - left), bytes);
+    }
+}
+
+template <class ImageType>
+static bool run_region_operations(const ImageType& image, ImageType& result, const Region& region,
+                                  const vector<Operation>& operations)
+{
+    TRACE_SCOPE("run_region");
+    int reach = chain_reach(operations);
+    if (reach < 0 || result.width() != image.width() || result.height() != image.height())
+    {
+        return false;
+    }
+
+    Region area;
+    area.x = max(region.x, 0);
+    area.y = max(region.y, 0);
+    area.width = static_cast<int>(min(static_cast<long>(region.x) + region.width, static_cast<long>(image.width()))) - area.x;
+    area.height = static_cast<int>(min(static_cast<long>(region.y) + region.height, static_cast<long>(image.height()))) - area.y;
+    if (area.width > 0 && area.height > 0)
+    {
+        run_area(image, result, area, operations, reach);
+    }
+    return true;
+}
+
+bool run_region(const Image& image, Image& result, const Region& region, const vector<Operation>& operations)
+{
+    return run_region_operations(image, result, region, operations);
+}
+
+bool run_region(const GrayImage& image, GrayImage& result, const Region& region, const vector<Operation>& operations)
+{
+    return run_region_operations(image, result, region, operations);
+}
+
+bool is_streamable(const vector<Operation>& operations)
+{
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        if (operations[i].process == 4 || operations[i].process == 5 || operations[i].process == 11
+            || operations[i].process == GRAY_PROCESS || is_neighbourhood_operation(operations[i])
+            || is_histogram_operation(operations[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bytes of an image buffer of the given size and bytes per pixel, including row alignment padding
+static size_t buffer_bytes(long width, long height, int channels = Image::CHANNELS)
+{
+    size_t stride = (static_cast<size_t>(width) * channels + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+    return stride * height;
+}
+
+bool chain_fits(int width, int height, const vector<Operation>& operations)
+{
+    double w = width, h = height; // Products of the factors could overflow an int or a long
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        const Operation& op = operations[i];
+        if (op.process == 4 || (op.process == 5 && effective_turns(static_cast<int>(op.first)) % 2 != 0))
+        {
+            swap(w, h);
+        }
+        else if (op.process == 6)
+        {
+            w *= op.first;
+            h *= op.second;
+        }
+        else if (op.process == 11) // As resize_dimensions, without its int results
+        {
+            double new_width = op.first > 0 ? op.first : max(1.0, round(w * op.second / h));
+            h = op.second > 0 ? op.second : max(1.0, round(h * op.first / w));
+            w = new_width;
+        }
+        if (w > MAX_IMAGE_SIDE || h > MAX_IMAGE_SIDE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t pipeline_memory(int width, int height, const vector<Operation>& operations)
+{
+    // Each new image is created while the one it is made from is still held, which is then freed
+    int channels = starts_gray(operations) ? GrayImage::CHANNELS : Image::CHANNELS;
+    size_t previous = buffer_bytes(width, height, channels);
+    size_t peak = previous;
+    long w = width, h = height;
+
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        const Operation& op = operations[i];
+        if (op.process == GRAY_PROCESS && channels != GrayImage::CHANNELS)
+        {
+            channels = GrayImage::CHANNELS; // The gray image is made while the color one is held
+        }
+        else if (is_row_operation(op) || is_histogram_operation(op) || op.process == GRAY_PROCESS
+                 || (op.process == 5 && effective_turns(static_cast<int>(op.first)) % 2 == 0))
+        {
+            continue; // Run in place
+        }
+        if (op.process == 4 || (op.process == 5 && effective_turns(static_cast<int>(op.first)) % 2 != 0))
+        {
+            swap(w, h);
+        }
+        else if (op.process == 6)
+        {
+            w *= static_cast<long>(op.first);
+            h *= static_cast<long>(op.second);
+        }
+        else if (op.process == 11)
+        {
+            int new_width = static_cast<int>(op.first), new_height = static_cast<int>(op.second);
+            resize_dimensions(static_cast<int>(w), static_cast<int>(h), new_width, new_height);
+            w = new_width;
+            h = new_height;
+        }
+
+        size_t current = buffer_bytes(w, h, channels);
+        // The blurred copy of an unsharp mask, or the second buffer of the box passes of a wide Gaussian
+        size_t scratch = op.process == 15 || (op.process == 14 && op.first > GAUSSIAN_BOX_SIGMA) ? current : 0;
+        peak = max(peak, previous + current + scratch);
+        previous = current;
+    }
+    return peak;
+}
+
+// A stage of a streamed pipeline: fused row steps, or an enlargement when steps is empty
+struct StreamStage
+{
+    vector<RowStep> steps;
+    int x_scale;
+    int y_scale;
+};
+
+bool stream_pipeline(const string& input, const string& output, const vector<Operation>& operations,
+                     size_t memory_limit, StreamReport& report)
+{
+    report.window_rows = 0;
+    report.buffer_bytes = 0;
+    if (!is_streamable(operations))
+    {
+        return false;
+    }
+
+    unique_ptr<RowReader> opened = open_row_reader(input);
+    if (!opened)
+    {
+        return false;
+    }
+    RowReader& reader = *opened;
+
+    // Split the chain into stages and size the buffer each stage writes into
+    vector<StreamStage> stages;
+    vector<Operation>::const_iterator op = operations.begin();
+    long width = reader.width(), rows_per_input_row = 1;
+    size_t bytes_per_input_row = buffer_bytes(width, 1);
+    while (op != operations.end())
+    {
+        StreamStage stage = {vector<RowStep>(), 1, 1};
+        if (op->process == 6)
+        {
+            stage.x_scale = static_cast<int>(op->first);
+            stage.y_scale = static_cast<int>(op->second);
+            width *= stage.x_scale;
+            rows_per_input_row *= stage.y_scale;
+            if (width > MAX_IMAGE_SIDE || reader.height() * rows_per_input_row > MAX_IMAGE_SIDE)
+            {
+                return false;
+            }
+            bytes_per_input_row += buffer_bytes(width, rows_per_input_row);
+            ++op;
+        }
+        else
+        {
+            vector<Operation>::const_iterator last = op;
+            while (last != operations.end() && last->process != 6)
+            {
+                ++last;
+            }
+            stage.steps = build_steps(op, last, static_cast<int>(width), static_cast<int>(reader.height() * rows_per_input_row));
+            op = last;
+        }
+        stages.push_back(stage);
+    }
+
+    long output_height = reader.height() * rows_per_input_row;
+
+    // The window is as many input rows as fit in the limit (or in the default window)
+    size_t window_bytes = memory_limit > 0 ? memory_limit : STREAM_WINDOW_BYTES;
+    size_t window_rows = window_bytes / bytes_per_input_row;
+    if (window_rows == 0)
+    {
+        if (memory_limit > 0)
+        {
+            report.buffer_bytes = bytes_per_input_row; // Not even one row fits
+            return false;
+        }
+        window_rows = 1;
+    }
+    window_rows = min(window_rows, static_cast<size_t>(reader.height()));
+    report.window_rows = static_cast<int>(window_rows);
+    report.buffer_bytes = bytes_per_input_row * window_rows;
+
+    vector<Image> buffers;
+    buffers.push_back(Image(reader.width(), report.window_rows));
+    for (size_t s = 0; s < stages.size(); s++)
+    {
+        if (stages[s].steps.empty())
+        {
+            const Image& last = buffers.back();
+            buffers.push_back(Image(last.width() * stages[s].x_scale, last.height() * stages[s].y_scale));
+        }
+    }
+
+    unique_ptr<RowWriter> writer = open_row_writer(output, static_cast<int>(width), static_cast<int>(output_height));
+    if (!writer)
+    {
+        return false;
+    }
+
+    for (int first = 0; first < reader.height(); first += report.window_rows) // For each window of input rows
+    {
+        int count = min(report.window_rows, reader.height() - first);
+        {
+            TRACE_SCOPE("stream_read");
+            if (!reader.read_rows(buffers[0], count))
+            {
+                return false;
+            }
+        }
+
+        size_t b = 0;
+        int row = first; // Index of the window's first row in the image at this stage
+        {
+            TRACE_SCOPE("stream_filter");
+            for (size_t s = 0; s < stages.size(); s++)
+            {
+                const StreamStage& stage = stages[s];
+                if (stage.steps.empty())
+                {
+                    enlarge_rows(buffers[b], count, buffers[b + 1], stage.x_scale, stage.y_scale);
+                    b++;
+                    count *= stage.y_scale;
+                    row *= stage.y_scale;
+                    continue;
+                }
+
+                Image& window = buffers[b];
+                parallel_rows(count, window.row_bytes(), [&](int begin, int end)
+                {
+                    vector<short> scratch;
+                    for (int i = begin; i < end; i++) // For each row in the band
+                    {
+                        apply_steps(stage.steps, window.row(i), window.row(i), window.width(), row + i, scratch);
+                    }
+                });
+            }
+        }
+
+        TRACE_SCOPE("stream_write");
+        if (!writer->write_rows(buffers[b], count))
+        {
+            return false;
+        }
+    }
+    return writer->close_file();
+}
@@ -0,0 +1,182 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "image_buffer.h"
+#include "kernels.h"
+#include "resample.h"
+
+using namespace std;
+
+// Process number of the gray operation, which converts the image to a GrayImage (see run_gray_pipeline)
+const int GRAY_PROCESS = 12;
+
+// Highest process number: the neighbourhood filters blur (13), gaussian (14), sharpen (15) and edges (16) follow
+// gray, then the histogram operations levels (17), equalize (18) and threshold (19)
+const int LAST_PROCESS = 19;
+
+// Largest width or height an operation may ask for or a chain may make, so a row of 4-byte pixels is indexed by an int
+const int MAX_IMAGE_SIDE = INT_MAX / 4;
+
+// One step of a pipeline: the process_N function to run and its parameters
+struct Operation
+{
+    int process;   // N of the process_N function (1-11, 13-19), or GRAY_PROCESS
+    double first;  // Rotations (5), x scale (6), scaling factor (8, 9), width (11), GrayWeights (12),
+                   // radius (13), sigma (14), amount (15) or percent clipped at each end (17)
+    double second; // y scale (6), height (11) or sigma (15)
+    ResampleFilter filter; // Filter (11)
+};
+
+// A rectangle of pixels: columns x to x + width - 1 of rows y to y + height - 1, with rows counted as the image
+// stores them (row 0 is the bottom of the picture)
+struct Region
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+/**
+ * Parses an operation written as NAME[=PARAMETERS] or N[=PARAMETERS], for
+ * example "grayscale", "darken=0.5", "rotate=3", "enlarge=2,3", "9=0.5" or
+ * "resize=320,0,bilinear" (a width or height of 0 keeps the aspect ratio;
+ * the filter is nearest, box, bilinear or lanczos, the default).
+ * Names: vignette, clarendon, grayscale, rotate90, rotate, enlarge,
+ * contrast, lighten, darken, primary, resize, gray[=average|bt601|bt709]
+ * (12), which converts to a one-byte-per-pixel gray image with the average
+ * (the default) or a luma standard's weights, and the neighbourhood filters
+ * blur=RADIUS (13, a box of whole pixels), gaussian=SIGMA (14),
+ * sharpen=AMOUNT[,SIGMA] (15, an unsharp mask; SIGMA defaults to 1) and
+ * edges (16, Sobel), and the histogram operations levels[=PERCENT] (17,
+ * auto-levels clipping PERCENT, 0 to 50, at each end; 0.5 by default),
+ * equalize (18) and threshold (19, at the image's Otsu threshold).
+ * @param text      The operation as written on the command line
+ * @param operation Receives the parsed operation
+ * @return True if the text names a known operation with valid parameters
+ */
+bool parse_operation(const string& text, Operation& operation);
+
+// Short name of an operation, as accepted by parse_operation
+string operation_name(const Operation& operation);
+
+// True if the operation maps each row independently, so it can be fused with its neighbours
+bool is_row_operation(const Operation& operation);
+
+// How many pixels on each side of a pixel its result depends on: 0 for row operations, the radius of a
+// neighbourhood filter, or -1 for the operations that move pixels, change the image size or type or depend on
+// the whole image (the histogram operations)
+int operation_reach(const Operation& operation);
+
+// The sum of the operations' reaches: how far from a changed pixel the chain's result can change, or -1 if an
+// operation's reach is -1 (the sum is capped at INT_MAX)
+int chain_reach(const vector<Operation>& operations);
+
+// The weights of a gray operation
+GrayWeights operation_weights(const Operation& operation);
+
+// True if the chain includes a gray operation, so its result is a GrayImage (see run_gray_pipeline)
+bool converts_to_gray(const vector<Operation>& operations);
+
+// True if the chain starts with a gray operation, so its input can be read straight into a GrayImage
+bool starts_gray(const vector<Operation>& operations);
+
+/**
+ * Applies the operations to the image in order. Runs of consecutive row
+ * operations are fused: each band of rows is read once, passed through
+ * every operation of the run while it is in cache, and written once.
+ * Consecutive lighten and darken steps are folded into a single lookup
+ * table. Only the first step makes a new image; every later fused run and
+ * half turn works in place, and each quarter turn, enlarge, resize or
+ * neighbourhood filter step makes a new image and frees the one it was
+ * made from. A gray operation
+ * here converts to gray and back to three channels; run_gray_pipeline
+ * keeps the gray image instead.
+ * @param image      The input image
+ * @param operations The operations to apply, in order
+ * @return The resulting image
+ */
+Image run_pipeline(const Image& image, const vector<Operation>& operations);
+
+// As above, but the input's buffer is taken over, so even the first step can run in place
+Image run_pipeline(Image&& image, const vector<Operation>& operations);
+
+/**
+ * Runs a chain that converts to gray: the operations before the first
+ * gray operation run on the color image as in run_pipeline, which is then
+ * converted with that operation's weights and freed, and the rest run on
+ * the gray image, one byte per pixel. The color filters read a gray pixel
+ * as equal blue, green and red and store the average of their results.
+ * @param image      The input image, taken over
+ * @param operations The operations to apply, in order
+ * @return The resulting gray image
+ */
+GrayImage run_gray_pipeline(Image&& image, const vector<Operation>& operations);
+
+// Applies the operations to a gray image as above (gray operations leave it unchanged)
+GrayImage run_pipeline(GrayImage&& image, const vector<Operation>& operations);
+
+/**
+ * Computes the chain's result for the pixels within a region only, into
+ * result, which already holds the image's size: every pixel outside the
+ * region is left alone. Row operations run over just the region's pixels.
+ * When the chain has neighbourhood filters, the region is widened by the
+ * chain's reach (clipped to the image) and copied out, the operations run
+ * on that window, and its middle is copied back; pixels near the window's
+ * edges that are not the image's edges come out wrong, but only out to
+ * the reach, so the region's pixels are exactly those run_pipeline gives.
+ * The cost depends on the region's size, not the image's.
+ * @param image      The input image
+ * @param result     The image to write the region's results into, the image's size; may be image
+ * @param region     The pixels to compute, clipped to the image
+ * @param operations The operations to apply, in order
+ * @return False if chain_reach is -1 or result is not the image's size
+ */
+bool run_region(const Image& image, Image& result, const Region& region, const vector<Operation>& operations);
+bool run_region(const GrayImage& image, GrayImage& result, const Region& region, const vector<Operation>& operations);
+
+// Bytes of pixel buffers a streamed run uses when no limit is given
+const size_t STREAM_WINDOW_BYTES = 8 << 20;
+
+// How much memory a streamed run used
+struct StreamReport
+{
+    int window_rows;     // Input rows processed per window
+    size_t buffer_bytes; // Bytes held by the row buffers of the window
+};
+
+// True if the operations can run on a window of rows at a time (anything but the rotations, resizing, gray, the
+// neighbourhood filters, whose rows depend on the rows around them, and the histogram operations, whose rows
+// depend on the whole image)
+bool is_streamable(const vector<Operation>& operations);
+
+// True if no image the chain makes from a width x height input is wider or taller than MAX_IMAGE_SIDE
+bool chain_fits(int width, int height, const vector<Operation>& operations);
+
+// Bytes of image buffers run_pipeline (or, for chains with gray, run_gray_pipeline) holds at its peak for a
+// width x height input it takes over, including the input; a chain that starts with gray reads a gray input
+size_t pipeline_memory(int width, int height, const vector<Operation>& operations);
+
+/**
+ * Streams an image file through the operations into a new image file,
+ * with the row readers and writers of their formats (see codec.h). Rows
+ * are read, processed and written a window at a time, so memory use
+ * depends on the image width and the limit but not on the height. Gives
+ * the same bytes as reading the whole image and calling run_pipeline.
+ * @param input        The file name to read ("-" is not supported)
+ * @param output       The file name to write, or "-" for a BMP on standard output
+ * @param operations   Operations for which is_streamable is true
+ * @param memory_limit Most bytes the row buffers may use, or 0 for STREAM_WINDOW_BYTES
+ * @param report       Receives the window size and the bytes held by its buffers (if one
+ *                     row does not fit in the limit: 0 rows and the bytes one row needs)
+ * @return False if a file could not be read or written, or if one row does not fit in the limit
+ * @throws bad_alloc If the row buffers cannot be allocated (with no limit, an enlargement's can be huge)
+ */
+bool stream_pipeline(const string& input, const string& output, const vector<Operation>& operations,
+                     size_t memory_limit, StreamReport& report);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+// Layouts of the pixels a row kernel can be instantiated for
+enum PixelFormat
+{
+    PIXEL_BGR8,  // Blue, green and red bytes (Image, 24-bit BMP)
+    PIXEL_BGRA8, // Blue, green, red and alpha bytes; the filters leave alpha alone
+    PIXEL_GRAY8, // One gray byte, read as equal blue, green and red
+    PIXEL_FORMATS
+};
+
+/**
+ * Compile-time descriptions of the pixel formats, for the kernel templates
+ * in kernels.cpp. CHANNELS is the bytes per pixel and COLORS how many of
+ * them hold color (the rest are copied through). load reads a pixel as
+ * blue, green and red values; store writes them back, taking the
+ * non-color bytes from the source pixel. A gray pixel stores the average
+ * of the three, as process_3 does.
+ */
+struct Bgr8
+{
+    static const PixelFormat FORMAT = PIXEL_BGR8;
+    static const int CHANNELS = 3;
+    static const int COLORS = 3;
+
+    static inline void load(const unsigned char* pixel, int& blue, int& green, int& red)
+    {
+        blue = pixel[0];
+        green = pixel[1];
+        red = pixel[2];
+    }
+
+    static inline void store(unsigned char* pixel, const unsigned char*, int blue, int green, int red)
+    {
+        pixel[0] = static_cast<unsigned char>(blue);
+        pixel[1] = static_cast<unsigned char>(green);
+        pixel[2] = static_cast<unsigned char>(red);
+    }
+};
+
+struct Bgra8
+{
+    static const PixelFormat FORMAT = PIXEL_BGRA8;
+    static const int CHANNELS = 4;
+    static const int COLORS = 3;
+
+    static inline void load(const unsigned char* pixel, int& blue, int& green, int& red)
+    {
+        Bgr8::load(pixel, blue, green, red);
+    }
+
+    static inline void store(unsigned char* pixel, const unsigned char* source, int blue, int green, int red)
+    {
+        unsigned char alpha = source[3]; // Read before the write, in case pixel is source
+        Bgr8::store(pixel, source, blue, green, red);
+        pixel[3] = alpha;
+    }
+};
+
+struct Gray8
+{
+    static const PixelFormat FORMAT = PIXEL_GRAY8;
+    static const int CHANNELS = 1;
+    static const int COLORS = 1;
+
+    static inline void load(const unsigned char* pixel, int& blue, int& green, int& red)
+    {
+        blue = green = red = pixel[0];
+    }
+
+    static inline void store(unsigned char* pixel, const unsigned char*, int blue, int green, int red)
+    {
+        pixel[0] = static_cast<unsigned char>((blue + green + red) / 3);
+    }
+};
+
+// Bytes per pixel of a format
+inline int pixel_channels(PixelFormat format)
+{
+    return format == PIXEL_BGRA8 ? Bgra8::CHANNELS : format == PIXEL_GRAY8 ? Gray8::CHANNELS : Bgr8::CHANNELS;
+}
+
+#endif
@@ -0,0 +1,610 @@
+#include "pnm.h"
+#include "trace.h"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Bytes of samples read or written at a time by the whole-image functions and the row streams
+static const long PNM_BAND_BYTES = 1 << 20;
+
+// Bytes of samples in one row of the file
+static long pnm_row_bytes(const PnmHeader& header)
+{
+    return static_cast<long>(header.width) * header.channels * (header.max_value > 255 ? 2 : 1);
+}
+
+// Rows of the file in a band of about PNM_BAND_BYTES, and no more than the image has
+static int band_rows(long row_bytes, int height)
+{
+    return static_cast<int>(min(static_cast<long>(height), max(1L, PNM_BAND_BYTES / row_bytes)));
+}
+
+// Reads the next character of the header, counting it
+static bool next_char(int fd, char& c, long& position)
+{
+    if (!read_fully(fd, &c, 1))
+    {
+        return false;
+    }
+    position++;
+    return true;
+}
+
+// Reads a decimal number from the header, skipping the whitespace and comments before it; the whitespace
+// character that must follow it is read too
+static bool read_number(int fd, int& value, long& position)
+{
+    char c;
+    do
+    {
+        if (!next_char(fd, c, position))
+        {
+            return false;
+        }
+        while (c == '#') // A comment runs to the end of the line
+        {
+            if (!next_char(fd, c, position))
+            {
+                return false;
+            }
+            if (c == '\n' || c == '\r')
+            {
+                break;
+            }
+            c = '#';
+        }
+    } while (isspace(static_cast<unsigned char>(c)));
+
+    if (!isdigit(static_cast<unsigned char>(c)))
+    {
+        return false;
+    }
+    value = 0;
+    while (isdigit(static_cast<unsigned char>(c)))
+    {
+        if (value > (INT_MAX - 9) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+        if (!next_char(fd, c, position))
+        {
+            return false;
+        }
+    }
+    return isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+// Reads the header a character at a time, so nothing after it is consumed (the file may be a pipe)
+static bool parse_pnm_header(int fd, PnmHeader& header)
+{
+    char magic[2];
+    long position = sizeof(magic);
+    if (!read_fully(fd, magic, sizeof(magic)) || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+    {
+        return false;
+    }
+    header.channels = magic[1] == '5' ? 1 : 3;
+    bool parsed = read_number(fd, header.width, position) && read_number(fd, header.height, position)
+        && read_number(fd, header.max_value, position);
+    header.pixel_offset = position;
+    return parsed && header.width > 0 && header.height > 0 && header.max_value >= 1 && header.max_value <= 65535;
+}
+
+/**
+ * Opens a PGM or PPM file and checks that it is complete.
+ * @param filename The file name to open
+ * @param header   Receives the parsed header fields
+ * @return The open file descriptor (positioned at the first sample), or -1
+ */
+static int open_pnm(const string& filename, PnmHeader& header)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    bool valid = parse_pnm_header(fd, header);
+    struct stat info;
+    if (valid && fstat(fd, &info) == 0 && S_ISREG(info.st_mode)
+        && info.st_size < header.pixel_offset + pnm_row_bytes(header) * header.height)
+    {
+        valid = false; // Truncated samples
+    }
+
+    if (!valid)
+    {
+        cout << "Not a binary PGM or PPM image file." << endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool read_pnm_header(const string& filename, PnmHeader& header)
+{
+    int fd = open_pnm(filename, header);
+    if (fd < 0)
+    {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+// Copies width three-byte pixels, swapping the first and third bytes (red, green, blue to blue, green, red and back)
+static void swap_red_blue(const unsigned char* src, unsigned char* dst, int width)
+{
+    for (int x = 0; x < width; x++)
+    {
+        dst[3 * x] = src[3 * x + 2];
+        dst[3 * x + 1] = src[3 * x + 1];
+        dst[3 * x + 2] = src[3 * x];
+    }
+}
+
+// Decodes rows of a file's samples into image rows of blue, green and red bytes, or of gray bytes
+class SampleDecoder
+{
+public:
+    SampleDecoder(const PnmHeader& header, int channels, GrayWeights weights)
+        : header_(header), channels_(channels), weights_(nullptr)
+    {
+        // The to_gray weights are in blue, green, red order and PPM samples in red, green, blue order
+        const short* bgr = gray_weights(weights);
+        if (bgr != nullptr)
+        {
+            rgb_weights_[0] = bgr[2];
+            rgb_weights_[1] = bgr[1];
+            rgb_weights_[2] = bgr[0];
+            weights_ = rgb_weights_;
+        }
+        if (header.max_value != 255)
+        {
+            scaled_.resize(static_cast<size_t>(header.width) * header.channels);
+            for (int v = 0; v < 256; v++)
+            {
+                scale_[v] = static_cast<unsigned char>(v >= header.max_value ? 255
+                                                       : (v * 255 + header.max_value / 2) / header.max_value);
+            }
+        }
+    }
+
+    void decode(const unsigned char* samples, unsigned char* row)
+    {
+        int width = header_.width;
+        if (header_.max_value != 255) // Scale to 8 bits first
+        {
+            size_t count = scaled_.size();
+            if (header_.max_value > 255)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    int value = min(samples[2 * i] << 8 | samples[2 * i + 1], header_.max_value);
+                    scaled_[i] = static_cast<unsigned char>((value * 255 + header_.max_value / 2) / header_.max_value);
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    scaled_[i] = scale_[samples[i]];
+                }
+            }
+            samples = scaled_.data();
+        }
+
+        if (header_.channels == 3 && channels_ == 3)
+        {
+            swap_red_blue(samples, row, width);
+        }
+        else if (header_.channels == 3)
+        {
+            active_kernels().to_gray(samples, row, weights_, width);
+        }
+        else if (channels_ == 3)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = samples[x];
+            }
+        }
+        else
+        {
+            memcpy(row, samples, width);
+        }
+    }
+
+private:
+    const PnmHeader& header_;
+    int channels_;
+    const short* weights_;
+    short rgb_weights_[3];
+    unsigned char scale_[256];     // 8-bit value of each sample, for maxima under 255
+    vector<unsigned char> scaled_; // A row of samples scaled to 8 bits
+};
+
+// Reads the file a band of rows at a time, top first, and decodes each row into its image row
+template <class ImageType>
+static bool read_pnm_file(const string& filename, ImageType& image, GrayWeights weights)
+{
+    PnmHeader header;
+    int fd = open_pnm(filename, header);
+    if (fd < 0)
+    {
+        image = ImageType();
+        return false;
+    }
+
+    ImageType result = ImageType::uninitialized(header.width, header.height);
+    SampleDecoder decoder(header, ImageType::CHANNELS, weights);
+    long row_bytes = pnm_row_bytes(header);
+    int band = band_rows(row_bytes, header.height);
+    vector<unsigned char> samples(row_bytes * band);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    bool success = true;
+    for (int first = 0; first < header.height && success; first += band)
+    {
+        int count = min(band, header.height - first);
+        success = read_fully(fd, samples.data(), row_bytes * count);
+        for (int i = 0; success && i < count; i++)
+        {
+            decoder.decode(samples.data() + row_bytes * i, result.row(header.height - 1 - first - i));
+        }
+    }
+
+    close(fd);
+    if (success)
+    {
+        trace_count(TRACE_BYTES_READ, header.pixel_offset + row_bytes * header.height);
+        image.swap(result);
+    }
+    else
+    {
+        image = ImageType();
+    }
+    return success;
+}
+
+bool read_pnm(const string& filename, Image& image)
+{
+    return read_pnm_file(filename, image, GRAY_AVERAGE);
+}
+
+bool read_pnm(const string& filename, GrayImage& image, GrayWeights weights)
+{
+    return read_pnm_file(filename, image, weights);
+}
+
+// The header of a binary PGM (one channel) or PPM (three channels) file with a maximum of 255
+static string make_pnm_header(int width, int height, int channels)
+{
+    ostringstream text;
+    text << (channels == 1 ? "P5" : "P6") << "\n" << width << " " << height << "\n255\n";
+    return text.str();
+}
+
+// Encodes an image row as the samples of a file row: red, green and blue, or gray
+static void encode_row(const unsigned char* row, unsigned char* samples, int width, int channels)
+{
+    if (channels == 3)
+    {
+        swap_red_blue(row, samples, width);
+    }
+    else
+    {
+        memcpy(samples, row, width);
+    }
+}
+
+// Writes the header, then a band of rows at a time from the top of the picture (the last image row) down
+template <class ImageType>
+static bool write_pnm_file(const string& filename, const ImageType& image)
+{
+    bool to_stdout = filename == "-";
+    int fd = to_stdout ? STDOUT_FILENO : open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    string header = make_pnm_header(image.width(), image.height(), ImageType::CHANNELS);
+    long row_bytes = static_cast<long>(image.row_bytes());
+    int band = band_rows(row_bytes, image.height());
+    vector<unsigned char> samples(row_bytes * band);
+
+    bool success = write_fully(fd, header.data(), header.size());
+    for (int first = 0; first < image.height() && success; first += band)
+    {
+        int count = min(band, image.height() - first);
+        for (int i = 0; i < count; i++)
+        {
+            encode_row(image.row(image.height() - 1 - first - i), samples.data() + row_bytes * i, image.width(),
+                       ImageType::CHANNELS);
+        }
+        success = write_fully(fd, samples.data(), row_bytes * count);
+    }
+
+    if (!to_stdout)
+    {
+        success = close(fd) == 0 && success;
+    }
+    if (success)
+    {
+        trace_count(TRACE_BYTES_WRITTEN, header.size() + row_bytes * image.height());
+    }
+    return success;
+}
+
+bool write_pnm(const string& filename, const Image& image)
+{
+    return write_pnm_file(filename, image);
+}
+
+bool write_pnm(const string& filename, const GrayImage& image)
+{
+    return write_pnm_file(filename, image);
+}
+
+// Reads exactly count bytes at the given offset, retrying short reads
+static bool pread_fully(int fd, void* buffer, size_t count, off_t offset)
+{
+    unsigned char* position = static_cast<unsigned char*>(buffer);
+    while (count > 0)
+    {
+        ssize_t got = pread(fd, position, count, offset);
+        if (got <= 0)
+        {
+            return false;
+        }
+        position += got;
+        offset += got;
+        count -= got;
+    }
+    return true;
+}
+
+// Writes exactly count bytes at the given offset, retrying short writes
+static bool pwrite_fully(int fd, const void* buffer, size_t count, off_t offset)
+{
+    const unsigned char* position = static_cast<const unsigned char*>(buffer);
+    while (count > 0)
+    {
+        ssize_t done = pwrite(fd, position, count, offset);
+        if (done < 0)
+        {
+            return false;
+        }
+        position += done;
+        offset += done;
+        count -= done;
+    }
+    return true;
+}
+
+PnmRowReader::PnmRowReader()
+    : fd_(-1), next_row_(0)
+{
+    header_.width = 0;
+    header_.height = 0;
+}
+
+PnmRowReader::~PnmRowReader()
+{
+    close_file();
+}
+
+bool PnmRowReader::open_file(const string& filename)
+{
+    close_file();
+    fd_ = open_pnm(filename, header_);
+    next_row_ = 0;
+    if (fd_ < 0)
+    {
+        header_.width = 0;
+        header_.height = 0;
+        return false;
+    }
+    if (lseek(fd_, 0, SEEK_CUR) < 0)
+    {
+        cout << "PGM and PPM files can only be streamed from a seekable file." << endl;
+        close_file();
+        return false;
+    }
+
+    long row_bytes = pnm_row_bytes(header_);
+    samples_.resize(row_bytes * band_rows(row_bytes, header_.height));
+    trace_count(TRACE_BYTES_READ, header_.pixel_offset);
+    return true;
+}
+
+bool PnmRowReader::read_rows(Image& band, int count)
+{
+    if (fd_ < 0 || count < 0 || count > band.height() || next_row_ + count > header_.height)
+    {
+        return false;
+    }
+
+    // The band's rows are file rows height - next_row_ - count to height - next_row_ - 1, last first
+    SampleDecoder decoder(header_, Image::CHANNELS, GRAY_AVERAGE);
+    long row_bytes = pnm_row_bytes(header_);
+    int chunk = static_cast<int>(samples_.size() / row_bytes);
+    int top = header_.height - next_row_ - count;
+    for (int first = top; first < top + count; first += chunk)
+    {
+        int rows = min(chunk, top + count - first);
+        if (!pread_fully(fd_, samples_.data(), row_bytes * rows, header_.pixel_offset + row_bytes * first))
+        {
+            return false;
+        }
+        for (int i = 0; i < rows; i++)
+        {
+            decoder.decode(samples_.data() + row_bytes * i, band.row(header_.height - 1 - next_row_ - (first + i)));
+        }
+    }
+    next_row_ += count;
+    trace_count(TRACE_BYTES_READ, row_bytes * count);
+    return true;
+}
+
+void PnmRowReader::close_file()
+{
+    if (fd_ >= 0)
+    {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+PnmRowWriter::PnmRowWriter()
+    : fd_(-1), width_(0), height_(0), pixel_offset_(0), rows_written_(0), failed_(false)
+{
+}
+
+PnmRowWriter::~PnmRowWriter()
+{
+    close_file();
+}
+
+bool PnmRowWriter::open_file(const string& filename, int width, int height)
+{
+    close_file();
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd_, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        cout << "PGM and PPM files can only be streamed to a regular file." << endl;
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    width_ = width;
+    height_ = height;
+    rows_written_ = 0;
+    string header = make_pnm_header(width, height, Image::CHANNELS);
+    pixel_offset_ = static_cast<long>(header.size());
+    long row_bytes = 3L * width;
+    samples_.resize(row_bytes * band_rows(row_bytes, height));
+    failed_ = !write_fully(fd_, header.data(), header.size());
+    if (!failed_)
+    {
+        trace_count(TRACE_BYTES_WRITTEN, pixel_offset_);
+    }
+    return !failed_;
+}
+
+bool PnmRowWriter::write_rows(const Image& band, int count)
+{
+    if (fd_ < 0 || failed_ || band.width() != width_ || count < 0 || count > band.height()
+        || rows_written_ + count > height_)
+    {
+        failed_ = true;
+        return false;
+    }
+
+    // The band's rows go to file rows height - rows_written_ - count to height - rows_written_ - 1, last first
+    long row_bytes = 3L * width_;
+    int chunk = static_cast<int>(samples_.size() / row_bytes);
+    int top = height_ - rows_written_ - count;
+    for (int first = top; first < top + count; first += chunk)
+    {
+        int rows = min(chunk, top + count - first);
+        for (int i = 0; i < rows; i++)
+        {
+            encode_row(band.row(height_ - 1 - rows_written_ - (first + i)), samples_.data() + row_bytes * i, width_,
+                       Image::CHANNELS);
+        }
+        if (!pwrite_fully(fd_, samples_.data(), row_bytes * rows, pixel_offset_ + row_bytes * first))
+        {
+            failed_ = true;
+            return false;
+        }
+    }
+    rows_written_ += count;
+    trace_count(TRACE_BYTES_WRITTEN, row_bytes * count);
+    return true;
+}
+
+bool PnmRowWriter::close_file()
+{
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    bool success = !failed_ && rows_written_ == height_;
+    success = close(fd_) == 0 && success;
+    fd_ = -1;
+    return success;
+}
+
+// True if the bytes start a binary PGM or PPM file
+static bool sniff_pnm(const unsigned char bytes[], size_t count)
+{
+    return count >= 3 && bytes[0] == 'P' && (bytes[1] == '5' || bytes[1] == '6') && isspace(bytes[2]);
+}
+
+static bool read_pnm_info(const string& filename, ImageInfo& info)
+{
+    PnmHeader header;
+    if (!read_pnm_header(filename, header))
+    {
+        return false;
+    }
+    info.width = header.width;
+    info.height = header.height;
+    return true;
+}
+
+static bool read_pnm_color(const string& filename, Image& image)
+{
+    return read_pnm(filename, image);
+}
+
+static bool read_pnm_gray(const string& filename, GrayImage& image, GrayWeights weights)
+{
+    return read_pnm(filename, image, weights);
+}
+
+static bool write_pnm_color(const string& filename, const Image& image)
+{
+    return write_pnm(filename, image);
+}
+
+static bool write_pnm_gray(const string& filename, const GrayImage& image)
+{
+    return write_pnm(filename, image);
+}
+
+static RowReader* new_pnm_reader()
+{
+    return new PnmRowReader();
+}
+
+static RowWriter* new_pnm_writer()
+{
+    return new PnmRowWriter();
+}
+
+const ImageCodec& pnm_codec()
+{
+    static const ImageCodec codec = {
+        "PGM/PPM", ".ppm .pgm .pnm", true, sniff_pnm, read_pnm_info, read_pnm_color, read_pnm_gray, write_pnm_color,
+        write_pnm_gray, new_pnm_reader, new_pnm_writer
+    };
+    return codec;
+}
@@ -0,0 +1,116 @@
+#ifndef PNM_H
+#define PNM_H
+
+#include <string>
+#include <vector>
+#include "image_buffer.h"
+#include "kernels.h"
+#include "codec.h"
+
+using namespace std;
+
+// The header fields of a binary PGM (P5) or PPM (P6) file
+struct PnmHeader
+{
+    int width;
+    int height;
+    int channels;      // 1 for PGM, 3 (red, green, blue) for PPM
+    int max_value;     // Largest sample value, 1 to 65535; over 255 samples take two bytes, most significant first
+    long pixel_offset; // Offset of the first sample, just after the single whitespace that ends the header
+};
+
+/**
+ * Opens a PGM or PPM file and reads its header, without reading the
+ * samples. Prints a message if it is not a complete binary PGM or PPM file.
+ * @param filename The file name to check
+ * @param header   Receives the parsed header fields
+ * @return True if the file can be read
+ */
+bool read_pnm_header(const string& filename, PnmHeader& header);
+
+/**
+ * Reads a binary PGM or PPM file into a color image. The samples are read
+ * a band of rows at a time (from a pipe as well as a file) and each row is
+ * decoded once into the image: red and blue swap places, gray samples are
+ * copied into all three channels and samples with a maximum other than
+ * 255 are scaled to 8 bits. The file stores the top row first; the image
+ * keeps it last, as read_bmp does.
+ * @param filename The file name to read
+ * @param image    Receives the decoded image
+ * @return True if successful and false otherwise
+ */
+bool read_pnm(const string& filename, Image& image);
+
+// Reads a PGM or PPM file into a gray image in the same way; PPM rows go through the to_gray kernel with the weights given
+bool read_pnm(const string& filename, GrayImage& image, GrayWeights weights = GRAY_AVERAGE);
+
+// Writes a color image to a binary PPM file (P6, maximum 255); filename "-" is standard output
+bool write_pnm(const string& filename, const Image& image);
+
+// Writes a gray image to a binary PGM file (P5, maximum 255)
+bool write_pnm(const string& filename, const GrayImage& image);
+
+/**
+ * Reads a PGM or PPM file a band of rows at a time. Rows come out in
+ * image order, the last rows of the file first, so the file must be
+ * seekable.
+ */
+class PnmRowReader : public RowReader
+{
+public:
+    PnmRowReader();
+    ~PnmRowReader();
+
+    bool open_file(const string& filename);
+
+    int width() const { return header_.width; }
+    int height() const { return header_.height; }
+
+    bool read_rows(Image& band, int count);
+
+    void close_file();
+
+private:
+    PnmRowReader(const PnmRowReader&);
+    PnmRowReader& operator=(const PnmRowReader&);
+
+    int fd_;
+    PnmHeader header_;
+    int next_row_; // Index of the next image row to read
+    vector<unsigned char> samples_; // Scratch band of file rows
+};
+
+/**
+ * Writes a PPM file a band of rows at a time. Rows arrive in image order
+ * and are written from the end of the file back, so the file must be a
+ * regular file. Produces the same bytes as write_pnm.
+ */
+class PnmRowWriter : public RowWriter
+{
+public:
+    PnmRowWriter();
+    ~PnmRowWriter();
+
+    bool open_file(const string& filename, int width, int height);
+
+    bool write_rows(const Image& band, int count);
+
+    bool close_file();
+
+private:
+    PnmRowWriter(const PnmRowWriter&);
+    PnmRowWriter& operator=(const PnmRowWriter&);
+
+    int fd_;
+    int width_;
+    int height_;
+    long pixel_offset_;
+    int rows_written_;
+    bool failed_;
+    vector<unsigned char> samples_; // Scratch band of file rows
+};
+
+// The PGM/PPM entry of the codec registry (see codec.h)
+const ImageCodec& pnm_codec();
+
+#endif
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "prefetch.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define IMAGE_EDITOR_IO_URING 1
+#endif
+
+using namespace std;
+
+// A file being read ahead: one chunk at a time into its own buffer
+struct PrefetchSlot
+{
+    int fd;       // -1 when the slot is free
+    off_t offset; // Bytes read so far
+    off_t size;
+    vector<char> buffer;
+};
+
+#ifdef IMAGE_EDITOR_IO_URING
+
+/**
+ * An io_uring instance: the submission and completion rings and the
+ * submission entries, mapped from the kernel. Only one thread uses it, so
+ * the only ordering needed is with the kernel: the tails it reads and the
+ * heads it writes are accessed with acquire and release semantics.
+ */
+struct FilePrefetcher::Ring
+{
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_bytes;
+    void* cq_ring;
+    size_t cq_ring_bytes;
+    io_uring_sqe* sqes;
+    size_t sqes_bytes;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+    unsigned pending; // Entries queued but not yet passed to io_uring_enter
+
+    Ring() : fd(-1), sq_ring(MAP_FAILED), sq_ring_bytes(0), cq_ring(MAP_FAILED), cq_ring_bytes(0), sqes(nullptr),
+             sqes_bytes(0), pending(0) {}
+
+    ~Ring()
+    {
+        if (sqes != nullptr)
+        {
+            munmap(sqes, sqes_bytes);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        {
+            munmap(cq_ring, cq_ring_bytes);
+        }
+        if (sq_ring != MAP_FAILED)
+        {
+            munmap(sq_ring, sq_ring_bytes);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    // Sets up a ring of at least entries entries; false if the kernel refuses (too old, or io_uring disabled)
+    bool setup(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+        {
+            sq_ring_bytes = cq_ring_bytes = max(sq_ring_bytes, cq_ring_bytes);
+        }
+        sq_ring = mmap(nullptr, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            return false;
+        }
+        cq_ring = single ? sq_ring
+                         : mmap(nullptr, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            return false;
+        }
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* mapped = mmap(nullptr, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(mapped);
+
+        char* sq = static_cast<char*>(sq_ring);
+        char* cq = static_cast<char*>(cq_ring);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Queues a read of the slot's next chunk, tagged with the slot's index
+    void queue_read(PrefetchSlot& slot, size_t index)
+    {
+        unsigned tail = *sq_tail; // Only this thread writes the tail
+        unsigned entry = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[entry];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot.fd;
+        sqe->addr = reinterpret_cast<unsigned long>(slot.buffer.data());
+        sqe->len = static_cast<unsigned>(min(static_cast<off_t>(slot.buffer.size()), slot.size - slot.offset));
+        sqe->off = static_cast<unsigned long>(slot.offset);
+        sqe->user_data = index;
+        sq_array[entry] = entry;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        pending++;
+    }
+
+    // Submits the queued reads and waits for at least one completion; false on an error other than an interruption
+    bool submit_and_wait()
+    {
+        long result = syscall(__NR_io_uring_enter, fd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (result < 0)
+        {
+            return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+        }
+        pending -= min(pending, static_cast<unsigned>(result));
+        return true;
+    }
+
+    // Takes the next completion, if there is one
+    bool next_completion(io_uring_cqe& completion)
+    {
+        unsigned head = *cq_head; // Only this thread writes the head
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        completion = cqes[head & cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+#else
+
+struct FilePrefetcher::Ring
+{
+    bool setup(unsigned) { return false; }
+};
+
+#endif
+
+FilePrefetcher::FilePrefetcher(const vector<string>& files, int depth, bool allow_io_uring)
+    : files_(files), depth_(max(depth, 1)), consumer_(0), stopping_(false), bytes_read_(0)
+{
+    if (allow_io_uring)
+    {
+        ring_.reset(new Ring());
+        if (!ring_->setup(static_cast<unsigned>(depth_)))
+        {
+            ring_.reset();
+        }
+    }
+    if (ring_)
+    {
+        thread_ = thread(&FilePrefetcher::read_with_ring, this);
+    }
+    else
+    {
+        thread_ = thread(&FilePrefetcher::read_with_pread, this);
+    }
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        stopping_ = true;
+        window_.notify_all();
+    }
+    thread_.join();
+}
+
+void FilePrefetcher::advance(size_t index)
+{
+    lock_guard<mutex> lock(lock_);
+    consumer_ = max(consumer_, index);
+    window_.notify_all();
+}
+
+bool FilePrefetcher::wait_for_window(size_t next)
+{
+    unique_lock<mutex> lock(lock_);
+    window_.wait(lock, [&] { return stopping_ || next <= consumer_ + depth_; });
+    return !stopping_;
+}
+
+// Opens a file to read ahead, or returns -1 if it cannot be opened or is empty
+static int open_for_prefetch(const string& filename, off_t& size)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd >= 0 && (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0))
+    {
+        close(fd);
+        fd = -1;
+    }
+    size = fd >= 0 ? info.st_size : 0;
+    return fd;
+}
+
+void FilePrefetcher::read_with_pread()
+{
+    vector<char> buffer(PREFETCH_CHUNK_BYTES);
+    for (size_t next = 1; next < files_.size(); next++) // The consumer opens the first file itself
+    {
+        if (!wait_for_window(next))
+        {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(lock_);
+            if (next <= consumer_)
+            {
+                continue; // The consumer got there first
+            }
+        }
+
+        off_t size = 0;
+        int fd = open_for_prefetch(files_[next], size);
+        for (off_t offset = 0; fd >= 0 && offset < size && !stopping_;)
+        {
+            ssize_t got = pread(fd, buffer.data(), buffer.size(), offset);
+            if (got <= 0 && errno != EINTR)
+            {
+                break;
+            }
+            offset += max(got, static_cast<ssize_t>(0));
+            bytes_read_ += max(got, static_cast<ssize_t>(0));
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+}
+
+#ifdef IMAGE_EDITOR_IO_URING
+
+void FilePrefetcher::read_with_ring()
+{
+    vector<PrefetchSlot> slots(depth_);
+    for (size_t s = 0; s < slots.size(); s++)
+    {
+        slots[s].fd = -1;
+        slots[s].buffer.resize(PREFETCH_CHUNK_BYTES);
+    }
+    size_t next = 1; // The consumer opens the first file itself
+    size_t in_flight = 0;
+
+    while (true)
+    {
+        // Start reading the files the window allows in the free slots
+        size_t limit = 0;
+        {
+            unique_lock<mutex> lock(lock_);
+            if (in_flight == 0) // Nothing to wait for in the kernel
+            {
+                window_.wait(lock, [&] { return stopping_ || next >= files_.size() || next <= consumer_ + depth_; });
+            }
+            if (stopping_ || (in_flight == 0 && next >= files_.size()))
+            {
+                break;
+            }
+            next = max(next, consumer_ + 1);
+            limit = consumer_ + depth_;
+        }
+        for (size_t s = 0; s < slots.size() && next < files_.size() && next <= limit; s++)
+        {
+            if (slots[s].fd >= 0)
+            {
+                continue;
+            }
+            slots[s].offset = 0;
+            slots[s].fd = open_for_prefetch(files_[next++], slots[s].size);
+            if (slots[s].fd >= 0)
+            {
+                ring_->queue_read(slots[s], s);
+                in_flight++;
+            }
+        }
+        if (in_flight == 0)
+        {
+            continue;
+        }
+
+        // Wait for reads to finish, and queue each file's next chunk
+        if (!ring_->submit_and_wait())
+        {
+            break;
+        }
+        io_uring_cqe completion;
+        while (ring_->next_completion(completion))
+        {
+            PrefetchSlot& slot = slots[completion.user_data];
+            if (completion.res > 0)
+            {
+                slot.offset += completion.res;
+                bytes_read_ += completion.res;
+            }
+            if (completion.res > 0 && slot.offset < slot.size && !stopping_)
+            {
+                ring_->queue_read(slot, completion.user_data);
+            }
+            else
+            {
+                close(slot.fd);
+                slot.fd = -1;
+                in_flight--;
+            }
+        }
+    }
+
+    // Reads still in flight write into the slots' buffers: wait for them before the buffers go
+    while (in_flight > 0 && ring_->submit_and_wait())
+    {
+        io_uring_cqe completion;
+        while (ring_->next_completion(completion))
+        {
+            close(slots[completion.user_data].fd);
+            in_flight--;
+        }
+    }
+}
+
+#else
+
+void FilePrefetcher::read_with_ring()
+{
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Bytes asked for by each read of a file being prefetched
+const size_t PREFETCH_CHUNK_BYTES = 1 << 20;
+
+/**
+ * Reads files ahead of a consumer that opens them in order, so that their
+ * contents are in the page cache by the time it does: while the consumer
+ * is on file i, files i + 1 to i + depth are read in the background and
+ * the bytes thrown away, so the disk works while the consumer decodes and
+ * the memory used is the kernel's cache, not the program's.
+ *
+ * Where the kernel allows it, reads go through io_uring (set up with its
+ * raw system calls): a background thread keeps one read of
+ * PREFETCH_CHUNK_BYTES in flight for each of up to depth files and sleeps
+ * in the kernel until one completes. Otherwise the thread reads the files
+ * one after another with pread.
+ */
+class FilePrefetcher
+{
+public:
+    /**
+     * Starts reading ahead.
+     * @param files          The files the consumer will open, in order
+     * @param depth          Most files read ahead of the consumer, at least 1
+     * @param allow_io_uring False to read with pread even where io_uring works
+     */
+    FilePrefetcher(const vector<string>& files, int depth, bool allow_io_uring = true);
+
+    // Stops reading ahead, waiting for the reads in flight
+    ~FilePrefetcher();
+
+    // Tells the prefetcher the consumer has reached file index, so files up to index + depth may be read
+    void advance(size_t index);
+
+    // True if the reads go through io_uring
+    bool uses_io_uring() const { return ring_ != nullptr; }
+
+    // Bytes read ahead so far
+    size_t bytes_read() const { return bytes_read_.load(); }
+
+private:
+    FilePrefetcher(const FilePrefetcher&);
+    FilePrefetcher& operator=(const FilePrefetcher&);
+
+    struct Ring;
+
+    // Waits until file next may be read (true) or the prefetcher is stopping (false)
+    bool wait_for_window(size_t next);
+
+    // Background thread bodies
+    void read_with_pread();
+    void read_with_ring();
+
+    vector<string> files_;
+    size_t depth_;
+    unique_ptr<Ring> ring_; // Null when reading with pread
+    mutex lock_;
+    condition_variable window_;
+    size_t consumer_; // Index of the file the consumer is on
+    atomic<bool> stopping_;
+    atomic<size_t> bytes_read_;
+    thread thread_;
+};
+
+#endif
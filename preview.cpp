@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "preview.h"
+#include "trace.h"
+
+using namespace std;
+
+// True if both chains have the same operations with the same parameters
+static bool same_operations(const vector<Operation>& a, const vector<Operation>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].process != b[i].process || a[i].first != b[i].first || a[i].second != b[i].second
+            || a[i].filter != b[i].filter)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A run of stale tiles along a row of tiles, from column first to last, that began in row bottom
+struct TileRun
+{
+    int first;
+    int last;
+    int bottom;
+};
+
+PreviewCache::PreviewCache(int tile_size) : tile_size_(max(tile_size, 1))
+{
+    stats_.tiles = 0;
+    stats_.total_tiles = 0;
+    stats_.regions = 0;
+}
+
+void PreviewCache::invalidate(const string& name, const Region& region)
+{
+    map<string, Entry>::iterator found = entries_.find(name);
+    if (found == entries_.end())
+    {
+        return; // Its next render runs the whole chain anyway
+    }
+    Entry& entry = found->second;
+
+    long left = max(region.x, 0), bottom = max(region.y, 0);
+    long right = min(static_cast<long>(region.x) + region.width, static_cast<long>(entry.width));
+    long top = min(static_cast<long>(region.y) + region.height, static_cast<long>(entry.height));
+    if (left >= right || bottom >= top)
+    {
+        return;
+    }
+    for (long y = bottom / tile_size_; y <= (top - 1) / tile_size_; y++)
+    {
+        for (long x = left / tile_size_; x <= (right - 1) / tile_size_; x++)
+        {
+            entry.dirty[y * entry.columns + x] = 1;
+        }
+    }
+    entry.any_dirty = true;
+}
+
+const Image& PreviewCache::render(const string& name, const Image& image, const vector<Operation>& operations)
+{
+    TRACE_SCOPE("preview_render");
+    int columns = (image.width() + tile_size_ - 1) / tile_size_;
+    int rows = (image.height() + tile_size_ - 1) / tile_size_;
+    stats_.tiles = 0;
+    stats_.total_tiles = columns * rows;
+    stats_.regions = 0;
+
+    map<string, Entry>::iterator found = entries_.find(name);
+    if (found != entries_.end() && found->second.width == image.width() && found->second.height == image.height()
+        && same_operations(found->second.operations, operations)
+        && (!found->second.any_dirty || chain_reach(operations) >= 0))
+    {
+        if (found->second.any_dirty)
+        {
+            render_dirty(found->second, image);
+        }
+        return found->second.result;
+    }
+
+    Entry& entry = entries_[name];
+    entry.operations = operations;
+    entry.width = image.width();
+    entry.height = image.height();
+    entry.result = run_pipeline(image, operations);
+    entry.columns = columns;
+    entry.rows = rows;
+    entry.dirty.assign(static_cast<size_t>(columns) * rows, 0);
+    entry.any_dirty = false;
+    stats_.tiles = stats_.total_tiles;
+    return entry.result;
+}
+
+void PreviewCache::forget(const string& name)
+{
+    entries_.erase(name);
+}
+
+void PreviewCache::render_dirty(Entry& entry, const Image& image)
+{
+    // A changed pixel changes results up to the reach away, so a dirty tile makes the tiles within spread of it stale
+    long reach = chain_reach(entry.operations);
+    int spread = static_cast<int>(min((reach + tile_size_ - 1) / tile_size_, static_cast<long>(max(entry.columns, entry.rows))));
+    vector<char> stale(entry.dirty.size(), 0);
+    for (int y = 0; y < entry.rows; y++)
+    {
+        for (int x = 0; x < entry.columns; x++)
+        {
+            if (!entry.dirty[y * entry.columns + x])
+            {
+                continue;
+            }
+            for (int i = max(y - spread, 0); i <= min(y + spread, entry.rows - 1); i++)
+            {
+                fill(stale.begin() + i * entry.columns + max(x - spread, 0),
+                     stale.begin() + i * entry.columns + min(x + spread, entry.columns - 1) + 1, 1);
+            }
+        }
+    }
+
+    // Join the stale tiles into rectangles: runs along each row of tiles, stacked while the next row has the same run
+    vector<Region> regions;
+    vector<TileRun> open;
+    for (int y = 0; y <= entry.rows; y++) // One row past the last closes every run
+    {
+        vector<TileRun> runs;
+        for (int x = 0; y < entry.rows && x < entry.columns; x++)
+        {
+            if (!stale[y * entry.columns + x])
+            {
+                continue;
+            }
+            TileRun run = {x, x, y};
+            while (run.last + 1 < entry.columns && stale[y * entry.columns + run.last + 1])
+            {
+                run.last++;
+            }
+            x = run.last;
+            for (size_t o = 0; o < open.size(); o++)
+            {
+                if (open[o].first == run.first && open[o].last == run.last)
+                {
+                    run.bottom = open[o].bottom;
+                    open[o].first = -1; // Continued
+                }
+            }
+            runs.push_back(run);
+        }
+        for (size_t o = 0; o < open.size(); o++)
+        {
+            if (open[o].first >= 0)
+            {
+                Region region = {open[o].first * tile_size_, open[o].bottom * tile_size_,
+                                 (open[o].last - open[o].first + 1) * tile_size_, (y - open[o].bottom) * tile_size_};
+                regions.push_back(region);
+                stats_.tiles += (open[o].last - open[o].first + 1) * (y - open[o].bottom);
+            }
+        }
+        open.swap(runs);
+    }
+
+    for (size_t r = 0; r < regions.size(); r++)
+    {
+        run_region(image, entry.result, regions[r], entry.operations);
+    }
+    stats_.regions = static_cast<int>(regions.size());
+    fill(entry.dirty.begin(), entry.dirty.end(), 0);
+    entry.any_dirty = false;
+}
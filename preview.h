@@ -0,0 +1,84 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "image_buffer.h"
+#include "pipeline.h"
+
+using namespace std;
+
+// Side, in pixels, of the square tiles a PreviewCache tracks changes in
+const int PREVIEW_TILE_SIZE = 64;
+
+// What the last PreviewCache::render computed
+struct PreviewStats
+{
+    int tiles;       // Tiles computed: all of them when the whole chain ran
+    int total_tiles; // Tiles in the image
+    int regions;     // Rectangles of tiles run_region was called on, or 0 when the whole chain ran
+};
+
+/**
+ * Keeps the last result of a chain of operations for each image of an
+ * interactive preview, so that after a small edit only the tiles of the
+ * result the edit can reach are computed again. The caller edits its
+ * image, marks the pixels it changed with invalidate, and calls render:
+ * the changed tiles are widened by the chain's reach (see chain_reach),
+ * joined into rectangles, and each rectangle is run with run_region and
+ * stitched into the kept result. The result matches run_pipeline exactly,
+ * and the cost of a render depends on the size of the edit, not the image.
+ *
+ * A render with other operations or another image size runs the whole
+ * chain, and so does every render of a chain that moves pixels or
+ * changes the image size (chain_reach -1) once anything has changed.
+ * Results are kept until forget is called. Not safe to use from several
+ * threads at once.
+ */
+class PreviewCache
+{
+public:
+    explicit PreviewCache(int tile_size = PREVIEW_TILE_SIZE);
+
+    // Marks the pixels of the named image within region (in its rows, as run_region) as changed since its last render
+    void invalidate(const string& name, const Region& region);
+
+    /**
+     * The result of the operations on the image, which is the named image
+     * as last rendered with the regions passed to invalidate since then
+     * changed.
+     * @param name       The image's name, as passed to invalidate
+     * @param image      The image's current pixels
+     * @param operations The operations to apply, in order
+     * @return The result, valid until the next render or forget of the same name
+     */
+    const Image& render(const string& name, const Image& image, const vector<Operation>& operations);
+
+    // Frees the named image's result
+    void forget(const string& name);
+
+    PreviewStats stats() const { return stats_; }
+
+private:
+    struct Entry
+    {
+        vector<Operation> operations;
+        int width;          // Size of the image the result was made from
+        int height;
+        Image result;
+        int columns;        // Tiles across the image
+        int rows;           // Tiles up the image
+        vector<char> dirty; // Per tile, row by row: true if its source pixels changed since the last render
+        bool any_dirty;
+    };
+
+    // Runs the chain over the tiles the dirty ones reach and clears them
+    void render_dirty(Entry& entry, const Image& image);
+
+    int tile_size_;
+    map<string, Entry> entries_;
+    PreviewStats stats_;
+};
+
+#endif
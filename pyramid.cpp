@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+#include "pyramid.h"
+#include "image.h"
+#include "kernels.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+using namespace std;
+
+template <class ImageType>
+static void halve_rows(const ImageType& image, ImageType& dst)
+{
+    TRACE_SCOPE("halve");
+    int width = image.width() / 2;
+    dst.reshape(width, image.height() / 2);
+    const FilterKernels& kernels = active_kernels(ImageType::Format::FORMAT);
+    parallel_rows(dst.height(), image.row_bytes() * 2 + dst.row_bytes(), [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            kernels.halve(image.row(2 * i), image.row(2 * i + 1), dst.row(i), width);
+        }
+    });
+}
+
+void halve_image(const Image& image, Image& dst)
+{
+    halve_rows(image, dst);
+}
+
+void halve_image(const GrayImage& image, GrayImage& dst)
+{
+    halve_rows(image, dst);
+}
+
+Pyramid::Pyramid(Image&& image)
+{
+    TRACE_SCOPE("build_pyramid");
+    levels_.push_back(std::move(image));
+    while (levels_.back().width() >= 2 && levels_.back().height() >= 2)
+    {
+        Image next;
+        halve_image(levels_.back(), next);
+        levels_.push_back(std::move(next));
+    }
+}
+
+const Image& Pyramid::level_for(int width, int height) const
+{
+    int index = 0;
+    while (index + 1 < levels() && levels_[index + 1].width() >= width && levels_[index + 1].height() >= height)
+    {
+        index++;
+    }
+    return levels_[index];
+}
+
+size_t Pyramid::size_bytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < levels_.size(); i++)
+    {
+        bytes += levels_[i].size_bytes();
+    }
+    return bytes;
+}
+
+PyramidCache::PyramidCache(size_t limit)
+{
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+    stats_.cached_bytes = 0;
+    stats_.limit_bytes = limit;
+}
+
+shared_ptr<const Pyramid> PyramidCache::load(const string& filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+    {
+        return nullptr;
+    }
+
+    {
+        lock_guard<mutex> lock(lock_);
+        for (list<Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            if (it->filename != filename)
+            {
+                continue;
+            }
+            if (it->modified.tv_sec == info.st_mtim.tv_sec && it->modified.tv_nsec == info.st_mtim.tv_nsec
+                && it->size == info.st_size)
+            {
+                entries_.splice(entries_.begin(), entries_, it); // Now the most recently loaded
+                stats_.hits++;
+                return entries_.front().pyramid;
+            }
+            stats_.cached_bytes -= it->pyramid->size_bytes(); // The file has changed since
+            stats_.evictions++;
+            entries_.erase(it);
+            break;
+        }
+        stats_.misses++;
+    }
+
+    Image image;
+    if (!read_image(filename, image))
+    {
+        return nullptr;
+    }
+    shared_ptr<const Pyramid> pyramid = make_shared<Pyramid>(std::move(image));
+
+    lock_guard<mutex> lock(lock_);
+    for (list<Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+        if (it->filename == filename) // Another thread read the file meanwhile
+        {
+            stats_.cached_bytes -= it->pyramid->size_bytes();
+            entries_.erase(it);
+            break;
+        }
+    }
+    size_t bytes = pyramid->size_bytes();
+    if (bytes <= stats_.limit_bytes)
+    {
+        trim(stats_.limit_bytes - bytes);
+        Entry entry = {filename, info.st_mtim, info.st_size, pyramid};
+        entries_.push_front(entry);
+        stats_.cached_bytes += bytes;
+    }
+    return pyramid;
+}
+
+void PyramidCache::set_limit(size_t limit)
+{
+    lock_guard<mutex> lock(lock_);
+    stats_.limit_bytes = limit;
+    trim(limit);
+}
+
+void PyramidCache::clear()
+{
+    lock_guard<mutex> lock(lock_);
+    entries_.clear();
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+    stats_.cached_bytes = 0;
+}
+
+PyramidCacheStats PyramidCache::stats() const
+{
+    lock_guard<mutex> lock(lock_);
+    return stats_;
+}
+
+void PyramidCache::trim(size_t keep)
+{
+    while (!entries_.empty() && stats_.cached_bytes > keep)
+    {
+        stats_.cached_bytes -= entries_.back().pyramid->size_bytes();
+        stats_.evictions++;
+        entries_.pop_back();
+    }
+}
+
+PyramidCache& pyramid_cache()
+{
+    static PyramidCache cache(DEFAULT_PYRAMID_CACHE_LIMIT);
+    return cache;
+}
+
+bool preview_image(const string& filename, int width, int height, const vector<Operation>& operations, Image& result,
+                   ResampleFilter filter)
+{
+    TRACE_SCOPE("preview_image");
+    shared_ptr<const Pyramid> pyramid = pyramid_cache().load(filename);
+    if (!pyramid)
+    {
+        return false;
+    }
+
+    resize_dimensions(pyramid->level(0).width(), pyramid->level(0).height(), width, height);
+    const Image& level = pyramid->level_for(width, height);
+    if (level.width() == width && level.height() == height)
+    {
+        result = level;
+    }
+    else
+    {
+        resample(level, result, width, height, filter);
+    }
+    result = run_pipeline(std::move(result), operations);
+    return true;
+}
@@ -0,0 +1,137 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <cstddef>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "image_buffer.h"
+#include "pipeline.h"
+#include "resample.h"
+
+using namespace std;
+
+// Most bytes of pyramids the pyramid cache keeps by default
+const size_t DEFAULT_PYRAMID_CACHE_LIMIT = 512 << 20;
+
+/**
+ * Halves an image in both directions: each pixel of the result is the
+ * rounded average of a 2 x 2 block, computed in the SIMD halve kernel (see
+ * kernels.h) over bands of rows on the filter thread pool. An odd last
+ * row or column is dropped.
+ * @param image The input image, at least 2 x 2 pixels
+ * @param dst   Receives the width / 2 x height / 2 result; must not be image
+ */
+void halve_image(const Image& image, Image& dst);
+void halve_image(const GrayImage& image, GrayImage& dst);
+
+/**
+ * An image and its successive halvings (a mipmap): level 0 is the image,
+ * and each level after it is halve_image of the one before, down to a
+ * level less than 2 pixels wide or high. All the levels together hold
+ * about 4/3 of the image's pixels.
+ */
+class Pyramid
+{
+public:
+    // Takes over the image and builds its levels
+    explicit Pyramid(Image&& image);
+
+    int levels() const { return static_cast<int>(levels_.size()); }
+    const Image& level(int index) const { return levels_[index]; }
+
+    // The smallest level at least width x height pixels, to scale a result of that size from; level 0 if none is
+    const Image& level_for(int width, int height) const;
+
+    // Bytes of pixel buffers held by all the levels
+    size_t size_bytes() const;
+
+private:
+    vector<Image> levels_;
+};
+
+// Counts of a pyramid cache's activity since it was created or last cleared
+struct PyramidCacheStats
+{
+    size_t hits;         // Loads served by a cached pyramid of the file as it is now
+    size_t misses;       // Loads that read the file
+    size_t evictions;    // Pyramids dropped to stay under the limit, or because their file changed
+    size_t cached_bytes; // Bytes held by cached pyramids now
+    size_t limit_bytes;  // Most bytes of pyramids kept
+};
+
+/**
+ * Keeps the pyramids of recently loaded image files, keyed by path and
+ * checked against the file's modification time and size, so asking for
+ * the same file at several sizes reads and halves it once. Pyramids are
+ * dropped, least recently loaded first, whenever they would hold more
+ * than the limit; a pyramid still in use stays valid, as it is shared.
+ * Safe to use from several threads (two threads loading the same file at
+ * once may both read it).
+ */
+class PyramidCache
+{
+public:
+    explicit PyramidCache(size_t limit);
+
+    /**
+     * The pyramid of an image file: the cached one if the file has the same
+     * modification time and size as when it was read, otherwise the file is
+     * read (see read_image) and its pyramid built and cached.
+     * @param filename The file to read
+     * @return The pyramid, or nullptr if the file could not be read
+     */
+    shared_ptr<const Pyramid> load(const string& filename);
+
+    // Sets the most bytes of pyramids to keep, dropping any over it; 0 turns the cache off
+    void set_limit(size_t limit);
+
+    // Drops every pyramid and resets the counts
+    void clear();
+
+    PyramidCacheStats stats() const;
+
+private:
+    PyramidCache(const PyramidCache&);
+    PyramidCache& operator=(const PyramidCache&);
+
+    struct Entry
+    {
+        string filename;
+        timespec modified;
+        off_t size;
+        shared_ptr<const Pyramid> pyramid;
+    };
+
+    // Drops the least recently loaded pyramids until at most keep bytes are cached; lock_ must be held
+    void trim(size_t keep);
+
+    mutable mutex lock_;
+    list<Entry> entries_; // Most recently loaded first
+    PyramidCacheStats stats_;
+};
+
+// The cache preview_image loads from; its limit starts at DEFAULT_PYRAMID_CACHE_LIMIT
+PyramidCache& pyramid_cache();
+
+/**
+ * Previews an image file at a given size: the smallest level of its
+ * pyramid (from pyramid_cache) that covers the size is resampled to it,
+ * and the operations run on the result, so only the first preview of a
+ * file reads it at full resolution. The operations see the preview's
+ * pixels, so a blur radius, for one, is in preview pixels.
+ * @param filename   The file to preview
+ * @param width      Width of the preview, or 0 to keep the aspect ratio
+ * @param height     Height of the preview, or 0 to keep the aspect ratio (not both 0)
+ * @param operations The operations to apply to the preview, in order
+ * @param result     Receives the preview
+ * @param filter     The filter that scales the level to the preview's size
+ * @return False if the file could not be read
+ */
+bool preview_image(const string& filename, int width, int height, const vector<Operation>& operations, Image& result,
+                   ResampleFilter filter = RESAMPLE_BILINEAR);
+
+#endif
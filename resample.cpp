@@ -0,0 +1,387 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "resample.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// Names accepted by parse_resample_filter, indexed by filter
+static const char* const FILTER_NAMES[] = { "nearest", "box", "bilinear", "lanczos" };
+
+bool parse_resample_filter(const string& name, ResampleFilter& filter)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (name == FILTER_NAMES[i])
+        {
+            filter = static_cast<ResampleFilter>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+string resample_filter_name(ResampleFilter filter)
+{
+    return FILTER_NAMES[filter];
+}
+
+void resize_dimensions(int width, int height, int& new_width, int& new_height)
+{
+    if (new_width <= 0 && new_height > 0 && height > 0)
+    {
+        new_width = max(1L, lround(static_cast<double>(width) * new_height / height));
+    }
+    else if (new_height <= 0 && new_width > 0 && width > 0)
+    {
+        new_height = max(1L, lround(static_cast<double>(height) * new_width / width));
+    }
+}
+
+// Copies each pixel of CHANNELS bytes of a row SCALE times
+template <int CHANNELS, int SCALE>
+static void widen_row(const unsigned char* in, unsigned char* out, int width)
+{
+    for (int j = 0; j < width; j++)
+    {
+        for (int k = 0; k < SCALE; k++)
+        {
+            memcpy(out + CHANNELS * (SCALE * j + k), in + CHANNELS * j, CHANNELS);
+        }
+    }
+}
+
+// Copies each pixel of a row x_scale times; the common factors get unrolled copies
+template <int CHANNELS>
+static void widen_row(const unsigned char* in, unsigned char* out, int width, int x_scale)
+{
+    switch (x_scale)
+    {
+        case 1 : memcpy(out, in, static_cast<size_t>(width) * CHANNELS); return;
+        case 2 : widen_row<CHANNELS, 2>(in, out, width); return;
+        case 3 : widen_row<CHANNELS, 3>(in, out, width); return;
+        case 4 : widen_row<CHANNELS, 4>(in, out, width); return;
+    }
+    for (int j = 0; j < width; j++)
+    {
+        for (int k = 0; k < x_scale; k++)
+        {
+            memcpy(out, in + CHANNELS * j, CHANNELS);
+            out += CHANNELS;
+        }
+    }
+}
+
+template <class ImageType>
+static void enlarge_image_rows(const ImageType& src, int count, ImageType& dst, int x_scale, int y_scale)
+{
+    int width = src.width();
+
+    parallel_rows(count, dst.row_bytes() * y_scale, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each source row in the band
+        {
+            unsigned char* first = dst.row(i * y_scale);
+            widen_row<ImageType::CHANNELS>(src.row(i), first, width, x_scale);
+            for (int k = 1; k < y_scale; k++) // The other copies of the row are plain copies of the first
+            {
+                memcpy(dst.row(i * y_scale + k), first, dst.row_bytes());
+            }
+        }
+    });
+}
+
+void enlarge_rows(const Image& src, int count, Image& dst, int x_scale, int y_scale)
+{
+    enlarge_image_rows(src, count, dst, x_scale, y_scale);
+}
+
+void enlarge_rows(const GrayImage& src, int count, GrayImage& dst, int x_scale, int y_scale)
+{
+    enlarge_image_rows(src, count, dst, x_scale, y_scale);
+}
+
+// Nearest neighbour for any sizes, into a result of the new size: each output pixel takes the input pixel its center falls in
+template <class ImageType>
+static void resample_nearest(const ImageType& image, ImageType& result)
+{
+    const int CHANNELS = ImageType::CHANNELS;
+    int width = result.width();
+    int height = result.height();
+    if (width % image.width() == 0 && height % image.height() == 0)
+    {
+        enlarge_rows(image, image.height(), result, width / image.width(), height / image.height());
+        return;
+    }
+
+    vector<int> columns(width);
+    for (int j = 0; j < width; j++)
+    {
+        columns[j] = min(image.width() - 1, static_cast<int>((j + 0.5) * image.width() / width));
+    }
+
+    parallel_rows(height, result.row_bytes(), [&](int begin, int end)
+    {
+        int previous = -1;
+        for (int i = begin; i < end; i++)
+        {
+            int source = min(image.height() - 1, static_cast<int>((i + 0.5) * image.height() / height));
+            if (source == previous) // Enlarging: the same row again
+            {
+                memcpy(result.row(i), result.row(i - 1), result.row_bytes());
+                continue;
+            }
+            const unsigned char* in = image.row(source);
+            unsigned char* out = result.row(i);
+            for (int j = 0; j < width; j++)
+            {
+                memcpy(out + CHANNELS * j, in + CHANNELS * columns[j], CHANNELS);
+            }
+            previous = source;
+        }
+    });
+}
+
+static double box_filter(double x)
+{
+    return x >= -0.5 && x < 0.5 ? 1 : 0;
+}
+
+static double triangle_filter(double x)
+{
+    x = fabs(x);
+    return x < 1 ? 1 - x : 0;
+}
+
+static double sinc(double x)
+{
+    if (x == 0)
+    {
+        return 1;
+    }
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double lanczos3_filter(double x)
+{
+    return x > -3 && x < 3 ? sinc(x) * sinc(x / 3) : 0;
+}
+
+// The weights of one pass: output index i reads taps input indices from starts[i], weighted by weights[i * taps + k]
+struct ResampleWeights
+{
+    int taps;
+    vector<int> starts;
+    vector<short> weights;
+};
+
+/**
+ * Computes the fixed-point weights of each output index of one pass. The
+ * filter is stretched by the scale when shrinking, so every input pixel
+ * contributes. Each output's weights are rounded to RESAMPLE_SHIFT bits
+ * and the rounding error is added to its largest weight, so they sum to
+ * exactly 1 and flat areas stay flat.
+ * @param in_size   Input width or height
+ * @param out_size  Output width or height
+ * @param even_taps True to round taps up to an even number (with zero weights), for resample_row
+ */
+static ResampleWeights resample_weights(int in_size, int out_size, ResampleFilter filter, bool even_taps)
+{
+    double (*function)(double) = filter == RESAMPLE_BOX ? box_filter : filter == RESAMPLE_BILINEAR ? triangle_filter : lanczos3_filter;
+    double support = filter == RESAMPLE_BOX ? 0.5 : filter == RESAMPLE_BILINEAR ? 1 : 3;
+    double scale = static_cast<double>(in_size) / out_size;
+    double filter_scale = max(scale, 1.0);
+    support *= filter_scale;
+
+    // The input range of each output index
+    vector<int> first(out_size), count(out_size);
+    int taps = 1;
+    for (int i = 0; i < out_size; i++)
+    {
+        double center = (i + 0.5) * scale;
+        first[i] = max(static_cast<int>(center - support + 0.5), 0);
+        count[i] = max(min(static_cast<int>(center + support + 0.5), in_size) - first[i], 1);
+        taps = max(taps, count[i]);
+    }
+    if (even_taps)
+    {
+        taps += taps % 2;
+    }
+
+    ResampleWeights table;
+    table.taps = taps;
+    table.starts.resize(out_size);
+    table.weights.assign(static_cast<size_t>(out_size) * taps, 0);
+    vector<double> exact(taps);
+    for (int i = 0; i < out_size; i++)
+    {
+        // Every output reads the same number of taps: move the start back near the end, padding with zero weights
+        int start = max(min(first[i], in_size - taps), 0);
+        int offset = first[i] - start;
+        double center = (i + 0.5) * scale;
+        double total = 0;
+        for (int k = 0; k < count[i]; k++)
+        {
+            exact[k] = function((first[i] + k - center + 0.5) / filter_scale);
+            total += exact[k];
+        }
+
+        short* weights = &table.weights[static_cast<size_t>(i) * taps + offset];
+        int sum = 0, largest = 0;
+        for (int k = 0; k < count[i]; k++)
+        {
+            weights[k] = static_cast<short>(lround(total != 0 ? exact[k] / total * (1 << RESAMPLE_SHIFT) : 0));
+            sum += weights[k];
+            largest = weights[k] > weights[largest] ? k : largest;
+        }
+        weights[largest] += (1 << RESAMPLE_SHIFT) - sum;
+        table.starts[i] = start;
+    }
+    return table;
+}
+
+// Most input pixels per output pixel along an axis that the weights are computed for; a larger shrink is first
+// reduced by box averaging, since with thousands of taps each 14-bit weight would round far from its value
+const int RESAMPLE_MAX_RATIO = 8;
+
+/**
+ * Shrinks an image by whole factors: each output pixel is the rounded
+ * average of a block of x_factor x y_factor input pixels, or of what is
+ * left of one at the right and top edges. Sums are exact, however large
+ * the blocks.
+ */
+template <class ImageType>
+static void box_reduce(const ImageType& image, ImageType& dst, int x_factor, int y_factor)
+{
+    const int channels = ImageType::CHANNELS;
+    int width = (image.width() + x_factor - 1) / x_factor;
+    int height = (image.height() + y_factor - 1) / y_factor;
+    dst.reshape(width, height);
+    parallel_rows(height, image.row_bytes() * y_factor, [&](int begin, int end)
+    {
+        vector<uint64_t> sums(dst.row_bytes());
+        for (int i = begin; i < end; i++)
+        {
+            fill(sums.begin(), sums.end(), 0);
+            int first_row = i * y_factor;
+            int rows = min(y_factor, image.height() - first_row);
+            for (int r = first_row; r < first_row + rows; r++)
+            {
+                const unsigned char* in = image.row(r);
+                for (int x = 0; x < width; x++)
+                {
+                    int last = min((x + 1) * x_factor, image.width());
+                    for (int j = x * x_factor; j < last; j++)
+                    {
+                        for (int c = 0; c < channels; c++)
+                        {
+                            sums[x * channels + c] += in[j * channels + c];
+                        }
+                    }
+                }
+            }
+            unsigned char* out = dst.row(i);
+            for (int x = 0; x < width; x++)
+            {
+                uint64_t count = static_cast<uint64_t>(rows) * (min((x + 1) * x_factor, image.width()) - x * x_factor);
+                for (int c = 0; c < channels; c++)
+                {
+                    out[x * channels + c] = static_cast<unsigned char>((sums[x * channels + c] + count / 2) / count);
+                }
+            }
+        }
+    });
+}
+
+// resample for either kind of image; the vertical pass works on bytes, so only the horizontal one depends on the format
+template <class ImageType>
+static void resample_image(const ImageType& image, ImageType& dst, int width, int height, ResampleFilter filter)
+{
+    if (image.width() == 0 || image.height() == 0 || (width == image.width() && height == image.height()))
+    {
+        dst = image;
+        return;
+    }
+    if (&image == &dst) // The input is read until the last row is written
+    {
+        ImageType result;
+        resample_image(image, result, width, height, filter);
+        dst.swap(result);
+        return;
+    }
+    dst.reshape(width, height);
+    if (filter == RESAMPLE_NEAREST)
+    {
+        resample_nearest(image, dst);
+        return;
+    }
+    // Box-reduce a large shrink to at most RESAMPLE_MAX_RATIO times the result's size first
+    int x_factor = (image.width() + RESAMPLE_MAX_RATIO * width - 1) / (RESAMPLE_MAX_RATIO * width);
+    int y_factor = (image.height() + RESAMPLE_MAX_RATIO * height - 1) / (RESAMPLE_MAX_RATIO * height);
+    if (x_factor > 1 || y_factor > 1)
+    {
+        ImageType reduced;
+        box_reduce(image, reduced, x_factor, y_factor);
+        resample_image(reduced, dst, width, height, filter);
+        return;
+    }
+
+    const ResampleWeights rows = resample_weights(image.height(), height, filter, false);
+    const ResampleWeights columns = resample_weights(image.width(), width, filter, true);
+    const FilterKernels& kernels = active_kernels();
+    const FilterKernels& row_kernels = active_kernels(ImageType::Format::FORMAT);
+    bool vertical = height != image.height();
+    bool horizontal = width != image.width();
+
+    // Each output row reads rows.taps input rows
+    parallel_rows(height, image.row_bytes() * rows.taps, [&](int begin, int end)
+    {
+        // The vertical pass's result, with room for the horizontal pass to read past the last pixel
+        vector<unsigned char> line(image.row_bytes() + 2 * ImageType::CHANNELS);
+        vector<const unsigned char*> sources(rows.taps);
+        for (int i = begin; i < end; i++)
+        {
+            unsigned char* out = horizontal ? line.data() : dst.row(i);
+            if (vertical)
+            {
+                for (int k = 0; k < rows.taps; k++)
+                {
+                    sources[k] = image.row(rows.starts[i] + k);
+                }
+                kernels.resample_columns(sources.data(), &rows.weights[static_cast<size_t>(i) * rows.taps], rows.taps,
+                                         out, static_cast<int>(image.row_bytes()));
+            }
+            else
+            {
+                memcpy(out, image.row(i), image.row_bytes());
+            }
+
+            if (horizontal)
+            {
+                row_kernels.resample_row(line.data(), dst.row(i), width, columns.starts.data(), columns.weights.data(), columns.taps);
+            }
+        }
+    });
+}
+
+void resample(const Image& image, Image& dst, int width, int height, ResampleFilter filter)
+{
+    resample_image(image, dst, width, height, filter);
+}
+
+void resample(const GrayImage& image, GrayImage& dst, int width, int height, ResampleFilter filter)
+{
+    resample_image(image, dst, width, height, filter);
+}
+
+Image resample(const Image& image, int width, int height, ResampleFilter filter)
+{
+    Image result;
+    resample(image, result, width, height, filter);
+    return result;
+}
@@ -0,0 +1,68 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <string>
+#include "image_buffer.h"
+
+using namespace std;
+
+// How resample computes each output pixel from the input pixels around it
+enum ResampleFilter
+{
+    RESAMPLE_NEAREST,  // The input pixel the output pixel's center falls in
+    RESAMPLE_BOX,      // Average of the input pixels the output pixel covers
+    RESAMPLE_BILINEAR, // Triangle filter: linear interpolation, widened when shrinking
+    RESAMPLE_LANCZOS3  // Windowed sinc with three lobes: sharpest, slowest
+};
+
+/**
+ * Parses a filter name: "nearest", "box", "bilinear" or "lanczos".
+ * @return True if the name is one of those
+ */
+bool parse_resample_filter(const string& name, ResampleFilter& filter);
+
+// Name of a filter, as accepted by parse_resample_filter
+string resample_filter_name(ResampleFilter filter);
+
+/**
+ * Fills in a missing target dimension. A width or height of 0 is chosen
+ * to keep the image's aspect ratio (at least 1 pixel).
+ * @param width      Width of the image
+ * @param height     Height of the image
+ * @param new_width  Target width, or 0; receives the width to use
+ * @param new_height Target height, or 0; receives the height to use
+ */
+void resize_dimensions(int width, int height, int& new_width, int& new_height);
+
+/**
+ * Scales an image to any size, up or down. The box, bilinear and Lanczos
+ * filters are separable and run as two passes per output row: a vertical
+ * pass over the input rows the output row needs, into a scratch row, then
+ * a horizontal pass over the scratch row. The weights of every output row
+ * and column are computed once per call and held in 14-bit fixed point,
+ * and both passes run in the SIMD resampling kernels (see kernels.h).
+ * Output rows are spread over the filter thread pool. Nearest-neighbour
+ * scaling copies pixels; integer enlargements replicate rows (see
+ * enlarge_rows). A shrink by more than 8 times along an axis is first
+ * reduced by whole-block averaging, so the weights stay few and accurate.
+ * @param image  The input image
+ * @param width  Width of the result, at least 1
+ * @param height Height of the result, at least 1
+ * @param filter The filter to use
+ * @return The resized image
+ */
+Image resample(const Image& image, int width, int height, ResampleFilter filter);
+
+// resample into dst, which is reshaped to width x height (keeping its buffer if it already is); dst may be image
+void resample(const Image& image, Image& dst, int width, int height, ResampleFilter filter);
+void resample(const GrayImage& image, GrayImage& dst, int width, int height, ResampleFilter filter);
+
+/**
+ * Enlarges rows 0 to count - 1 of src by whole factors into rows 0 to
+ * count * y_scale - 1 of dst, which must be x_scale times as wide: each
+ * source row is widened once and then copied y_scale - 1 times.
+ */
+void enlarge_rows(const Image& src, int count, Image& dst, int x_scale, int y_scale);
+void enlarge_rows(const GrayImage& src, int count, GrayImage& dst, int x_scale, int y_scale);
+
+#endif
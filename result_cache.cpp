@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "result_cache.h"
+#include "codec.h"
+#include "hash.h"
+#include "trace.h"
+
+using namespace std;
+
+// Changes whenever the key's layout or the output of an operation changes, so old results are not served
+static const char KEY_VERSION[] = "image-editor result 1";
+
+template <class ImageType>
+static string key_of(const ImageType& image, const vector<Operation>& operations, const string& output)
+{
+    if (output == "-")
+    {
+        return "";
+    }
+    TRACE_SCOPE("result_key");
+    Hash64 hash;
+    hash.update(KEY_VERSION, sizeof(KEY_VERSION));
+    int header[3] = {image.width(), image.height(), ImageType::CHANNELS};
+    hash.update(header, sizeof(header));
+    for (size_t i = 0; i < operations.size(); i++) // Field by field: the struct's padding is not set
+    {
+        const Operation& operation = operations[i];
+        int filter = operation.filter;
+        hash.update(&operation.process, sizeof(operation.process));
+        hash.update(&operation.first, sizeof(operation.first));
+        hash.update(&operation.second, sizeof(operation.second));
+        hash.update(&filter, sizeof(filter));
+    }
+    const char* format = output_codec(output)->name;
+    hash.update(format, strlen(format) + 1);
+    for (int i = 0; i < image.height(); i++)
+    {
+        hash.update(image.row(i), image.row_bytes());
+    }
+
+    char digits[17];
+    snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(hash.digest()));
+    return digits;
+}
+
+string result_key(const Image& image, const vector<Operation>& operations, const string& output)
+{
+    return key_of(image, operations, output);
+}
+
+string result_key(const GrayImage& image, const vector<Operation>& operations, const string& output)
+{
+    return key_of(image, operations, output);
+}
+
+// True for the names of cached results: 16 hex digits
+static bool is_key(const char* name)
+{
+    size_t length = strlen(name);
+    return length == 16 && strspn(name, "0123456789abcdef") == length;
+}
+
+// Copies a file in the kernel where it can, into a new file of the given mode; false (leaving no file) on failure
+static bool copy_file(const string& source, const string& destination, mode_t mode)
+{
+    int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        return false;
+    }
+    int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    bool copied = out >= 0;
+    bool in_kernel = true;
+    vector<char> buffer;
+    while (copied)
+    {
+        ssize_t moved = in_kernel ? copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0) : -1;
+        if (moved < 0 && in_kernel && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+        {
+            in_kernel = false; // Not between these files: copy through a buffer
+            buffer.resize(1 << 20);
+            continue;
+        }
+        if (!in_kernel)
+        {
+            moved = read(in, buffer.data(), buffer.size());
+            for (ssize_t written = 0; moved > 0 && written < moved;)
+            {
+                ssize_t step = write(out, buffer.data() + written, moved - written);
+                if (step < 0 && errno != EINTR)
+                {
+                    moved = -1;
+                    break;
+                }
+                written += max(step, static_cast<ssize_t>(0));
+            }
+        }
+        if (moved == 0)
+        {
+            break;
+        }
+        copied = moved > 0 || errno == EINTR;
+    }
+    copied = out >= 0 && close(out) == 0 && copied;
+    close(in);
+    if (!copied)
+    {
+        unlink(destination.c_str());
+    }
+    return copied;
+}
+
+ResultCache::ResultCache(const string& directory, size_t limit, bool link_outputs)
+    : directory_(directory), link_outputs_(link_outputs), ok_(false), temporaries_(0)
+{
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.limit_bytes = limit;
+    mkdir(directory.c_str(), 0777); // Fails harmlessly if it already exists
+
+    DIR* opened = opendir(directory.c_str());
+    if (opened == nullptr)
+    {
+        return;
+    }
+    ok_ = true;
+
+    // The results already there, most recently used first
+    vector<pair<timespec, Entry> > found;
+    for (struct dirent* item = readdir(opened); item != nullptr; item = readdir(opened))
+    {
+        struct stat info;
+        if (is_key(item->d_name) && stat(path(item->d_name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+        {
+            Entry entry = {item->d_name, static_cast<size_t>(info.st_size)};
+            found.push_back(make_pair(info.st_mtim, entry));
+        }
+    }
+    closedir(opened);
+    sort(found.begin(), found.end(), [](const pair<timespec, Entry>& a, const pair<timespec, Entry>& b)
+    {
+        return a.first.tv_sec != b.first.tv_sec ? a.first.tv_sec > b.first.tv_sec : a.first.tv_nsec > b.first.tv_nsec;
+    });
+
+    lock_guard<mutex> lock(lock_);
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        entries_.push_back(found[i].second);
+        index_[found[i].second.key] = --entries_.end();
+        stats_.cached_bytes += found[i].second.size;
+    }
+    stats_.entries = entries_.size();
+    trim(limit);
+}
+
+bool ResultCache::fetch(const string& key, const string& output)
+{
+    TRACE_SCOPE("result_cache_fetch");
+    {
+        lock_guard<mutex> lock(lock_);
+        if (!ok_ || key.empty() || index_.find(key) == index_.end())
+        {
+            stats_.misses++;
+            return false;
+        }
+    }
+
+    string cached = path(key);
+    unlink(output.c_str()); // Replaced, never written through
+    bool served = (link_outputs_ && link(cached.c_str(), output.c_str()) == 0) || copy_file(cached, output, 0666);
+    if (served)
+    {
+        utimensat(AT_FDCWD, cached.c_str(), nullptr, 0); // Now the most recently used, for other programs too
+    }
+
+    lock_guard<mutex> lock(lock_);
+    map<string, list<Entry>::iterator>::iterator found = index_.find(key);
+    if (!served) // Deleted by another program sharing the directory
+    {
+        if (found != index_.end())
+        {
+            stats_.cached_bytes -= found->second->size;
+            entries_.erase(found->second);
+            index_.erase(found);
+            stats_.entries = entries_.size();
+        }
+        stats_.misses++;
+        return false;
+    }
+    if (found != index_.end())
+    {
+        entries_.splice(entries_.begin(), entries_, found->second);
+    }
+    stats_.hits++;
+    return true;
+}
+
+void ResultCache::store(const string& key, const string& output)
+{
+    struct stat info;
+    if (!ok_ || key.empty() || stat(output.c_str(), &info) != 0 || static_cast<size_t>(info.st_size) > stats_.limit_bytes)
+    {
+        return;
+    }
+    TRACE_SCOPE("result_cache_store");
+    string temporary;
+    {
+        lock_guard<mutex> lock(lock_);
+        temporary = directory_ + "/.new-" + to_string(getpid()) + "-" + to_string(temporaries_++);
+    }
+    if (!copy_file(output, temporary, 0444)) // Read-only, so a hard link to it cannot be written through by mistake
+    {
+        return;
+    }
+    if (rename(temporary.c_str(), path(key).c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return;
+    }
+
+    lock_guard<mutex> lock(lock_);
+    map<string, list<Entry>::iterator>::iterator found = index_.find(key);
+    if (found != index_.end()) // Stored by another thread meanwhile
+    {
+        stats_.cached_bytes -= found->second->size;
+        entries_.erase(found->second);
+        index_.erase(found);
+    }
+    trim(stats_.limit_bytes - info.st_size);
+    Entry entry = {key, static_cast<size_t>(info.st_size)};
+    entries_.push_front(entry);
+    index_[key] = entries_.begin();
+    stats_.cached_bytes += entry.size;
+    stats_.stores++;
+    stats_.entries = entries_.size();
+}
+
+ResultCacheStats ResultCache::stats() const
+{
+    lock_guard<mutex> lock(lock_);
+    return stats_;
+}
+
+void ResultCache::trim(size_t keep)
+{
+    while (!entries_.empty() && stats_.cached_bytes > keep)
+    {
+        const Entry& oldest = entries_.back();
+        unlink(path(oldest.key).c_str());
+        stats_.cached_bytes -= oldest.size;
+        stats_.evictions++;
+        index_.erase(oldest.key);
+        entries_.pop_back();
+    }
+    stats_.entries = entries_.size();
+}
+
+void release_output(const string& output)
+{
+    if (output != "-")
+    {
+        unlink(output.c_str());
+    }
+}
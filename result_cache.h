@@ -0,0 +1,112 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "image_buffer.h"
+#include "pipeline.h"
+
+using namespace std;
+
+// Most bytes of results a result cache keeps by default
+const size_t DEFAULT_RESULT_CACHE_LIMIT = size_t(1) << 30;
+
+/**
+ * The key under which a chain's result is cached: 16 hex digits of the
+ * XXH64 hash (see hash.h) of the image's size and pixels, the operations
+ * and their parameters, and the format the output's name selects (see
+ * output_codec), so the same pixels from any file give the same key.
+ * Returns "" for standard output ("-"), which cannot be cached.
+ */
+string result_key(const Image& image, const vector<Operation>& operations, const string& output);
+string result_key(const GrayImage& image, const vector<Operation>& operations, const string& output);
+
+// Counts of a result cache's activity since it was opened
+struct ResultCacheStats
+{
+    size_t hits;         // Results served from the cache
+    size_t misses;       // Results looked up and not found
+    size_t stores;       // Results added
+    size_t evictions;    // Results dropped to stay under the limit
+    size_t entries;      // Results cached now
+    size_t cached_bytes; // Bytes of the cached results
+    size_t limit_bytes;  // Most bytes of results kept
+};
+
+/**
+ * A directory of output files keyed by result_key, so running a chain
+ * again on the same pixels, as retries and duplicate uploads do, costs a
+ * read and a hash instead of the filters and the encoding. A hit copies
+ * the cached file to the output in the kernel (copy_file_range), or hard
+ * links it when link_outputs is set. The least recently used results are
+ * deleted whenever the directory would hold more than the limit; use is
+ * recorded in the files' modification times, so the order survives
+ * between runs and several programs may share the directory.
+ *
+ * Cached files are written to a temporary name and renamed, so a reader
+ * never sees half a file, and are made read-only. An output hard linked to
+ * one is the same file: it is deleted before anything is written over it
+ * here, and should not be changed in place by other programs.
+ *
+ * Safe to use from several threads.
+ */
+class ResultCache
+{
+public:
+    /**
+     * Opens a cache directory, creating it if it is missing, and reads the
+     * results already in it.
+     * @param directory    The directory to keep results in
+     * @param limit        Most bytes of results to keep
+     * @param link_outputs True to hard link hits to the outputs instead of copying them
+     */
+    ResultCache(const string& directory, size_t limit, bool link_outputs = false);
+
+    // False if the directory could not be created or read
+    bool ok() const { return ok_; }
+
+    /**
+     * Writes the result cached under key to output, replacing any file of
+     * that name, and marks it as the most recently used.
+     * @return False, counting a miss, if there is no such result
+     */
+    bool fetch(const string& key, const string& output);
+
+    // Copies the output file just written for key into the cache, dropping older results over the limit
+    void store(const string& key, const string& output);
+
+    ResultCacheStats stats() const;
+
+private:
+    ResultCache(const ResultCache&);
+    ResultCache& operator=(const ResultCache&);
+
+    struct Entry
+    {
+        string key;
+        size_t size;
+    };
+
+    string path(const string& key) const { return directory_ + "/" + key; }
+
+    // Deletes the least recently used results until at most keep bytes are cached; lock_ must be held
+    void trim(size_t keep);
+
+    string directory_;
+    bool link_outputs_;
+    bool ok_;
+    mutable mutex lock_;
+    list<Entry> entries_; // Most recently used first
+    map<string, list<Entry>::iterator> index_;
+    ResultCacheStats stats_;
+    size_t temporaries_; // Files written to temporary names so far, for unique names
+};
+
+// Deletes an output before it is written, so a hard link to a cached result is not written through
+void release_output(const string& output);
+
+#endif
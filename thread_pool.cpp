@@ -0,0 +1,202 @@
+#include "thread_pool.h"
+#include <atomic>
+#include <memory>
+#include <cstdlib>
+
+using namespace std;
+
+// Approximate bytes of source and destination rows handed to one task by parallel_rows
+static const size_t BAND_BYTES = 256 * 1024;
+
+// True on pool threads, and on a caller while it runs its own loop
+static thread_local bool in_pool_task = false;
+
+struct ThreadPool::Job
+{
+    const function<void(int, int)>* task;
+    atomic<int> remaining; // Chunks not yet finished
+};
+
+ThreadPool::ThreadPool(int threads)
+    : queues_(threads < 1 ? 1 : threads), generation_(0), stopping_(false)
+{
+    for (int i = 1; i < size(); i++)
+    {
+        threads_.push_back(thread(&ThreadPool::worker, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(wake_lock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        threads_[i].join();
+    }
+}
+
+// Pool thread: sleeps until a loop is posted, then helps drain it
+void ThreadPool::worker(int index)
+{
+    in_pool_task = true;
+    unsigned long seen = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(wake_lock_);
+            wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_)
+            {
+                return;
+            }
+            seen = generation_;
+        }
+        drain(index);
+    }
+}
+
+// Takes a chunk from the front of the thread's own queue, or steals one from the back of another
+bool ThreadPool::take(int index, Chunk& chunk)
+{
+    {
+        Queue& own = queues_[index];
+        lock_guard<mutex> lock(own.lock);
+        if (!own.chunks.empty())
+        {
+            chunk = own.chunks.front();
+            own.chunks.pop_front();
+            return true;
+        }
+    }
+
+    for (int i = 1; i < size(); i++)
+    {
+        Queue& victim = queues_[(index + i) % size()];
+        lock_guard<mutex> lock(victim.lock);
+        if (!victim.chunks.empty())
+        {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs chunks until every queue is empty
+void ThreadPool::drain(int index)
+{
+    Chunk chunk;
+    while (take(index, chunk))
+    {
+        (*chunk.job->task)(chunk.begin, chunk.end);
+
+        // The job lives on the caller's stack, so it must not be touched after the last chunk is counted
+        if (--chunk.job->remaining == 0)
+        {
+            lock_guard<mutex> lock(wake_lock_);
+            done_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int count, int grain, const function<void(int, int)>& task)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+    if (grain < 1)
+    {
+        grain = 1;
+    }
+    int chunks = (count - 1) / grain + 1;
+
+    unique_lock<mutex> exclusive(submit_, try_to_lock);
+    if (size() == 1 || chunks == 1 || in_pool_task || !exclusive.owns_lock())
+    {
+        for (int begin = 0; begin < count; begin += grain)
+        {
+            task(begin, count - begin < grain ? count : begin + grain);
+        }
+        return;
+    }
+
+    Job job;
+    job.task = &task;
+    job.remaining = chunks;
+
+    // Deal each thread a contiguous run of chunks
+    for (int t = 0; t < size(); t++)
+    {
+        int first = static_cast<long>(chunks) * t / size();
+        int last = static_cast<long>(chunks) * (t + 1) / size();
+        lock_guard<mutex> lock(queues_[t].lock);
+        for (int c = first; c < last; c++)
+        {
+            Chunk chunk = { &job, c * grain, count - c * grain < grain ? count : (c + 1) * grain };
+            queues_[t].chunks.push_back(chunk);
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(wake_lock_);
+        generation_++;
+    }
+    wake_.notify_all();
+
+    in_pool_task = true;
+    drain(0);
+    in_pool_task = false;
+
+    unique_lock<mutex> lock(wake_lock_);
+    done_.wait(lock, [&] { return job.remaining == 0; });
+}
+
+static mutex pool_lock;
+static unique_ptr<ThreadPool> pool;
+static int requested_threads = 0;
+
+// One thread per core, unless overridden by the IMAGE_EDITOR_THREADS environment variable
+static int default_thread_count()
+{
+    const char* value = getenv("IMAGE_EDITOR_THREADS");
+    int threads = value != nullptr ? atoi(value) : 0;
+    if (threads < 1)
+    {
+        threads = thread::hardware_concurrency();
+    }
+    return threads < 1 ? 1 : threads;
+}
+
+void set_thread_count(int threads)
+{
+    lock_guard<mutex> lock(pool_lock);
+    pool.reset();
+    requested_threads = threads;
+}
+
+int thread_count()
+{
+    return filter_pool().size();
+}
+
+ThreadPool& filter_pool()
+{
+    lock_guard<mutex> lock(pool_lock);
+    if (!pool)
+    {
+        pool.reset(new ThreadPool(requested_threads > 0 ? requested_threads : default_thread_count()));
+    }
+    return *pool;
+}
+
+void parallel_rows(int height, size_t row_bytes, const function<void(int, int)>& task)
+{
+    size_t rows = row_bytes == 0 ? height : BAND_BYTES / row_bytes;
+    filter_pool().parallel_for(height, rows < 1 ? 1 : static_cast<int>(rows), task);
+}
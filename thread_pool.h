@@ -0,0 +1,99 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A persistent pool of worker threads that runs loops split into chunks.
+ *
+ * Each call to parallel_for deals the chunks out evenly to per-thread
+ * queues. A thread takes work from the front of its own queue and, once it
+ * runs dry, steals from the back of the other queues, so an uneven split or
+ * a slow core does not leave the rest of the pool idle. The calling thread
+ * works alongside the pool threads.
+ */
+class ThreadPool
+{
+public:
+    // Creates a pool in which threads threads (including the caller) run each loop
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    // Number of threads, including the calling thread, that run each loop
+    int size() const { return static_cast<int>(queues_.size()); }
+
+    /**
+     * Runs task(begin, end) over [0, count) in chunks of at most grain
+     * indices and returns once every chunk has finished. A call made from
+     * inside a task, or while another thread is using the pool, runs
+     * serially on the calling thread.
+     * @param count Number of indices to process
+     * @param grain Largest number of indices handed to one task call
+     * @param task  Function called with each chunk's [begin, end) range
+     */
+    void parallel_for(int count, int grain, const function<void(int, int)>& task);
+
+private:
+    struct Job;
+
+    // A range of indices and the loop it belongs to
+    struct Chunk
+    {
+        Job* job;
+        int begin;
+        int end;
+    };
+
+    // A thread's queue of chunks; the owner pops the front, thieves the back
+    struct Queue
+    {
+        mutex lock;
+        deque<Chunk> chunks;
+    };
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void worker(int index);
+    bool take(int index, Chunk& chunk);
+    void drain(int index);
+
+    vector<Queue> queues_;
+    vector<thread> threads_;
+
+    mutex submit_;           // Held by the thread whose loop is running
+    mutex wake_lock_;
+    condition_variable wake_; // Signalled when a loop is posted or the pool stops
+    condition_variable done_; // Signalled when the last chunk of a loop finishes
+    unsigned long generation_;
+    bool stopping_;
+};
+
+// Sets the number of threads used by the image filters (0 picks one per core).
+// Must not be called while a filter is running.
+void set_thread_count(int threads);
+
+// Number of threads used by the image filters
+int thread_count();
+
+// The pool used by the image filters, sized by set_thread_count
+ThreadPool& filter_pool();
+
+/**
+ * Runs task(begin, end) over bands of rows whose size is chosen so that a
+ * band of source and destination rows fits in the per-core cache.
+ * @param height    Number of rows
+ * @param row_bytes Bytes touched per row
+ * @param task      Function called with each band's [begin, end) rows
+ */
+void parallel_rows(int height, size_t row_bytes, const function<void(int, int)>& task);
+
+#endif
@@ -0,0 +1,358 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+#include "trace.h"
+
+using namespace std;
+
+size_t peak_resident_bytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+#ifndef IMAGE_EDITOR_NO_TRACE
+
+enum TraceFormat { TRACE_TEXT, TRACE_JSON, TRACE_CHROME };
+
+// One timed stage on one thread
+struct Span
+{
+    const char* name;
+    int thread;
+    long long start;
+    long long end;
+};
+
+atomic<bool> trace_active(false);
+
+static atomic<size_t> counters[TRACE_COUNTERS];
+static const char* const counter_names[TRACE_COUNTERS] = {
+    "bytes_read", "bytes_written", "allocations", "allocated_bytes", "image_buffers", "image_bytes",
+    "pool_hits"
+};
+
+// Allocations are counted only in builds with the operator new below (make TRACE_ALLOCATIONS=1)
+static bool counted(int counter)
+{
+#ifdef IMAGE_EDITOR_TRACE_ALLOCATIONS
+    (void)counter;
+    return true;
+#else
+    return counter != TRACE_ALLOCATIONS && counter != TRACE_ALLOCATED_BYTES;
+#endif
+}
+
+static mutex spans_lock;
+static vector<Span> spans;
+static TraceFormat format;
+static string report_file;
+static long long trace_start;
+static atomic<int> next_thread(0);
+
+long long trace_now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Small numbers for threads in the order they first record a span, so the main thread is 0
+static int thread_number()
+{
+    static thread_local int number = next_thread++;
+    return number;
+}
+
+void trace_span(const char* name, long long start, long long end)
+{
+    Span span = {name, thread_number(), start, end};
+    lock_guard<mutex> lock(spans_lock);
+    spans.push_back(span);
+}
+
+void trace_add(TraceCounter counter, size_t amount)
+{
+    counters[counter].fetch_add(amount, memory_order_relaxed);
+}
+
+bool start_trace(const string& spec)
+{
+    size_t colon = spec.find(':');
+    string name = spec.substr(0, colon);
+    if (name == "text") format = TRACE_TEXT;
+    else if (name == "json") format = TRACE_JSON;
+    else if (name == "chrome") format = TRACE_CHROME;
+    else return false;
+
+    report_file = colon == string::npos ? "" : spec.substr(colon + 1);
+    for (int i = 0; i < TRACE_COUNTERS; i++)
+    {
+        counters[i] = 0;
+    }
+    spans.clear();
+    thread_number(); // The thread that starts the trace is thread 0
+    trace_start = trace_now();
+    trace_active = true;
+    return true;
+}
+
+// Calls, total and longest time of the spans with one name
+struct StageTotals
+{
+    long calls;
+    long long total;
+    long long longest;
+};
+
+static double milliseconds(long long nanoseconds)
+{
+    return nanoseconds / 1e6;
+}
+
+// Totals by stage name, in the order each stage first began
+static vector<pair<string, StageTotals> > stage_totals()
+{
+    vector<pair<string, StageTotals> > stages;
+    map<string, size_t> index;
+    vector<Span> sorted(spans);
+    stable_sort(sorted.begin(), sorted.end(), [](const Span& a, const Span& b) { return a.start < b.start; });
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        map<string, size_t>::iterator found = index.find(sorted[i].name);
+        if (found == index.end())
+        {
+            StageTotals totals = {0, 0, 0};
+            found = index.insert(make_pair(string(sorted[i].name), stages.size())).first;
+            stages.push_back(make_pair(string(sorted[i].name), totals));
+        }
+        StageTotals& totals = stages[found->second].second;
+        long long duration = sorted[i].end - sorted[i].start;
+        totals.calls++;
+        totals.total += duration;
+        totals.longest = max(totals.longest, duration);
+    }
+    return stages;
+}
+
+static void write_text(ostream& out, long long wall, size_t peak)
+{
+    vector<pair<string, StageTotals> > stages = stage_totals();
+    out << fixed << setprecision(3);
+    out << "trace: " << milliseconds(wall) << " ms wall, peak RSS " << peak / 1048576.0 << " MiB" << endl;
+    out << "  " << left << setw(20) << "stage" << right << setw(8) << "calls" << setw(13) << "total ms"
+        << setw(13) << "mean ms" << setw(13) << "max ms" << endl;
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        const StageTotals& totals = stages[i].second;
+        out << "  " << left << setw(20) << stages[i].first << right << setw(8) << totals.calls
+            << setw(13) << milliseconds(totals.total) << setw(13) << milliseconds(totals.total) / totals.calls
+            << setw(13) << milliseconds(totals.longest) << endl;
+    }
+    for (int i = 0; i < TRACE_COUNTERS; i++)
+    {
+        if (counted(i))
+        {
+            out << "  " << left << setw(20) << counter_names[i] << right << setw(16) << counters[i].load() << endl;
+        }
+    }
+}
+
+// The counters as the members of a JSON object
+static void write_counters(ostream& out)
+{
+    const char* separator = "";
+    for (int i = 0; i < TRACE_COUNTERS; i++)
+    {
+        if (counted(i))
+        {
+            out << separator << "\"" << counter_names[i] << "\": " << counters[i].load();
+            separator = ", ";
+        }
+    }
+}
+
+static void write_json(ostream& out, long long wall, size_t peak)
+{
+    vector<pair<string, StageTotals> > stages = stage_totals();
+    out << fixed << setprecision(3);
+    out << "{\"wall_ms\": " << milliseconds(wall) << ", \"peak_rss_bytes\": " << peak << ", \"counters\": {";
+    write_counters(out);
+    out << "}, \"stages\": [";
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        const StageTotals& totals = stages[i].second;
+        out << (i > 0 ? ", " : "") << "{\"name\": \"" << stages[i].first << "\", \"calls\": " << totals.calls
+            << ", \"total_ms\": " << milliseconds(totals.total) << ", \"max_ms\": " << milliseconds(totals.longest) << "}";
+    }
+    out << "]}" << endl;
+}
+
+// Complete events ("ph": "X") for chrome://tracing, timed in microseconds from the start of the trace
+static void write_chrome(ostream& out, long long wall, size_t peak)
+{
+    out << fixed << setprecision(3);
+    out << "{\"traceEvents\": [" << endl;
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        out << "{\"name\": \"" << spans[i].name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << spans[i].thread
+            << ", \"ts\": " << (spans[i].start - trace_start) / 1e3 << ", \"dur\": " << (spans[i].end - spans[i].start) / 1e3
+            << "}," << endl;
+    }
+    // The counters at the end of the run
+    out << "{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"tid\": 0, \"ts\": " << wall / 1e3 << ", \"args\": {";
+    write_counters(out);
+    out << "}}" << endl;
+    out << "], \"displayTimeUnit\": \"ms\", \"otherData\": {\"peak_rss_bytes\": " << peak << "}}" << endl;
+}
+
+void finish_trace()
+{
+    if (!tracing())
+    {
+        return;
+    }
+    trace_active = false;
+    long long wall = trace_now() - trace_start;
+    size_t peak = peak_resident_bytes();
+
+    lock_guard<mutex> lock(spans_lock);
+    ofstream file;
+    if (!report_file.empty())
+    {
+        file.open(report_file.c_str());
+        if (!file)
+        {
+            cerr << "Error! Could not write the trace to " << report_file << endl;
+            return;
+        }
+    }
+    ostream& out = report_file.empty() ? cerr : file;
+    switch (format)
+    {
+        case TRACE_TEXT : write_text(out, wall, peak); break;
+        case TRACE_JSON : write_json(out, wall, peak); break;
+        case TRACE_CHROME : write_chrome(out, wall, peak); break;
+    }
+}
+
+#ifdef IMAGE_EDITOR_TRACE_ALLOCATIONS
+
+// Every operator new of the program comes here, so allocations can be counted while tracing. Only built on request:
+// otherwise every allocation would pay for the test of the flag
+static void* traced_allocate(size_t size)
+{
+    if (tracing())
+    {
+        trace_add(TRACE_ALLOCATIONS, 1);
+        trace_add(TRACE_ALLOCATED_BYTES, size);
+    }
+    for (;;)
+    {
+        void* memory = malloc(size > 0 ? size : 1);
+        if (memory)
+        {
+            return memory;
+        }
+        new_handler handler = get_new_handler();
+        if (!handler)
+        {
+            throw bad_alloc();
+        }
+        handler();
+    }
+}
+
+// Not inlined into the containers of this file, where the compiler would see free called on memory from new
+__attribute__((noinline)) static void traced_free(void* memory) noexcept
+{
+    free(memory);
+}
+
+void* operator new(size_t size)
+{
+    return traced_allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return traced_allocate(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    try
+    {
+        return traced_allocate(size);
+    }
+    catch (const bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    try
+    {
+        return traced_allocate(size);
+    }
+    catch (const bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void operator delete(void* memory) noexcept
+{
+    traced_free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    traced_free(memory);
+}
+
+void operator delete(void* memory, const nothrow_t&) noexcept
+{
+    traced_free(memory);
+}
+
+void operator delete[](void* memory, const nothrow_t&) noexcept
+{
+    traced_free(memory);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void* memory, size_t) noexcept
+{
+    traced_free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    traced_free(memory);
+}
+#endif
+
+#endif // IMAGE_EDITOR_TRACE_ALLOCATIONS
+
+#else
+
+bool start_trace(const string&)
+{
+    return false;
+}
+
+void finish_trace()
+{
+}
+
+#endif
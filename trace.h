@@ -0,0 +1,119 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+//
+// Opt-in instrumentation: scoped timers around each stage of a run and
+// counters of the bytes read and written and the memory allocated, reported
+// when the run ends. Tracing is off unless start_trace is called (by the
+// --trace option or the IMAGE_EDITOR_TRACE environment variable); while it
+// is off a timer or counter costs one test of a flag. Building with
+// -DIMAGE_EDITOR_NO_TRACE (make TRACE=0) compiles them out entirely.
+// Allocations are counted only with -DIMAGE_EDITOR_TRACE_ALLOCATIONS (make
+// TRACE_ALLOCATIONS=1), which replaces operator new and delete.
+//
+
+// The quantities counted while tracing
+enum TraceCounter
+{
+    TRACE_BYTES_READ,      // Bytes of image files read
+    TRACE_BYTES_WRITTEN,   // Bytes of image files written
+    TRACE_ALLOCATIONS,     // Calls to operator new (with IMAGE_EDITOR_TRACE_ALLOCATIONS)
+    TRACE_ALLOCATED_BYTES, // Bytes requested from operator new (with IMAGE_EDITOR_TRACE_ALLOCATIONS)
+    TRACE_IMAGE_BUFFERS,   // Image pixel buffers allocated
+    TRACE_IMAGE_BYTES,     // Bytes of image pixel buffers allocated
+    TRACE_POOL_HITS,       // Image pixel buffers reused from the pool instead
+    TRACE_COUNTERS
+};
+
+/**
+ * Starts tracing the run.
+ * @param spec The report format, "text", "json" or "chrome" (a Chrome
+ *             trace-event file for chrome://tracing or Perfetto), followed
+ *             by ":FILE" to write the report to FILE instead of standard error
+ * @return False if the format is not recognized or tracing is compiled out
+ */
+bool start_trace(const string& spec);
+
+// Writes the report of everything traced since start_trace and stops tracing; does nothing if tracing is off
+void finish_trace();
+
+// Largest resident set size of the process so far, in bytes
+size_t peak_resident_bytes();
+
+#ifndef IMAGE_EDITOR_NO_TRACE
+
+// True between start_trace and finish_trace
+extern atomic<bool> trace_active;
+
+// True if tracing is on
+inline bool tracing()
+{
+    return trace_active.load(memory_order_relaxed);
+}
+
+// Nanoseconds on a steady clock
+long long trace_now();
+
+// Records a timed span of a stage; name must be a string literal
+void trace_span(const char* name, long long start, long long end);
+
+// Adds amount to a counter; use trace_count, which checks that tracing is on
+void trace_add(TraceCounter counter, size_t amount);
+
+// Adds amount to a counter if tracing is on
+inline void trace_count(TraceCounter counter, size_t amount)
+{
+    if (tracing())
+    {
+        trace_add(counter, amount);
+    }
+}
+
+// Times the enclosing scope as a span named name, if tracing was on when it began
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : name_(tracing() ? name : nullptr), start_(name_ ? trace_now() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (name_)
+        {
+            trace_span(name_, start_, trace_now());
+        }
+    }
+
+private:
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+
+    const char* name_;
+    long long start_;
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+
+// Times the rest of the enclosing block as a span named name (a string literal)
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(trace_scope_, __LINE__)(name)
+
+#else
+
+inline void trace_count(TraceCounter, size_t)
+{
+}
+
+#define TRACE_SCOPE(name) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "transform.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// Pixel moves for images of CHANNELS bytes per pixel; the loops are unrolled by the compiler
+template <int CHANNELS>
+static inline void copy_pixel(unsigned char* dst, const unsigned char* src)
+{
+    for (int c = 0; c < CHANNELS; c++)
+    {
+        dst[c] = src[c];
+    }
+}
+
+template <int CHANNELS>
+static inline void swap_pixel(unsigned char* a, unsigned char* b)
+{
+    for (int c = 0; c < CHANNELS; c++)
+    {
+        swap(a[c], b[c]);
+    }
+}
+
+/**
+ * Writes the transpose of the image into a height x width result (which
+ * must not be the image), with
+ * the source rows and columns optionally counted from the other end:
+ * result(y, x) = image(FLIP_ROWS ? height - 1 - x : x, FLIP_COLS ? width - 1 - y : y).
+ * The flips are template parameters, so each rotation gets its own loop.
+ * Bands of TRANSFORM_TILE result rows are shared out between the filter
+ * threads, and each band is filled one tile at a time.
+ */
+template <bool FLIP_ROWS, bool FLIP_COLS, class ImageType>
+static void transpose_tiled(const ImageType& image, ImageType& result)
+{
+    int height = image.height();
+    int width = image.width();
+
+    // Source pixels along a result row are one source row apart
+    const ptrdiff_t step = FLIP_ROWS ? -static_cast<ptrdiff_t>(image.stride()) : static_cast<ptrdiff_t>(image.stride());
+    int bands = (width + TRANSFORM_TILE - 1) / TRANSFORM_TILE;
+
+    filter_pool().parallel_for(bands, 1, [&](int begin, int end)
+    {
+        for (int band = begin; band < end; band++)
+        {
+            int y_end = min(width, (band + 1) * TRANSFORM_TILE);
+            for (int x0 = 0; x0 < height; x0 += TRANSFORM_TILE) // For each tile in the band
+            {
+                int x_end = min(height, x0 + TRANSFORM_TILE);
+                for (int y = band * TRANSFORM_TILE; y < y_end; y++) // For each result row in the tile
+                {
+                    int col = FLIP_COLS ? width - 1 - y : y;
+                    const unsigned char* in = image.pixel(FLIP_ROWS ? height - 1 - x0 : x0, col);
+                    unsigned char* out = result.pixel(y, x0);
+                    for (int x = x0; x < x_end; x++)
+                    {
+                        copy_pixel<ImageType::CHANNELS>(out, in);
+                        out += ImageType::CHANNELS;
+                        in += step;
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Transposes into dst, reshaped to height x width; a new buffer is needed when dst is the image itself
+template <bool FLIP_ROWS, bool FLIP_COLS, class ImageType>
+static void transpose_into(const ImageType& image, ImageType& dst)
+{
+    if (&image == &dst)
+    {
+        ImageType result = ImageType::uninitialized(image.height(), image.width());
+        transpose_tiled<FLIP_ROWS, FLIP_COLS>(image, result);
+        dst.swap(result);
+        return;
+    }
+    dst.reshape(image.height(), image.width());
+    transpose_tiled<FLIP_ROWS, FLIP_COLS>(image, dst);
+}
+
+// Copies width pixels of CHANNELS bytes from src to dst in reverse order (src and dst must not overlap)
+template <int CHANNELS>
+static void reverse_row(const unsigned char* src, unsigned char* dst, int width)
+{
+    const unsigned char* in = src + (width - 1) * CHANNELS;
+    for (int x = 0; x < width; x++)
+    {
+        copy_pixel<CHANNELS>(dst + x * CHANNELS, in);
+        in -= CHANNELS;
+    }
+}
+
+// Reverses the order of the pixels of a row in place
+template <int CHANNELS>
+static void reverse_row_inplace(unsigned char* row, int width)
+{
+    for (int left = 0, right = width - 1; left < right; left++, right--)
+    {
+        swap_pixel<CHANNELS>(row + left * CHANNELS, row + right * CHANNELS);
+    }
+}
+
+// Swaps row i with row height - 1 - i and reverses both, for the lower half of the rows; the middle row is reversed
+template <class ImageType>
+static void rotate_180_rows(ImageType& image)
+{
+    const int CHANNELS = ImageType::CHANNELS;
+    int height = image.height();
+    int width = image.width();
+
+    parallel_rows(height / 2, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the lower half
+        {
+            unsigned char* top = image.row(i);
+            unsigned char* bottom = image.row(height - 1 - i);
+            for (int x = 0; x < width; x++)
+            {
+                swap_pixel<CHANNELS>(top + x * CHANNELS, bottom + (width - 1 - x) * CHANNELS);
+            }
+        }
+    });
+
+    if (height % 2 == 1) // The middle row stays where it is
+    {
+        reverse_row_inplace<CHANNELS>(image.row(height / 2), width);
+    }
+}
+
+// Half turn into result, reshaped to fit; in place when result is the image
+template <class ImageType>
+static void rotate_180_into(const ImageType& image, ImageType& result)
+{
+    if (&image == &result)
+    {
+        rotate_180_rows(result);
+        return;
+    }
+
+    int height = image.height();
+    int width = image.width();
+    result.reshape(width, height);
+
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            reverse_row<ImageType::CHANNELS>(image.row(height - 1 - i), result.row(i), width);
+        }
+    });
+}
+
+int effective_turns(int turns)
+{
+    return turns % 4 < 0 ? 3 : turns % 4;
+}
+
+// Any number of quarter turns, for either kind of image
+template <class ImageType>
+static void rotate_turns(const ImageType& image, ImageType& dst, int turns)
+{
+    switch (effective_turns(turns)) // Chosen once per image; each case has its own specialized loop
+    {
+        case 0 : dst = image; break;
+        case 1 : transpose_into<false, true>(image, dst); break; // Result row y is source column width - 1 - y
+        case 2 : rotate_180_into(image, dst); break;
+        default : transpose_into<true, false>(image, dst); // Result row y is source column y, from the last row down
+    }
+}
+
+void rotate_90(const Image& image, Image& dst)
+{
+    // Result row y is source column width - 1 - y, read from the first row up
+    transpose_into<false, true>(image, dst);
+}
+
+void rotate_270(const Image& image, Image& dst)
+{
+    // Result row y is source column y, read from the last row down
+    transpose_into<true, false>(image, dst);
+}
+
+void rotate(const Image& image, Image& dst, int turns)
+{
+    rotate_turns(image, dst, turns);
+}
+
+void rotate(const GrayImage& image, GrayImage& dst, int turns)
+{
+    rotate_turns(image, dst, turns);
+}
+
+Image rotate_90(const Image& image)
+{
+    Image result;
+    rotate_90(image, result);
+    return result;
+}
+
+Image rotate_270(const Image& image)
+{
+    Image result;
+    rotate_270(image, result);
+    return result;
+}
+
+Image transpose(const Image& image)
+{
+    Image result;
+    transpose_into<false, false>(image, result);
+    return result;
+}
+
+void rotate_180(const Image& image, Image& result)
+{
+    rotate_180_into(image, result);
+}
+
+Image rotate_180(const Image& image)
+{
+    Image result;
+    rotate_180(image, result);
+    return result;
+}
+
+Image flip_horizontal(const Image& image)
+{
+    int height = image.height();
+    int width = image.width();
+    Image result = Image::uninitialized(width, height);
+
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            reverse_row<Image::CHANNELS>(image.row(i), result.row(i), width);
+        }
+    });
+    return result;
+}
+
+Image flip_vertical(const Image& image)
+{
+    int height = image.height();
+    Image result = Image::uninitialized(image.width(), height);
+
+    parallel_rows(height, image.row_bytes() * 2, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            memcpy(result.row(i), image.row(height - 1 - i), image.row_bytes());
+        }
+    });
+    return result;
+}
+
+void rotate_180_inplace(Image& image)
+{
+    rotate_180_rows(image);
+}
+
+void flip_horizontal_inplace(Image& image)
+{
+    int width = image.width();
+
+    parallel_rows(image.height(), image.row_bytes(), [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) // For each row in the band
+        {
+            reverse_row_inplace<Image::CHANNELS>(image.row(i), width);
+        }
+    });
+}
+
+void flip_vertical_inplace(Image& image)
+{
+    int height = image.height();
+    size_t row_bytes = image.row_bytes();
+
+    parallel_rows(height / 2, row_bytes * 2, [&](int begin, int end)
+    {
+        vector<unsigned char> temp(row_bytes);
+        for (int i = begin; i < end; i++) // For each row in the lower half
+        {
+            memcpy(temp.data(), image.row(i), row_bytes);
+            memcpy(image.row(i), image.row(height - 1 - i), row_bytes);
+            memcpy(image.row(height - 1 - i), temp.data(), row_bytes);
+        }
+    });
+}
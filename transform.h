@@ -0,0 +1,61 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "image_buffer.h"
+
+/**
+ * Rotations, flips and transposes. Each output pixel is a copy of exactly
+ * one input pixel, so every transform gives the same bytes as moving the
+ * pixels one at a time. Transforms that swap rows and columns walk the
+ * image in TRANSFORM_TILE x TRANSFORM_TILE pixel tiles, so the rows of
+ * the source tile and of the destination tile both stay in cache; the
+ * others only reorder whole rows and work row by row.
+ *
+ * Rotations are clockwise, as in process_4, with row 0 being the first
+ * row of the image.
+ */
+
+// Side, in pixels, of the square tiles used by the transposing transforms
+const int TRANSFORM_TILE = 32;
+
+// Rotates the image by 90 degrees clockwise (same result as process_4)
+Image rotate_90(const Image& image);
+
+// Rotates the image by 180 degrees
+Image rotate_180(const Image& image);
+
+// Rotates the image by 270 degrees clockwise (90 degrees counterclockwise)
+Image rotate_270(const Image& image);
+
+// Swaps rows and columns: pixel (y, x) moves to (x, y)
+Image transpose(const Image& image);
+
+// Mirrors the image left to right: pixel (y, x) moves to (y, width - 1 - x)
+Image flip_horizontal(const Image& image);
+
+// Mirrors the image top to bottom: row y moves to height - 1 - y
+Image flip_vertical(const Image& image);
+
+// Rotations that write into dst, which is reshaped to fit (keeping its buffer if it already does);
+// dst may be the image itself, in which case a half turn is done in place
+void rotate_90(const Image& image, Image& dst);
+void rotate_180(const Image& image, Image& dst);
+void rotate_270(const Image& image, Image& dst);
+
+/**
+ * The quarter turns clockwise that rotate makes for a count of turns, 0 to
+ * 3: the count mod 4, except that, as in the original process_5, a
+ * negative count that is not a multiple of 4 makes three.
+ */
+int effective_turns(int turns);
+
+// Rotates by effective_turns(turns) quarter turns clockwise into dst, as above
+void rotate(const Image& image, Image& dst, int turns);
+void rotate(const GrayImage& image, GrayImage& dst, int turns);
+
+// In-place versions of the transforms that keep the image dimensions
+void rotate_180_inplace(Image& image);
+void flip_horizontal_inplace(Image& image);
+void flip_vertical_inplace(Image& image);
+
+#endif
@@ -0,0 +1,149 @@
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "vignette.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// Distance, in rows, from row to the center row of the image (as in the original expression, height / 2)
+static int row_distance(int height, int row)
+{
+    return abs(row - height / 2);
+}
+
+VignetteMask::VignetteMask(int width, int height, bool keep_rows)
+    : width_(width), height_(height), shift_(MAX_VIGNETTE_SHIFT)
+{
+    // The corners are farthest from the center, so they have the smallest factor; use as many
+    // fraction bits as it leaves room for
+    double corner = sqrt(pow(width / 2.0, 2) + pow(static_cast<double>(height / 2), 2));
+    double smallest = height > 0 ? (height - corner) / height : 0;
+    while (shift_ >= MIN_VIGNETTE_SHIFT && -smallest * (1 << shift_) > 32767)
+    {
+        shift_--;
+    }
+
+    if (keep_rows && fixed_point())
+    {
+        int rows = height / 2 + 1;
+        rows_.resize(static_cast<size_t>(rows) * width);
+        parallel_rows(rows, static_cast<size_t>(width) * sizeof(short), [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                compute_row(i, &rows_[static_cast<size_t>(i) * width]);
+            }
+        });
+    }
+}
+
+size_t VignetteMask::stored_bytes(int width, int height)
+{
+    return (static_cast<size_t>(height) / 2 + 1) * width * sizeof(short);
+}
+
+void VignetteMask::compute_row(int distance, short* factors) const
+{
+    double dy2 = static_cast<double>(distance) * distance;
+    double center = static_cast<double>(width_) / 2;
+    double scale = static_cast<double>(1 << shift_) / height_;
+    int half = min(width_ / 2, width_ - 1); // Column col and column width - col are the same distance from the center
+    int col = 0;
+
+#if defined(__SSE2__)
+    // Four columns at a time; the conversion rounds to nearest like lround (ties to even)
+    const __m128d dy2s = _mm_set1_pd(dy2);
+    const __m128d centers = _mm_set1_pd(center);
+    const __m128d heights = _mm_set1_pd(height_);
+    const __m128d scales = _mm_set1_pd(scale);
+    for (; col + 3 <= half; col += 4)
+    {
+        __m128d dx0 = _mm_sub_pd(_mm_set_pd(col + 1, col), centers);
+        __m128d dx1 = _mm_sub_pd(_mm_set_pd(col + 3, col + 2), centers);
+        __m128d d0 = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx0, dx0), dy2s));
+        __m128d d1 = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx1, dx1), dy2s));
+        __m128i f0 = _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(heights, d0), scales));
+        __m128i f1 = _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(heights, d1), scales));
+        __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi64(f0, f1), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(factors + col), packed);
+    }
+#endif
+    for (; col <= half; col++)
+    {
+        double dx = col - center;
+        factors[col] = static_cast<short>(lround((height_ - sqrt(dx * dx + dy2)) * scale));
+    }
+    for (col = half + 1; col < width_; col++)
+    {
+        factors[col] = factors[width_ - col];
+    }
+}
+
+const short* VignetteMask::factors(int row, vector<short>& scratch) const
+{
+    int distance = row_distance(height_, row);
+    if (!rows_.empty())
+    {
+        return &rows_[static_cast<size_t>(distance) * width_];
+    }
+    scratch.resize(width_);
+    compute_row(distance, scratch.data());
+    return scratch.data();
+}
+
+// The most recent mask that fit in the cache
+static mutex cache_lock;
+static shared_ptr<const VignetteMask> cached_mask;
+
+shared_ptr<const VignetteMask> vignette_mask(int width, int height)
+{
+    lock_guard<mutex> lock(cache_lock);
+    if (cached_mask && cached_mask->width() == width && cached_mask->height() == height)
+    {
+        return cached_mask;
+    }
+
+    bool keep_rows = VignetteMask::stored_bytes(width, height) <= VIGNETTE_CACHE_BYTES;
+    shared_ptr<const VignetteMask> mask = make_shared<VignetteMask>(width, height, keep_rows);
+    if (keep_rows)
+    {
+        cached_mask = mask;
+    }
+    return mask;
+}
+
+void vignette_row(const VignetteMask& mask, const unsigned char* src, unsigned char* dst, int row, vector<short>& scratch,
+                  PixelFormat format)
+{
+    vignette_span(mask, src, dst, row, 0, mask.width(), scratch, format);
+}
+
+void vignette_span(const VignetteMask& mask, const unsigned char* src, unsigned char* dst, int row, int column, int width,
+                   vector<short>& scratch, PixelFormat format)
+{
+    int height = mask.height();
+
+    if (!mask.fixed_point()) // Factors too negative for 16 bits: use the original expression
+    {
+        int channels = pixel_channels(format);
+        for (int col = 0; col < width; col++)
+        {
+            double distance = sqrt(pow(column + col - (static_cast<double>(mask.width()) / 2), 2) + pow(static_cast<double>(row) - (height / 2), 2));
+            double scaling_factor = (height - distance) / height;
+
+            // Values are truncated to int first, then stored as bytes like write_image does
+            for (int c = 0; c < channels; c++)
+            {
+                dst[channels * col + c] = static_cast<int>(scaling_factor * src[channels * col + c]);
+            }
+        }
+        return;
+    }
+
+    active_kernels(format).vignette(src, dst, mask.factors(row, scratch) + column, mask.shift(), width);
+}
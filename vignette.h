@@ -0,0 +1,94 @@
+#ifndef VIGNETTE_H
+#define VIGNETTE_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "kernels.h"
+
+using namespace std;
+
+// Fewest fraction bits the vignette kernels accept
+const int MIN_VIGNETTE_SHIFT = 8;
+
+// Most fraction bits used; a factor of 1 must still fit in a short
+const int MAX_VIGNETTE_SHIFT = 14;
+
+// Largest mask, in bytes, kept for later calls; larger images compute each row's factors as they go
+const size_t VIGNETTE_CACHE_BYTES = 64 << 20;
+
+/**
+ * The vignette falloff of a width x height image (process_1): each pixel is
+ * scaled by (height - distance) / height, where distance is measured from
+ * the pixel to the center of the image. The factors are held in 16-bit
+ * fixed point, with as many fraction bits (up to 14) as the most negative
+ * factor allows, and applied by the vignette row kernel, so no floating
+ * point is needed per pixel; every value is within 1 of the original
+ * double-precision result.
+ *
+ * The distance only depends on how far a pixel is from the center row and
+ * column, so rows the same distance above and below the center share their
+ * factors, and so do columns the same distance left and right: a quarter of
+ * the square roots are taken, once per mask.
+ */
+class VignetteMask
+{
+public:
+    /**
+     * Computes the falloff of a width x height image.
+     * @param width     Width of the image in pixels
+     * @param height    Height of the image in pixels
+     * @param keep_rows True to compute and store the factors of every row
+     *                  now; false to compute each row when it is used
+     */
+    VignetteMask(int width, int height, bool keep_rows);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Number of fraction bits in the factors
+    int shift() const { return shift_; }
+
+    // False for images so much wider than tall that the factors do not fit in 16 bits (below -128)
+    bool fixed_point() const { return shift_ >= MIN_VIGNETTE_SHIFT; }
+
+    // Bytes needed to store the factors of every row of a width x height image
+    static size_t stored_bytes(int width, int height);
+
+    /**
+     * The width factors of a row of the image.
+     * @param row     Index of the row within the image
+     * @param scratch Holds the factors if they are not stored in the mask
+     * @return Pointer to the factors, valid until scratch is next used
+     */
+    const short* factors(int row, vector<short>& scratch) const;
+
+private:
+    void compute_row(int distance, short* factors) const;
+
+    int width_;
+    int height_;
+    int shift_;
+    vector<short> rows_; // Factors for rows 0 to height / 2 away from the center row, or empty
+};
+
+// The mask for a width x height image; repeated calls for the same size share the last mask that fit in the cache
+shared_ptr<const VignetteMask> vignette_mask(int width, int height);
+
+/**
+ * Applies the vignette to one row of an image.
+ * @param mask    The mask for the image's dimensions
+ * @param src     The source row
+ * @param dst     The destination row (may be the same as src)
+ * @param row     Index of the row within the image
+ * @param scratch Working space for the row's factors, reused between calls
+ * @param format  Pixel format of the rows: PIXEL_BGR8 or PIXEL_GRAY8
+ */
+void vignette_row(const VignetteMask& mask, const unsigned char* src, unsigned char* dst, int row, vector<short>& scratch,
+                  PixelFormat format = PIXEL_BGR8);
+
+// As vignette_row, for the width pixels of the row starting at column; src and dst point at that pixel
+void vignette_span(const VignetteMask& mask, const unsigned char* src, unsigned char* dst, int row, int column, int width,
+                   vector<short>& scratch, PixelFormat format = PIXEL_BGR8);
+
+#endif